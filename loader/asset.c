@@ -0,0 +1,195 @@
+/* asset.c -- AAsset implementation backed by the virtual filesystem
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "asset.h"
+#include "vfs.h"
+#include "trace.h"
+
+//#define ENABLE_DEBUG
+
+#ifdef ENABLE_DEBUG
+#define dlog sceClibPrintf
+#else
+#define dlog
+#endif
+
+// Reads the whole asset in an owned buffer, from then on the file handle is not needed anymore
+static int asset_load_buffer(AAsset *asset) {
+	uint8_t *buf = malloc(asset->size ? asset->size : 1);
+	if (!buf)
+		return -1;
+
+	stream_seek(asset->f, 0, SEEK_SET);
+	if (stream_read(asset->f, buf, asset->size) != asset->size) {
+		free(buf);
+		stream_seek(asset->f, asset->pos, SEEK_SET);
+		return -1;
+	}
+
+	stream_close(asset->f);
+	asset->f = NULL;
+	asset->buf = buf;
+	return 0;
+}
+
+static AAsset *asset_open(const char *fname, int mode) {
+	AAsset *asset = calloc(1, sizeof(AAsset));
+	if (!asset)
+		return NULL;
+
+	vfs_path(fname, asset->path);
+	dlog("AAssetManager_open %s\n", asset->path);
+	asset->mode = mode;
+
+	asset->f = vfs_open(asset->path, AASSET_STREAMING_BUFFER_SIZE);
+	if (!asset->f) {
+		free(asset);
+		return NULL;
+	}
+	asset->size = stream_size(asset->f);
+
+	// Files already in RAM are used in place
+	asset->buf = (uint8_t *)stream_data(asset->f);
+	if (!asset->buf && mode == AASSET_MODE_BUFFER)
+		asset_load_buffer(asset);
+
+	return asset;
+}
+
+AAsset *AAssetManager_open(void *mgr, const char *fname, int mode) {
+	uint64_t start = trace_begin();
+	AAsset *asset = asset_open(fname, mode);
+	trace_record(TRACE_ASSET_OPEN, trace_path(fname), (uintptr_t)asset, 0, asset ? asset->size : 0, !asset, start);
+	return asset;
+}
+
+void AAsset_close(AAsset *asset) {
+	uint64_t start = trace_begin();
+	if (asset->f)
+		stream_close(asset->f);
+	else
+		free(asset->buf);
+	free(asset);
+	trace_record(TRACE_ASSET_CLOSE, 0, (uintptr_t)asset, TRACE_NO_OFFSET, 0, 0, start);
+}
+
+static int asset_read(AAsset *asset, void *buf, size_t count) {
+	if (asset->pos + count > asset->size)
+		count = asset->size - asset->pos;
+	if (!count)
+		return 0;
+
+	if (asset->buf) {
+		sceClibMemcpy(buf, &asset->buf[asset->pos], count);
+	} else {
+		count = stream_read(asset->f, buf, count);
+		if (!count)
+			return -1;
+	}
+
+	asset->pos += count;
+	return count;
+}
+
+int AAsset_read(AAsset *asset, void *buf, size_t count) {
+	uint64_t start = trace_begin();
+	uint64_t offset = asset->pos;
+	int res = asset_read(asset, buf, count);
+	trace_record(TRACE_ASSET_READ, 0, (uintptr_t)asset, offset, count, res < 0, start);
+	return res;
+}
+
+static int64_t asset_seek(AAsset *asset, int64_t offset, int whence) {
+	int64_t pos;
+	switch (whence) {
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = asset->pos + offset;
+		break;
+	case SEEK_END:
+		pos = asset->size + offset;
+		break;
+	default:
+		return -1;
+	}
+	if (pos < 0 || pos > asset->size)
+		return -1;
+
+	if (!asset->buf && pos != asset->pos && stream_seek(asset->f, pos, SEEK_SET) < 0)
+		return -1;
+	asset->pos = pos;
+	return pos;
+}
+
+int64_t AAsset_seek64(AAsset *asset, int64_t offset, int whence) {
+	uint64_t start = trace_begin();
+	int64_t res = asset_seek(asset, offset, whence);
+	trace_record(TRACE_ASSET_SEEK, 0, (uintptr_t)asset, offset, whence, res < 0, start);
+	return res;
+}
+
+off_t AAsset_seek(AAsset *asset, off_t offset, int whence) {
+	return AAsset_seek64(asset, offset, whence);
+}
+
+int64_t AAsset_getLength64(AAsset *asset) {
+	return asset->size;
+}
+
+off_t AAsset_getLength(AAsset *asset) {
+	return asset->size;
+}
+
+int64_t AAsset_getRemainingLength64(AAsset *asset) {
+	return asset->size - asset->pos;
+}
+
+off_t AAsset_getRemainingLength(AAsset *asset) {
+	return asset->size - asset->pos;
+}
+
+const void *AAsset_getBuffer(AAsset *asset) {
+	if (!asset->buf && asset_load_buffer(asset) < 0)
+		return NULL;
+	return asset->buf;
+}
+
+int AAsset_isAllocated(AAsset *asset) {
+	return asset->buf != NULL;
+}
+
+int AAsset_openFileDescriptor64(AAsset *asset, int64_t *out_start, int64_t *out_length) {
+	int fd = vfs_open_fd(asset->path);
+	if (fd < 0)
+		return -1;
+	*out_start = 0;
+	*out_length = asset->size;
+	return fd;
+}
+
+int AAsset_openFileDescriptor(AAsset *asset, off_t *out_start, off_t *out_length) {
+	int fd = vfs_open_fd(asset->path);
+	if (fd < 0)
+		return -1;
+	*out_start = 0;
+	*out_length = asset->size;
+	return fd;
+}
@@ -0,0 +1,43 @@
+#ifndef __ASSET_H__
+#define __ASSET_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "file_cache.h"
+#include "stream.h"
+
+enum {
+	AASSET_MODE_UNKNOWN = 0,
+	AASSET_MODE_RANDOM = 1,
+	AASSET_MODE_STREAMING = 2,
+	AASSET_MODE_BUFFER = 3
+};
+
+#define AASSET_STREAMING_BUFFER_SIZE (64 * 1024)
+
+typedef struct {
+	stream *f;
+	uint8_t *buf; // whole asset contents, owned by the asset once f is closed
+	int64_t size;
+	int64_t pos;
+	int mode;
+	char path[256];
+} AAsset;
+
+AAsset *AAssetManager_open(void *mgr, const char *fname, int mode);
+void AAsset_close(AAsset *asset);
+int AAsset_read(AAsset *asset, void *buf, size_t count);
+off_t AAsset_seek(AAsset *asset, off_t offset, int whence);
+int64_t AAsset_seek64(AAsset *asset, int64_t offset, int whence);
+off_t AAsset_getLength(AAsset *asset);
+int64_t AAsset_getLength64(AAsset *asset);
+off_t AAsset_getRemainingLength(AAsset *asset);
+int64_t AAsset_getRemainingLength64(AAsset *asset);
+const void *AAsset_getBuffer(AAsset *asset);
+int AAsset_isAllocated(AAsset *asset);
+int AAsset_openFileDescriptor(AAsset *asset, off_t *out_start, off_t *out_length);
+int AAsset_openFileDescriptor64(AAsset *asset, int64_t *out_start, int64_t *out_length);
+
+#endif
@@ -0,0 +1,562 @@
+/* bionic_pthread.c -- bionic pthread ABI on top of the newlib pthreads
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "bionic_pthread.h"
+#include "sync.h"
+
+// bionic objects are a single word, the game only sees a pointer to ours
+// or, for the static initializers, one of these values
+#define  MUTEX_TYPE_NORMAL	 0x0000
+#define  MUTEX_TYPE_RECURSIVE  0x4000
+#define  MUTEX_TYPE_ERRORCHECK 0x8000
+#define  COND_STATIC 0x0000
+
+// newlib numbers these differently, the game compares against bionic's
+#define BIONIC_EDEADLK 35
+#define BIONIC_EOVERFLOW 75
+#define BIONIC_ETIMEDOUT 110
+
+#define POOL_CHUNK_SLOTS 256
+#define POOL_MAX_CHUNKS 64
+
+// Fixed size objects handed out from a lock-free free list. Slots are referred to by
+// index + 1 so that the list head fits a generation tag next to it in a single word,
+// a slot that got popped and pushed back in between can't fool the compare and swap.
+typedef struct {
+	uint32_t slot_size;
+	uint64_t head; // tag << 32 | (index + 1), 0 when empty
+	uint8_t *chunks[POOL_MAX_CHUNKS];
+	uint32_t num_chunks;
+	uint32_t live;
+	uint32_t overflow; // objects living outside the chunks once those ran out
+	pthread_mutex_t grow_lock;
+} obj_pool;
+
+#define POOL_INIT(type) { .slot_size = (sizeof(type) + 3) & ~3, .grow_lock = PTHREAD_MUTEX_INITIALIZER }
+
+static obj_pool mutex_pool = POOL_INIT(sync_mutex);
+static obj_pool cond_pool = POOL_INIT(sync_cond);
+static obj_pool mutexattr_pool = POOL_INIT(pthread_mutexattr_t);
+static obj_pool condattr_pool = POOL_INIT(pthread_condattr_t);
+static obj_pool attr_pool = POOL_INIT(pthread_attr_t);
+
+static uint32_t static_inits = 0, init_races = 0;
+
+static inline uint32_t *pool_slot(obj_pool *p, uint32_t index) {
+	return (uint32_t *)(p->chunks[index / POOL_CHUNK_SLOTS] + (index % POOL_CHUNK_SLOTS) * p->slot_size);
+}
+
+static void pool_push(obj_pool *p, uint32_t index) {
+	uint64_t head = __atomic_load_n(&p->head, __ATOMIC_ACQUIRE);
+	uint64_t n;
+	do {
+		*pool_slot(p, index) = (uint32_t)head;
+		n = ((head >> 32) + 1) << 32 | (index + 1);
+	} while (!__atomic_compare_exchange_n(&p->head, &head, n, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+}
+
+static int pool_grow(obj_pool *p) {
+	pthread_mutex_lock(&p->grow_lock);
+	int ret = 0;
+	// Someone else may have refilled the list while we waited for the lock
+	if (!(uint32_t)__atomic_load_n(&p->head, __ATOMIC_ACQUIRE) && p->num_chunks < POOL_MAX_CHUNKS) {
+		uint8_t *chunk = calloc(POOL_CHUNK_SLOTS, p->slot_size);
+		if (chunk) {
+			uint32_t first = p->num_chunks * POOL_CHUNK_SLOTS;
+			p->chunks[p->num_chunks] = chunk;
+			__atomic_store_n(&p->num_chunks, p->num_chunks + 1, __ATOMIC_RELEASE);
+			for (int i = POOL_CHUNK_SLOTS - 1; i >= 0; i--)
+				pool_push(p, first + i);
+			ret = 1;
+		}
+	} else {
+		ret = 1;
+	}
+	pthread_mutex_unlock(&p->grow_lock);
+	return ret;
+}
+
+static void *pool_get(obj_pool *p) {
+	uint64_t head = __atomic_load_n(&p->head, __ATOMIC_ACQUIRE);
+	for (;;) {
+		uint32_t index = (uint32_t)head;
+		if (!index) {
+			if (!pool_grow(p)) {
+				// Out of chunks, a plain allocation still gives the caller a working object
+				void *obj = calloc(1, p->slot_size);
+				if (obj) {
+					__atomic_add_fetch(&p->live, 1, __ATOMIC_RELAXED);
+					__atomic_add_fetch(&p->overflow, 1, __ATOMIC_RELAXED);
+				}
+				return obj;
+			}
+			head = __atomic_load_n(&p->head, __ATOMIC_ACQUIRE);
+			continue;
+		}
+		// The slot may be handed out under our feet, the tag then makes the swap fail
+		uint32_t next = *pool_slot(p, index - 1);
+		uint64_t n = (head >> 32) << 32 | next;
+		if (__atomic_compare_exchange_n(&p->head, &head, n, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			uint32_t *slot = pool_slot(p, index - 1);
+			memset(slot, 0, p->slot_size);
+			__atomic_add_fetch(&p->live, 1, __ATOMIC_RELAXED);
+			return slot;
+		}
+	}
+}
+
+static void pool_put(obj_pool *p, void *obj) {
+	if (!obj)
+		return;
+	uint32_t chunks = __atomic_load_n(&p->num_chunks, __ATOMIC_ACQUIRE);
+	for (uint32_t i = 0; i < chunks; i++) {
+		uintptr_t offset = (uintptr_t)obj - (uintptr_t)p->chunks[i];
+		if (offset < POOL_CHUNK_SLOTS * p->slot_size) {
+			__atomic_sub_fetch(&p->live, 1, __ATOMIC_RELAXED);
+			pool_push(p, i * POOL_CHUNK_SLOTS + offset / p->slot_size);
+			return;
+		}
+	}
+	// Not in any chunk, so it came from the calloc fallback in pool_get
+	__atomic_sub_fetch(&p->live, 1, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&p->overflow, 1, __ATOMIC_RELAXED);
+	free(obj);
+}
+
+static inline int is_static_mutex(sync_mutex *m) {
+	uintptr_t v = (uintptr_t)m;
+	return v == MUTEX_TYPE_NORMAL || v == MUTEX_TYPE_RECURSIVE || v == MUTEX_TYPE_ERRORCHECK;
+}
+
+// Statically initialized mutexes get their object on first use. Threads racing for
+// it each build one, the compare and swap picks the winner and the others give theirs back.
+static sync_mutex *get_mutex(sync_mutex **mutex) {
+	sync_mutex *cur = __atomic_load_n(mutex, __ATOMIC_ACQUIRE);
+	if (!is_static_mutex(cur))
+		return cur;
+
+	sync_mutex *m = pool_get(&mutex_pool);
+	if (!m)
+		return NULL;
+	switch ((uintptr_t)cur) {
+	case MUTEX_TYPE_RECURSIVE:
+		sync_mutex_init(m, SYNC_MUTEX_RECURSIVE);
+		break;
+	case MUTEX_TYPE_ERRORCHECK:
+		sync_mutex_init(m, SYNC_MUTEX_ERRORCHECK);
+		break;
+	default:
+		sync_mutex_init(m, SYNC_MUTEX_NORMAL);
+		break;
+	}
+	if (__atomic_compare_exchange_n(mutex, &cur, m, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		__atomic_add_fetch(&static_inits, 1, __ATOMIC_RELAXED);
+		return m;
+	}
+	// Nobody saw ours, it can go straight back
+	pool_put(&mutex_pool, m);
+	__atomic_add_fetch(&init_races, 1, __ATOMIC_RELAXED);
+	return cur;
+}
+
+static sync_cond *get_cond(sync_cond **cond) {
+	sync_cond *cur = __atomic_load_n(cond, __ATOMIC_ACQUIRE);
+	if ((uintptr_t)cur != COND_STATIC)
+		return cur;
+
+	sync_cond *c = pool_get(&cond_pool);
+	if (!c)
+		return NULL;
+	sync_cond_init(c);
+	if (__atomic_compare_exchange_n(cond, &cur, c, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		__atomic_add_fetch(&static_inits, 1, __ATOMIC_RELAXED);
+		return c;
+	}
+	pool_put(&cond_pool, c);
+	__atomic_add_fetch(&init_races, 1, __ATOMIC_RELAXED);
+	return cur;
+}
+
+int pthread_attr_destroy_soloader(pthread_attr_t **attr)
+{
+	int ret = pthread_attr_destroy(*attr);
+	pool_put(&attr_pool, *attr);
+	return ret;
+}
+
+int pthread_attr_getstack_soloader(const pthread_attr_t **attr,
+				   void **stackaddr,
+				   size_t *stacksize)
+{
+	return pthread_attr_getstack(*attr, stackaddr, stacksize);
+}
+
+int pthread_condattr_init_soloader(pthread_condattr_t **attr)
+{
+	*attr = pool_get(&condattr_pool);
+	if (!*attr)
+		return ENOMEM;
+
+	return pthread_condattr_init(*attr);
+}
+
+int pthread_condattr_destroy_soloader(pthread_condattr_t **attr)
+{
+	int ret = pthread_condattr_destroy(*attr);
+	pool_put(&condattr_pool, *attr);
+	return ret;
+}
+
+int pthread_cond_init_soloader(sync_cond **cond,
+				   const pthread_condattr_t **attr)
+{
+	// Attributes are ignored, deadlines are always CLOCK_REALTIME like the bionic default
+	sync_cond *c = pool_get(&cond_pool);
+	if (!c)
+		return ENOMEM;
+	sync_cond_init(c);
+	*cond = c;
+	return 0;
+}
+
+int pthread_cond_destroy_soloader(sync_cond **cond)
+{
+	sync_cond *c = *cond;
+	if ((uintptr_t)c == COND_STATIC)
+		return 0;
+	int ret = sync_cond_destroy(c);
+	if (ret)
+		return ret;
+	*cond = (sync_cond *)COND_STATIC;
+	pool_put(&cond_pool, c);
+	return 0;
+}
+
+int pthread_cond_signal_soloader(sync_cond **cond)
+{
+	sync_cond *c = get_cond(cond);
+	if (!c)
+		return EINVAL;
+	return sync_cond_signal(c);
+}
+
+int pthread_cond_timedwait_soloader(sync_cond **cond,
+					sync_mutex **mutex,
+					struct timespec *abstime)
+{
+	sync_cond *c = get_cond(cond);
+	sync_mutex *m = get_mutex(mutex);
+	if (!c || !m)
+		return EINVAL;
+	if (abstime->tv_nsec < 0 || abstime->tv_nsec >= 1000000000)
+		return EINVAL;
+	return sync_cond_timedwait(c, m, sync_deadline(abstime)) ? BIONIC_ETIMEDOUT : 0;
+}
+
+int pthread_create_soloader(pthread_t **thread,
+				const pthread_attr_t **attr,
+				void *(*start)(void *),
+				void *param)
+{
+	*thread = calloc(1, sizeof(pthread_t));
+
+	if (attr != NULL) {
+		pthread_attr_setstacksize(*attr, 512 * 1024);
+		return pthread_create(*thread, *attr, start, param);
+	} else {
+		pthread_attr_t attrr;
+		pthread_attr_init(&attrr);
+		pthread_attr_setstacksize(&attrr, 512 * 1024);
+		return pthread_create(*thread, &attrr, start, param);
+	}
+
+}
+
+int pthread_mutexattr_init_soloader(pthread_mutexattr_t **attr)
+{
+	*attr = pool_get(&mutexattr_pool);
+	if (!*attr)
+		return ENOMEM;
+
+	return pthread_mutexattr_init(*attr);
+}
+
+int pthread_mutexattr_settype_soloader(pthread_mutexattr_t **attr, int type)
+{
+	return pthread_mutexattr_settype(*attr, type);
+}
+
+int pthread_mutexattr_setpshared_soloader(pthread_mutexattr_t **attr, int pshared)
+{
+	return pthread_mutexattr_setpshared(*attr, pshared);
+}
+
+int pthread_mutexattr_destroy_soloader(pthread_mutexattr_t **attr)
+{
+	int ret = pthread_mutexattr_destroy(*attr);
+	pool_put(&mutexattr_pool, *attr);
+	return ret;
+}
+
+int pthread_mutex_destroy_soloader(sync_mutex **mutex)
+{
+	sync_mutex *m = *mutex;
+	// Never locked, there is nothing behind it yet
+	if (is_static_mutex(m))
+		return 0;
+	int ret = sync_mutex_destroy(m);
+	if (ret)
+		return ret;
+	// A use after destroy lazily gets a fresh mutex instead of a recycled slot
+	*mutex = (sync_mutex *)MUTEX_TYPE_NORMAL;
+	pool_put(&mutex_pool, m);
+	return 0;
+}
+
+int pthread_mutex_init_soloader(sync_mutex **mutex,
+				const pthread_mutexattr_t **attr)
+{
+	sync_mutex *m = pool_get(&mutex_pool);
+	if (!m)
+		return ENOMEM;
+
+	// bionic and newlib agree on the type values, settype passed them through as is
+	int type = PTHREAD_MUTEX_NORMAL;
+	if (attr != NULL && *attr != NULL)
+		pthread_mutexattr_gettype(*attr, &type);
+	sync_mutex_init(m, type == PTHREAD_MUTEX_RECURSIVE ? SYNC_MUTEX_RECURSIVE :
+		(type == PTHREAD_MUTEX_ERRORCHECK ? SYNC_MUTEX_ERRORCHECK : SYNC_MUTEX_NORMAL));
+	*mutex = m;
+	return 0;
+}
+
+int pthread_mutex_lock_soloader(sync_mutex **mutex)
+{
+	sync_mutex *m = get_mutex(mutex);
+	if (!m)
+		return EINVAL;
+	int ret = sync_mutex_lock(m);
+	return ret == EDEADLK ? BIONIC_EDEADLK : ret;
+}
+
+int pthread_mutex_trylock_soloader(sync_mutex **mutex)
+{
+	sync_mutex *m = get_mutex(mutex);
+	if (!m)
+		return EINVAL;
+	return sync_mutex_trylock(m);
+}
+
+int pthread_mutex_unlock_soloader(sync_mutex **mutex)
+{
+	sync_mutex *m = get_mutex(mutex);
+	if (!m)
+		return EINVAL;
+	return sync_mutex_unlock(m);
+}
+
+int pthread_join_soloader(const pthread_t *thread, void **value_ptr)
+{
+	return pthread_join(*thread, value_ptr);
+}
+
+int pthread_cond_wait_soloader(sync_cond **cond, sync_mutex **mutex)
+{
+	sync_cond *c = get_cond(cond);
+	sync_mutex *m = get_mutex(mutex);
+	if (!c || !m)
+		return EINVAL;
+	return sync_cond_wait(c, m);
+}
+
+int pthread_cond_broadcast_soloader(sync_cond **cond)
+{
+	sync_cond *c = get_cond(cond);
+	if (!c)
+		return EINVAL;
+	return sync_cond_broadcast(c);
+}
+
+int pthread_attr_init_soloader(pthread_attr_t **attr)
+{
+	*attr = pool_get(&attr_pool);
+	if (!*attr)
+		return ENOMEM;
+
+	return pthread_attr_init(*attr);
+}
+
+int pthread_attr_setdetachstate_soloader(pthread_attr_t **attr, int state)
+{
+	return pthread_attr_setdetachstate(*attr, !state);
+}
+
+int pthread_attr_setstacksize_soloader(pthread_attr_t **attr, size_t stacksize)
+{
+	return pthread_attr_setstacksize(*attr, stacksize);
+}
+
+int pthread_attr_getstacksize_soloader(pthread_attr_t **attr, size_t *stacksize)
+{
+	return pthread_attr_getstacksize(*attr, stacksize);
+}
+
+int pthread_attr_setschedparam_soloader(pthread_attr_t **attr,
+					const struct sched_param *param)
+{
+	return pthread_attr_setschedparam(*attr, param);
+}
+
+int pthread_attr_getschedparam_soloader(pthread_attr_t **attr,
+					const struct sched_param *param)
+{
+	return pthread_attr_getschedparam(*attr, param);
+}
+
+int pthread_attr_setstack_soloader(pthread_attr_t **attr,
+				   void *stackaddr,
+				   size_t stacksize)
+{
+	return pthread_attr_setstack(*attr, stackaddr, stacksize);
+}
+
+int pthread_setschedparam_soloader(const pthread_t *thread, int policy,
+				   const struct sched_param *param)
+{
+	return pthread_setschedparam(*thread, policy, param);
+}
+
+int pthread_getschedparam_soloader(const pthread_t *thread, int *policy,
+				   struct sched_param *param)
+{
+	return pthread_getschedparam(*thread, policy, param);
+}
+
+int pthread_detach_soloader(const pthread_t *thread)
+{
+	return pthread_detach(*thread);
+}
+
+int pthread_getattr_np_soloader(pthread_t* thread, pthread_attr_t *attr) {
+	fprintf(stderr, "[WARNING!] Not implemented: pthread_getattr_np\n");
+	return 0;
+}
+
+int pthread_equal_soloader(const pthread_t *t1, const pthread_t *t2)
+{
+	if (t1 == t2)
+		return 1;
+	if (!t1 || !t2)
+		return 0;
+	return pthread_equal(*t1, *t2);
+}
+
+#ifndef MAX_TASK_COMM_LEN
+#define MAX_TASK_COMM_LEN 16
+#endif
+
+int pthread_setname_np_soloader(const pthread_t *thread, const char* thread_name) {
+	if (thread == 0 || thread_name == NULL) {
+		return EINVAL;
+	}
+	size_t thread_name_len = strlen(thread_name);
+	if (thread_name_len >= MAX_TASK_COMM_LEN) {
+		return ERANGE;
+	}
+
+	// TODO: Implement the actual name setting if possible
+	fprintf(stderr, "PTHR: pthread_setname_np with name %s\n", thread_name);
+
+	return 0;
+}
+
+// A 32 bit bionic sem_t is a single word, the count lives right in it
+int sem_init_soloader(sync_sem *sem, int pshared, unsigned int value)
+{
+	int ret = sync_sem_init(sem, value);
+	if (ret) {
+		errno = ret;
+		return -1;
+	}
+	return 0;
+}
+
+int sem_destroy_soloader(sync_sem *sem)
+{
+	return 0;
+}
+
+int sem_getvalue_soloader(sync_sem *sem, int *sval)
+{
+	if (!sval) {
+		errno = EINVAL;
+		return -1;
+	}
+	*sval = sync_sem_getvalue(sem);
+	return 0;
+}
+
+int sem_post_soloader(sync_sem *sem)
+{
+	if (sync_sem_post(sem)) {
+		errno = BIONIC_EOVERFLOW;
+		return -1;
+	}
+	return 0;
+}
+
+int sem_wait_soloader(sync_sem *sem)
+{
+	return sync_sem_wait(sem);
+}
+
+int sem_trywait_soloader(sync_sem *sem)
+{
+	if (sync_sem_trywait(sem)) {
+		errno = EAGAIN;
+		return -1;
+	}
+	return 0;
+}
+
+int sem_timedwait_soloader(sync_sem *sem, const struct timespec *abstime)
+{
+	// A free count is taken even past the deadline, like POSIX wants
+	if (!sync_sem_trywait(sem))
+		return 0;
+	if (!abstime || abstime->tv_nsec < 0 || abstime->tv_nsec >= 1000000000) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (sync_sem_timedwait(sem, sync_deadline(abstime))) {
+		errno = BIONIC_ETIMEDOUT;
+		return -1;
+	}
+	return 0;
+}
+
+void bionic_pthread_get_stats(bionic_pthread_stats *out) {
+	out->mutexes = __atomic_load_n(&mutex_pool.live, __ATOMIC_RELAXED);
+	out->conds = __atomic_load_n(&cond_pool.live, __ATOMIC_RELAXED);
+	out->attrs = __atomic_load_n(&attr_pool.live, __ATOMIC_RELAXED) + __atomic_load_n(&mutexattr_pool.live, __ATOMIC_RELAXED)
+		+ __atomic_load_n(&condattr_pool.live, __ATOMIC_RELAXED);
+	out->chunks = mutex_pool.num_chunks + cond_pool.num_chunks + attr_pool.num_chunks + mutexattr_pool.num_chunks + condattr_pool.num_chunks;
+	out->overflow = __atomic_load_n(&mutex_pool.overflow, __ATOMIC_RELAXED) + __atomic_load_n(&cond_pool.overflow, __ATOMIC_RELAXED)
+		+ __atomic_load_n(&attr_pool.overflow, __ATOMIC_RELAXED) + __atomic_load_n(&mutexattr_pool.overflow, __ATOMIC_RELAXED)
+		+ __atomic_load_n(&condattr_pool.overflow, __ATOMIC_RELAXED);
+	out->static_inits = static_inits;
+	out->init_races = init_races;
+}
@@ -0,0 +1,68 @@
+#ifndef __BIONIC_PTHREAD_H__
+#define __BIONIC_PTHREAD_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "sync.h"
+
+typedef struct {
+	uint32_t mutexes; // live objects
+	uint32_t conds;
+	uint32_t attrs;
+	uint32_t chunks; // pool chunks allocated so far
+	uint32_t overflow; // live objects allocated past the last chunk
+	uint32_t static_inits; // statically initialized objects brought to life
+	uint32_t init_races; // first uses lost to another thread
+} bionic_pthread_stats;
+
+int pthread_attr_destroy_soloader(pthread_attr_t **attr);
+int pthread_attr_getstack_soloader(const pthread_attr_t **attr, void **stackaddr, size_t *stacksize);
+int pthread_attr_init_soloader(pthread_attr_t **attr);
+int pthread_attr_setdetachstate_soloader(pthread_attr_t **attr, int state);
+int pthread_attr_setstacksize_soloader(pthread_attr_t **attr, size_t stacksize);
+int pthread_attr_getstacksize_soloader(pthread_attr_t **attr, size_t *stacksize);
+int pthread_attr_setschedparam_soloader(pthread_attr_t **attr, const struct sched_param *param);
+int pthread_attr_getschedparam_soloader(pthread_attr_t **attr, const struct sched_param *param);
+int pthread_attr_setstack_soloader(pthread_attr_t **attr, void *stackaddr, size_t stacksize);
+
+int pthread_condattr_init_soloader(pthread_condattr_t **attr);
+int pthread_condattr_destroy_soloader(pthread_condattr_t **attr);
+int pthread_cond_init_soloader(sync_cond **cond, const pthread_condattr_t **attr);
+int pthread_cond_destroy_soloader(sync_cond **cond);
+int pthread_cond_signal_soloader(sync_cond **cond);
+int pthread_cond_broadcast_soloader(sync_cond **cond);
+int pthread_cond_wait_soloader(sync_cond **cond, sync_mutex **mutex);
+int pthread_cond_timedwait_soloader(sync_cond **cond, sync_mutex **mutex, struct timespec *abstime);
+
+int pthread_mutexattr_init_soloader(pthread_mutexattr_t **attr);
+int pthread_mutexattr_settype_soloader(pthread_mutexattr_t **attr, int type);
+int pthread_mutexattr_setpshared_soloader(pthread_mutexattr_t **attr, int pshared);
+int pthread_mutexattr_destroy_soloader(pthread_mutexattr_t **attr);
+int pthread_mutex_init_soloader(sync_mutex **mutex, const pthread_mutexattr_t **attr);
+int pthread_mutex_destroy_soloader(sync_mutex **mutex);
+int pthread_mutex_lock_soloader(sync_mutex **mutex);
+int pthread_mutex_trylock_soloader(sync_mutex **mutex);
+int pthread_mutex_unlock_soloader(sync_mutex **mutex);
+
+int pthread_create_soloader(pthread_t **thread, const pthread_attr_t **attr, void *(*start)(void *), void *param);
+int pthread_join_soloader(const pthread_t *thread, void **value_ptr);
+int pthread_detach_soloader(const pthread_t *thread);
+int pthread_equal_soloader(const pthread_t *t1, const pthread_t *t2);
+int pthread_setschedparam_soloader(const pthread_t *thread, int policy, const struct sched_param *param);
+int pthread_getschedparam_soloader(const pthread_t *thread, int *policy, struct sched_param *param);
+int pthread_getattr_np_soloader(pthread_t *thread, pthread_attr_t *attr);
+int pthread_setname_np_soloader(const pthread_t *thread, const char *thread_name);
+
+int sem_init_soloader(sync_sem *sem, int pshared, unsigned int value);
+int sem_destroy_soloader(sync_sem *sem);
+int sem_getvalue_soloader(sync_sem *sem, int *sval);
+int sem_post_soloader(sync_sem *sem);
+int sem_wait_soloader(sync_sem *sem);
+int sem_trywait_soloader(sync_sem *sem);
+int sem_timedwait_soloader(sync_sem *sem, const struct timespec *abstime);
+
+void bionic_pthread_get_stats(bionic_pthread_stats *stats);
+
+#endif
@@ -2,10 +2,51 @@
 #define __CONFIG_H__
 
 //#define DEBUG
+//#define ENABLE_IO_STATS // Periodically prints loader I/O statistics
+//#define ENABLE_IO_TRACE // Records every file access to ux0:data/valiant/trace.bin
+//#define ENABLE_ALLOC_TRACE // Records every game allocation to ux0:data/valiant/alloc_trace.bin
+//#define ENABLE_ALLOC_PROFILE // Tracks game allocations per call site, L+R+SELECT writes ux0:data/valiant/heap_NNN.txt
 
 #define LOAD_ADDRESS 0x98000000
 
 #define SCREEN_W 960
 #define SCREEN_H 544
 
+// RAM cache for small assets, accounted against _newlib_heap_size_user
+#define FILE_CACHE_BUDGET (24 * 1024 * 1024)
+#define FILE_CACHE_MAX_FILE_SIZE (512 * 1024)
+
+// Files listed in the manifest are kept in RAM for good, accounted against FILE_CACHE_BUDGET
+#define VFS_OVERLAY_MANIFEST "ux0:data/valiant/overlay.txt"
+#define VFS_OVERLAY_BUDGET (8 * 1024 * 1024)
+
+// Archive entries up to this size are decompressed whole on open, bigger ones as they're read
+#define VFS_ARCHIVE_MAX_BUFFERED (1024 * 1024)
+
+// Size of each of the two read-ahead buffers of a streamed file
+#define READAHEAD_WINDOW (128 * 1024)
+
+// stdio buffer of each file opened by the game
+#define STREAM_BUFFER_SIZE (64 * 1024)
+
+// Address range reserved for the small allocations of the game, accounted against _newlib_heap_size_user
+#define SLAB_ARENA_SIZE (32 * 1024 * 1024)
+
+// Part of the slab arena plain malloc never takes, so that MemoryId heaps always find spans
+#define SLAB_MEMID_RESERVE (8 * 1024 * 1024)
+
+// Headroom thresholds of the newlib heap and vitaGL pools. Past the first, loader caches get
+// trimmed. Past the second, they get dropped and if it lasts the game starts in lowend mode
+// from then on, until a lowend session keeps the third all along.
+#define MEM_HEAP_WARN (24 * 1024 * 1024)
+#define MEM_HEAP_CRITICAL (8 * 1024 * 1024)
+#define MEM_HEAP_RESTORE (48 * 1024 * 1024)
+#define MEM_GPU_WARN (8 * 1024 * 1024)
+#define MEM_GPU_CRITICAL (2 * 1024 * 1024)
+#define MEM_GPU_RESTORE (16 * 1024 * 1024)
+#define MEM_LOWEND_MARKER "ux0:data/valiant/lowend"
+
+// Threads decompressing obb entries ahead of the game, one per core it leaves spare
+#define DECOMP_WORKERS 2
+
 #endif
@@ -0,0 +1,220 @@
+/* decomp.c -- worker pool decompressing independent entries in parallel
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "decomp.h"
+
+#ifdef __vita__
+#include <vitasdk.h>
+#include "io_sched.h"
+#define now_us() sceKernelGetProcessTimeWide()
+#else
+#include <time.h>
+static uint64_t now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+#endif
+
+#define DECOMP_MAX_WORKERS 4
+#define DECOMP_MAX_PENDING 64 // past this, submitters decompress on their own
+
+enum {
+	JOB_QUEUED,
+	JOB_RUNNING,
+	JOB_DONE
+};
+
+typedef struct decomp_job {
+	struct decomp_job *next;
+	uint32_t hash;
+	int state;
+	int refs; // the queue plus every requester waiting on it
+	decomp_fn fn;
+	void *arg;
+	char key[];
+} decomp_job;
+
+static decomp_job *jobs_head = NULL, *jobs_tail = NULL; // pending and running jobs, FIFO
+static int num_jobs = 0;
+static int num_workers = 0;
+static decomp_stats stats;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER; // a job got queued
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER; // a job completed
+
+static uint32_t hash_key(const char *key) {
+	uint32_t h = 0x811C9DC5;
+	while (*key) {
+		h ^= (uint8_t)tolower((uint8_t)*key++);
+		h *= 0x01000193;
+	}
+	return h;
+}
+
+static decomp_job *find_job(const char *key, uint32_t hash) {
+	for (decomp_job *j = jobs_head; j; j = j->next) {
+		if (j->hash == hash && !strcasecmp(j->key, key))
+			return j;
+	}
+	return NULL;
+}
+
+static void unlink_job(decomp_job *job) {
+	decomp_job **p = &jobs_head, *prev = NULL;
+	while (*p != job) {
+		prev = *p;
+		p = &(*p)->next;
+	}
+	*p = job->next;
+	if (jobs_tail == job)
+		jobs_tail = prev;
+	num_jobs--;
+}
+
+static void put_job(decomp_job *job) {
+	if (--job->refs == 0)
+		free(job);
+}
+
+// Called with the lock held, returns with the lock held
+static void run_job(decomp_job *job) {
+	job->state = JOB_RUNNING;
+	pthread_mutex_unlock(&pool_lock);
+	uint64_t t = now_us();
+	job->fn(job->arg);
+	t = now_us() - t;
+	pthread_mutex_lock(&pool_lock);
+	stats.busy_us += t;
+	job->state = JOB_DONE;
+	unlink_job(job);
+	pthread_cond_broadcast(&done_cond);
+	put_job(job);
+}
+
+static void *decomp_thread(void *arg) {
+#ifdef __vita__
+	// Nobody waits on queued jobs yet, a requester joining one runs it at its own class
+	io_set_thread_class(IO_CLASS_BACKGROUND);
+#endif
+	pthread_mutex_lock(&pool_lock);
+	for (;;) {
+		decomp_job *job = jobs_head;
+		while (job && job->state != JOB_QUEUED)
+			job = job->next;
+		if (!job) {
+			pthread_cond_wait(&work_cond, &pool_lock);
+			continue;
+		}
+		run_job(job);
+	}
+	pthread_mutex_unlock(&pool_lock);
+	return NULL;
+}
+
+// Spawns workers until there are the given amount, the pool never shrinks
+void decomp_init(int workers) {
+	if (workers > DECOMP_MAX_WORKERS)
+		workers = DECOMP_MAX_WORKERS;
+
+	pthread_mutex_lock(&pool_lock);
+	while (num_workers < workers) {
+		pthread_t t;
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setstacksize(&attr, 64 * 1024);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		if (pthread_create(&t, &attr, decomp_thread, NULL) != 0)
+			break;
+		num_workers++;
+	}
+	pthread_mutex_unlock(&pool_lock);
+}
+
+// Queues a job, unless one with the same key is already pending, in which case -1 is
+// returned and arg is left to the caller. Without workers, or with a full queue, the
+// job runs right away on the calling thread.
+int decomp_queue(const char *key, decomp_fn fn, void *arg) {
+	uint32_t hash = hash_key(key);
+	size_t len = strlen(key);
+	pthread_mutex_lock(&pool_lock);
+	if (find_job(key, hash)) {
+		stats.merged++;
+		pthread_mutex_unlock(&pool_lock);
+		return -1;
+	}
+
+	decomp_job *job = NULL;
+	if (num_workers && num_jobs < DECOMP_MAX_PENDING)
+		job = malloc(sizeof(decomp_job) + len + 1);
+	if (!job) {
+		pthread_mutex_unlock(&pool_lock);
+		fn(arg);
+		return 0;
+	}
+	job->next = NULL;
+	job->hash = hash;
+	job->state = JOB_QUEUED;
+	job->refs = 1;
+	job->fn = fn;
+	job->arg = arg;
+	memcpy(job->key, key, len + 1);
+	if (jobs_tail)
+		jobs_tail->next = job;
+	else
+		jobs_head = job;
+	jobs_tail = job;
+	num_jobs++;
+	stats.queued++;
+	pthread_cond_signal(&work_cond);
+	pthread_mutex_unlock(&pool_lock);
+	return 0;
+}
+
+// Waits for the job with the given key, if any. A job still sitting in the queue is
+// run by the caller, so a requester never waits behind somebody else's entries.
+// Returns 1 if a job was found, in which case its result can be looked up.
+int decomp_join(const char *key) {
+	if (!num_workers)
+		return 0;
+
+	uint32_t hash = hash_key(key);
+	pthread_mutex_lock(&pool_lock);
+	decomp_job *job = find_job(key, hash);
+	if (!job) {
+		pthread_mutex_unlock(&pool_lock);
+		return 0;
+	}
+
+	job->refs++;
+	if (job->state == JOB_QUEUED) {
+		stats.stolen++;
+		run_job(job);
+	} else {
+		stats.waits++;
+		uint64_t t = now_us();
+		while (job->state != JOB_DONE)
+			pthread_cond_wait(&done_cond, &pool_lock);
+		stats.wait_us += now_us() - t;
+	}
+	put_job(job);
+	pthread_mutex_unlock(&pool_lock);
+	return 1;
+}
+
+void decomp_get_stats(decomp_stats *out) {
+	pthread_mutex_lock(&pool_lock);
+	*out = stats;
+	pthread_mutex_unlock(&pool_lock);
+}
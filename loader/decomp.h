@@ -0,0 +1,26 @@
+#ifndef __DECOMP_H__
+#define __DECOMP_H__
+
+#include <stdint.h>
+
+// Runs a job and frees its argument, the result is expected to land in a cache
+// looked up by the job key
+typedef void (*decomp_fn)(void *arg);
+
+typedef struct {
+	uint32_t queued;
+	uint32_t merged; // submissions for a key already pending
+	uint32_t stolen; // jobs run by a waiting requester instead of a worker
+	uint32_t waits; // requesters blocked on a job already running
+	uint64_t wait_us;
+	uint64_t busy_us; // time spent running jobs, summed over all workers
+} decomp_stats;
+
+void decomp_init(int workers);
+
+int decomp_queue(const char *key, decomp_fn fn, void *arg);
+int decomp_join(const char *key);
+
+void decomp_get_stats(decomp_stats *stats);
+
+#endif
@@ -0,0 +1,254 @@
+/* dir_cache.c -- cached directory listings
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "dir_cache.h"
+
+#define DIR_CACHE_MAX_DIRS 64
+
+#define SCE_ERRNO_MASK 0xFF
+
+typedef struct {
+	uint32_t name_offs;
+	uint8_t is_dir;
+} dir_entry;
+
+struct dir_listing {
+	struct dir_listing *next; // most recently used first
+	int refs;
+	uint8_t detached; // invalidated while still referenced
+	int count;
+	dir_entry *entries;
+	char *names;
+	char key[];
+};
+
+static dir_listing *listings = NULL;
+static int num_listings = 0;
+static uint32_t cache_gen = 0;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void free_listing(dir_listing *l) {
+	free(l->entries);
+	free(l->names);
+	free(l);
+}
+
+static void detach_listing(dir_listing **p) {
+	dir_listing *l = *p;
+	*p = l->next;
+	num_listings--;
+	if (l->refs)
+		l->detached = 1;
+	else
+		free_listing(l);
+}
+
+static dir_listing *alloc_listing(const char *path) {
+	size_t len = strlen(path);
+	dir_listing *l = calloc(1, sizeof(dir_listing) + len + 1);
+	if (l)
+		memcpy(l->key, path, len + 1);
+	return l;
+}
+
+static int append_entry(dir_listing *l, int *cap, size_t *names_len, size_t *names_cap, const char *name, int is_dir) {
+	size_t name_len = strlen(name) + 1;
+	if (l->count == *cap) {
+		int new_cap = *cap ? *cap * 2 : 32;
+		dir_entry *entries = realloc(l->entries, new_cap * sizeof(dir_entry));
+		if (!entries)
+			return -1;
+		l->entries = entries;
+		*cap = new_cap;
+	}
+	if (*names_len + name_len > *names_cap) {
+		size_t new_cap = *names_cap ? *names_cap * 2 : 1024;
+		while (new_cap < *names_len + name_len)
+			new_cap *= 2;
+		char *names = realloc(l->names, new_cap);
+		if (!names)
+			return -1;
+		l->names = names;
+		*names_cap = new_cap;
+	}
+	l->entries[l->count].name_offs = *names_len;
+	l->entries[l->count].is_dir = is_dir;
+	memcpy(&l->names[*names_len], name, name_len);
+	*names_len += name_len;
+	l->count++;
+	return 0;
+}
+
+// Reads the whole directory in one go, entries and names end up in two flat arrays
+static dir_listing *load_listing(const char *path) {
+	SceUID d = sceIoDopen(path);
+	if (d < 0) {
+		errno = d & SCE_ERRNO_MASK;
+		return NULL;
+	}
+
+	dir_listing *l = alloc_listing(path);
+	if (!l) {
+		sceIoDclose(d);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	int cap = 0;
+	size_t names_len = 0, names_cap = 0;
+	SceIoDirent ent;
+	while (sceIoDread(d, &ent) > 0) {
+		if (append_entry(l, &cap, &names_len, &names_cap, ent.d_name, SCE_S_ISDIR(ent.d_stat.st_mode)) < 0)
+			break;
+	}
+
+	sceIoDclose(d);
+	return l;
+}
+
+dir_listing *dir_cache_get(const char *path) {
+	// Trailing slashes would defeat both lookups and invalidation
+	char key[256];
+	size_t len = strlen(path);
+	if (len >= sizeof(key)) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+	while (len > 1 && path[len - 1] == '/' && path[len - 2] != ':')
+		len--;
+	memcpy(key, path, len);
+	key[len] = 0;
+
+	pthread_mutex_lock(&cache_lock);
+	dir_listing **p = &listings;
+	while (*p) {
+		dir_listing *l = *p;
+		if (!strcasecmp(l->key, key)) {
+			*p = l->next;
+			l->next = listings;
+			listings = l;
+			l->refs++;
+			pthread_mutex_unlock(&cache_lock);
+			return l;
+		}
+		p = &l->next;
+	}
+	uint32_t gen = cache_gen;
+	pthread_mutex_unlock(&cache_lock);
+
+	dir_listing *l = load_listing(key);
+	if (!l)
+		return NULL;
+
+	pthread_mutex_lock(&cache_lock);
+	l->refs = 1;
+	if (gen == cache_gen) {
+		l->next = listings;
+		listings = l;
+		num_listings++;
+		if (num_listings > DIR_CACHE_MAX_DIRS) {
+			p = &listings;
+			while ((*p)->next)
+				p = &(*p)->next;
+			detach_listing(p);
+		}
+	} else {
+		// The directory changed while we were reading it, hand out a private copy
+		l->detached = 1;
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return l;
+}
+
+// Private copy of base with the patched names dropped or added, for directories with
+// changes that didn't reach the disk yet. base may be NULL and stays referenced.
+dir_listing *dir_cache_patch(dir_listing *base, const char *path, const dir_patch *patch, int count) {
+	dir_listing *l = alloc_listing(path);
+	if (!l) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	l->refs = 1;
+	l->detached = 1;
+
+	int cap = 0, res = 0;
+	size_t names_len = 0, names_cap = 0;
+	for (int i = 0; base && i < base->count && res == 0; i++) {
+		const char *name = dir_cache_name(base, i);
+		int j;
+		for (j = 0; j < count; j++) {
+			if (!strcasecmp(patch[j].name, name))
+				break;
+		}
+		if (j == count)
+			res = append_entry(l, &cap, &names_len, &names_cap, name, base->entries[i].is_dir);
+	}
+	for (int i = 0; i < count && res == 0; i++) {
+		if (patch[i].state != DIR_PATCH_REMOVE)
+			res = append_entry(l, &cap, &names_len, &names_cap, patch[i].name, patch[i].state == DIR_PATCH_DIR);
+	}
+	if (res < 0) {
+		free_listing(l);
+		errno = ENOMEM;
+		return NULL;
+	}
+	return l;
+}
+
+void dir_cache_release(dir_listing *l) {
+	pthread_mutex_lock(&cache_lock);
+	if (--l->refs == 0 && l->detached)
+		free_listing(l);
+	pthread_mutex_unlock(&cache_lock);
+}
+
+int dir_cache_count(dir_listing *l) {
+	return l->count;
+}
+
+const char *dir_cache_name(dir_listing *l, int index) {
+	return &l->names[l->entries[index].name_offs];
+}
+
+int dir_cache_is_dir(dir_listing *l, int index) {
+	return l->entries[index].is_dir;
+}
+
+// Drops the listings of a path, of its parent and of anything below it
+void dir_cache_invalidate(const char *path) {
+	size_t len = strlen(path);
+	while (len && path[len - 1] == '/')
+		len--;
+	size_t parent_len = len;
+	while (parent_len && path[parent_len - 1] != '/')
+		parent_len--;
+	if (parent_len)
+		parent_len--;
+
+	pthread_mutex_lock(&cache_lock);
+	cache_gen++;
+	dir_listing **p = &listings;
+	while (*p) {
+		const char *key = (*p)->key;
+		size_t key_len = strlen(key);
+		if ((key_len == parent_len && !strncasecmp(key, path, parent_len)) ||
+			(key_len >= len && !strncasecmp(key, path, len) && (key[len] == 0 || key[len] == '/')))
+			detach_listing(p);
+		else
+			p = &(*p)->next;
+	}
+	pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,28 @@
+#ifndef __DIR_CACHE_H__
+#define __DIR_CACHE_H__
+
+#include <stdint.h>
+
+typedef struct dir_listing dir_listing;
+
+enum {
+	DIR_PATCH_REMOVE,
+	DIR_PATCH_FILE,
+	DIR_PATCH_DIR
+};
+
+typedef struct {
+	const char *name;
+	int state;
+} dir_patch;
+
+dir_listing *dir_cache_get(const char *path);
+dir_listing *dir_cache_patch(dir_listing *base, const char *path, const dir_patch *patch, int count);
+void dir_cache_release(dir_listing *list);
+int dir_cache_count(dir_listing *list);
+const char *dir_cache_name(dir_listing *list, int index);
+int dir_cache_is_dir(dir_listing *list, int index);
+
+void dir_cache_invalidate(const char *path);
+
+#endif
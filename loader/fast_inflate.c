@@ -0,0 +1,613 @@
+/* fast_inflate.c -- whole-buffer deflate decoder behind the zlib imports
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <zlib.h>
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "fast_inflate.h"
+
+#define LITLEN_ROOT 10
+#define DIST_ROOT 8
+#define PRECODE_ROOT 7
+#define LITLEN_ENOUGH 2048 // worst case for 286 symbols with a 10 bits root is 1332
+#define DIST_ENOUGH 1024 // worst case for 30 symbols with an 8 bits root is 402
+#define PRECODE_ENOUGH 128
+
+#define MAX_STREAMS 64
+
+// Decoding table entries, the same layout of zlib codes packed in a single word:
+// bits 0-7 are the bits to drop, bits 8-15 the op and bits 16-31 the value.
+// Op is 0 for a literal, 16 + extra bits for a length or distance base, 32 for
+// the end of block and 64 for an invalid code. Any other op points to a subtable
+// starting at value, indexed by op bits.
+#define ENTRY(op, bits, val) ((uint32_t)(bits) | ((uint32_t)(op) << 8) | ((uint32_t)(val) << 16))
+#define E_BITS(e) ((e) & 0xFF)
+#define E_OP(e) (((e) >> 8) & 0xFF)
+#define E_VAL(e) ((e) >> 16)
+#define IS_LINK(op) ((op) && (op) < 16)
+
+enum {
+	TABLE_PRECODE,
+	TABLE_LITLEN,
+	TABLE_DIST
+};
+
+typedef struct {
+	uint32_t litlen[LITLEN_ENOUGH];
+	uint32_t dist[DIST_ENOUGH];
+	uint32_t precode[PRECODE_ENOUGH];
+	uint16_t work[320];
+	uint8_t lens[320];
+	uint8_t precode_lens[19];
+} inflate_tables;
+
+typedef struct {
+	z_streamp strm;
+	int window_bits;
+	int tried; // fast path attempted since the last reset
+	int done; // stream fully decoded by the fast path
+} tracked_stream;
+
+static const uint16_t len_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t len_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577
+};
+static const uint8_t dist_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const uint8_t precode_order[19] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static uint32_t fixed_litlen[512];
+static uint32_t fixed_dist[32];
+static int fixed_litlen_bits = 9, fixed_dist_bits = 5;
+static pthread_once_t fixed_once = PTHREAD_ONCE_INIT;
+
+static tracked_stream streams[MAX_STREAMS];
+static pthread_mutex_t streams_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline uint64_t load_le64(const uint8_t *p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32_t sym_entry(int type, unsigned sym, unsigned bits) {
+	if (type == TABLE_PRECODE)
+		return ENTRY(0, bits, sym);
+	if (type == TABLE_DIST)
+		return sym < 30 ? ENTRY(16 + dist_extra[sym], bits, dist_base[sym]) : ENTRY(64, bits, 0);
+	if (sym < 256)
+		return ENTRY(0, bits, sym);
+	if (sym == 256)
+		return ENTRY(32, bits, 0);
+	if (sym < 286)
+		return ENTRY(16 + len_extra[sym - 257], bits, len_base[sym - 257]);
+	return ENTRY(64, bits, 0);
+}
+
+// Builds a two level canonical Huffman decoding table, following zlib inflate_table
+// so that the very same streams are accepted and rejected
+static int build_table(int type, const uint8_t *lens, unsigned codes, uint32_t *table, int *bits, unsigned enough, uint16_t *work) {
+	uint16_t count[16], offs[16];
+	unsigned len, sym, min, max, root, curr, drop, used, huff, incr, fill, low, mask;
+	int left;
+
+	memset(count, 0, sizeof(count));
+	for (sym = 0; sym < codes; sym++)
+		count[lens[sym]]++;
+
+	root = *bits;
+	for (max = 15; max >= 1; max--) {
+		if (count[max])
+			break;
+	}
+	if (root > max)
+		root = max;
+	if (max == 0) {
+		// No codes at all, any attempt to decode one fails
+		table[0] = table[1] = ENTRY(64, 1, 0);
+		*bits = 1;
+		return 0;
+	}
+	for (min = 1; min < max; min++) {
+		if (count[min])
+			break;
+	}
+	if (root < min)
+		root = min;
+
+	left = 1;
+	for (len = 1; len <= 15; len++) {
+		left <<= 1;
+		left -= count[len];
+		if (left < 0)
+			return -1; // over-subscribed
+	}
+	if (left > 0 && (type == TABLE_PRECODE || max != 1))
+		return -1; // incomplete, only allowed for a single one bit code
+
+	offs[1] = 0;
+	for (len = 1; len < 15; len++)
+		offs[len + 1] = offs[len] + count[len];
+	for (sym = 0; sym < codes; sym++) {
+		if (lens[sym])
+			work[offs[lens[sym]]++] = sym;
+	}
+
+	uint32_t *next = table;
+	huff = 0;
+	sym = 0;
+	len = min;
+	curr = root;
+	drop = 0;
+	low = (unsigned)-1;
+	used = 1U << root;
+	mask = used - 1;
+	if (used > enough)
+		return -1;
+
+	for (;;) {
+		uint32_t here = sym_entry(type, work[sym], len - drop);
+		incr = 1U << (len - drop);
+		fill = 1U << curr;
+		min = fill;
+		do {
+			fill -= incr;
+			next[(huff >> drop) + fill] = here;
+		} while (fill != 0);
+
+		// Codes are stored bit reversed, so increment backwards
+		incr = 1U << (len - 1);
+		while (huff & incr)
+			incr >>= 1;
+		if (incr != 0) {
+			huff &= incr - 1;
+			huff += incr;
+		} else {
+			huff = 0;
+		}
+
+		sym++;
+		if (--count[len] == 0) {
+			if (len == max)
+				break;
+			len = lens[work[sym]];
+		}
+
+		if (len > root && (huff & mask) != low) {
+			if (drop == 0)
+				drop = root;
+			next += min;
+
+			// Grow the subtable as long as the remaining codes would fill it
+			curr = len - drop;
+			left = 1 << curr;
+			while (curr + drop < max) {
+				left -= count[curr + drop];
+				if (left <= 0)
+					break;
+				curr++;
+				left <<= 1;
+			}
+
+			used += 1U << curr;
+			if (used > enough)
+				return -1;
+			low = huff & mask;
+			table[low] = ENTRY(curr, root, next - table);
+		}
+	}
+
+	if (huff != 0)
+		next[huff] = ENTRY(64, len - drop, 0);
+	*bits = root;
+	return 0;
+}
+
+static void build_fixed_tables(void) {
+	uint8_t lens[288];
+	uint16_t work[288];
+	memset(lens, 8, 144);
+	memset(&lens[144], 9, 112);
+	memset(&lens[256], 7, 24);
+	memset(&lens[280], 8, 8);
+	build_table(TABLE_LITLEN, lens, 288, fixed_litlen, &fixed_litlen_bits, 512, work);
+	memset(lens, 5, 32);
+	build_table(TABLE_DIST, lens, 32, fixed_dist, &fixed_dist_bits, 32, work);
+}
+
+// Matches are copied in wide chunks whenever there's room to overshoot
+static inline void copy_match(uint8_t *out, unsigned dist, unsigned len, const uint8_t *out_end) {
+	const uint8_t *src = out - dist;
+	if ((size_t)(out_end - out) >= len + 16) {
+		uint8_t *end = out + len;
+#ifdef __ARM_NEON
+		if (dist >= 16) {
+			do {
+				vst1q_u8(out, vld1q_u8(src));
+				out += 16;
+				src += 16;
+			} while (out < end);
+			return;
+		}
+#endif
+		if (dist >= 8) {
+			do {
+				memcpy(out, src, 8);
+				out += 8;
+				src += 8;
+			} while (out < end);
+			return;
+		}
+		if (dist == 1) {
+			memset(out, *src, len);
+			return;
+		}
+	}
+	do {
+		*out++ = *src++;
+	} while (--len);
+}
+
+// The bit buffer is refilled a whole word at a time while far enough from the end of the
+// input. Past the end, zeros are fed in and accounted, so that running short is detected.
+#define REFILL() do { \
+		if (in_end - in >= 8) { \
+			bitbuf |= load_le64(in) << bitsleft; \
+			in += (63 - bitsleft) >> 3; \
+			bitsleft |= 56; \
+		} else { \
+			while (bitsleft <= 56) { \
+				if (in < in_end) \
+					bitbuf |= (uint64_t)*in++ << bitsleft; \
+				else if (++overread > 16) \
+					goto short_input; \
+				bitsleft += 8; \
+			} \
+		} \
+	} while (0)
+
+#define BITS(n) ((uint32_t)bitbuf & ((1U << (n)) - 1))
+#define DROP(n) do { bitbuf >>= (n); bitsleft -= (n); } while (0)
+
+int fast_inflate(const void *in_buf, size_t in_size, void *out_buf, size_t out_size, size_t *in_used, size_t *out_used) {
+	const uint8_t *in = in_buf, *in_end = in + in_size;
+	uint8_t *out = out_buf, *out_start = out, *out_end = out + out_size;
+	uint64_t bitbuf = 0;
+	unsigned bitsleft = 0, overread = 0;
+	int final, res;
+	inflate_tables *t = NULL;
+
+	pthread_once(&fixed_once, build_fixed_tables);
+
+	do {
+		REFILL();
+		final = BITS(1);
+		int type = (bitbuf >> 1) & 3;
+		DROP(3);
+
+		if (type == 0) {
+			// Stored block, hand back the whole bytes left in the bit buffer
+			DROP(bitsleft & 7);
+			if ((bitsleft >> 3) < overread)
+				goto short_input;
+			in -= (bitsleft >> 3) - overread;
+			bitbuf = 0;
+			bitsleft = 0;
+			overread = 0;
+			if (in_end - in < 4)
+				goto short_input;
+			unsigned len = in[0] | (in[1] << 8);
+			if (len != (~(in[2] | (in[3] << 8)) & 0xFFFF))
+				goto bad_data;
+			in += 4;
+			if ((size_t)(in_end - in) < len)
+				goto short_input;
+			if ((size_t)(out_end - out) < len)
+				goto short_output;
+			memcpy(out, in, len);
+			in += len;
+			out += len;
+			continue;
+		}
+		if (type == 3)
+			goto bad_data;
+
+		const uint32_t *litlen, *dist;
+		int litlen_bits, dist_bits;
+		if (type == 1) {
+			litlen = fixed_litlen;
+			dist = fixed_dist;
+			litlen_bits = fixed_litlen_bits;
+			dist_bits = fixed_dist_bits;
+		} else {
+			if (!t) {
+				t = malloc(sizeof(inflate_tables));
+				if (!t) {
+					res = FAST_INFLATE_NO_MEMORY;
+					goto out;
+				}
+			}
+
+			unsigned nlit = BITS(5) + 257;
+			DROP(5);
+			unsigned ndist = BITS(5) + 1;
+			DROP(5);
+			unsigned nclen = BITS(4) + 4;
+			DROP(4);
+			if (nlit > 286 || ndist > 30)
+				goto bad_data;
+
+			memset(t->precode_lens, 0, sizeof(t->precode_lens));
+			for (unsigned i = 0; i < nclen; i++) {
+				if (bitsleft < 3)
+					REFILL();
+				t->precode_lens[precode_order[i]] = BITS(3);
+				DROP(3);
+			}
+			int precode_bits = PRECODE_ROOT;
+			if (build_table(TABLE_PRECODE, t->precode_lens, 19, t->precode, &precode_bits, PRECODE_ENOUGH, t->work) < 0)
+				goto bad_data;
+
+			unsigned n = 0;
+			while (n < nlit + ndist) {
+				if (bitsleft < 14)
+					REFILL();
+				uint32_t e = t->precode[BITS(precode_bits)];
+				DROP(E_BITS(e));
+				if (E_OP(e) != 0)
+					goto bad_data;
+				unsigned sym = E_VAL(e);
+				if (sym < 16) {
+					t->lens[n++] = sym;
+					continue;
+				}
+
+				unsigned rep;
+				uint8_t val = 0;
+				if (sym == 16) {
+					if (!n)
+						goto bad_data;
+					val = t->lens[n - 1];
+					rep = 3 + BITS(2);
+					DROP(2);
+				} else if (sym == 17) {
+					rep = 3 + BITS(3);
+					DROP(3);
+				} else {
+					rep = 11 + BITS(7);
+					DROP(7);
+				}
+				if (n + rep > nlit + ndist)
+					goto bad_data;
+				memset(&t->lens[n], val, rep);
+				n += rep;
+			}
+			if (!t->lens[256])
+				goto bad_data;
+
+			litlen_bits = LITLEN_ROOT;
+			dist_bits = DIST_ROOT;
+			if (build_table(TABLE_LITLEN, t->lens, nlit, t->litlen, &litlen_bits, LITLEN_ENOUGH, t->work) < 0 ||
+				build_table(TABLE_DIST, &t->lens[nlit], ndist, t->dist, &dist_bits, DIST_ENOUGH, t->work) < 0)
+				goto bad_data;
+			litlen = t->litlen;
+			dist = t->dist;
+		}
+
+		// A full refill covers the longest length code plus distance code with their extra bits
+		for (;;) {
+			REFILL();
+			uint32_t e = litlen[BITS(litlen_bits)];
+			if (IS_LINK(E_OP(e))) {
+				DROP(E_BITS(e));
+				e = litlen[E_VAL(e) + BITS(E_OP(e))];
+			}
+			DROP(E_BITS(e));
+			unsigned op = E_OP(e);
+			if (op == 0) {
+				if (out == out_end)
+					goto short_output;
+				*out++ = E_VAL(e);
+				continue;
+			}
+			if (!(op & 16)) {
+				if (op & 32)
+					break;
+				goto bad_data;
+			}
+
+			unsigned len = E_VAL(e) + BITS(op & 15);
+			DROP(op & 15);
+			e = dist[BITS(dist_bits)];
+			if (IS_LINK(E_OP(e))) {
+				DROP(E_BITS(e));
+				e = dist[E_VAL(e) + BITS(E_OP(e))];
+			}
+			DROP(E_BITS(e));
+			op = E_OP(e);
+			if (!(op & 16))
+				goto bad_data;
+			unsigned d = E_VAL(e) + BITS(op & 15);
+			DROP(op & 15);
+
+			if (d > (size_t)(out - out_start))
+				goto bad_data;
+			if (len > (size_t)(out_end - out))
+				goto short_output;
+			copy_match(out, d, len, out_end);
+			out += len;
+		}
+	} while (!final);
+
+	// The rest of the last byte is padding, whole bytes left in the bit buffer are not ours
+	if ((bitsleft >> 3) < overread)
+		goto short_input;
+	in -= (bitsleft >> 3) - overread;
+	*in_used = in - (const uint8_t *)in_buf;
+	*out_used = out - out_start;
+	res = FAST_INFLATE_OK;
+	goto out;
+
+bad_data:
+	res = FAST_INFLATE_BAD_DATA;
+	goto out;
+short_input:
+	res = FAST_INFLATE_SHORT_INPUT;
+	goto out;
+short_output:
+	res = FAST_INFLATE_SHORT_OUTPUT;
+out:
+	free(t);
+	return res;
+}
+
+// Decodes a whole zlib stream, header and adler32 trailer included
+static int zlib_decode(const uint8_t *in, size_t in_size, uint8_t *out, size_t out_size, int window_bits, size_t *in_used, size_t *out_used, uint32_t *check) {
+	if (in_size < 2)
+		return FAST_INFLATE_SHORT_INPUT;
+	// Preset dictionaries and windows bigger than requested are left to zlib
+	if ((in[0] & 0x0F) != Z_DEFLATED || (in[0] >> 4) + 8 > window_bits || ((in[0] << 8) | in[1]) % 31 || (in[1] & 0x20))
+		return FAST_INFLATE_BAD_DATA;
+
+	int res = fast_inflate(in + 2, in_size - 2, out, out_size, in_used, out_used);
+	if (res != FAST_INFLATE_OK)
+		return res;
+
+	size_t pos = 2 + *in_used;
+	if (in_size - pos < 4)
+		return FAST_INFLATE_SHORT_INPUT;
+	uint32_t adler = ((uint32_t)in[pos] << 24) | (in[pos + 1] << 16) | (in[pos + 2] << 8) | in[pos + 3];
+	if (adler32(1, out, *out_used) != adler)
+		return FAST_INFLATE_BAD_DATA;
+	*in_used = pos + 4;
+	*check = adler;
+	return FAST_INFLATE_OK;
+}
+
+int uncompress_hook(Bytef *dest, uLongf *dest_len, const Bytef *source, uLong source_len) {
+	size_t in_used, out_used;
+	uint32_t check;
+	if (zlib_decode(source, source_len, dest, *dest_len, MAX_WBITS, &in_used, &out_used, &check) == FAST_INFLATE_OK) {
+		*dest_len = out_used;
+		return Z_OK;
+	}
+	// Let zlib sort out the exact error
+	return uncompress(dest, dest_len, source, source_len);
+}
+
+/*
+ * Streams are tracked from their init, the window bits tell which wrapper to expect.
+ * Untracked streams, gzip ones and those whose first call doesn't carry the whole
+ * stream in and out are served by zlib as usual.
+ */
+
+static tracked_stream *find_stream(z_streamp strm) {
+	// Only the owner of a stream ever looks it up, so no lock is needed
+	for (int i = 0; i < MAX_STREAMS; i++) {
+		if (streams[i].strm == strm)
+			return &streams[i];
+	}
+	return NULL;
+}
+
+static void track_stream(z_streamp strm, int window_bits) {
+	pthread_mutex_lock(&streams_lock);
+	tracked_stream *s = find_stream(strm);
+	if (!s)
+		s = find_stream(NULL);
+	if (s) {
+		s->window_bits = window_bits;
+		s->tried = 0;
+		s->done = 0;
+		s->strm = strm;
+	}
+	pthread_mutex_unlock(&streams_lock);
+}
+
+int inflateInit_hook(z_streamp strm, const char *version, int stream_size) {
+	int res = inflateInit_(strm, version, stream_size);
+	if (res == Z_OK)
+		track_stream(strm, MAX_WBITS);
+	return res;
+}
+
+int inflateInit2_hook(z_streamp strm, int window_bits, const char *version, int stream_size) {
+	int res = inflateInit2_(strm, window_bits, version, stream_size);
+	if (res == Z_OK)
+		track_stream(strm, window_bits);
+	return res;
+}
+
+int inflate_hook(z_streamp strm, int flush) {
+	tracked_stream *s = find_stream(strm);
+	if (!s)
+		return inflate(strm, flush);
+	if (s->done)
+		return Z_STREAM_END;
+
+	if (!s->tried && strm->total_in == 0 && strm->total_out == 0 && strm->avail_in && strm->avail_out) {
+		s->tried = 1;
+		size_t in_used, out_used;
+		uint32_t check = 0;
+		int res = FAST_INFLATE_BAD_DATA;
+		if (s->window_bits < 0)
+			res = fast_inflate(strm->next_in, strm->avail_in, strm->next_out, strm->avail_out, &in_used, &out_used);
+		else if (s->window_bits <= MAX_WBITS || (s->window_bits > 32 && strm->next_in[0] != 0x1F))
+			res = zlib_decode(strm->next_in, strm->avail_in, strm->next_out, strm->avail_out, s->window_bits & 15, &in_used, &out_used, &check);
+
+		if (res == FAST_INFLATE_OK) {
+			strm->next_in += in_used;
+			strm->avail_in -= in_used;
+			strm->total_in = in_used;
+			strm->next_out += out_used;
+			strm->avail_out -= out_used;
+			strm->total_out = out_used;
+			if (s->window_bits >= 0)
+				strm->adler = check;
+			s->done = 1;
+			return Z_STREAM_END;
+		}
+	}
+
+	// Nothing got consumed, so zlib can take over from scratch
+	return inflate(strm, flush);
+}
+
+int inflateReset_hook(z_streamp strm) {
+	tracked_stream *s = find_stream(strm);
+	if (s) {
+		s->tried = 0;
+		s->done = 0;
+	}
+	return inflateReset(strm);
+}
+
+int inflateEnd_hook(z_streamp strm) {
+	pthread_mutex_lock(&streams_lock);
+	tracked_stream *s = find_stream(strm);
+	if (s)
+		s->strm = NULL;
+	pthread_mutex_unlock(&streams_lock);
+	return inflateEnd(strm);
+}
@@ -0,0 +1,25 @@
+#ifndef __FAST_INFLATE_H__
+#define __FAST_INFLATE_H__
+
+#include <stddef.h>
+#include <zlib.h>
+
+enum {
+	FAST_INFLATE_OK = 0,
+	FAST_INFLATE_BAD_DATA = -1,
+	FAST_INFLATE_SHORT_INPUT = -2, // stream continues past the input buffer
+	FAST_INFLATE_SHORT_OUTPUT = -3, // output buffer too small
+	FAST_INFLATE_NO_MEMORY = -4
+};
+
+int fast_inflate(const void *in, size_t in_size, void *out, size_t out_size, size_t *in_used, size_t *out_used);
+
+// zlib ABI shims, stock zlib keeps serving streams which can't be decoded in one go
+int uncompress_hook(Bytef *dest, uLongf *dest_len, const Bytef *source, uLong source_len);
+int inflateInit_hook(z_streamp strm, const char *version, int stream_size);
+int inflateInit2_hook(z_streamp strm, int window_bits, const char *version, int stream_size);
+int inflate_hook(z_streamp strm, int flush);
+int inflateReset_hook(z_streamp strm);
+int inflateEnd_hook(z_streamp strm);
+
+#endif
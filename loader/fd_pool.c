@@ -0,0 +1,169 @@
+/* fd_pool.c -- read-only file handles shared by every reader of a file
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "fd_pool.h"
+
+// Handles nobody uses anymore stay open, so that reopening a file right after
+// closing it costs nothing. Past this amount, the least recently used get closed.
+#define FD_POOL_MAX_IDLE 8
+
+typedef struct pool_handle {
+	struct pool_handle *next; // most recently used first
+	SceUID fd;
+	int refs;
+	uint8_t detached; // invalidated while still referenced
+	char key[];
+} pool_handle;
+
+static pool_handle *handles = NULL;
+static int num_idle = 0;
+static fd_pool_stats stats;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void unlink_handle(pool_handle *h) {
+	pool_handle **p = &handles;
+	while (*p != h)
+		p = &(*p)->next;
+	*p = h->next;
+}
+
+// Called with the lock held, the handle must already be unlinked
+static void close_handle(pool_handle *h) {
+	sceIoClose(h->fd);
+	stats.closes++;
+	stats.handles--;
+	free(h);
+}
+
+static void trim_idle(void) {
+	pool_handle *victim = NULL;
+	while (num_idle > FD_POOL_MAX_IDLE) {
+		for (pool_handle *h = handles; h; h = h->next) {
+			if (!h->refs)
+				victim = h;
+		}
+		unlink_handle(victim);
+		num_idle--;
+		close_handle(victim);
+	}
+}
+
+static pool_handle *find_handle(const char *path) {
+	for (pool_handle *h = handles; h; h = h->next) {
+		if (!h->detached && !strcasecmp(h->key, path))
+			return h;
+	}
+	return NULL;
+}
+
+static pool_handle *grab_handle(pool_handle *h) {
+	if (!h->refs++)
+		num_idle--;
+	unlink_handle(h);
+	h->next = handles;
+	handles = h;
+	stats.shared++;
+	return h;
+}
+
+// Returns a read-only descriptor which may be shared with other readers of the same
+// file, so it must only be accessed through positional reads and fd_pool_close.
+SceUID fd_pool_open(const char *path) {
+	pthread_mutex_lock(&pool_lock);
+	pool_handle *h = find_handle(path);
+	if (h) {
+		grab_handle(h);
+		pthread_mutex_unlock(&pool_lock);
+		return h->fd;
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+	// The card can take a while, so the open happens unlocked
+	SceUID fd = sceIoOpen(path, SCE_O_RDONLY, 0);
+	if (fd < 0)
+		return fd;
+	size_t len = strlen(path);
+	pool_handle *n = malloc(sizeof(pool_handle) + len + 1);
+	if (!n)
+		return fd;
+
+	pthread_mutex_lock(&pool_lock);
+	h = find_handle(path);
+	if (h) {
+		// Somebody else opened it meanwhile
+		grab_handle(h);
+		pthread_mutex_unlock(&pool_lock);
+		sceIoClose(fd);
+		free(n);
+		return h->fd;
+	}
+	n->fd = fd;
+	n->refs = 1;
+	n->detached = 0;
+	memcpy(n->key, path, len + 1);
+	n->next = handles;
+	handles = n;
+	stats.opens++;
+	if (++stats.handles > stats.peak)
+		stats.peak = stats.handles;
+	pthread_mutex_unlock(&pool_lock);
+	return fd;
+}
+
+void fd_pool_close(SceUID fd) {
+	pthread_mutex_lock(&pool_lock);
+	pool_handle *h = handles;
+	while (h && h->fd != fd)
+		h = h->next;
+	if (!h) {
+		// Opened while the pool was out of memory
+		pthread_mutex_unlock(&pool_lock);
+		sceIoClose(fd);
+		return;
+	}
+	if (--h->refs == 0) {
+		if (h->detached) {
+			unlink_handle(h);
+			close_handle(h);
+		} else {
+			num_idle++;
+			trim_idle();
+		}
+	}
+	pthread_mutex_unlock(&pool_lock);
+}
+
+// Files can't be removed nor renamed while open, so idle handles must go before
+// touching them. Busy ones get closed as soon as their last reader is done.
+void fd_pool_invalidate(const char *path) {
+	pthread_mutex_lock(&pool_lock);
+	pool_handle *h = find_handle(path);
+	if (h) {
+		if (h->refs) {
+			h->detached = 1;
+		} else {
+			unlink_handle(h);
+			num_idle--;
+			close_handle(h);
+		}
+	}
+	pthread_mutex_unlock(&pool_lock);
+}
+
+void fd_pool_get_stats(fd_pool_stats *out) {
+	pthread_mutex_lock(&pool_lock);
+	*out = stats;
+	pthread_mutex_unlock(&pool_lock);
+}
@@ -0,0 +1,20 @@
+#ifndef __FD_POOL_H__
+#define __FD_POOL_H__
+
+#include <vitasdk.h>
+#include <stdint.h>
+
+typedef struct {
+	uint32_t opens; // physical opens
+	uint32_t shared; // opens served by an already open handle
+	uint32_t closes; // physical closes
+	int handles; // currently open, busy or idle
+	int peak;
+} fd_pool_stats;
+
+SceUID fd_pool_open(const char *path);
+void fd_pool_close(SceUID fd);
+void fd_pool_invalidate(const char *path);
+void fd_pool_get_stats(fd_pool_stats *stats);
+
+#endif
@@ -0,0 +1,274 @@
+/* file_cache.c -- bounded LRU cache for small, frequently reopened files
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "file_cache.h"
+#include "fs_index.h"
+#include "fd_pool.h"
+#include "io_sched.h"
+
+#define FILE_CACHE_BUCKETS 512
+
+struct file_cache_entry {
+	struct file_cache_entry *next; // hash chain
+	struct file_cache_entry *lru_prev, *lru_next;
+	uint32_t hash;
+	int refs;
+	uint8_t detached; // invalidated while still referenced
+	size_t size;
+	uint8_t *data;
+	char key[];
+};
+
+static file_cache_entry *buckets[FILE_CACHE_BUCKETS];
+static file_cache_entry *lru_head = NULL, *lru_tail = NULL; // head is most recently used
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t cache_budget = 0;
+static size_t cache_max_file_size = 0;
+static file_cache_stats stats;
+
+static uint32_t hash_key(const char *key) {
+	uint32_t h = 0x811C9DC5;
+	while (*key) {
+		h ^= (uint8_t)tolower((uint8_t)*key++);
+		h *= 0x01000193;
+	}
+	return h;
+}
+
+static void lru_unlink(file_cache_entry *e) {
+	if (e->lru_prev)
+		e->lru_prev->lru_next = e->lru_next;
+	else
+		lru_head = e->lru_next;
+	if (e->lru_next)
+		e->lru_next->lru_prev = e->lru_prev;
+	else
+		lru_tail = e->lru_prev;
+	e->lru_prev = e->lru_next = NULL;
+}
+
+static void lru_push(file_cache_entry *e) {
+	e->lru_prev = NULL;
+	e->lru_next = lru_head;
+	if (lru_head)
+		lru_head->lru_prev = e;
+	lru_head = e;
+	if (!lru_tail)
+		lru_tail = e;
+}
+
+static file_cache_entry *find_entry(const char *key, uint32_t hash) {
+	file_cache_entry *e = buckets[hash % FILE_CACHE_BUCKETS];
+	while (e) {
+		if (e->hash == hash && !strcasecmp(e->key, key))
+			return e;
+		e = e->next;
+	}
+	return NULL;
+}
+
+// Removes an entry from the table, its memory is released as soon as nobody references it
+static void detach_entry(file_cache_entry *e) {
+	file_cache_entry **p = &buckets[e->hash % FILE_CACHE_BUCKETS];
+	while (*p != e)
+		p = &(*p)->next;
+	*p = e->next;
+	lru_unlink(e);
+	stats.used -= e->size;
+	if (e->refs) {
+		e->detached = 1;
+	} else {
+		free(e->data);
+		free(e);
+	}
+}
+
+static void evict(size_t target) {
+	file_cache_entry *e = lru_tail;
+	while (e && stats.used > target) {
+		file_cache_entry *prev = e->lru_prev;
+		if (!e->refs) {
+			detach_entry(e);
+			stats.evictions++;
+		}
+		e = prev;
+	}
+}
+
+void file_cache_init(size_t budget, size_t max_file_size) {
+	cache_budget = budget;
+	cache_max_file_size = max_file_size < budget ? max_file_size : budget;
+	stats.budget = budget;
+}
+
+static uint8_t *load_file(const char *path, size_t size) {
+	SceUID fd = fd_pool_open(path);
+	if (fd < 0)
+		return NULL;
+	uint8_t *data = malloc(size ? size : 1);
+	if (data && io_pread(fd, data, size, 0, io_class_for_path(path)) != size) {
+		free(data);
+		data = NULL;
+	}
+	fd_pool_close(fd);
+	return data;
+}
+
+static file_cache_entry *insert_entry(const char *key, uint8_t *data, size_t size) {
+	uint32_t hash = hash_key(key);
+	size_t len = strlen(key);
+	pthread_mutex_lock(&cache_lock);
+	file_cache_entry *e = find_entry(key, hash);
+	if (e) {
+		free(data);
+	} else {
+		e = calloc(1, sizeof(file_cache_entry) + len + 1);
+		if (!e) {
+			pthread_mutex_unlock(&cache_lock);
+			free(data);
+			return NULL;
+		}
+		e->hash = hash;
+		e->size = size;
+		e->data = data;
+		memcpy(e->key, key, len + 1);
+		e->next = buckets[hash % FILE_CACHE_BUCKETS];
+		buckets[hash % FILE_CACHE_BUCKETS] = e;
+		stats.used += e->size;
+		evict(cache_budget);
+		lru_push(e);
+	}
+	e->refs++;
+	pthread_mutex_unlock(&cache_lock);
+	return e;
+}
+
+file_cache_entry *file_cache_get(const char *path) {
+	if (!cache_budget)
+		return NULL;
+
+	uint32_t hash = hash_key(path);
+	pthread_mutex_lock(&cache_lock);
+	file_cache_entry *e = find_entry(path, hash);
+	if (e) {
+		e->refs++;
+		lru_unlink(e);
+		lru_push(e);
+		stats.hits++;
+		stats.bytes_served += e->size;
+		pthread_mutex_unlock(&cache_lock);
+		return e;
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	struct stat st;
+	int res = fs_index_stat(path, &st);
+	if (res == FS_INDEX_UNKNOWN)
+		res = stat(path, &st);
+	if (res != 0 || !S_ISREG(st.st_mode) || st.st_size > cache_max_file_size) {
+		pthread_mutex_lock(&cache_lock);
+		if (res != 0)
+			stats.missing++;
+		else
+			stats.bypasses++;
+		pthread_mutex_unlock(&cache_lock);
+		return NULL;
+	}
+
+	// The file is read without holding the lock, so another thread may beat us to it
+	uint8_t *data = load_file(path, st.st_size);
+	if (!data)
+		return NULL;
+
+	e = insert_entry(path, data, st.st_size);
+	pthread_mutex_lock(&cache_lock);
+	stats.misses++;
+	if (e)
+		stats.bytes_served += e->size;
+	pthread_mutex_unlock(&cache_lock);
+	return e;
+}
+
+// Lookup only, for data which isn't backed by a file of its own
+file_cache_entry *file_cache_find(const char *key) {
+	uint32_t hash = hash_key(key);
+	pthread_mutex_lock(&cache_lock);
+	file_cache_entry *e = find_entry(key, hash);
+	if (e) {
+		e->refs++;
+		lru_unlink(e);
+		lru_push(e);
+		stats.hits++;
+		stats.bytes_served += e->size;
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return e;
+}
+
+// Takes ownership of data, which is freed right away if it doesn't fit the cache
+file_cache_entry *file_cache_insert(const char *key, uint8_t *data, size_t size) {
+	if (size > cache_max_file_size) {
+		free(data);
+		return NULL;
+	}
+	return insert_entry(key, data, size);
+}
+
+// Same as file_cache_insert without the size threshold. Referenced entries are never
+// evicted, so holding on to the returned one keeps the data in RAM for good.
+file_cache_entry *file_cache_pin(const char *key, uint8_t *data, size_t size) {
+	return insert_entry(key, data, size);
+}
+
+void file_cache_release(file_cache_entry *e) {
+	pthread_mutex_lock(&cache_lock);
+	if (--e->refs == 0 && e->detached) {
+		free(e->data);
+		free(e);
+	}
+	pthread_mutex_unlock(&cache_lock);
+}
+
+const uint8_t *file_cache_data(file_cache_entry *e) {
+	return e->data;
+}
+
+size_t file_cache_size(file_cache_entry *e) {
+	return e->size;
+}
+
+void file_cache_invalidate(const char *path) {
+	uint32_t hash = hash_key(path);
+	pthread_mutex_lock(&cache_lock);
+	file_cache_entry *e = find_entry(path, hash);
+	if (e)
+		detach_entry(e);
+	pthread_mutex_unlock(&cache_lock);
+}
+
+void file_cache_trim(size_t target) {
+	pthread_mutex_lock(&cache_lock);
+	evict(target);
+	pthread_mutex_unlock(&cache_lock);
+}
+
+void file_cache_get_stats(file_cache_stats *out) {
+	pthread_mutex_lock(&cache_lock);
+	*out = stats;
+	pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,34 @@
+#ifndef __FILE_CACHE_H__
+#define __FILE_CACHE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+typedef struct file_cache_entry file_cache_entry;
+
+typedef struct {
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t bypasses; // files above the size threshold
+	uint32_t missing; // lookups of files that don't exist
+	uint32_t evictions;
+	uint64_t bytes_served;
+	size_t used;
+	size_t budget;
+} file_cache_stats;
+
+void file_cache_init(size_t budget, size_t max_file_size);
+
+file_cache_entry *file_cache_get(const char *path);
+file_cache_entry *file_cache_find(const char *key);
+file_cache_entry *file_cache_insert(const char *key, uint8_t *data, size_t size);
+file_cache_entry *file_cache_pin(const char *key, uint8_t *data, size_t size);
+void file_cache_release(file_cache_entry *entry);
+const uint8_t *file_cache_data(file_cache_entry *entry);
+size_t file_cache_size(file_cache_entry *entry);
+
+void file_cache_invalidate(const char *path);
+void file_cache_trim(size_t target);
+void file_cache_get_stats(file_cache_stats *stats);
+
+#endif
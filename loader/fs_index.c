@@ -0,0 +1,421 @@
+/* fs_index.c -- in-memory metadata index of the data directory
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "fs_index.h"
+
+#define FS_INDEX_BUCKETS 1024
+#define FS_INDEX_MAX_WRITERS 32
+#define FS_INDEX_MAX_RESCANS 4
+
+typedef struct fs_node {
+	struct fs_node *next;
+	uint32_t hash;
+	uint8_t stale; // metadata must be refreshed from the filesystem
+	int writers; // open write handles, metadata is volatile while > 0
+	struct stat st;
+	char key[]; // lowercase path relative to the root
+} fs_node;
+
+typedef struct {
+	uintptr_t handle;
+	char key[256];
+} fs_writer;
+
+static char root_path[256];
+static size_t root_len = 0;
+
+static fs_node **buckets = NULL;
+static volatile int index_ready = 0;
+static uint32_t index_gen = 0;
+static pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static fs_writer writers[FS_INDEX_MAX_WRITERS];
+static int num_writers = 0;
+
+static uint32_t hash_key(const char *key) {
+	uint32_t h = 0x811C9DC5;
+	while (*key) {
+		h ^= (uint8_t)*key++;
+		h *= 0x01000193;
+	}
+	return h;
+}
+
+// Turns an absolute path into a normalized lowercase key relative to the root.
+// Returns -1 if the path lives outside of the indexed tree.
+static int make_key(const char *path, char *key) {
+	if (!root_len || strncasecmp(path, root_path, root_len))
+		return -1;
+	path += root_len;
+	if (*path && *path != '/')
+		return -1;
+
+	int len = 0;
+	while (*path) {
+		if (*path == '/') {
+			path++;
+			continue;
+		}
+		if (path[0] == '.' && (path[1] == '/' || path[1] == 0)) {
+			path++;
+			continue;
+		}
+		if (len)
+			key[len++] = '/';
+		while (*path && *path != '/') {
+			if (len >= 255)
+				return -1;
+			key[len++] = tolower((uint8_t)*path++);
+		}
+	}
+	key[len] = 0;
+	return 0;
+}
+
+static fs_node *find_node(fs_node **table, const char *key, uint32_t hash) {
+	fs_node *node = table[hash % FS_INDEX_BUCKETS];
+	while (node) {
+		if (node->hash == hash && !strcmp(node->key, key))
+			return node;
+		node = node->next;
+	}
+	return NULL;
+}
+
+static fs_node *insert_node(fs_node **table, const char *key) {
+	uint32_t hash = hash_key(key);
+	fs_node *node = find_node(table, key, hash);
+	if (node)
+		return node;
+
+	size_t len = strlen(key);
+	node = calloc(1, sizeof(fs_node) + len + 1);
+	if (!node)
+		return NULL;
+	node->hash = hash;
+	node->stale = 1;
+	memcpy(node->key, key, len + 1);
+	node->next = table[hash % FS_INDEX_BUCKETS];
+	table[hash % FS_INDEX_BUCKETS] = node;
+	return node;
+}
+
+static void free_table(fs_node **table) {
+	for (int i = 0; i < FS_INDEX_BUCKETS; i++) {
+		fs_node *node = table[i];
+		while (node) {
+			fs_node *next = node->next;
+			free(node);
+			node = next;
+		}
+	}
+	free(table);
+}
+
+static void scan_dir(fs_node **table, char *path, size_t path_len, char *key, size_t key_len) {
+	DIR *d = opendir(path);
+	if (!d)
+		return;
+
+	struct dirent *ent;
+	while ((ent = readdir(d))) {
+		if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, ".."))
+			continue;
+		size_t name_len = strlen(ent->d_name);
+		if (path_len + name_len + 2 > 256 || key_len + name_len + 2 > 256)
+			continue;
+
+		path[path_len] = '/';
+		memcpy(&path[path_len + 1], ent->d_name, name_len + 1);
+		size_t child_key_len = key_len;
+		if (key_len)
+			key[child_key_len++] = '/';
+		for (size_t i = 0; i <= name_len; i++)
+			key[child_key_len + i] = tolower((uint8_t)ent->d_name[i]);
+		child_key_len += name_len;
+
+		struct stat st;
+		if (stat(path, &st) == 0) {
+			fs_node *node = insert_node(table, key);
+			if (node) {
+				node->st = st;
+				node->stale = 0;
+			}
+			if (S_ISDIR(st.st_mode))
+				scan_dir(table, path, path_len + name_len + 1, key, child_key_len);
+		}
+
+		path[path_len] = 0;
+		key[key_len] = 0;
+	}
+
+	closedir(d);
+}
+
+static void *fs_index_thread(void *arg) {
+	for (int i = 0; i < FS_INDEX_MAX_RESCANS; i++) {
+		pthread_mutex_lock(&index_lock);
+		uint32_t gen = index_gen;
+		pthread_mutex_unlock(&index_lock);
+
+		fs_node **table = calloc(FS_INDEX_BUCKETS, sizeof(fs_node *));
+		if (!table)
+			return NULL;
+
+		char path[256], key[256];
+		struct stat st;
+		strcpy(path, root_path);
+		key[0] = 0;
+		if (stat(path, &st) == 0) {
+			fs_node *node = insert_node(table, key);
+			if (node) {
+				node->st = st;
+				node->stale = 0;
+			}
+			scan_dir(table, path, root_len, key, 0);
+		}
+
+		// Any mutation performed through the hooks while scanning may not be
+		// reflected in the snapshot, so we just throw it away and retry
+		pthread_mutex_lock(&index_lock);
+		if (gen == index_gen) {
+			// Files opened for writing before the index got ready stay volatile
+			for (int j = 0; j < num_writers; j++) {
+				fs_node *node = insert_node(table, writers[j].key);
+				if (node)
+					node->writers++;
+			}
+			buckets = table;
+			index_ready = 1;
+			pthread_mutex_unlock(&index_lock);
+			sceClibPrintf("fs_index: data directory indexed\n");
+			return NULL;
+		}
+		pthread_mutex_unlock(&index_lock);
+		free_table(table);
+	}
+
+	sceClibPrintf("fs_index: giving up, data directory kept changing\n");
+	return NULL;
+}
+
+void fs_index_init(const char *root) {
+	strncpy(root_path, root, sizeof(root_path) - 1);
+	root_len = strlen(root_path);
+	while (root_len && root_path[root_len - 1] == '/')
+		root_path[--root_len] = 0;
+
+	pthread_t t;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, 128 * 1024);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_create(&t, &attr, fs_index_thread, NULL);
+}
+
+int fs_index_stat(const char *path, struct stat *st) {
+	char key[256];
+	if (!index_ready || make_key(path, key) < 0)
+		return FS_INDEX_UNKNOWN;
+
+	int res = FS_INDEX_MISS;
+	pthread_mutex_lock(&index_lock);
+	fs_node *node = find_node(buckets, key, hash_key(key));
+	if (node) {
+		if (node->stale || node->writers) {
+			res = FS_INDEX_UNKNOWN;
+		} else {
+			*st = node->st;
+			res = FS_INDEX_HIT;
+		}
+	}
+	pthread_mutex_unlock(&index_lock);
+
+	if (res == FS_INDEX_MISS)
+		errno = ENOENT;
+	return res;
+}
+
+void fs_index_update(const char *path, const struct stat *st) {
+	char key[256];
+	if (!index_ready || make_key(path, key) < 0)
+		return;
+
+	pthread_mutex_lock(&index_lock);
+	fs_node *node = insert_node(buckets, key);
+	if (node && !node->writers) {
+		node->st = *st;
+		node->stale = 0;
+	}
+	pthread_mutex_unlock(&index_lock);
+}
+
+void fs_index_add_dir(const char *path) {
+	char key[256];
+	if (make_key(path, key) < 0)
+		return;
+
+	pthread_mutex_lock(&index_lock);
+	index_gen++;
+	if (index_ready) {
+		fs_node *node = insert_node(buckets, key);
+		if (node)
+			node->stale = 1;
+	}
+	pthread_mutex_unlock(&index_lock);
+}
+
+// Unlinks the node with the given key and, if it's a directory, all of its descendants
+static void remove_tree(const char *key) {
+	size_t len = strlen(key);
+	for (int i = 0; i < FS_INDEX_BUCKETS; i++) {
+		fs_node **p = &buckets[i];
+		while (*p) {
+			fs_node *node = *p;
+			if (!strncmp(node->key, key, len) && (node->key[len] == 0 || node->key[len] == '/' || !len)) {
+				*p = node->next;
+				free(node);
+			} else {
+				p = &node->next;
+			}
+		}
+	}
+}
+
+void fs_index_remove(const char *path) {
+	char key[256];
+	if (make_key(path, key) < 0)
+		return;
+
+	pthread_mutex_lock(&index_lock);
+	index_gen++;
+	if (index_ready)
+		remove_tree(key);
+	pthread_mutex_unlock(&index_lock);
+}
+
+void fs_index_rename(const char *old_path, const char *new_path) {
+	char old_key[256], new_key[256];
+	int old_in = make_key(old_path, old_key) == 0;
+	int new_in = make_key(new_path, new_key) == 0;
+	if (!old_in && !new_in)
+		return;
+
+	pthread_mutex_lock(&index_lock);
+	index_gen++;
+	// Open write handles follow the file, so that closing them releases the new key
+	if (old_in) {
+		size_t old_len = strlen(old_key);
+		for (int i = 0; i < num_writers; i++) {
+			char *key = writers[i].key;
+			if (strncmp(key, old_key, old_len) || (key[old_len] != 0 && key[old_len] != '/'))
+				continue;
+			if (new_in && strlen(new_key) + strlen(&key[old_len]) < sizeof(writers[i].key)) {
+				char moved[256];
+				sprintf(moved, "%s%s", new_key, &key[old_len]);
+				strcpy(key, moved);
+			} else {
+				// Left the indexed tree, nothing to release on close anymore
+				writers[i--] = writers[--num_writers];
+			}
+		}
+	}
+	if (index_ready) {
+		if (new_in)
+			remove_tree(new_key);
+		if (old_in) {
+			// Move the renamed node and its descendants under the new key, their
+			// metadata gets refreshed lazily on next access
+			size_t old_len = strlen(old_key);
+			fs_node *moved = NULL;
+			for (int i = 0; i < FS_INDEX_BUCKETS; i++) {
+				fs_node **p = &buckets[i];
+				while (*p) {
+					fs_node *node = *p;
+					if (!strncmp(node->key, old_key, old_len) && (node->key[old_len] == 0 || node->key[old_len] == '/')) {
+						*p = node->next;
+						node->next = moved;
+						moved = node;
+					} else {
+						p = &node->next;
+					}
+				}
+			}
+			while (moved) {
+				fs_node *next = moved->next;
+				if (new_in && strlen(new_key) + strlen(&moved->key[old_len]) < 256) {
+					char key[256];
+					sprintf(key, "%s%s", new_key, &moved->key[old_len]);
+					fs_node *node = insert_node(buckets, key);
+					if (node)
+						node->writers += moved->writers;
+				}
+				free(moved);
+				moved = next;
+			}
+		} else {
+			insert_node(buckets, new_key);
+		}
+	}
+	pthread_mutex_unlock(&index_lock);
+}
+
+void fs_index_write_begin(uintptr_t handle, const char *path) {
+	char key[256];
+	if (make_key(path, key) < 0)
+		return;
+
+	pthread_mutex_lock(&index_lock);
+	index_gen++;
+	if (num_writers < FS_INDEX_MAX_WRITERS) {
+		writers[num_writers].handle = handle;
+		strcpy(writers[num_writers].key, key);
+		num_writers++;
+	}
+	// If we run out of tracking slots, the node is never released and
+	// will just keep on hitting the filesystem
+	if (index_ready) {
+		fs_node *node = insert_node(buckets, key);
+		if (node)
+			node->writers++;
+	}
+	pthread_mutex_unlock(&index_lock);
+}
+
+void fs_index_write_end(uintptr_t handle) {
+	if (!num_writers)
+		return;
+
+	pthread_mutex_lock(&index_lock);
+	for (int i = 0; i < num_writers; i++) {
+		if (writers[i].handle == handle) {
+			if (index_ready) {
+				fs_node *node = find_node(buckets, writers[i].key, hash_key(writers[i].key));
+				if (node) {
+					if (node->writers)
+						node->writers--;
+					node->stale = 1;
+				}
+			}
+			writers[i] = writers[--num_writers];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&index_lock);
+}
@@ -0,0 +1,25 @@
+#ifndef __FS_INDEX_H__
+#define __FS_INDEX_H__
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+enum {
+	FS_INDEX_MISS = -1, // path is known not to exist
+	FS_INDEX_HIT = 0, // stat filled from the index
+	FS_INDEX_UNKNOWN = 1, // caller must query the filesystem
+};
+
+void fs_index_init(const char *root);
+
+int fs_index_stat(const char *path, struct stat *st);
+void fs_index_update(const char *path, const struct stat *st);
+
+void fs_index_add_dir(const char *path);
+void fs_index_remove(const char *path);
+void fs_index_rename(const char *old_path, const char *new_path);
+
+void fs_index_write_begin(uintptr_t handle, const char *path);
+void fs_index_write_end(uintptr_t handle);
+
+#endif
@@ -0,0 +1,268 @@
+/* heap_prof.c -- per call site accounting of the game allocations
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "heap_prof.h"
+#include "so_util.h"
+
+#ifdef ENABLE_ALLOC_PROFILE
+
+#define PROF_SITE_BUCKETS 4096
+#define PROF_INITIAL_BLOCKS (64 * 1024) // must be a power of two
+#define PROF_STACK_SCAN 64 // words searched for the return address of the allocating function
+
+// Allocations made from site, itself called from caller, on a given thread
+typedef struct prof_site {
+	struct prof_site *next;
+	uintptr_t site;
+	uintptr_t caller;
+	uint32_t thread;
+	uint32_t allocs;
+	uint32_t frees;
+	uint32_t live_blocks;
+	size_t live_bytes;
+	size_t peak_bytes;
+} prof_site;
+
+typedef struct {
+	uintptr_t p; // 0 for an empty slot
+	prof_site *site;
+	uint32_t size;
+} prof_block;
+
+static so_module *mod = NULL;
+static uintptr_t text_start = 0, text_end = 0;
+
+static prof_site *sites[PROF_SITE_BUCKETS];
+static int num_sites = 0;
+static prof_block *blocks = NULL;
+static uint32_t blocks_size = 0, num_blocks = 0;
+static size_t live_bytes = 0, peak_bytes = 0;
+static uint32_t untracked = 0; // blocks the table had no room for
+static int snapshot = 0;
+static pthread_mutex_t prof_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void heap_prof_init(so_module *m) {
+	blocks = calloc(PROF_INITIAL_BLOCKS, sizeof(prof_block));
+	if (blocks)
+		blocks_size = PROF_INITIAL_BLOCKS;
+	mod = m;
+	text_start = m->text_base;
+	text_end = m->text_base + m->text_size;
+}
+
+// Accepts only words pointing right after a call instruction of the game
+static int is_return_address(uintptr_t v) {
+	if (v < text_start + 4 || v >= text_end)
+		return 0;
+	if (v & 1) {
+		const uint16_t *ins = (const uint16_t *)(v & ~1);
+		if ((ins[-1] & 0xFF87) == 0x4780) // blx rN
+			return 1;
+		return (ins[-2] & 0xF800) == 0xF000 && (ins[-1] & 0xC000) == 0xC000; // bl, blx imm
+	}
+	if (v & 3)
+		return 0;
+	uint32_t ins = ((const uint32_t *)v)[-1];
+	return (ins & 0x0F000000) == 0x0B000000 || (ins & 0xFE000000) == 0xFA000000 || (ins & 0x0FFFFFF0) == 0x012FFF30;
+}
+
+// Most allocations go through an engine wrapper, so the site alone would lump them
+// together. The game has no frame pointers, the stack gets scanned instead.
+static uintptr_t find_caller(uintptr_t site) {
+	const uintptr_t *sp = __builtin_frame_address(0);
+	for (int i = 0; i < PROF_STACK_SCAN; i++) {
+		if (sp[i] != site && is_return_address(sp[i]))
+			return sp[i];
+	}
+	return 0;
+}
+
+static uint32_t hash_block(uintptr_t p) {
+	return ((p >> 3) * 0x9E3779B1u) & (blocks_size - 1);
+}
+
+static void put_block(prof_block *table, uint32_t size, uintptr_t p, prof_site *s, uint32_t len) {
+	uint32_t i = ((p >> 3) * 0x9E3779B1u) & (size - 1);
+	while (table[i].p)
+		i = (i + 1) & (size - 1);
+	table[i].p = p;
+	table[i].site = s;
+	table[i].size = len;
+}
+
+static int grow_blocks(void) {
+	prof_block *n = calloc(blocks_size * 2, sizeof(prof_block));
+	if (!n)
+		return 0;
+	for (uint32_t i = 0; i < blocks_size; i++) {
+		if (blocks[i].p)
+			put_block(n, blocks_size * 2, blocks[i].p, blocks[i].site, blocks[i].size);
+	}
+	free(blocks);
+	blocks = n;
+	blocks_size *= 2;
+	return 1;
+}
+
+// Backward shift deletion keeps the probe sequences intact
+static int take_block(uintptr_t p, prof_block *out) {
+	uint32_t i = hash_block(p);
+	while (blocks[i].p && blocks[i].p != p)
+		i = (i + 1) & (blocks_size - 1);
+	if (!blocks[i].p)
+		return 0;
+	*out = blocks[i];
+	uint32_t hole = i;
+	for (;;) {
+		i = (i + 1) & (blocks_size - 1);
+		if (!blocks[i].p)
+			break;
+		uint32_t home = hash_block(blocks[i].p);
+		if (((i - home) & (blocks_size - 1)) >= ((i - hole) & (blocks_size - 1))) {
+			blocks[hole] = blocks[i];
+			hole = i;
+		}
+	}
+	blocks[hole].p = 0;
+	num_blocks--;
+	return 1;
+}
+
+static prof_site *get_site(uintptr_t site, uintptr_t caller, uint32_t thread) {
+	uint32_t h = ((site ^ (caller * 31) ^ thread) * 0x9E3779B1u) % PROF_SITE_BUCKETS;
+	prof_site *s;
+	for (s = sites[h]; s; s = s->next) {
+		if (s->site == site && s->caller == caller && s->thread == thread)
+			return s;
+	}
+	s = calloc(1, sizeof(prof_site));
+	if (!s)
+		return NULL;
+	s->site = site;
+	s->caller = caller;
+	s->thread = thread;
+	s->next = sites[h];
+	sites[h] = s;
+	num_sites++;
+	return s;
+}
+
+void heap_prof_alloc(void *p, size_t size, uintptr_t site) {
+	if (!p || !blocks)
+		return;
+	uintptr_t caller = find_caller(site);
+	uint32_t thread = sceKernelGetThreadId();
+
+	pthread_mutex_lock(&prof_lock);
+	prof_site *s = get_site(site, caller, thread);
+	if (!s || (num_blocks * 2 >= blocks_size && !grow_blocks())) {
+		untracked++;
+		pthread_mutex_unlock(&prof_lock);
+		return;
+	}
+	put_block(blocks, blocks_size, (uintptr_t)p, s, size);
+	num_blocks++;
+	s->allocs++;
+	s->live_blocks++;
+	s->live_bytes += size;
+	if (s->live_bytes > s->peak_bytes)
+		s->peak_bytes = s->live_bytes;
+	live_bytes += size;
+	if (live_bytes > peak_bytes)
+		peak_bytes = live_bytes;
+	pthread_mutex_unlock(&prof_lock);
+}
+
+void heap_prof_free(void *p) {
+	if (!p || !blocks)
+		return;
+	prof_block b;
+	pthread_mutex_lock(&prof_lock);
+	if (take_block((uintptr_t)p, &b)) {
+		b.site->frees++;
+		b.site->live_blocks--;
+		b.site->live_bytes -= b.size;
+		live_bytes -= b.size;
+	}
+	pthread_mutex_unlock(&prof_lock);
+}
+
+static int by_live_bytes(const void *a, const void *b) {
+	const prof_site *x = a, *y = b;
+	if (x->live_bytes != y->live_bytes)
+		return x->live_bytes < y->live_bytes ? 1 : -1;
+	return x->peak_bytes < y->peak_bytes ? 1 : (x->peak_bytes > y->peak_bytes ? -1 : 0);
+}
+
+static void print_symbol(FILE *f, uintptr_t addr) {
+	uintptr_t offset;
+	const char *name = addr ? so_symbol_name(mod, addr, &offset) : NULL;
+	if (name)
+		fprintf(f, "%s+0x%X", name, offset);
+	else
+		fprintf(f, "?");
+}
+
+// Text dump of every site, biggest live usage first, see tools/heap_diff.c
+int heap_prof_dump(void) {
+	if (!blocks)
+		return -1;
+	pthread_mutex_lock(&prof_lock);
+	int n = 0;
+	prof_site *copy = malloc(num_sites * sizeof(prof_site));
+	if (copy) {
+		for (int i = 0; i < PROF_SITE_BUCKETS; i++) {
+			for (prof_site *s = sites[i]; s; s = s->next)
+				copy[n++] = *s;
+		}
+	}
+	size_t live = live_bytes, peak = peak_bytes;
+	uint32_t blocks_live = num_blocks, lost = untracked;
+	int index = ++snapshot;
+	pthread_mutex_unlock(&prof_lock);
+	if (!copy)
+		return -1;
+	qsort(copy, n, sizeof(prof_site), by_live_bytes);
+
+	char path[256];
+	sprintf(path, "ux0:data/valiant/heap_%03d.txt", index);
+	FILE *f = fopen(path, "w");
+	if (!f) {
+		free(copy);
+		return -1;
+	}
+	fprintf(f, "# snapshot %d at %llu ms: %u bytes live in %u blocks, %u bytes peak, %u untracked\n",
+		index, sceKernelGetProcessTimeWide() / 1000, live, blocks_live, peak, lost);
+	fprintf(f, "# site\tcaller\tthread\tlive_blocks\tlive_bytes\tpeak_bytes\tallocs\tfrees\tsymbol\n");
+	for (int i = 0; i < n; i++) {
+		prof_site *s = &copy[i];
+		SceKernelThreadInfo info;
+		info.size = sizeof(info);
+		if (sceKernelGetThreadInfo(s->thread, &info) < 0)
+			sprintf(info.name, "0x%08X", s->thread); // exited since
+		fprintf(f, "0x%08X\t0x%08X\t%s\t%u\t%u\t%u\t%u\t%u\t",
+			s->site - text_start, s->caller ? s->caller - text_start : 0, info.name,
+			s->live_blocks, s->live_bytes, s->peak_bytes, s->allocs, s->frees);
+		print_symbol(f, s->site);
+		fprintf(f, " <- ");
+		print_symbol(f, s->caller);
+		fprintf(f, "\n");
+	}
+	fclose(f);
+	free(copy);
+	return index;
+}
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef __HEAP_PROF_H__
+#define __HEAP_PROF_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "config.h"
+
+struct so_module;
+
+#ifdef ENABLE_ALLOC_PROFILE
+void heap_prof_init(struct so_module *mod);
+void heap_prof_alloc(void *p, size_t size, uintptr_t site);
+void heap_prof_free(void *p);
+int heap_prof_dump(void);
+#else
+#define heap_prof_init(mod)
+#define heap_prof_alloc(p, size, site)
+#define heap_prof_free(p)
+#define heap_prof_dump() 0
+#endif
+
+#endif
@@ -0,0 +1,338 @@
+/* io_sched.c -- single card access thread serving reads by priority class
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <malloc.h>
+#include <pthread.h>
+
+#include "io_sched.h"
+
+#define IO_SCHED_PRIORITY 64 // above every game thread, it sleeps on the card anyway
+#define IO_MAX_ASYNC 64
+#define IO_MERGE_MAX (128 * 1024) // neighbouring requests get read in one go up to this
+#define IO_CHUNK_SIZE (256 * 1024) // bigger reads are split, so urgent ones can cut in
+#define IO_LATENCY_BUCKETS 24 // log2 of microseconds
+
+typedef struct io_request {
+	struct io_request *next;
+	SceUID fd;
+	uint8_t *buf;
+	uint32_t size;
+	uint32_t done; // bytes already read
+	uint64_t offs;
+	int cls;
+	uint64_t submit_us;
+	uint64_t deadline;
+	int res;
+	int finished;
+	io_done_fn done_fn; // set for asynchronous requests
+	void *arg;
+} io_request;
+
+// How long each class may sit in the queue before it overtakes more urgent ones
+static const uint64_t class_budget_us[IO_NUM_CLASSES] = { 4000, 30000, 250000 };
+
+static const char *audio_patterns[] = { "sound/", "music/", ".wav", ".ogg" };
+
+static io_request *queue = NULL;
+static io_request async_pool[IO_MAX_ASYNC];
+static io_request *async_free = NULL;
+static uint8_t *merge_buf = NULL;
+static int running = 0;
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+static pthread_key_t class_key;
+static pthread_once_t class_key_once = PTHREAD_ONCE_INIT;
+
+static io_sched_stats stats;
+static uint32_t latency_hist[IO_NUM_CLASSES][IO_LATENCY_BUCKETS];
+
+static void create_class_key(void) {
+	pthread_key_create(&class_key, NULL);
+}
+
+// Threads working ahead of the game demote every read they issue
+void io_set_thread_class(int cls) {
+	pthread_once(&class_key_once, create_class_key);
+	pthread_setspecific(class_key, (void *)(uintptr_t)(cls + 1));
+}
+
+static int effective_class(int cls) {
+	pthread_once(&class_key_once, create_class_key);
+	int thread_cls = (int)(uintptr_t)pthread_getspecific(class_key) - 1;
+	return thread_cls > cls ? thread_cls : cls;
+}
+
+int io_class_for_path(const char *path) {
+	char lower[256];
+	int i;
+	for (i = 0; path[i] && i < sizeof(lower) - 1; i++)
+		lower[i] = tolower((uint8_t)path[i]);
+	lower[i] = 0;
+	for (i = 0; i < sizeof(audio_patterns) / sizeof(*audio_patterns); i++) {
+		if (strstr(lower, audio_patterns[i]))
+			return IO_CLASS_AUDIO;
+	}
+	return IO_CLASS_INTERACTIVE;
+}
+
+static void enqueue(io_request *r) {
+	r->next = queue;
+	queue = r;
+}
+
+static void dequeue(io_request *r) {
+	io_request **p = &queue;
+	while (*p != r)
+		p = &(*p)->next;
+	*p = r->next;
+}
+
+static io_request *earliest_deadline(void) {
+	io_request *best = queue;
+	for (io_request *r = queue; r; r = r->next) {
+		if (r->deadline < best->deadline)
+			best = r;
+	}
+	return best;
+}
+
+static int is_mergeable(io_request *r) {
+	return !r->done && r->size <= IO_MERGE_MAX;
+}
+
+// Gathers untouched requests overlapping or following the first one, as long as
+// a single read of the whole range fits the merge buffer. Returns the range end.
+static uint64_t build_batch(io_request *first, io_request **batch) {
+	uint64_t start = first->offs, end = first->offs + first->size;
+	dequeue(first);
+	first->next = NULL;
+	*batch = first;
+	if (!is_mergeable(first))
+		return end;
+
+	int grown;
+	do {
+		grown = 0;
+		io_request **p = &queue;
+		while (*p) {
+			io_request *r = *p;
+			uint64_t r_end = r->offs + r->size;
+			if (r->fd == first->fd && is_mergeable(r) && r->offs >= start && r->offs <= end &&
+				(r_end > end ? r_end : end) - start <= IO_MERGE_MAX) {
+				*p = r->next;
+				r->next = *batch;
+				*batch = r;
+				if (r_end > end)
+					end = r_end;
+				stats.classes[r->cls].merged++;
+				grown = 1;
+			} else {
+				p = &r->next;
+			}
+		}
+	} while (grown);
+	return end;
+}
+
+// Called with the lock held
+static void account(io_request *r) {
+	io_class_stats *c = &stats.classes[r->cls];
+	c->depth--;
+	uint64_t latency = sceKernelGetProcessTimeWide() - r->submit_us;
+	int bucket = 0;
+	while (latency > 1 && bucket < IO_LATENCY_BUCKETS - 1) {
+		latency >>= 1;
+		bucket++;
+	}
+	latency_hist[r->cls][bucket]++;
+}
+
+static void *io_thread(void *arg) {
+	sceKernelChangeThreadPriority(sceKernelGetThreadId(), IO_SCHED_PRIORITY);
+
+	pthread_mutex_lock(&sched_lock);
+	for (;;) {
+		while (!queue)
+			pthread_cond_wait(&work_cond, &sched_lock);
+
+		io_request *batch;
+		io_request *first = earliest_deadline();
+		uint64_t start = first->offs + first->done;
+		uint64_t end = build_batch(first, &batch);
+		pthread_mutex_unlock(&sched_lock);
+
+		int res;
+		if (batch->next) {
+			res = sceIoPread(first->fd, merge_buf, end - start, start);
+			for (io_request *r = batch; r; r = r->next) {
+				int64_t avail = res < 0 ? res : res - (int64_t)(r->offs - start);
+				if (avail < 0 && res >= 0)
+					avail = 0;
+				if (avail > r->size)
+					avail = r->size;
+				if (avail > 0)
+					sceClibMemcpy(r->buf, &merge_buf[r->offs - start], avail);
+				r->res = avail;
+			}
+		} else {
+			uint32_t len = first->size - first->done > IO_CHUNK_SIZE ? IO_CHUNK_SIZE : first->size - first->done;
+			res = sceIoPread(first->fd, first->buf + first->done, len, start);
+			if (res == len && first->done + len < first->size) {
+				// More chunks to go, each one competes again as a fresh request
+				first->done += len;
+				first->deadline = sceKernelGetProcessTimeWide() + class_budget_us[first->cls];
+				pthread_mutex_lock(&sched_lock);
+				stats.reads++;
+				stats.bytes += len;
+				enqueue(first);
+				continue;
+			}
+			first->res = res < 0 && !first->done ? res : first->done + (res > 0 ? res : 0);
+		}
+
+		pthread_mutex_lock(&sched_lock);
+		stats.reads++;
+		if (res > 0)
+			stats.bytes += res;
+		io_request *async = NULL;
+		while (batch) {
+			io_request *r = batch;
+			batch = r->next;
+			account(r);
+			if (r->done_fn) {
+				r->next = async;
+				async = r;
+			} else {
+				r->finished = 1;
+			}
+		}
+		pthread_cond_broadcast(&done_cond);
+		pthread_mutex_unlock(&sched_lock);
+
+		for (io_request *r = async; r; r = r->next)
+			r->done_fn(r->arg, r->res);
+
+		pthread_mutex_lock(&sched_lock);
+		while (async) {
+			io_request *r = async;
+			async = r->next;
+			r->next = async_free;
+			async_free = r;
+		}
+	}
+	pthread_mutex_unlock(&sched_lock);
+	return NULL;
+}
+
+void io_sched_init(void) {
+	merge_buf = memalign(64, IO_MERGE_MAX);
+	if (!merge_buf)
+		return;
+	for (int i = 0; i < IO_MAX_ASYNC; i++) {
+		async_pool[i].next = async_free;
+		async_free = &async_pool[i];
+	}
+
+	pthread_t t;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, 32 * 1024);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&t, &attr, io_thread, NULL) == 0)
+		running = 1;
+}
+
+// Called with the lock held
+static void submit(io_request *r, SceUID fd, void *buf, uint32_t size, uint64_t offs, int cls) {
+	r->fd = fd;
+	r->buf = buf;
+	r->size = size;
+	r->done = 0;
+	r->offs = offs;
+	r->cls = effective_class(cls);
+	r->submit_us = sceKernelGetProcessTimeWide();
+	r->deadline = r->submit_us + class_budget_us[r->cls];
+	r->res = 0;
+	r->finished = 0;
+	enqueue(r);
+
+	io_class_stats *c = &stats.classes[r->cls];
+	c->requests++;
+	if (++c->depth > c->max_depth)
+		c->max_depth = c->depth;
+	pthread_cond_signal(&work_cond);
+}
+
+// Blocking positional read, served in class order with everybody else's
+int io_pread(SceUID fd, void *buf, uint32_t size, uint64_t offs, int cls) {
+	if (!running || !size)
+		return sceIoPread(fd, buf, size, offs);
+
+	io_request r;
+	r.done_fn = NULL;
+	pthread_mutex_lock(&sched_lock);
+	submit(&r, fd, buf, size, offs, cls);
+	while (!r.finished)
+		pthread_cond_wait(&done_cond, &sched_lock);
+	pthread_mutex_unlock(&sched_lock);
+	return r.res;
+}
+
+// Queues a read, done runs on the scheduler thread once it completed, so it must
+// not issue reads itself. Returns -1 if the read can't be queued.
+int io_submit(SceUID fd, void *buf, uint32_t size, uint64_t offs, int cls, io_done_fn done, void *arg) {
+	if (!running || !size)
+		return -1;
+
+	pthread_mutex_lock(&sched_lock);
+	io_request *r = async_free;
+	if (!r) {
+		pthread_mutex_unlock(&sched_lock);
+		return -1;
+	}
+	async_free = r->next;
+	r->done_fn = done;
+	r->arg = arg;
+	submit(r, fd, buf, size, offs, cls);
+	pthread_mutex_unlock(&sched_lock);
+	return 0;
+}
+
+static uint32_t percentile(const uint32_t *hist, uint32_t total, int pct) {
+	uint32_t target = (total * pct + 99) / 100, seen = 0;
+	for (int i = 0; i < IO_LATENCY_BUCKETS; i++) {
+		seen += hist[i];
+		if (seen >= target)
+			return 2u << i; // upper bound of the bucket
+	}
+	return 0;
+}
+
+void io_sched_get_stats(io_sched_stats *out) {
+	pthread_mutex_lock(&sched_lock);
+	*out = stats;
+	for (int c = 0; c < IO_NUM_CLASSES; c++) {
+		uint32_t total = 0;
+		for (int i = 0; i < IO_LATENCY_BUCKETS; i++)
+			total += latency_hist[c][i];
+		if (!total)
+			continue;
+		out->classes[c].p50_us = percentile(latency_hist[c], total, 50);
+		out->classes[c].p95_us = percentile(latency_hist[c], total, 95);
+		out->classes[c].p99_us = percentile(latency_hist[c], total, 99);
+	}
+	pthread_mutex_unlock(&sched_lock);
+}
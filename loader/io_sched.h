@@ -0,0 +1,43 @@
+#ifndef __IO_SCHED_H__
+#define __IO_SCHED_H__
+
+#include <vitasdk.h>
+#include <stdint.h>
+
+// Lower values get served first
+enum {
+	IO_CLASS_AUDIO, // streamed sound, a late read is an audible crackle
+	IO_CLASS_INTERACTIVE, // the game is blocked on it
+	IO_CLASS_BACKGROUND, // prefetches nobody waits on yet
+	IO_NUM_CLASSES
+};
+
+typedef void (*io_done_fn)(void *arg, int res);
+
+typedef struct {
+	uint32_t requests;
+	uint32_t merged; // served by a read issued for a neighbouring request
+	int depth;
+	int max_depth;
+	uint32_t p50_us; // submission to completion
+	uint32_t p95_us;
+	uint32_t p99_us;
+} io_class_stats;
+
+typedef struct {
+	io_class_stats classes[IO_NUM_CLASSES];
+	uint32_t reads; // card accesses actually issued
+	uint64_t bytes;
+} io_sched_stats;
+
+void io_sched_init(void);
+
+int io_class_for_path(const char *path);
+void io_set_thread_class(int cls);
+
+int io_pread(SceUID fd, void *buf, uint32_t size, uint64_t offs, int cls);
+int io_submit(SceUID fd, void *buf, uint32_t size, uint64_t offs, int cls, io_done_fn done, void *arg);
+
+void io_sched_get_stats(io_sched_stats *stats);
+
+#endif
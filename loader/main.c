@@ -38,6 +38,27 @@
 #include "dialog.h"
 #include "so_util.h"
 #include "sha1.h"
+#include "fs_index.h"
+#include "asset.h"
+#include "file_cache.h"
+#include "obb.h"
+#include "readahead.h"
+#include "stream.h"
+#include "writebehind.h"
+#include "dir_cache.h"
+#include "trace.h"
+#include "prefetch.h"
+#include "decomp.h"
+#include "fast_inflate.h"
+#include "fd_pool.h"
+#include "io_sched.h"
+#include "mmap.h"
+#include "vfs.h"
+#include "slab.h"
+#include "heap_prof.h"
+#include "mem_monitor.h"
+#include "sync.h"
+#include "bionic_pthread.h"
 
 #include <SLES/OpenSLES.h>
 #include <SLES/OpenSLES_Android.h>
@@ -91,11 +112,6 @@ char *getcwd_hook(char *buf, size_t size) {
 	return buf;
 }
 
-int posix_memalign(void **memptr, size_t alignment, size_t size) {
-	*memptr = memalign(alignment, size);
-	return 0;
-}
-
 int __android_log_print(int prio, const char *tag, const char *fmt, ...) {
 #ifdef ENABLE_DEBUG
 	va_list list;
@@ -144,296 +160,6 @@ int ret1(void) {
 	return 1;
 }
 
-#define  MUTEX_TYPE_NORMAL	 0x0000
-#define  MUTEX_TYPE_RECURSIVE  0x4000
-#define  MUTEX_TYPE_ERRORCHECK 0x8000
-
-static void init_static_mutex(pthread_mutex_t **mutex)
-{
-	pthread_mutex_t *mtxMem = NULL;
-
-	switch ((int)*mutex) {
-	case MUTEX_TYPE_NORMAL: {
-		pthread_mutex_t initTmpNormal = PTHREAD_MUTEX_INITIALIZER;
-		mtxMem = calloc(1, sizeof(pthread_mutex_t));
-		sceClibMemcpy(mtxMem, &initTmpNormal, sizeof(pthread_mutex_t));
-		*mutex = mtxMem;
-		break;
-	}
-	case MUTEX_TYPE_RECURSIVE: {
-		pthread_mutex_t initTmpRec = PTHREAD_RECURSIVE_MUTEX_INITIALIZER;
-		mtxMem = calloc(1, sizeof(pthread_mutex_t));
-		sceClibMemcpy(mtxMem, &initTmpRec, sizeof(pthread_mutex_t));
-		*mutex = mtxMem;
-		break;
-	}
-	case MUTEX_TYPE_ERRORCHECK: {
-		pthread_mutex_t initTmpErr = PTHREAD_ERRORCHECK_MUTEX_INITIALIZER;
-		mtxMem = calloc(1, sizeof(pthread_mutex_t));
-		sceClibMemcpy(mtxMem, &initTmpErr, sizeof(pthread_mutex_t));
-		*mutex = mtxMem;
-		break;
-	}
-	default:
-		break;
-	}
-}
-
-static void init_static_cond(pthread_cond_t **cond)
-{
-	if (*cond == NULL) {
-		pthread_cond_t initTmp = PTHREAD_COND_INITIALIZER;
-		pthread_cond_t *condMem = calloc(1, sizeof(pthread_cond_t));
-		sceClibMemcpy(condMem, &initTmp, sizeof(pthread_cond_t));
-		*cond = condMem;
-	}
-}
-
-int pthread_attr_destroy_soloader(pthread_attr_t **attr)
-{
-	int ret = pthread_attr_destroy(*attr);
-	free(*attr);
-	return ret;
-}
-
-int pthread_attr_getstack_soloader(const pthread_attr_t **attr,
-				   void **stackaddr,
-				   size_t *stacksize)
-{
-	return pthread_attr_getstack(*attr, stackaddr, stacksize);
-}
-
-__attribute__((unused)) int pthread_condattr_init_soloader(pthread_condattr_t **attr)
-{
-	*attr = calloc(1, sizeof(pthread_condattr_t));
-
-	return pthread_condattr_init(*attr);
-}
-
-__attribute__((unused)) int pthread_condattr_destroy_soloader(pthread_condattr_t **attr)
-{
-	int ret = pthread_condattr_destroy(*attr);
-	free(*attr);
-	return ret;
-}
-
-int pthread_cond_init_soloader(pthread_cond_t **cond,
-				   const pthread_condattr_t **attr)
-{
-	*cond = calloc(1, sizeof(pthread_cond_t));
-
-	if (attr != NULL)
-		return pthread_cond_init(*cond, *attr);
-	else
-		return pthread_cond_init(*cond, NULL);
-}
-
-int pthread_cond_destroy_soloader(pthread_cond_t **cond)
-{
-	int ret = pthread_cond_destroy(*cond);
-	free(*cond);
-	return ret;
-}
-
-int pthread_cond_signal_soloader(pthread_cond_t **cond)
-{
-	init_static_cond(cond);
-	return pthread_cond_signal(*cond);
-}
-
-int pthread_cond_timedwait_soloader(pthread_cond_t **cond,
-					pthread_mutex_t **mutex,
-					struct timespec *abstime)
-{
-	init_static_cond(cond);
-	init_static_mutex(mutex);
-	return pthread_cond_timedwait(*cond, *mutex, abstime);
-}
-
-int pthread_create_soloader(pthread_t **thread,
-				const pthread_attr_t **attr,
-				void *(*start)(void *),
-				void *param)
-{
-	*thread = calloc(1, sizeof(pthread_t));
-
-	if (attr != NULL) {
-		pthread_attr_setstacksize(*attr, 512 * 1024);
-		return pthread_create(*thread, *attr, start, param);
-	} else {
-		pthread_attr_t attrr;
-		pthread_attr_init(&attrr);
-		pthread_attr_setstacksize(&attrr, 512 * 1024);
-		return pthread_create(*thread, &attrr, start, param);
-	}
-
-}
-
-int pthread_mutexattr_init_soloader(pthread_mutexattr_t **attr)
-{
-	*attr = calloc(1, sizeof(pthread_mutexattr_t));
-
-	return pthread_mutexattr_init(*attr);
-}
-
-int pthread_mutexattr_settype_soloader(pthread_mutexattr_t **attr, int type)
-{
-	return pthread_mutexattr_settype(*attr, type);
-}
-
-int pthread_mutexattr_setpshared_soloader(pthread_mutexattr_t **attr, int pshared)
-{
-	return pthread_mutexattr_setpshared(*attr, pshared);
-}
-
-int pthread_mutexattr_destroy_soloader(pthread_mutexattr_t **attr)
-{
-	int ret = pthread_mutexattr_destroy(*attr);
-	free(*attr);
-	return ret;
-}
-
-int pthread_mutex_destroy_soloader(pthread_mutex_t **mutex)
-{
-	int ret = pthread_mutex_destroy(*mutex);
-	free(*mutex);
-	return ret;
-}
-
-int pthread_mutex_init_soloader(pthread_mutex_t **mutex,
-				const pthread_mutexattr_t **attr)
-{
-	*mutex = calloc(1, sizeof(pthread_mutex_t));
-
-	if (attr != NULL)
-		return pthread_mutex_init(*mutex, *attr);
-	else
-		return pthread_mutex_init(*mutex, NULL);
-}
-
-int pthread_mutex_lock_soloader(pthread_mutex_t **mutex)
-{
-	init_static_mutex(mutex);
-	return pthread_mutex_lock(*mutex);
-}
-
-int pthread_mutex_trylock_soloader(pthread_mutex_t **mutex)
-{
-	init_static_mutex(mutex);
-	return pthread_mutex_trylock(*mutex);
-}
-
-int pthread_mutex_unlock_soloader(pthread_mutex_t **mutex)
-{
-	return pthread_mutex_unlock(*mutex);
-}
-
-int pthread_join_soloader(const pthread_t *thread, void **value_ptr)
-{
-	return pthread_join(*thread, value_ptr);
-}
-
-int pthread_cond_wait_soloader(pthread_cond_t **cond, pthread_mutex_t **mutex)
-{
-	return pthread_cond_wait(*cond, *mutex);
-}
-
-int pthread_cond_broadcast_soloader(pthread_cond_t **cond)
-{
-	return pthread_cond_broadcast(*cond);
-}
-
-int pthread_attr_init_soloader(pthread_attr_t **attr)
-{
-	*attr = calloc(1, sizeof(pthread_attr_t));
-
-	return pthread_attr_init(*attr);
-}
-
-int pthread_attr_setdetachstate_soloader(pthread_attr_t **attr, int state)
-{
-	return pthread_attr_setdetachstate(*attr, !state);
-}
-
-int pthread_attr_setstacksize_soloader(pthread_attr_t **attr, size_t stacksize)
-{
-	return pthread_attr_setstacksize(*attr, stacksize);
-}
-
-int pthread_attr_getstacksize_soloader(pthread_attr_t **attr, size_t *stacksize)
-{
-	return pthread_attr_getstacksize(*attr, stacksize);
-}
-
-int pthread_attr_setschedparam_soloader(pthread_attr_t **attr,
-					const struct sched_param *param)
-{
-	return pthread_attr_setschedparam(*attr, param);
-}
-
-int pthread_attr_getschedparam_soloader(pthread_attr_t **attr,
-					const struct sched_param *param)
-{
-	return pthread_attr_getschedparam(*attr, param);
-}
-
-int pthread_attr_setstack_soloader(pthread_attr_t **attr,
-				   void *stackaddr,
-				   size_t stacksize)
-{
-	return pthread_attr_setstack(*attr, stackaddr, stacksize);
-}
-
-int pthread_setschedparam_soloader(const pthread_t *thread, int policy,
-				   const struct sched_param *param)
-{
-	return pthread_setschedparam(*thread, policy, param);
-}
-
-int pthread_getschedparam_soloader(const pthread_t *thread, int *policy,
-				   struct sched_param *param)
-{
-	return pthread_getschedparam(*thread, policy, param);
-}
-
-int pthread_detach_soloader(const pthread_t *thread)
-{
-	return pthread_detach(*thread);
-}
-
-int pthread_getattr_np_soloader(pthread_t* thread, pthread_attr_t *attr) {
-	fprintf(stderr, "[WARNING!] Not implemented: pthread_getattr_np\n");
-	return 0;
-}
-
-int pthread_equal_soloader(const pthread_t *t1, const pthread_t *t2)
-{
-	if (t1 == t2)
-		return 1;
-	if (!t1 || !t2)
-		return 0;
-	return pthread_equal(*t1, *t2);
-}
-
-#ifndef MAX_TASK_COMM_LEN
-#define MAX_TASK_COMM_LEN 16
-#endif
-
-int pthread_setname_np_soloader(const pthread_t *thread, const char* thread_name) {
-	if (thread == 0 || thread_name == NULL) {
-		return EINVAL;
-	}
-	size_t thread_name_len = strlen(thread_name);
-	if (thread_name_len >= MAX_TASK_COMM_LEN) {
-		return ERANGE;
-	}
-
-	// TODO: Implement the actual name setting if possible
-	fprintf(stderr, "PTHR: pthread_setname_np with name %s\n", thread_name);
-
-	return 0;
-}
-
 int clock_gettime_hook(int clk_id, struct timespec *t) {
 	struct timeval now;
 	int rv = gettimeofday(&now, NULL);
@@ -466,31 +192,120 @@ void throw_exc(char **str, void *a, int b) {
 	dlog("throwing %s\n", *str);
 }
 
-FILE *fopen_hook(char *fname, char *mode) {
-	FILE *f;
+static stream *fopen_real(char *fname, char *mode) {
+	stream *f;
 	char real_fname[256];
 	dlog("fopen(%s,%s)\n", fname, mode);
-	if (strncmp(fname, "ux0:", 4)) {
-		sprintf(real_fname, "ux0:data/valiant/%s", fname);
-		dlog("fopen(%s,%s) patched\n", real_fname, mode);
-		f = fopen(real_fname, mode);
-	} else {
-		f = fopen(fname, mode);
+	fname = (char *)vfs_path(fname, real_fname);
+	if (wb_handles(fname) && (strpbrk(mode, "wa+") || wb_lookup(fname) != WB_UNKNOWN))
+		return wb_fopen(fname, mode);
+	if (strpbrk(mode, "wa+")) {
+		vfs_invalidate(fname);
+		file_cache_invalidate(fname);
+		dir_cache_invalidate(fname);
+		f = stream_open(fname, mode, STREAM_BUFFER_SIZE);
+		if (f)
+			fs_index_write_begin((uintptr_t)f, fname);
+		return f;
 	}
+	return vfs_open(fname, STREAM_BUFFER_SIZE);
+}
+
+stream *fopen_hook(char *fname, char *mode) {
+	uint64_t start = trace_begin();
+	stream *f = fopen_real(fname, mode);
+	trace_record(TRACE_OPEN, trace_path(fname), (uintptr_t)f, 0, f ? stream_size(f) : 0, !f, start);
 	return f;
 }
 
-int open_hook(const char *fname, int flags, mode_t mode) {
+int fclose_hook(void *f) {
+	stream *s = stream_from_file(f);
+	if (!s)
+		return 0;
+	uint64_t start = trace_begin();
+	int res = stream_close(s);
+	fs_index_write_end((uintptr_t)s);
+	trace_record(TRACE_CLOSE, 0, (uintptr_t)s, TRACE_NO_OFFSET, 0, res < 0, start);
+	return res;
+}
+
+// bionic values, the newlib ones differ
+#define BIONIC_O_CREAT 00100
+#define BIONIC_O_TRUNC 01000
+#define BIONIC_O_APPEND 02000
+
+// Descriptors of the save directory are backed by write-behind streams, like its FILEs
+static int wb_open_fd(const char *fname, int flags) {
+	struct stat st;
+	int rw = (flags & O_RDWR) != 0;
+	int exists = vfs_stat(fname, &st) == 0;
+	const char *mode;
+	if (!(flags & (O_WRONLY | O_RDWR)))
+		mode = "r";
+	else if (!exists && !(flags & BIONIC_O_CREAT))
+		mode = NULL;
+	else if (flags & BIONIC_O_TRUNC)
+		mode = rw ? "w+" : "w";
+	else if (flags & BIONIC_O_APPEND)
+		mode = rw ? "a+" : "a";
+	else
+		mode = exists ? "r+" : (rw ? "w+" : "w");
+	if (!mode) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	stream *s = wb_fopen(fname, mode);
+	if (!s)
+		return -1;
+	int fd = fileno_hook(s);
+	if (fd < 0) {
+		stream_abort(s);
+		errno = EMFILE;
+	}
+	return fd;
+}
+
+static int open_real(const char *fname, int flags, mode_t mode) {
 	int f;
 	char real_fname[256];
 	dlog("open(%s)\n", fname);
-	if (strncmp(fname, "ux0:", 4)) {
-		sprintf(real_fname, "ux0:data/valiant/%s", fname);
-		f = open(real_fname, flags, mode);
+	fname = vfs_path(fname, real_fname);
+	if (wb_handles(fname) && ((flags & (O_WRONLY | O_RDWR)) || wb_lookup(fname) != WB_UNKNOWN))
+		return wb_open_fd(fname, flags);
+	if (!(flags & (O_WRONLY | O_RDWR)))
+		return vfs_open_fd(fname);
+	vfs_invalidate(fname);
+	file_cache_invalidate(fname);
+	dir_cache_invalidate(fname);
+	f = open(fname, flags, mode);
+	if (f >= 0)
+		fs_index_write_begin((uintptr_t)f, fname);
+	return f;
+}
+
+int open_hook(const char *fname, int flags, mode_t mode) {
+	uint64_t start = trace_begin();
+	int fd = open_real(fname, flags, mode);
+	trace_record(TRACE_OPEN, trace_path(fname), fd, 0, 0, fd < 0, start);
+	return fd;
+}
+
+int close_hook(int fd) {
+	uint64_t start = trace_begin();
+	int res;
+	stream *s;
+	if (ra_from_fd(fd)) {
+		res = ra_close_fd(fd);
+	} else if ((s = stream_from_fd(fd))) {
+		// Opened by the virtual filesystem out of an archive or the overlay
+		res = stream_close(s);
 	} else {
-		f = open(fname, flags, mode);
+		res = close(fd);
+		fs_index_write_end((uintptr_t)fd);
 	}
-	return f;
+	trace_record(TRACE_CLOSE, 0, fd, TRACE_NO_OFFSET, 0, res < 0, start);
+	return res;
 }
 
 extern void *__aeabi_atexit;
@@ -536,38 +351,43 @@ typedef struct __attribute__((__packed__)) stat64_bionic {
 	unsigned long long __pad4;
 } stat64_bionic;
 
+static int stat_real(const char *fname, struct stat *st) {
+	uint64_t start = trace_begin();
+	int res = vfs_stat(fname, st);
+	trace_record(TRACE_STAT, trace_path(fname), 0, TRACE_NO_OFFSET, res == 0 ? st->st_size : 0, res != 0, start);
+	return res;
+}
+
+static void stat_to_bionic(const struct stat *st, stat64_bionic *statbuf) {
+	statbuf->st_dev = st->st_dev;
+	statbuf->st_ino = st->st_ino;
+	statbuf->st_mode = st->st_mode;
+	statbuf->st_nlink = st->st_nlink;
+	statbuf->st_uid = st->st_uid;
+	statbuf->st_gid = st->st_gid;
+	statbuf->st_rdev = st->st_rdev;
+	statbuf->st_size = st->st_size;
+	statbuf->st_blksize = st->st_blksize;
+	statbuf->st_blocks = st->st_blocks;
+	statbuf->st_atime = st->st_atime;
+	statbuf->st_atime_nsec = 0;
+	statbuf->st_mtime = st->st_mtime;
+	statbuf->st_mtime_nsec = 0;
+	statbuf->st_ctime = st->st_ctime;
+	statbuf->st_ctime_nsec = 0;
+}
+
 int lstat_hook(const char *pathname, stat64_bionic *statbuf) {
 	dlog("lstat(%s)\n", pathname);
 	int res;
 	struct stat st;
-	if (strncmp(pathname, "ux0:", 4)) {
-		char fname[256];
-		sprintf(fname, "ux0:data/valiant/%s", pathname);
-		dlog("lstat(%s) fixed\n", fname);
-		res = stat(fname, &st);
-	} else {
-		res = stat(pathname, &st);
-	}
+	char fname[256];
+	res = stat_real(vfs_path(pathname, fname), &st);
 	if (res == 0) {
 		if (!statbuf) {
 			statbuf = malloc(sizeof(stat64_bionic));
 		}
-		statbuf->st_dev = st.st_dev;
-		statbuf->st_ino = st.st_ino;
-		statbuf->st_mode = st.st_mode;
-		statbuf->st_nlink = st.st_nlink;
-		statbuf->st_uid = st.st_uid;
-		statbuf->st_gid = st.st_gid;
-		statbuf->st_rdev = st.st_rdev;
-		statbuf->st_size = st.st_size;
-		statbuf->st_blksize = st.st_blksize;
-		statbuf->st_blocks = st.st_blocks;
-		statbuf->st_atime = st.st_atime;
-		statbuf->st_atime_nsec = 0;
-		statbuf->st_mtime = st.st_mtime;
-		statbuf->st_mtime_nsec = 0;
-		statbuf->st_ctime = st.st_ctime;
-		statbuf->st_ctime_nsec = 0;
+		stat_to_bionic(&st, statbuf);
 	}
 	return res;
 }
@@ -576,48 +396,28 @@ int stat_hook(const char *pathname, stat64_bionic *statbuf) {
 	dlog("stat(%s)\n", pathname);
 	int res;
 	struct stat st;
-	if (strncmp(pathname, "ux0:", 4)) {
-		char fname[256];
-		sprintf(fname, "ux0:data/valiant/%s", pathname);
-		dlog("stat(%s) fixed\n", fname);
-		res = stat(fname, &st);
-	} else {
-		res = stat(pathname, &st);
-	}
+	char fname[256];
+	res = stat_real(vfs_path(pathname, fname), &st);
 	if (res == 0) {
 		if (!statbuf) {
 			statbuf = malloc(sizeof(stat64_bionic));
 		}
-		statbuf->st_dev = st.st_dev;
-		statbuf->st_ino = st.st_ino;
-		statbuf->st_mode = st.st_mode;
-		statbuf->st_nlink = st.st_nlink;
-		statbuf->st_uid = st.st_uid;
-		statbuf->st_gid = st.st_gid;
-		statbuf->st_rdev = st.st_rdev;
-		statbuf->st_size = st.st_size;
-		statbuf->st_blksize = st.st_blksize;
-		statbuf->st_blocks = st.st_blocks;
-		statbuf->st_atime = st.st_atime;
-		statbuf->st_atime_nsec = 0;
-		statbuf->st_mtime = st.st_mtime;
-		statbuf->st_mtime_nsec = 0;
-		statbuf->st_ctime = st.st_ctime;
-		statbuf->st_ctime_nsec = 0;
+		stat_to_bionic(&st, statbuf);
 	}
 	return res;
 }
 
-void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset) {
-	return memalign(length, 0x1000);
-}
-
-int munmap(void *addr, size_t length) {
-	free(addr);
-	return 0;
-}
-
 int fstat_hook(int fd, void *statbuf) {
+	ra_file *ra = ra_from_fd(fd);
+	if (ra) {
+		*(uint64_t *)(statbuf + 0x30) = ra_size(ra);
+		return 0;
+	}
+	stream *s = stream_from_fd(fd);
+	if (s) {
+		*(uint64_t *)(statbuf + 0x30) = stream_size(s);
+		return 0;
+	}
 	struct stat st;
 	int res = fstat(fd, &st);
 	if (res == 0)
@@ -670,55 +470,43 @@ struct android_dirent {
 };
 
 typedef struct {
-	SceUID uid;
+	dir_listing *list;
+	int pos;
 	struct android_dirent dir;
 } android_DIR;
 
 int closedir_fake(android_DIR *dirp) {
-	if (!dirp || dirp->uid < 0) {
+	if (!dirp) {
 		errno = EBADF;
 		return -1;
 	}
 
-	int res = sceIoDclose(dirp->uid);
-	dirp->uid = -1;
-
+	dir_cache_release(dirp->list);
 	free(dirp);
 
-	if (res < 0) {
-		errno = res & SCE_ERRNO_MASK;
-		return -1;
-	}
-
 	errno = 0;
 	return 0;
 }
 
 android_DIR *opendir_fake(const char *dirname) {
 	dlog("opendir(%s)\n", dirname);
-	SceUID uid;
-	if (strncmp(dirname, "ux0:", 4)) {
-		char real_fname[256];
-		sprintf(real_fname, "ux0:data/valiant/%s", dirname);
-		uid = sceIoDopen(real_fname);
-	} else {
-		uid = sceIoDopen(dirname);
-	}
-	
-	if (uid < 0) {
-		errno = uid & SCE_ERRNO_MASK;
+	char real_fname[256];
+	dirname = vfs_path(dirname, real_fname);
+
+	// The disk, its pending saves and the archive all show up in one listing
+	dir_listing *list = vfs_list_dir(dirname);
+	if (!list)
 		return NULL;
-	}
 
 	android_DIR *dirp = calloc(1, sizeof(android_DIR));
 
 	if (!dirp) {
-		sceIoDclose(uid);
+		dir_cache_release(list);
 		errno = ENOMEM;
 		return NULL;
 	}
 
-	dirp->uid = uid;
+	dirp->list = list;
 
 	errno = 0;
 	return dirp;
@@ -730,21 +518,13 @@ struct android_dirent *readdir_fake(android_DIR *dirp) {
 		return NULL;
 	}
 
-	SceIoDirent sce_dir;
-	int res = sceIoDread(dirp->uid, &sce_dir);
-
-	if (res < 0) {
-		errno = res & SCE_ERRNO_MASK;
-		return NULL;
-	}
-
-	if (res == 0) {
-		errno = 0;
+	errno = 0;
+	if (dirp->pos >= dir_cache_count(dirp->list))
 		return NULL;
-	}
 
-	dirp->dir.d_type = SCE_S_ISDIR(sce_dir.d_stat.st_mode) ? DT_DIR : DT_REG;
-	strcpy(dirp->dir.d_name, sce_dir.d_name);
+	dirp->dir.d_type = dir_cache_is_dir(dirp->list, dirp->pos) ? DT_DIR : DT_REG;
+	strcpy(dirp->dir.d_name, dir_cache_name(dirp->list, dirp->pos));
+	dirp->pos++;
 	return &dirp->dir;
 }
 
@@ -752,10 +532,83 @@ size_t __strlen_chk(const char *s, size_t s_len) {
 	return strlen(s);
 }
 
-uint64_t lseek64(int fd, uint64_t offset, int whence) {
+static ssize_t read_real(int fd, void *buf, size_t count, uint64_t *offset) {
+	ra_file *ra = ra_from_fd(fd);
+	if (ra) {
+		*offset = ra_seek(ra, 0, SEEK_CUR);
+		return ra_read(ra, buf, count);
+	}
+	stream *s = stream_from_fd(fd);
+	if (s) {
+		*offset = stream_tell(s);
+		return stream_read(s, buf, count);
+	}
+	*offset = TRACE_NO_OFFSET;
+	return read(fd, buf, count);
+}
+
+ssize_t read_hook(int fd, void *buf, size_t count) {
+	uint64_t start = trace_begin();
+	uint64_t offset;
+	ssize_t res = read_real(fd, buf, count, &offset);
+	trace_record(TRACE_READ, 0, fd, offset, count, res < 0, start);
+	return res;
+}
+
+static int64_t lseek_real(int fd, int64_t offset, int whence) {
+	ra_file *ra = ra_from_fd(fd);
+	if (ra)
+		return ra_seek(ra, offset, whence);
+	stream *s = stream_from_fd(fd);
+	if (s)
+		return stream_seek(s, offset, whence) < 0 ? -1 : stream_tell(s);
 	return lseek(fd, offset, whence);
 }
 
+off_t lseek_hook(int fd, off_t offset, int whence) {
+	uint64_t start = trace_begin();
+	off_t res = lseek_real(fd, offset, whence);
+	trace_record(TRACE_SEEK, 0, fd, offset, whence, res < 0, start);
+	return res;
+}
+
+ssize_t write_hook(int fd, const void *buf, size_t count) {
+	stream *s = stream_from_fd(fd);
+	if (s) {
+		size_t res = stream_write(s, buf, count);
+		if (!res && count) {
+			errno = EIO;
+			return -1;
+		}
+		return res;
+	}
+	return write(fd, buf, count);
+}
+
+// Save files opened through wb_open_fd are stream fds, newlib knows nothing about them
+int ftruncate_hook(int fd, off_t length) {
+	stream *s = stream_from_fd(fd);
+	if (s) {
+		if (stream_truncate(s, length) < 0) {
+			errno = EINVAL;
+			return -1;
+		}
+		return 0;
+	}
+	if (ra_from_fd(fd)) {
+		errno = EINVAL;
+		return -1;
+	}
+	return ftruncate(fd, length);
+}
+
+uint64_t lseek64(int fd, uint64_t offset, int whence) {
+	uint64_t start = trace_begin();
+	int64_t res = lseek_real(fd, offset, whence);
+	trace_record(TRACE_SEEK, 0, fd, offset, whence, res < 0, start);
+	return res;
+}
+
 void __assert2(const char *file, int line, const char *func, const char *expr) {
 	dlog("assertion failed:\n%s:%d (%s): %s\n", file, line, func, expr);
 	sceKernelExitProcess(0);
@@ -777,129 +630,125 @@ extern void *__aeabi_d2ulz;
 
 uint32_t fake_stdout;
 
+static int access_real(const char *pathname, int mode) {
+	char real_fname[256];
+	pathname = vfs_path(pathname, real_fname);
+	
+	// There are no permissions on Vita, so existence is all that matters
+	struct stat st;
+	return vfs_stat(pathname, &st);
+}
+
 int access_hook(const char *pathname, int mode) {
 	dlog("access(%s)\n", pathname);
-	if (strncmp(pathname, "ux0:", 4)) {
-		char real_fname[256];
-		sprintf(real_fname, "ux0:data/valiant/%s", pathname);
-		return access(real_fname, mode);
-	}
-	
-	return access(pathname, mode);
+	uint64_t start = trace_begin();
+	int res = access_real(pathname, mode);
+	trace_record(TRACE_STAT, trace_path(pathname), 0, TRACE_NO_OFFSET, 0, res != 0, start);
+	return res;
 }
 
 int mkdir_hook(const char *pathname, int mode) {
 	dlog("mkdir(%s)\n", pathname);
-	if (strncmp(pathname, "ux0:", 4)) {
-		char real_fname[256];
-		sprintf(real_fname, "ux0:data/valiant/%s", pathname);
-		return mkdir(real_fname, mode);
-	}
+	char real_fname[256];
+	pathname = vfs_path(pathname, real_fname);
 	
-	return mkdir(pathname, mode);
-}
-
-FILE *AAssetManager_open(void *mgr, const char *fname, int mode) {
-	char full_fname[256];
-	sprintf(full_fname, "ux0:data/valiant/%s", fname);
-	dlog("AAssetManager_open %s\n", full_fname);
-	return fopen(full_fname, "rb");
-}
-
-int AAsset_close(FILE *f) {
-	return fclose(f);
-}
-
-size_t AAsset_getLength(FILE *f) {
-	size_t p = ftell(f);
-	fseek(f, 0, SEEK_END);
-	size_t res = ftell(f);
-	fseek(f, p, SEEK_SET);
+	// The disk may not match what the game sees yet, so it has to go through the queue
+	if (wb_handles(pathname) && wb_pending(pathname))
+		return wb_mkdir(pathname);
+	int res = mkdir(pathname, mode);
+	if (res == 0) {
+		fs_index_add_dir(pathname);
+		dir_cache_invalidate(pathname);
+	}
 	return res;
 }
 
-size_t AAsset_read(FILE *f, void *buf, size_t count) {
-	return fread(buf, 1, count, f);
-}
-
-size_t AAsset_seek(FILE *f, size_t offs, int whence) {
-	fseek(f, offs, whence);
-	return ftell(f);
-}
-
 int rmdir_hook(const char *pathname) {
 	dlog("rmdir(%s)\n", pathname);
-	SceUID uid;
-	if (strncmp(pathname, "ux0:", 4)) {
-		char real_fname[256];
-		sprintf(real_fname, "ux0:data/valiant/%s", pathname);
-		return rmdir(real_fname);
-	}
+	char real_fname[256];
+	pathname = vfs_path(pathname, real_fname);
 	
-	return rmdir(pathname);
+	if (wb_handles(pathname))
+		return wb_rmdir(pathname);
+	int res = rmdir(pathname);
+	if (res == 0) {
+		fs_index_remove(pathname);
+		dir_cache_invalidate(pathname);
+	}
+	return res;
 }
 
 int unlink_hook(const char *pathname) {
 	dlog("unlink(%s)\n", pathname);
-	SceUID uid;
-	if (strncmp(pathname, "ux0:", 4)) {
-		char real_fname[256];
-		sprintf(real_fname, "ux0:data/valiant/%s", pathname);
-		return sceIoRemove(real_fname);
-	}
+	char real_fname[256];
+	pathname = vfs_path(pathname, real_fname);
 	
-	return sceIoRemove(pathname);
+	if (wb_handles(pathname))
+		return wb_remove(pathname);
+
+	vfs_invalidate(pathname);
+	int res = sceIoRemove(pathname);
+	if (res >= 0) {
+		fs_index_remove(pathname);
+		file_cache_invalidate(pathname);
+		dir_cache_invalidate(pathname);
+	}
+	return res;
 }
 
 int remove_hook(const char *pathname) {
 	dlog("unlink(%s)\n", pathname);
-	SceUID uid;
-	if (strncmp(pathname, "ux0:", 4)) {
-		char real_fname[256];
-		sprintf(real_fname, "ux0:data/valiant/%s", pathname);
-		return sceIoRemove(real_fname);
-	}
+	char real_fname[256];
+	pathname = vfs_path(pathname, real_fname);
 	
-	return sceIoRemove(pathname);
+	if (wb_handles(pathname))
+		return wb_remove(pathname);
+
+	vfs_invalidate(pathname);
+	int res = sceIoRemove(pathname);
+	if (res >= 0) {
+		fs_index_remove(pathname);
+		file_cache_invalidate(pathname);
+		dir_cache_invalidate(pathname);
+	}
+	return res;
 }
 
-DIR *AAssetManager_openDir(void *mgr, const char *fname) {
+android_DIR *AAssetManager_openDir(void *mgr, const char *fname) {
 	dlog("AAssetManager_opendir(%s)\n", fname);
-	if (strncmp(fname, "ux0:", 4)) {
-		char real_fname[256];
-		sprintf(real_fname, "ux0:data/valiant/%s", fname);
-		return opendir(real_fname);
-	}
-	
-	return opendir(fname);	
+	return opendir_fake(fname);
 }
 
-const char *AAssetDir_getNextFileName(DIR *assetDir) {
-	struct dirent *ent;
-	if (ent = readdir(assetDir)) {
-		return ent->d_name;
-	}
-	return NULL;
+const char *AAssetDir_getNextFileName(android_DIR *assetDir) {
+	if (assetDir->pos >= dir_cache_count(assetDir->list))
+		return NULL;
+	return dir_cache_name(assetDir->list, assetDir->pos++);
 }
 
-void AAssetDir_close(DIR *assetDir) {
-	closedir(assetDir);
+void AAssetDir_close(android_DIR *assetDir) {
+	closedir_fake(assetDir);
 }
 
 int rename_hook(const char *old_filename, const char *new_filename) {
 	dlog("rename %s -> %s\n", old_filename, new_filename);
 	char real_old[256], real_new[256];
-	if (strncmp(old_filename, "ux0:", 4)) {
-		sprintf(real_old, "ux0:data/valiant/%s", old_filename);
-	} else {
-		strcpy(real_old, old_filename);
-	}
-	if (strncmp(new_filename, "ux0:", 4)) {
-		sprintf(real_new, "ux0:data/valiant/%s", new_filename);
-	} else {
-		strcpy(real_new, new_filename);
+	vfs_path(old_filename, real_old);
+	vfs_path(new_filename, real_new);
+	// Crossing into or out of the save directory goes through the queue as well, the
+	// side outside of it stays handled until the rename lands
+	if (wb_handles(real_old) || wb_handles(real_new))
+		return wb_rename(real_old, real_new);
+	vfs_invalidate(real_old);
+	vfs_invalidate(real_new);
+	int res = sceIoRename(real_old, real_new);
+	if (res >= 0) {
+		fs_index_rename(real_old, real_new);
+		file_cache_invalidate(real_old);
+		file_cache_invalidate(real_new);
+		dir_cache_invalidate(real_old);
+		dir_cache_invalidate(real_new);
 	}
-	return sceIoRename(real_old, real_new);
+	return res;
 }
 
 int nanosleep_hook(const struct timespec *req, struct timespec *rem) {
@@ -907,68 +756,6 @@ int nanosleep_hook(const struct timespec *req, struct timespec *rem) {
 	return sceKernelDelayThreadCB(usec);
 }
 
-int sem_destroy_soloader(int * uid) {
-    if (sceKernelDeleteSema(*uid) < 0)
-        return -1;
-    return 0;
-}
-
-int sem_getvalue_soloader (int * uid, int * sval) {
-    SceKernelSemaInfo info;
-    info.size = sizeof(SceKernelSemaInfo);
-
-    if (sceKernelGetSemaInfo(*uid, &info) < 0) return -1;
-    if (!sval) sval = malloc(sizeof(int32_t));
-    *sval = info.currentCount;
-    return 0;
-}
-
-int sem_init_soloader (int * uid, int pshared, unsigned int value) {
-    *uid = sceKernelCreateSema("sema", 0, (int) value, 0x7fffffff, NULL);
-    if (*uid < 0)
-        return -1;
-    return 0;
-}
-
-int sem_post_soloader (int * uid) {
-    if (sceKernelSignalSema(*uid, 1) < 0)
-        return -1;
-    return 0;
-}
-
-uint64_t current_timestamp_ms() {
-    struct timeval te;
-    gettimeofday(&te, NULL);
-    return (te.tv_sec*1000LL + te.tv_usec/1000);
-}
-
-int sem_timedwait_soloader (int * uid, const struct timespec * abstime) {
-    uint timeout = 1000;
-    if (sceKernelWaitSema(*uid, 1, &timeout) >= 0)
-        return 0;
-    if (!abstime) return -1;
-    long long now = (long long) current_timestamp_ms() * 1000; // us
-    long long _timeout = abstime->tv_sec * 1000 * 1000 + abstime->tv_nsec / 1000; // us
-    if (_timeout-now >= 0) return -1;
-    uint timeout_real = _timeout - now;
-    if (sceKernelWaitSema(*uid, 1, &timeout_real) < 0)
-        return -1;
-    return 0;
-}
-
-int sem_trywait_soloader (int * uid) {
-    uint timeout = 1000;
-    if (sceKernelWaitSema(*uid, 1, &timeout) < 0)
-        return -1;
-    return 0;
-}
-
-int sem_wait_soloader (int * uid) {
-    if (sceKernelWaitSema(*uid, 1, NULL) < 0)
-        return -1;
-    return 0;
-}
-
 extern void *__aeabi_memset8;
 extern void *__aeabi_memset4;
 extern void *__aeabi_memset;
@@ -981,7 +768,7 @@ extern void *__aeabi_memclr4;
 extern void *__aeabi_memclr8;
 
 static so_default_dynlib default_dynlib[] = {
-	{ "ftruncate", (uintptr_t)&ftruncate },
+	{ "ftruncate", (uintptr_t)&ftruncate_hook },
 	{ "pthread_setname_np", (uintptr_t)&ret0 },
 	{ "memrchr", (uintptr_t)&memrchr },
 	{ "strtok_r", (uintptr_t)&strtok_r },
@@ -990,7 +777,7 @@ static so_default_dynlib default_dynlib[] = {
 	{ "glFramebufferRenderbuffer", (uintptr_t)&ret0 },
 	{ "glDeleteRenderbuffers", (uintptr_t)&ret0 },
 	{ "glBindRenderbuffer", (uintptr_t)&ret0 },
-	{ "fsetpos", (uintptr_t)&fsetpos },
+	{ "fsetpos", (uintptr_t)&fsetpos_hook },
 	{ "sem_destroy", (uintptr_t)&sem_destroy_soloader },
 	{ "sem_getvalue", (uintptr_t)&sem_getvalue_soloader },
 	{ "sem_init", (uintptr_t)&sem_init_soloader },
@@ -1078,6 +865,14 @@ static so_default_dynlib default_dynlib[] = {
 	{ "AAsset_read", (uintptr_t)&AAsset_read},
 	{ "AAsset_seek", (uintptr_t)&AAsset_seek},
 	{ "AAsset_getLength", (uintptr_t)&AAsset_getLength},
+	{ "AAsset_getLength64", (uintptr_t)&AAsset_getLength64},
+	{ "AAsset_getRemainingLength", (uintptr_t)&AAsset_getRemainingLength},
+	{ "AAsset_getRemainingLength64", (uintptr_t)&AAsset_getRemainingLength64},
+	{ "AAsset_seek64", (uintptr_t)&AAsset_seek64},
+	{ "AAsset_getBuffer", (uintptr_t)&AAsset_getBuffer},
+	{ "AAsset_isAllocated", (uintptr_t)&AAsset_isAllocated},
+	{ "AAsset_openFileDescriptor", (uintptr_t)&AAsset_openFileDescriptor},
+	{ "AAsset_openFileDescriptor64", (uintptr_t)&AAsset_openFileDescriptor64},
 	{ "stdout", (uintptr_t)&fake_stdout },
 	{ "stdin", (uintptr_t)&fake_stdout },
 	{ "stderr", (uintptr_t)&fake_stdout },
@@ -1170,14 +965,14 @@ static so_default_dynlib default_dynlib[] = {
 	{ "bsd_signal", (uintptr_t)&ret0 },
 	{ "bsearch", (uintptr_t)&bsearch },
 	{ "btowc", (uintptr_t)&btowc },
-	{ "calloc", (uintptr_t)&calloc },
+	{ "calloc", (uintptr_t)&slab_calloc },
 	{ "ceil", (uintptr_t)&ceil },
 	{ "ceilf", (uintptr_t)&ceilf },
 	{ "chdir", (uintptr_t)&chdir_hook },
-	{ "clearerr", (uintptr_t)&clearerr },
+	{ "clearerr", (uintptr_t)&clearerr_hook },
 	{ "clock", (uintptr_t)&clock },
 	{ "clock_gettime", (uintptr_t)&clock_gettime_hook },
-	{ "close", (uintptr_t)&close },
+	{ "close", (uintptr_t)&close_hook },
 	{ "cos", (uintptr_t)&cos },
 	{ "cosf", (uintptr_t)&cosf },
 	{ "cosh", (uintptr_t)&cosh },
@@ -1194,50 +989,50 @@ static so_default_dynlib default_dynlib[] = {
 	{ "exp2", (uintptr_t)&exp2 },
 	{ "expf", (uintptr_t)&expf },
 	{ "fabsf", (uintptr_t)&fabsf },
-	{ "fclose", (uintptr_t)&fclose },
+	{ "fclose", (uintptr_t)&fclose_hook },
 	{ "fcntl", (uintptr_t)&ret0 },
 	{ "mktime", (uintptr_t)&mktime },
 	// { "fdopen", (uintptr_t)&fdopen },
-	{ "feof", (uintptr_t)&feof },
-	{ "ferror", (uintptr_t)&ferror },
-	{ "fflush", (uintptr_t)&ret0 },
-	{ "fgets", (uintptr_t)&fgets },
+	{ "feof", (uintptr_t)&feof_hook },
+	{ "ferror", (uintptr_t)&ferror_hook },
+	{ "fflush", (uintptr_t)&fflush_hook },
+	{ "fgets", (uintptr_t)&fgets_hook },
 	{ "floor", (uintptr_t)&floor },
-	{ "fileno", (uintptr_t)&fileno },
+	{ "fileno", (uintptr_t)&fileno_hook },
 	{ "floorf", (uintptr_t)&floorf },
 	{ "fmod", (uintptr_t)&fmod },
 	{ "fmodf", (uintptr_t)&fmodf },
 	{ "fopen", (uintptr_t)&fopen_hook },
 	{ "open", (uintptr_t)&open_hook },
-	{ "fprintf", (uintptr_t)&fprintf },
-	{ "fputc", (uintptr_t)&ret0 },
+	{ "fprintf", (uintptr_t)&fprintf_hook },
+	{ "fputc", (uintptr_t)&putc_hook },
 	// { "fputwc", (uintptr_t)&fputwc },
-	{ "fputs", (uintptr_t)&ret0 },
-	{ "fread", (uintptr_t)&fread },
-	{ "free", (uintptr_t)&free },
+	{ "fputs", (uintptr_t)&fputs_hook },
+	{ "fread", (uintptr_t)&fread_hook },
+	{ "free", (uintptr_t)&slab_free },
 	{ "frexp", (uintptr_t)&frexp },
 	{ "frexpf", (uintptr_t)&frexpf },
-	{ "fscanf", (uintptr_t)&fscanf },
-	{ "fseek", (uintptr_t)&fseek },
-	{ "fseeko", (uintptr_t)&fseeko },
+	{ "fscanf", (uintptr_t)&fscanf_hook },
+	{ "fseek", (uintptr_t)&fseek_hook },
+	{ "fseeko", (uintptr_t)&fseek_hook },
 	{ "fstat", (uintptr_t)&fstat_hook },
-	{ "ftell", (uintptr_t)&ftell },
-	{ "ftello", (uintptr_t)&ftello },
+	{ "ftell", (uintptr_t)&ftell_hook },
+	{ "ftello", (uintptr_t)&ftell_hook },
 	// { "ftruncate", (uintptr_t)&ftruncate },
-	{ "fwrite", (uintptr_t)&fwrite },
-	{ "getc", (uintptr_t)&getc },
+	{ "fwrite", (uintptr_t)&fwrite_hook },
+	{ "getc", (uintptr_t)&getc_hook },
 	{ "gettid", (uintptr_t)&ret0 },
 	{ "getpid", (uintptr_t)&ret0 },
 	{ "getcwd", (uintptr_t)&getcwd_hook },
 	{ "getenv", (uintptr_t)&ret0 },
-	{ "getwc", (uintptr_t)&getwc },
+	{ "getwc", (uintptr_t)&getwc_hook },
 	{ "gettimeofday", (uintptr_t)&gettimeofday },
 	{ "gzopen", (uintptr_t)&gzopen },
-	{ "inflate", (uintptr_t)&inflate },
-	{ "inflateEnd", (uintptr_t)&inflateEnd },
-	{ "inflateInit_", (uintptr_t)&inflateInit_ },
-	{ "inflateInit2_", (uintptr_t)&inflateInit2_ },
-	{ "inflateReset", (uintptr_t)&inflateReset },
+	{ "inflate", (uintptr_t)&inflate_hook },
+	{ "inflateEnd", (uintptr_t)&inflateEnd_hook },
+	{ "inflateInit_", (uintptr_t)&inflateInit_hook },
+	{ "inflateInit2_", (uintptr_t)&inflateInit2_hook },
+	{ "inflateReset", (uintptr_t)&inflateReset_hook },
 	{ "isascii", (uintptr_t)&isascii },
 	{ "isalnum", (uintptr_t)&isalnum },
 	{ "isalpha", (uintptr_t)&isalpha },
@@ -1273,19 +1068,19 @@ static so_default_dynlib default_dynlib[] = {
 	{ "lrand48", (uintptr_t)&lrand48 },
 	{ "lrint", (uintptr_t)&lrint },
 	{ "lrintf", (uintptr_t)&lrintf },
-	{ "lseek", (uintptr_t)&lseek },
+	{ "lseek", (uintptr_t)&lseek_hook },
 	{ "lseek64", (uintptr_t)&lseek64 },
-	{ "malloc", (uintptr_t)&malloc },
+	{ "malloc", (uintptr_t)&slab_malloc },
 	{ "mbrtowc", (uintptr_t)&mbrtowc },
-	{ "memalign", (uintptr_t)&memalign },
+	{ "memalign", (uintptr_t)&slab_memalign },
 	{ "memchr", (uintptr_t)&sceClibMemchr },
 	{ "memcmp", (uintptr_t)&memcmp },
 	{ "memcpy", (uintptr_t)&sceClibMemcpy },
 	{ "memmove", (uintptr_t)&memmove },
 	{ "memset", (uintptr_t)&sceClibMemset },
 	{ "mkdir", (uintptr_t)&mkdir_hook },
-	// { "mmap", (uintptr_t)&mmap},
-	// { "munmap", (uintptr_t)&munmap},
+	{ "mmap", (uintptr_t)&mmap_hook },
+	{ "munmap", (uintptr_t)&munmap_hook },
 	{ "modf", (uintptr_t)&modf },
 	{ "modff", (uintptr_t)&modff },
 	// { "poll", (uintptr_t)&poll },
@@ -1335,14 +1130,14 @@ static so_default_dynlib default_dynlib[] = {
 	{ "pthread_setspecific", (uintptr_t)&pthread_setspecific },
 	{ "sched_get_priority_min", (uintptr_t)&ret0 },
 	{ "sched_get_priority_max", (uintptr_t)&ret99 },
-	{ "putc", (uintptr_t)&putc },
+	{ "putc", (uintptr_t)&putc_hook },
 	{ "puts", (uintptr_t)&puts },
-	{ "putwc", (uintptr_t)&putwc },
+	{ "putwc", (uintptr_t)&putwc_hook },
 	{ "qsort", (uintptr_t)&qsort },
 	{ "rand", (uintptr_t)&rand },
-	{ "read", (uintptr_t)&read },
+	{ "read", (uintptr_t)&read_hook },
 	{ "realpath", (uintptr_t)&realpath },
-	{ "realloc", (uintptr_t)&realloc },
+	{ "realloc", (uintptr_t)&slab_realloc },
 	// { "recv", (uintptr_t)&recv },
 	{ "roundf", (uintptr_t)&roundf },
 	{ "rint", (uintptr_t)&rint },
@@ -1353,7 +1148,7 @@ static so_default_dynlib default_dynlib[] = {
 	{ "setjmp", (uintptr_t)&setjmp },
 	{ "setlocale", (uintptr_t)&ret0 },
 	// { "setsockopt", (uintptr_t)&setsockopt },
-	{ "setvbuf", (uintptr_t)&setvbuf },
+	{ "setvbuf", (uintptr_t)&setvbuf_hook },
 	{ "sin", (uintptr_t)&sin },
 	{ "sinf", (uintptr_t)&sinf },
 	{ "sinh", (uintptr_t)&sinh },
@@ -1405,11 +1200,11 @@ static so_default_dynlib default_dynlib[] = {
 	{ "toupper", (uintptr_t)&toupper },
 	{ "towlower", (uintptr_t)&towlower },
 	{ "towupper", (uintptr_t)&towupper },
-	{ "ungetc", (uintptr_t)&ungetc },
-	{ "ungetwc", (uintptr_t)&ungetwc },
+	{ "ungetc", (uintptr_t)&ungetc_hook },
+	{ "ungetwc", (uintptr_t)&ungetwc_hook },
 	{ "usleep", (uintptr_t)&usleep },
 	{ "vasprintf", (uintptr_t)&vasprintf },
-	{ "vfprintf", (uintptr_t)&vfprintf },
+	{ "vfprintf", (uintptr_t)&vfprintf_hook },
 	{ "vprintf", (uintptr_t)&vprintf },
 	{ "vsnprintf", (uintptr_t)&vsnprintf },
 	{ "vsscanf", (uintptr_t)&vsscanf },
@@ -1429,7 +1224,7 @@ static so_default_dynlib default_dynlib[] = {
 	{ "wmemcpy", (uintptr_t)&wmemcpy },
 	{ "wmemmove", (uintptr_t)&wmemmove },
 	{ "wmemset", (uintptr_t)&wmemset },
-	{ "write", (uintptr_t)&write },
+	{ "write", (uintptr_t)&write_hook },
 	{ "sigaction", (uintptr_t)&ret0 },
 	{ "zlibVersion", (uintptr_t)&zlibVersion },
 	// { "writev", (uintptr_t)&writev },
@@ -1437,14 +1232,14 @@ static so_default_dynlib default_dynlib[] = {
 	{ "Android_JNI_GetEnv", (uintptr_t)&Android_JNI_GetEnv },
 	{ "nanosleep", (uintptr_t)&nanosleep_hook }, // FIXME
 	{ "raise", (uintptr_t)&raise },
-	{ "posix_memalign", (uintptr_t)&posix_memalign },
+	{ "posix_memalign", (uintptr_t)&slab_posix_memalign },
 	{ "swprintf", (uintptr_t)&swprintf },
 	{ "wcscpy", (uintptr_t)&wcscpy },
 	{ "wcscat", (uintptr_t)&wcscat },
 	{ "wcstombs", (uintptr_t)&wcstombs },
 	{ "wcsstr", (uintptr_t)&wcsstr },
 	{ "compress", (uintptr_t)&compress },
-	{ "uncompress", (uintptr_t)&uncompress },
+	{ "uncompress", (uintptr_t)&uncompress_hook },
 	{ "atof", (uintptr_t)&atof },
 	{ "trunc", (uintptr_t)&trunc },
 	{ "round", (uintptr_t)&round },
@@ -1717,26 +1512,219 @@ int GetArrayLength(void *env, void *array) {
 	}
 }*/
 
-/*so_hook new_hook;
-void *_new(void *this, int size) {
-	void *ret = SO_CONTINUE(void *, new_hook, this, size);
-	if (!ret) {
-		sceClibPrintf("new failed!!!!\n");
+static so_default_dynlib zip_hooks[] = {
+	{ "zip_open", (uintptr_t)&zip_open_hook },
+	{ "zip_close", (uintptr_t)&zip_close_hook },
+	{ "zip_discard", (uintptr_t)&zip_discard_hook },
+	{ "zip_get_num_entries", (uintptr_t)&zip_get_num_entries_hook },
+	{ "zip_get_num_files", (uintptr_t)&zip_get_num_files_hook },
+	{ "zip_get_name", (uintptr_t)&zip_get_name_hook },
+	{ "zip_name_locate", (uintptr_t)&zip_name_locate_hook },
+	{ "zip_stat", (uintptr_t)&zip_stat_hook },
+	{ "zip_stat_index", (uintptr_t)&zip_stat_index_hook },
+	{ "zip_fopen", (uintptr_t)&zip_fopen_hook },
+	{ "zip_fopen_index", (uintptr_t)&zip_fopen_index_hook },
+	{ "zip_fopen_encrypted", (uintptr_t)&zip_fopen_encrypted_hook },
+	{ "zip_fopen_index_encrypted", (uintptr_t)&zip_fopen_index_encrypted_hook },
+	{ "zip_fread", (uintptr_t)&zip_fread_hook },
+	{ "zip_fseek", (uintptr_t)&zip_fseek_hook },
+	{ "zip_ftell", (uintptr_t)&zip_ftell_hook },
+	{ "zip_fclose", (uintptr_t)&zip_fclose_hook },
+	{ "zip_strerror", (uintptr_t)&zip_strerror_hook },
+	{ "zip_file_strerror", (uintptr_t)&zip_file_strerror_hook },
+	{ "zip_error_get", (uintptr_t)&zip_error_get_hook },
+	{ "zip_error_clear", (uintptr_t)&zip_error_clear_hook },
+	{ "zip_get_error", (uintptr_t)&zip_get_error_hook },
+	{ "zip_file_error_get", (uintptr_t)&zip_file_error_get_hook },
+	{ "zip_file_error_clear", (uintptr_t)&zip_file_error_clear_hook },
+	{ "zip_file_get_error", (uintptr_t)&zip_file_get_error_hook },
+	{ "zip_get_archive_comment", (uintptr_t)&zip_get_archive_comment_hook },
+	{ "zip_get_file_comment", (uintptr_t)&zip_get_file_comment_hook },
+	{ "zip_file_get_comment", (uintptr_t)&zip_file_get_comment_hook },
+	{ "zip_set_default_password", (uintptr_t)&zip_set_default_password_hook },
+	{ "zip_get_archive_flag", (uintptr_t)&zip_get_archive_flag_hook },
+	{ "zip_file_extra_fields_count", (uintptr_t)&zip_file_extra_fields_count_hook },
+	{ "zip_file_extra_fields_count_by_id", (uintptr_t)&zip_file_extra_fields_count_hook },
+	{ "zip_file_extra_field_get", (uintptr_t)&zip_file_extra_field_get_hook },
+	{ "zip_file_extra_field_get_by_id", (uintptr_t)&zip_file_extra_field_get_hook },
+	{ "zip_file_get_external_attributes", (uintptr_t)&zip_file_get_external_attributes_hook },
+	{ "zip_unchange", (uintptr_t)&zip_unchange_hook },
+	{ "zip_unchange_all", (uintptr_t)&zip_unchange_hook },
+	{ "zip_unchange_archive", (uintptr_t)&zip_unchange_hook },
+	{ "zip_add", (uintptr_t)&zip_rdonly_hook },
+	{ "zip_add_dir", (uintptr_t)&zip_rdonly_hook },
+	{ "zip_dir_add", (uintptr_t)&zip_rdonly_hook },
+	{ "zip_file_add", (uintptr_t)&zip_rdonly_hook },
+	{ "zip_replace", (uintptr_t)&zip_rdonly_hook },
+	{ "zip_file_replace", (uintptr_t)&zip_rdonly_hook },
+	{ "zip_delete", (uintptr_t)&zip_rdonly_hook },
+	{ "zip_rename", (uintptr_t)&zip_rdonly_hook },
+	{ "zip_file_rename", (uintptr_t)&zip_rdonly_hook },
+	{ "zip_set_file_comment", (uintptr_t)&zip_rdonly_hook },
+	{ "zip_file_set_comment", (uintptr_t)&zip_rdonly_hook },
+	{ "zip_set_archive_comment", (uintptr_t)&zip_rdonly_hook },
+	{ "zip_set_archive_flag", (uintptr_t)&zip_rdonly_hook },
+	{ "zip_set_file_compression", (uintptr_t)&zip_rdonly_hook },
+	{ "zip_file_set_encryption", (uintptr_t)&zip_rdonly_hook },
+	{ "zip_file_set_external_attributes", (uintptr_t)&zip_rdonly_hook },
+	{ "zip_file_set_mtime", (uintptr_t)&zip_rdonly_hook },
+	{ "zip_file_extra_field_set", (uintptr_t)&zip_rdonly_hook },
+	{ "zip_file_extra_field_delete", (uintptr_t)&zip_rdonly_hook },
+	{ "zip_file_extra_field_delete_by_id", (uintptr_t)&zip_rdonly_hook },
+	{ "zip_source_buffer", (uintptr_t)&zip_source_hook },
+	{ "zip_source_file", (uintptr_t)&zip_source_hook },
+	{ "zip_source_filep", (uintptr_t)&zip_source_hook },
+	{ "zip_source_function", (uintptr_t)&zip_source_hook },
+	{ "zip_source_zip", (uintptr_t)&zip_source_hook },
+	{ "zip_fdopen", (uintptr_t)&zip_fdopen_hook },
+	{ "zip_open_from_source", (uintptr_t)&zip_open_from_source_hook },
+};
+
+// libzip helpers that never see a zip_t or zip_file_t, safe to run as they are
+static const char *zip_passthrough[] = {
+	"zip_error_init",
+	"zip_error_init_with_code",
+	"zip_error_fini",
+	"zip_error_set",
+	"zip_error_code_zip",
+	"zip_error_code_system",
+	"zip_error_system_type",
+	"zip_error_strerror",
+	"zip_error_to_str",
+	"zip_error_to_data",
+	"zip_stat_init",
+	"zip_libzip_version",
+	"zip_source_",
+};
+
+static int find_zip_hook(const char *name) {
+	for (int i = 0; i < sizeof(zip_hooks) / sizeof(*zip_hooks); i++) {
+		if (!strcmp(zip_hooks[i].symbol, name))
+			return 1;
 	}
-	return ret;
-}*/
+	return 0;
+}
+
+// Entries ending with an underscore match a whole family
+static int is_zip_passthrough(const char *name) {
+	for (int i = 0; i < sizeof(zip_passthrough) / sizeof(*zip_passthrough); i++) {
+		size_t len = strlen(zip_passthrough[i]);
+		if (zip_passthrough[i][len - 1] == '_' ? !strncmp(zip_passthrough[i], name, len) : !strcmp(zip_passthrough[i], name))
+			return 1;
+	}
+	return 0;
+}
 
 void patch_game(void) {
 	hook_addr(so_symbol(&main_mod, "OPENSSL_cpuid_setup"), (uintptr_t)&ret0);
 	hook_addr(so_symbol(&main_mod, "_ZN3ITF33W1W_PushLocalNotification_Manager9cancelAllEv"), (uintptr_t)&ret0);
 	
-	//new_hook = hook_addr((uintptr_t)so_symbol(&main_mod, "_ZnajN3ITF8MemoryId17ITF_ALLOCATOR_IDSE"), (uintptr_t)&_new);
-	//hook_addr((uintptr_t)so_symbol(&main_mod, "zip_fopen"), (uintptr_t)&ret0);
-	//hook_addr((uintptr_t)so_symbol(&main_mod, "zip_open"), (uintptr_t)&ret0);
+	// Give every engine subsystem its own heap, the matching deletes end up in free like the rest
+	if (so_symbol(&main_mod, "_ZnajN3ITF8MemoryId17ITF_ALLOCATOR_IDSE"))
+		hook_addr(so_symbol(&main_mod, "_ZnajN3ITF8MemoryId17ITF_ALLOCATOR_IDSE"), (uintptr_t)&slab_memid_alloc);
+	if (so_symbol(&main_mod, "_ZnwjN3ITF8MemoryId17ITF_ALLOCATOR_IDSE"))
+		hook_addr(so_symbol(&main_mod, "_ZnwjN3ITF8MemoryId17ITF_ALLOCATOR_IDSE"), (uintptr_t)&slab_memid_alloc);
+	
+	// Redirect libzip to our pre-indexed reader, only if it exposes the 64 bit API (libzip >= 0.10) we implement
+	if (so_symbol(&main_mod, "zip_get_num_entries")) {
+		for (int i = 0; i < sizeof(zip_hooks) / sizeof(*zip_hooks); i++)
+			hook_addr(so_symbol(&main_mod, zip_hooks[i].symbol), zip_hooks[i].func);
+
+		// Anything else handed one of our handles would run the real libzip on it, only the
+		// helpers working on objects owned by the game are left alone
+		for (int i = 0; i < main_mod.num_dynsym; i++) {
+			Elf32_Sym *sym = &main_mod.dynsym[i];
+			const char *name = main_mod.dynstr + sym->st_name;
+			if (sym->st_shndx == SHN_UNDEF || ELF32_ST_TYPE(sym->st_info) != STT_FUNC || strncmp(name, "zip_", 4))
+				continue;
+			if (find_zip_hook(name) || is_zip_passthrough(name))
+				continue;
+			sceClibPrintf("Stubbing unsupported libzip export %s\n", name);
+			hook_addr(main_mod.text_base + sym->st_value, (uintptr_t)&zip_unsupported_hook);
+		}
+	}
 }
 
 uint8_t is_lowend = 0;
 
+#ifdef ENABLE_IO_STATS
+void print_io_stats(void) {
+	static uint32_t frames = 0;
+	if (++frames % 300)
+		return;
+
+	file_cache_stats fc;
+	file_cache_get_stats(&fc);
+	sceClibPrintf("file_cache: %u hits, %u misses, %u bypasses, %u missing, %u evictions, %llu bytes served, %u/%u bytes used\n",
+		fc.hits, fc.misses, fc.bypasses, fc.missing, fc.evictions, fc.bytes_served, fc.used, fc.budget);
+
+	readahead_stats ra;
+	readahead_get_stats(&ra);
+	sceClibPrintf("readahead: %u reads, %u prefetch hits (%u%%), %u misses, %u prefetches, %llu ms stalled, %llu bytes\n",
+		ra.reads, ra.prefetch_hits, ra.reads ? ra.prefetch_hits * 100 / ra.reads : 0, ra.misses, ra.prefetches, ra.stall_us / 1000, ra.bytes);
+
+	prefetch_stats pf;
+	prefetch_get_stats(&pf);
+	sceClibPrintf("prefetch: %u profiled, %u warmed, %u skipped, %u diverged\n",
+		pf.profile_entries, pf.warmed, pf.skipped, pf.diverged);
+
+	decomp_stats dc;
+	decomp_get_stats(&dc);
+	sceClibPrintf("decomp: %u queued, %u merged, %u stolen, %u waits (%llu ms), %llu ms busy\n",
+		dc.queued, dc.merged, dc.stolen, dc.waits, dc.wait_us / 1000, dc.busy_us / 1000);
+
+	fd_pool_stats fp;
+	fd_pool_get_stats(&fp);
+	sceClibPrintf("fd_pool: %u opens, %u shared, %u closes, %d/%d handles\n",
+		fp.opens, fp.shared, fp.closes, fp.handles, fp.peak);
+
+	mmap_stats mm;
+	mmap_get_stats(&mm);
+	sceClibPrintf("mmap: %u anonymous, %u file backed (%u shared), %u/%u bytes anonymous/file\n",
+		mm.anon_maps, mm.file_maps, mm.shared_hits, mm.anon_bytes, mm.file_bytes);
+
+	static const char *class_names[IO_NUM_CLASSES] = { "audio", "interactive", "background" };
+	io_sched_stats io;
+	io_sched_get_stats(&io);
+	sceClibPrintf("io_sched: %u reads, %llu bytes\n", io.reads, io.bytes);
+	for (int i = 0; i < IO_NUM_CLASSES; i++) {
+		io_class_stats *c = &io.classes[i];
+		sceClibPrintf("  %s: %u requests, %u merged, depth %d/%d, latency p50 %u us, p95 %u us, p99 %u us\n",
+			class_names[i], c->requests, c->merged, c->depth, c->max_depth, c->p50_us, c->p95_us, c->p99_us);
+	}
+
+	static const char *level_names[] = { "ok", "warning", "critical" };
+	mem_monitor_stats ms;
+	mem_monitor_get_stats(&ms);
+	sceClibPrintf("mem: %s, heap %u KiB free (low %u KiB, largest ~%u KiB), gpu %u/%u KiB free (low %u KiB), %u trims%s\n",
+		level_names[ms.level], ms.heap_free / 1024, ms.heap_low / 1024, ms.heap_largest / 1024,
+		ms.gpu_free / 1024, ms.gpu_total / 1024, ms.gpu_low / 1024, ms.trims,
+		ms.downgraded ? ", lowend on next launch" : (ms.restored ? ", normal mode on next launch" : ""));
+
+	slab_stats sl;
+	slab_get_stats(&sl);
+	sceClibPrintf("slab: %u/%u bytes in %u spans (%u free), %u refills, %u releases, %u large, %u fallbacks, %u thread caches\n",
+		sl.arena_used, sl.arena_size, sl.spans, sl.span_free, sl.refills, sl.releases, sl.large, sl.fallbacks, sl.caches);
+	for (int i = 0; i < SLAB_MAX_HEAPS - 1; i++) {
+		slab_heap_stats hs;
+		if (slab_get_memid_stats(i, &hs) < 0 || (!hs.allocs && !hs.large))
+			continue;
+		sceClibPrintf("  memid %d: %u/%u bytes live/peak in %u blocks, %u spans, %u allocs, %u large, %u bulk releases\n",
+			i, hs.live_bytes, hs.peak_bytes, hs.live_blocks, hs.spans, hs.allocs, hs.large, hs.bulk_releases);
+	}
+
+	bionic_pthread_stats bp;
+	bionic_pthread_get_stats(&bp);
+	sceClibPrintf("pthread: %u mutexes, %u conds, %u attrs live in %u chunks (+%u outside), %u static inits, %u init races\n",
+		bp.mutexes, bp.conds, bp.attrs, bp.chunks, bp.overflow, bp.static_inits, bp.init_races);
+
+	sync_stats sy;
+	sync_get_stats(&sy);
+	sceClibPrintf("sync: %u contended locks, %u taken spinning, %u sleeps, %u cond waits, %u timeouts, %u idle signals, %u sem sleeps, %u sem timeouts\n",
+		sy.mutex_contended, sy.mutex_spun, sy.mutex_sleeps, sy.cond_waits, sy.cond_timeouts, sy.cond_idle, sy.sem_sleeps, sy.sem_timeouts);
+}
+#endif
+
 void *pthread_main(void *arg) {
 	int (* JNI_OnLoad) (void *vm) = (void *)so_symbol(&main_mod, "JNI_OnLoad");
 	int (* UAF_Init) (void *env, void *obj, int w, int h, char *lang, int dpi, uint8_t is_ggtv, uint8_t is_amazon, uint8_t is_portrait, int version, uint8_t is_full) = (void *)so_symbol(&main_mod, "Java_com_ubisoft_uaf_UAFJNILib_init");
@@ -1751,20 +1739,28 @@ void *pthread_main(void *arg) {
 	int (* UAF_Resume) (void *env) = (void *)so_symbol(&main_mod, "Java_com_ubisoft_uaf_UAFJNILib_resume");
 
 	sceIoMkdir("ux0:data/valiant/Files", 0777);
+	fs_index_add_dir("ux0:data/valiant/Files");
+
+	// libuaf init is mostly CPU bound, so that's our chance to get the card busy
+	prefetch_init("ux0:data/valiant/boot.profile");
 
 	sceClibPrintf("JNI_OnLoad\n");
+	trace_phase("JNI_OnLoad");
 	JNI_OnLoad(fake_vm);
 	
 	sceClibPrintf("UAF_InitGlobal\n");
+	trace_phase("UAF_InitGlobal");
 	UAF_InitGlobal(fake_env);
 	
 	//sceClibPrintf("UAF_InitMobileSDK\n");
 	//UAF_InitMobileSDK(fake_env);
 	
 	sceClibPrintf("UAF_InitNativeEngine\n");
+	trace_phase("UAF_InitNativeEngine");
 	UAF_InitNativeEngine(fake_env, NULL, "ux0:data/valiant", "ux0:data/valiant", "ux0:data/valiant/main.obb", (void *)1);
 	
 	sceClibPrintf("UAF_Init\n");
+	trace_phase("UAF_Init");
 	int lang = -1;
 	sceAppUtilSystemParamGetInt(SCE_SYSTEM_PARAM_ID_LANG, &lang);
 	switch (lang) {
@@ -1821,6 +1817,7 @@ void *pthread_main(void *arg) {
 	// For some reason, calling this makes the game start in high quality mode
 	if (!is_lowend) {
 		sceClibPrintf("UAF_Resume\n");
+		trace_phase("UAF_Resume");
 		UAF_Resume(fake_env);
 	}
 	
@@ -1831,7 +1828,10 @@ void *pthread_main(void *arg) {
 	
 	eglSwapInterval(0, 2); // Game expects to run at 30 FPS
 	
+	prefetch_finish();
+
 	sceClibPrintf("Entering main loop\n");
+	trace_phase("main_loop");
 	for (;;) {
 		SceTouchData touch;
 		sceTouchPeek(SCE_TOUCH_PORT_FRONT, &touch, 1);
@@ -1860,10 +1860,21 @@ void *pthread_main(void *arg) {
 		sceCtrlPeekBufferPositive(0, &pad, 1);
 		if (pad.buttons & SCE_CTRL_START)
 			UAF_SetDeviceBackPressed();
+#ifdef ENABLE_ALLOC_PROFILE
+		static uint32_t old_buttons = 0;
+		const uint32_t snapshot_combo = SCE_CTRL_LTRIGGER | SCE_CTRL_RTRIGGER | SCE_CTRL_SELECT;
+		if ((pad.buttons & snapshot_combo) == snapshot_combo && (old_buttons & snapshot_combo) != snapshot_combo)
+			sceClibPrintf("Heap snapshot %d written\n", heap_prof_dump());
+		old_buttons = pad.buttons;
+#endif
 		//UAF_SetPadAxisValues(fake_env, NULL, 2, (float)pad.lx / 255.0f, (float)pad.ly / 255.0f);
 		
 		UAF_Step();
 		vglSwapBuffers(GL_FALSE);
+		mem_monitor_tick();
+#ifdef ENABLE_IO_STATS
+		print_io_stats();
+#endif
 	}
 	
 	return NULL;
@@ -1882,6 +1893,10 @@ int main(int argc, char *argv[]) {
 	if (eventParam.type == 0x05) { // Game launched in lowend mode
 		is_lowend = 1;
 	}
+	if (file_exists(MEM_LOWEND_MARKER)) { // A previous run almost ran out of memory
+		sceClibPrintf("Starting in lowend mode, %s exists\n", MEM_LOWEND_MARKER);
+		is_lowend = 1;
+	}
 	
 	//sceSysmoduleLoadModule(SCE_SYSMODULE_RAZOR_CAPTURE);
 	//SceUID crasher_thread = sceKernelCreateThread("crasher", crasher, 0x40, 0x1000, 0, 0, NULL);
@@ -1903,11 +1918,27 @@ int main(int argc, char *argv[]) {
 	
 	char fname[256];
 	sprintf(data_path, "ux0:data/valiant");
+	vfs_init(data_path);
+	static const int saves_order[] = { VFS_HOST };
+	vfs_mount("ux0:data/valiant/Files", saves_order, 1);
+	trace_init("ux0:data/valiant/trace.bin");
+	slab_trace_init("ux0:data/valiant/alloc_trace.bin");
+	wb_init("ux0:data/valiant/Files");
+	fs_index_init(data_path);
+	file_cache_init(FILE_CACHE_BUDGET, FILE_CACHE_MAX_FILE_SIZE);
+	io_sched_init();
+	readahead_init(READAHEAD_WINDOW);
+	vfs_overlay_load(VFS_OVERLAY_MANIFEST, VFS_OVERLAY_BUDGET);
+	decomp_init(DECOMP_WORKERS);
+	vfs_mount_archive();
+	slab_init(SLAB_ARENA_SIZE, SLAB_MEMID_RESERVE);
+	sync_init();
 	
 	sceClibPrintf("Loading libuaf\n");
 	sprintf(fname, "%s/libuaf.so", data_path);
 	if (so_file_load(&main_mod, fname, LOAD_ADDRESS) < 0)
 		fatal_error("Error could not load %s.", fname);
+	heap_prof_init(&main_mod);
 	so_relocate(&main_mod);
 	so_resolve(&main_mod, default_dynlib, sizeof(default_dynlib), 0);
 
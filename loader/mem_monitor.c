@@ -0,0 +1,132 @@
+/* mem_monitor.c -- memory headroom tracking with graceful degradation under pressure
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+
+#include "config.h"
+#include "mem_monitor.h"
+#include "file_cache.h"
+#include "mmap.h"
+#include "slab.h"
+
+#define MEM_SAMPLE_FRAMES 15 // twice per second at 30 fps
+#define MEM_LOG_STEP (1024 * 1024) // a new low gets logged once it beats the last logged one by this much
+#define MEM_HYSTERESIS (4 * 1024 * 1024) // headroom to regain before leaving a level
+#define MEM_DOWNGRADE_SAMPLES 6 // consecutive critical samples before flagging lowend mode, a short spike isn't enough
+#define MEM_RESTORE_SAMPLES 1200 // ten minutes of lowend session to judge before clearing the flag
+
+extern int _newlib_heap_size_user;
+extern uint8_t is_lowend;
+
+static mem_monitor_stats stats = { .heap_low = (size_t)-1, .gpu_low = (size_t)-1 };
+static size_t logged_heap_low = (size_t)-1, logged_gpu_low = (size_t)-1;
+static uint32_t samples = 0, critical_samples = 0;
+static uint8_t restore_judged = 0;
+
+static int level_for(size_t free, size_t warn, size_t critical) {
+	// Hovering around a threshold must not flip the level on every sample
+	size_t slack_critical = stats.level >= MEM_LEVEL_CRITICAL ? MEM_HYSTERESIS : 0;
+	size_t slack_warn = stats.level >= MEM_LEVEL_WARN ? MEM_HYSTERESIS : 0;
+	if (free < critical + slack_critical)
+		return MEM_LEVEL_CRITICAL;
+	if (free < warn + slack_warn)
+		return MEM_LEVEL_WARN;
+	return MEM_LEVEL_OK;
+}
+
+// The game only picks its quality at boot, so the switch lands on the next launch
+static void downgrade(void) {
+	if ((is_lowend && !stats.restored) || stats.downgraded)
+		return;
+	FILE *f = fopen(MEM_LOWEND_MARKER, "w");
+	if (f)
+		fclose(f);
+	stats.downgraded = 1;
+	sceClibPrintf("mem: running out of memory, the game will start in lowend mode from now on (delete %s to undo)\n", MEM_LOWEND_MARKER);
+}
+
+// A lowend session that never came close to the limits hints at a one-off spike, so the
+// game goes back to its normal quality. The margins are wide since lowend mode uses less.
+static void restore(void) {
+	if (!is_lowend || restore_judged || stats.downgraded || samples < MEM_RESTORE_SAMPLES ||
+		stats.heap_low < MEM_HEAP_RESTORE || stats.gpu_low < MEM_GPU_RESTORE)
+		return;
+	// Lowend mode picked from LiveArea leaves no marker behind
+	restore_judged = 1;
+	SceIoStat st;
+	if (sceIoGetstat(MEM_LOWEND_MARKER, &st) < 0 || sceIoRemove(MEM_LOWEND_MARKER) < 0)
+		return;
+	stats.restored = 1;
+	sceClibPrintf("mem: plenty of headroom left in lowend mode, the game will start normally from now on\n");
+}
+
+static void sample(void) {
+	// Chunks past the top of the heap were never handed out, the top chunk borders them
+	struct mallinfo mi = mallinfo();
+	size_t unused = _newlib_heap_size_user - mi.arena;
+	stats.heap_largest = unused + mi.keepcost;
+	// The slab arena is a single block as far as newlib goes, its free part is headroom too
+	slab_stats sl;
+	slab_get_stats(&sl);
+	stats.heap_free = unused + mi.fordblks + (sl.arena_size - sl.arena_used) + sl.span_free;
+	stats.gpu_free = vglMemFree(VGL_MEM_ALL);
+	stats.gpu_total = vglMemTotal(VGL_MEM_ALL);
+	if (stats.heap_free < stats.heap_low)
+		stats.heap_low = stats.heap_free;
+	if (stats.gpu_free < stats.gpu_low)
+		stats.gpu_low = stats.gpu_free;
+
+	if (stats.heap_low + MEM_LOG_STEP <= logged_heap_low || stats.gpu_low + MEM_LOG_STEP <= logged_gpu_low) {
+		sceClibPrintf("mem: new low, %u KiB heap headroom (largest block ~%u KiB), %u/%u KiB gpu free\n",
+			stats.heap_low / 1024, stats.heap_largest / 1024, stats.gpu_low / 1024, stats.gpu_total / 1024);
+		logged_heap_low = stats.heap_low;
+		logged_gpu_low = stats.gpu_low;
+	}
+
+	// The largest block estimate ignores freed chunks, it would see pressure that isn't there
+	int heap_level = level_for(stats.heap_free, MEM_HEAP_WARN, MEM_HEAP_CRITICAL);
+	int gpu_level = level_for(stats.gpu_free, MEM_GPU_WARN, MEM_GPU_CRITICAL);
+	int level = heap_level > gpu_level ? heap_level : gpu_level;
+	if (level > stats.level) {
+		stats.trims++;
+		sceClibPrintf("mem: entering %s level, trimming loader caches\n", level == MEM_LEVEL_CRITICAL ? "critical" : "warning");
+	}
+	stats.level = level;
+
+	// Caches refill on their own, so they are held down for as long as the pressure lasts
+	if (level >= MEM_LEVEL_WARN) {
+		file_cache_stats fc;
+		file_cache_get_stats(&fc);
+		file_cache_trim(level == MEM_LEVEL_CRITICAL ? 0 : fc.budget / 2);
+		mmap_trim(0);
+	}
+	// Emptied MemoryId heaps hand their spans back here rather than on their last free
+	slab_collect(level >= MEM_LEVEL_WARN);
+	critical_samples = level == MEM_LEVEL_CRITICAL ? critical_samples + 1 : 0;
+	if (critical_samples >= MEM_DOWNGRADE_SAMPLES)
+		downgrade();
+	samples++;
+	restore();
+}
+
+// Called from the render thread, vitaGL pools are not meant to be inspected from elsewhere
+void mem_monitor_tick(void) {
+	static uint32_t frames = 0;
+	if (frames++ % MEM_SAMPLE_FRAMES)
+		return;
+	sample();
+}
+
+void mem_monitor_get_stats(mem_monitor_stats *out) {
+	*out = stats;
+}
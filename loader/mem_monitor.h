@@ -0,0 +1,29 @@
+#ifndef __MEM_MONITOR_H__
+#define __MEM_MONITOR_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum {
+	MEM_LEVEL_OK,
+	MEM_LEVEL_WARN, // loader caches get trimmed
+	MEM_LEVEL_CRITICAL // caches get dropped, and the game flagged for lowend mode if it lasts
+};
+
+typedef struct {
+	size_t heap_free; // newlib heap headroom, free chunks included
+	size_t heap_largest; // estimate of the biggest block malloc could still return
+	size_t heap_low; // lowest headroom seen so far
+	size_t gpu_free; // vitaGL pools
+	size_t gpu_total;
+	size_t gpu_low;
+	int level;
+	uint32_t trims; // times a level got entered and caches trimmed
+	uint8_t downgraded; // lowend marker written
+	uint8_t restored; // lowend marker cleared after a healthy lowend session
+} mem_monitor_stats;
+
+void mem_monitor_tick(void);
+void mem_monitor_get_stats(mem_monitor_stats *stats);
+
+#endif
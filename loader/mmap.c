@@ -0,0 +1,364 @@
+/* mmap.c -- mmap/munmap emulation on top of the heap
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "mmap.h"
+#include "readahead.h"
+#include "stream.h"
+#include "fd_pool.h"
+#include "io_sched.h"
+
+#define MMAP_PAGE_SIZE 0x1000
+#define MMAP_POOL_MAX_PAGES 16 // anonymous blocks up to this size get recycled
+#define MMAP_POOL_BUDGET (1024 * 1024)
+#define MMAP_IDLE_BUDGET (4 * 1024 * 1024) // unmapped file regions kept for the next map
+
+// A file range loaded once and handed to every read-only mapping falling inside it
+typedef struct map_region {
+	struct map_region *next; // most recently used first
+	int refs;
+	uint8_t detached; // invalidated while still mapped, no longer linked in regions
+	uint64_t offset;
+	size_t length;
+	uint8_t *data;
+	char key[];
+} map_region;
+
+typedef struct mapping {
+	struct mapping *next;
+	uint8_t *addr;
+	size_t length;
+	size_t remaining; // pages not unmapped yet
+	map_region *region; // NULL for memory owned by the mapping itself
+	uint32_t unmapped[]; // one bit per page
+} mapping;
+
+static void *pool[MMAP_POOL_MAX_PAGES]; // free blocks by page count, linked through their first word
+static size_t pool_bytes = 0;
+static map_region *regions = NULL;
+static size_t idle_bytes = 0;
+static mapping *mappings = NULL;
+static mmap_stats stats;
+static pthread_mutex_t mmap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t page_round(size_t size) {
+	return (size + MMAP_PAGE_SIZE - 1) & ~(MMAP_PAGE_SIZE - 1);
+}
+
+// Called with the lock held
+static uint8_t *anon_alloc(size_t size) {
+	size_t pages = size / MMAP_PAGE_SIZE;
+	uint8_t *p = NULL;
+	if (pages <= MMAP_POOL_MAX_PAGES && pool[pages - 1]) {
+		p = pool[pages - 1];
+		pool[pages - 1] = *(void **)p;
+		pool_bytes -= size;
+	} else {
+		p = memalign(MMAP_PAGE_SIZE, size);
+	}
+	if (p)
+		sceClibMemset(p, 0, size);
+	return p;
+}
+
+// Called with the lock held
+static void anon_free(uint8_t *p, size_t size) {
+	size_t pages = size / MMAP_PAGE_SIZE;
+	if (pages <= MMAP_POOL_MAX_PAGES && pool_bytes + size <= MMAP_POOL_BUDGET) {
+		*(void **)p = pool[pages - 1];
+		pool[pages - 1] = p;
+		pool_bytes += size;
+	} else {
+		free(p);
+	}
+}
+
+// Reads without moving the file position of the descriptor, the rest of the buffer is zeroed
+static int read_range(int fd, const char *path, uint8_t *buf, uint64_t offset, size_t length) {
+	int64_t res = -1;
+	if (path) {
+		SceUID h = fd_pool_open(path);
+		if (h >= 0) {
+			res = io_pread(h, buf, length, offset, IO_CLASS_INTERACTIVE);
+			fd_pool_close(h);
+		}
+	} else {
+		stream *s = stream_from_fd(fd);
+		if (s) {
+			int64_t pos = stream_tell(s);
+			if (stream_seek(s, offset, SEEK_SET) == 0)
+				res = stream_read(s, buf, length);
+			stream_seek(s, pos, SEEK_SET);
+		} else {
+			off_t pos = lseek(fd, 0, SEEK_CUR);
+			if (pos >= 0 && lseek(fd, offset, SEEK_SET) >= 0)
+				res = read(fd, buf, length);
+			lseek(fd, pos, SEEK_SET);
+		}
+	}
+	if (res < 0)
+		return -1;
+	if (res < length)
+		sceClibMemset(buf + res, 0, length - res);
+	return 0;
+}
+
+static map_region *find_region(const char *path, uint64_t offset, size_t length) {
+	for (map_region *r = regions; r; r = r->next) {
+		if (offset >= r->offset && offset + length <= r->offset + r->length && !strcasecmp(r->key, path))
+			return r;
+	}
+	return NULL;
+}
+
+static void unlink_region(map_region *r) {
+	map_region **p = &regions;
+	while (*p != r)
+		p = &(*p)->next;
+	*p = r->next;
+}
+
+static void free_region(map_region *r) {
+	stats.file_bytes -= r->length;
+	free(r->data);
+	free(r);
+}
+
+static void trim_idle(size_t budget) {
+	while (idle_bytes > budget) {
+		map_region *victim = NULL;
+		for (map_region *r = regions; r; r = r->next) {
+			if (!r->refs)
+				victim = r;
+		}
+		unlink_region(victim);
+		idle_bytes -= victim->length;
+		free_region(victim);
+	}
+}
+
+static void grab_region(map_region *r) {
+	if (!r->refs++)
+		idle_bytes -= r->length;
+	unlink_region(r);
+	r->next = regions;
+	regions = r;
+}
+
+static void release_region(map_region *r) {
+	if (--r->refs)
+		return;
+	if (r->detached) {
+		free_region(r);
+	} else {
+		idle_bytes += r->length;
+		trim_idle(MMAP_IDLE_BUDGET);
+	}
+}
+
+// Loads the range unless an already loaded region covers it, returns it referenced
+static map_region *get_region(const char *path, uint64_t offset, size_t length) {
+	pthread_mutex_lock(&mmap_lock);
+	map_region *r = find_region(path, offset, length);
+	if (r) {
+		grab_region(r);
+		stats.shared_hits++;
+		pthread_mutex_unlock(&mmap_lock);
+		return r;
+	}
+	pthread_mutex_unlock(&mmap_lock);
+
+	// The card can take a while, so the read happens unlocked
+	size_t len = strlen(path);
+	map_region *n = calloc(1, sizeof(map_region) + len + 1);
+	uint8_t *data = memalign(MMAP_PAGE_SIZE, length);
+	if (!n || !data || read_range(-1, path, data, offset, length) < 0) {
+		free(n);
+		free(data);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&mmap_lock);
+	r = find_region(path, offset, length);
+	if (r) {
+		// Somebody else mapped it meanwhile
+		grab_region(r);
+		pthread_mutex_unlock(&mmap_lock);
+		free(n);
+		free(data);
+		return r;
+	}
+	n->refs = 1;
+	n->offset = offset;
+	n->length = length;
+	n->data = data;
+	memcpy(n->key, path, len + 1);
+	n->next = regions;
+	regions = n;
+	stats.file_bytes += length;
+	pthread_mutex_unlock(&mmap_lock);
+	return n;
+}
+
+void *mmap_hook(void *addr, size_t length, int prot, int flags, int fd, off_t offset) {
+	if (!length || offset < 0 || (offset & (MMAP_PAGE_SIZE - 1)) || (flags & BIONIC_MAP_FIXED)) {
+		errno = EINVAL;
+		return BIONIC_MAP_FAILED;
+	}
+	// Nothing would ever write the changes back
+	if (!(flags & BIONIC_MAP_ANONYMOUS) && (flags & BIONIC_MAP_SHARED) && (prot & BIONIC_PROT_WRITE)) {
+		errno = EACCES;
+		return BIONIC_MAP_FAILED;
+	}
+
+	size_t pages = page_round(length) / MMAP_PAGE_SIZE;
+	mapping *m = calloc(1, sizeof(mapping) + (pages + 31) / 32 * sizeof(uint32_t));
+	if (!m) {
+		errno = ENOMEM;
+		return BIONIC_MAP_FAILED;
+	}
+	m->length = page_round(length);
+	m->remaining = pages;
+
+	ra_file *ra = (flags & BIONIC_MAP_ANONYMOUS) ? NULL : ra_from_fd(fd);
+	if (ra && !(prot & BIONIC_PROT_WRITE)) {
+		m->region = get_region(ra_path(ra), offset, m->length);
+		if (m->region)
+			m->addr = m->region->data + (offset - m->region->offset);
+	} else {
+		pthread_mutex_lock(&mmap_lock);
+		m->addr = anon_alloc(m->length);
+		pthread_mutex_unlock(&mmap_lock);
+		if (m->addr && !(flags & BIONIC_MAP_ANONYMOUS) && read_range(fd, ra ? ra_path(ra) : NULL, m->addr, offset, length) < 0) {
+			pthread_mutex_lock(&mmap_lock);
+			anon_free(m->addr, m->length);
+			pthread_mutex_unlock(&mmap_lock);
+			m->addr = NULL;
+		}
+	}
+	if (!m->addr) {
+		free(m);
+		errno = ENOMEM;
+		return BIONIC_MAP_FAILED;
+	}
+
+	pthread_mutex_lock(&mmap_lock);
+	m->next = mappings;
+	mappings = m;
+	if (flags & BIONIC_MAP_ANONYMOUS)
+		stats.anon_maps++;
+	else
+		stats.file_maps++;
+	if (!m->region)
+		stats.anon_bytes += m->length;
+	pthread_mutex_unlock(&mmap_lock);
+	return m->addr;
+}
+
+// Mappings go away once every page of theirs got unmapped, possibly over several calls.
+// Pages are tracked one by one, so unmapping the same range twice can't free them early.
+int munmap_hook(void *addr, size_t length) {
+	uint8_t *start = addr;
+	if (!length || ((uintptr_t)start & (MMAP_PAGE_SIZE - 1))) {
+		errno = EINVAL;
+		return -1;
+	}
+	uint8_t *end = start + page_round(length);
+	if (end < start) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&mmap_lock);
+	mapping **p = &mappings;
+	while (*p) {
+		mapping *m = *p;
+		if (end <= m->addr || start >= m->addr + m->length) {
+			p = &m->next;
+			continue;
+		}
+
+		size_t first = start > m->addr ? (start - m->addr) / MMAP_PAGE_SIZE : 0;
+		size_t last = end < m->addr + m->length ? (end - m->addr) / MMAP_PAGE_SIZE : m->length / MMAP_PAGE_SIZE;
+		for (size_t i = first; i < last; i++) {
+			uint32_t bit = 1u << (i & 31);
+			if (!(m->unmapped[i / 32] & bit)) {
+				m->unmapped[i / 32] |= bit;
+				m->remaining--;
+			}
+		}
+		if (m->remaining) {
+			p = &m->next;
+			continue;
+		}
+
+		*p = m->next;
+		if (m->region) {
+			release_region(m->region);
+		} else {
+			stats.anon_bytes -= m->length;
+			anon_free(m->addr, m->length);
+		}
+		free(m);
+	}
+	pthread_mutex_unlock(&mmap_lock);
+	return 0;
+}
+
+void mmap_invalidate(const char *path) {
+	pthread_mutex_lock(&mmap_lock);
+	map_region **p = &regions;
+	while (*p) {
+		map_region *r = *p;
+		if (strcasecmp(r->key, path)) {
+			p = &r->next;
+			continue;
+		}
+		// Mapped ones live on until their last munmap, which frees them
+		*p = r->next;
+		if (r->refs) {
+			r->detached = 1;
+		} else {
+			idle_bytes -= r->length;
+			free_region(r);
+		}
+	}
+	pthread_mutex_unlock(&mmap_lock);
+}
+
+// Drops idle file regions past target bytes, and every recycled anonymous block if target is 0
+void mmap_trim(size_t target) {
+	pthread_mutex_lock(&mmap_lock);
+	trim_idle(target);
+	if (!target) {
+		for (int i = 0; i < MMAP_POOL_MAX_PAGES; i++) {
+			while (pool[i]) {
+				void *p = pool[i];
+				pool[i] = *(void **)p;
+				free(p);
+			}
+		}
+		pool_bytes = 0;
+	}
+	pthread_mutex_unlock(&mmap_lock);
+}
+
+void mmap_get_stats(mmap_stats *out) {
+	pthread_mutex_lock(&mmap_lock);
+	*out = stats;
+	pthread_mutex_unlock(&mmap_lock);
+}
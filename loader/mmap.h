@@ -0,0 +1,31 @@
+#ifndef __MMAP_H__
+#define __MMAP_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// bionic values, the game is built against those
+#define BIONIC_PROT_READ 0x1
+#define BIONIC_PROT_WRITE 0x2
+#define BIONIC_MAP_SHARED 0x01
+#define BIONIC_MAP_PRIVATE 0x02
+#define BIONIC_MAP_FIXED 0x10
+#define BIONIC_MAP_ANONYMOUS 0x20
+#define BIONIC_MAP_FAILED ((void *)-1)
+
+typedef struct {
+	uint32_t anon_maps;
+	uint32_t file_maps;
+	uint32_t shared_hits; // file mappings served by an already loaded region
+	size_t anon_bytes; // anonymous and private file mappings
+	size_t file_bytes; // loaded regions, mapped or idle
+} mmap_stats;
+
+void *mmap_hook(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+int munmap_hook(void *addr, size_t length);
+
+void mmap_invalidate(const char *path);
+void mmap_trim(size_t target);
+void mmap_get_stats(mmap_stats *stats);
+
+#endif
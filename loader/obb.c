@@ -0,0 +1,1416 @@
+/* obb.c -- pre-indexed zip reader for main.obb
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <zlib.h>
+#include <zstd.h>
+#include <zip.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "config.h"
+#include "obb.h"
+#include "pack.h"
+#include "file_cache.h"
+#include "trace.h"
+#include "prefetch.h"
+#include "decomp.h"
+#include "fast_inflate.h"
+#include "fd_pool.h"
+#include "io_sched.h"
+#include "vfs.h"
+
+//#define ENABLE_DEBUG
+
+#ifdef ENABLE_DEBUG
+#define dlog sceClibPrintf
+#else
+#define dlog
+#endif
+
+#define OBB_INDEX_MAGIC 0x5842424F // OBBX
+#define OBB_INDEX_VERSION 1
+#define OBB_INFLATE_CHUNK (64 * 1024)
+#define OBB_CM_ZSTD 93 // zip method id of zstd, used for pack entries
+#define OBB_MAX_PACK_INDEX (256 * 1024 * 1024)
+
+#define ZIP_EOCD_SIG 0x06054B50
+#define ZIP_EOCD64_SIG 0x06064B50
+#define ZIP_EOCD64_LOC_SIG 0x07064B50
+#define ZIP_CDIR_SIG 0x02014B50
+#define ZIP_LOCAL_SIG 0x04034B50
+
+typedef struct {
+	uint32_t hash;
+	uint32_t name_offs;
+	uint16_t name_len;
+	uint16_t method;
+	uint16_t flags;
+	uint16_t orig_method; // zip method in the obb, packs only
+	uint32_t crc;
+	uint32_t dos_time;
+	uint64_t comp_size;
+	uint64_t size;
+	union {
+		uint64_t header_offs;
+		uint64_t orig_comp_size; // packs have no local headers, data_offs is always set
+	};
+	uint64_t data_offs; // 0 until the local header got parsed
+} obb_entry;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t archive_size;
+	int64_t archive_mtime;
+	uint32_t num_entries;
+	uint32_t names_size;
+	uint32_t table_size;
+	uint32_t pad;
+} obb_index_header;
+
+struct obb_archive {
+	struct obb_archive *next;
+	int refs;
+	char path[256];
+	SceUID fd;
+	uint64_t archive_size;
+	uint32_t num_entries;
+	uint32_t num_listed; // entries visible through libzip, loose assets in packs are not
+	obb_entry *entries;
+	char *names;
+	uint32_t names_size;
+	uint32_t *table; // entry index + 1, 0 is empty
+	uint32_t table_size; // power of two
+	pack_hash *sorted; // set instead of table when serving from a pack
+	pthread_mutex_t lock;
+};
+
+// zip_error_t as seen by libuaf.so
+typedef struct {
+	int zip_err;
+	int sys_err;
+	char *str;
+} zip_error_bionic;
+
+struct obb_file {
+	obb_archive *ar;
+	obb_entry *entry;
+	uint64_t data_offs;
+	uint64_t size;
+	uint64_t pos;
+	int codec;
+	file_cache_entry *cached; // whole uncompressed entry, set by obb_prefetch_index
+	int error;
+	uint64_t comp_pos;
+	z_stream zs;
+	ZSTD_DStream *zds;
+	ZSTD_inBuffer zin;
+	uint8_t *inbuf;
+	int eof;
+	int io_class;
+	zip_error_bionic zerr; // handed out by zip_file_get_error
+};
+
+enum {
+	OBB_CODEC_NONE,
+	OBB_CODEC_DEFLATE,
+	OBB_CODEC_ZSTD
+};
+
+static obb_archive *archives = NULL;
+static pthread_mutex_t archives_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline uint16_t rd16(const uint8_t *p) {
+	return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t rd32(const uint8_t *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t rd64(const uint8_t *p) {
+	return rd32(p) | ((uint64_t)rd32(p + 4) << 32);
+}
+
+static uint32_t hash_name(const char *name, size_t len) {
+	uint32_t h = 0x811C9DC5;
+	for (size_t i = 0; i < len; i++) {
+		h ^= (uint8_t)name[i];
+		h *= 0x01000193;
+	}
+	return h;
+}
+
+static int read_at(SceUID fd, void *buf, uint32_t size, uint64_t offs, int cls) {
+	return io_pread(fd, buf, size, offs, cls) == size ? 0 : -1;
+}
+
+static void build_table(obb_archive *ar) {
+	ar->table_size = 16;
+	while (ar->table_size < ar->num_entries * 2)
+		ar->table_size <<= 1;
+	ar->table = calloc(ar->table_size, sizeof(uint32_t));
+	if (!ar->table)
+		return;
+
+	for (uint32_t i = 0; i < ar->num_entries; i++) {
+		uint32_t slot = ar->entries[i].hash & (ar->table_size - 1);
+		while (ar->table[slot])
+			slot = (slot + 1) & (ar->table_size - 1);
+		ar->table[slot] = i + 1;
+	}
+}
+
+static int parse_central_directory(obb_archive *ar) {
+	uint8_t *tail;
+	uint32_t tail_size = ar->archive_size < 0x10000 + 22 ? ar->archive_size : 0x10000 + 22;
+	if (tail_size < 22)
+		return ZIP_ER_NOZIP;
+
+	tail = malloc(tail_size);
+	if (!tail)
+		return ZIP_ER_MEMORY;
+	if (read_at(ar->fd, tail, tail_size, ar->archive_size - tail_size, IO_CLASS_INTERACTIVE) < 0) {
+		free(tail);
+		return ZIP_ER_READ;
+	}
+
+	int eocd = -1;
+	for (int i = tail_size - 22; i >= 0; i--) {
+		if (rd32(&tail[i]) == ZIP_EOCD_SIG) {
+			eocd = i;
+			break;
+		}
+	}
+	if (eocd < 0) {
+		free(tail);
+		return ZIP_ER_NOZIP;
+	}
+
+	uint64_t num_entries = rd16(&tail[eocd + 10]);
+	uint64_t cd_size = rd32(&tail[eocd + 12]);
+	uint64_t cd_offs = rd32(&tail[eocd + 16]);
+
+	// Zip64 archives keep the real values in a separate end of central directory record
+	if (eocd >= 20 && rd32(&tail[eocd - 20]) == ZIP_EOCD64_LOC_SIG) {
+		uint8_t eocd64[56];
+		if (read_at(ar->fd, eocd64, sizeof(eocd64), rd64(&tail[eocd - 12]), IO_CLASS_INTERACTIVE) < 0 || rd32(eocd64) != ZIP_EOCD64_SIG) {
+			free(tail);
+			return ZIP_ER_NOZIP;
+		}
+		num_entries = rd64(&eocd64[32]);
+		cd_size = rd64(&eocd64[40]);
+		cd_offs = rd64(&eocd64[48]);
+	}
+	free(tail);
+
+	if (cd_offs + cd_size > ar->archive_size || num_entries > cd_size / 46)
+		return ZIP_ER_INCONS;
+
+	uint8_t *cd = malloc(cd_size);
+	if (!cd)
+		return ZIP_ER_MEMORY;
+	if (read_at(ar->fd, cd, cd_size, cd_offs, IO_CLASS_INTERACTIVE) < 0) {
+		free(cd);
+		return ZIP_ER_READ;
+	}
+
+	ar->num_entries = num_entries;
+	ar->entries = calloc(num_entries ? num_entries : 1, sizeof(obb_entry));
+	ar->names = malloc(cd_size);
+	if (!ar->entries || !ar->names) {
+		free(cd);
+		return ZIP_ER_MEMORY;
+	}
+
+	uint8_t *p = cd, *end = cd + cd_size;
+	uint32_t names_size = 0;
+	for (uint32_t i = 0; i < num_entries; i++) {
+		if (p + 46 > end || rd32(p) != ZIP_CDIR_SIG) {
+			free(cd);
+			return ZIP_ER_INCONS;
+		}
+		obb_entry *e = &ar->entries[i];
+		uint16_t name_len = rd16(&p[28]);
+		uint16_t extra_len = rd16(&p[30]);
+		uint16_t comment_len = rd16(&p[32]);
+		if (p + 46 + name_len + extra_len + comment_len > end) {
+			free(cd);
+			return ZIP_ER_INCONS;
+		}
+
+		e->flags = rd16(&p[8]);
+		e->method = rd16(&p[10]);
+		e->dos_time = rd16(&p[12]) | (rd16(&p[14]) << 16);
+		e->crc = rd32(&p[16]);
+		e->comp_size = rd32(&p[20]);
+		e->size = rd32(&p[24]);
+		e->header_offs = rd32(&p[42]);
+
+		// Zip64 extended information, only present for the fields that overflowed
+		uint8_t *extra = &p[46 + name_len], *extra_end = extra + extra_len;
+		while (extra + 4 <= extra_end) {
+			uint16_t id = rd16(extra), len = rd16(&extra[2]);
+			if (id == 0x0001) {
+				uint8_t *z = extra + 4, *z_end = extra + 4 + len;
+				if (e->size == 0xFFFFFFFF && z + 8 <= z_end) {
+					e->size = rd64(z);
+					z += 8;
+				}
+				if (e->comp_size == 0xFFFFFFFF && z + 8 <= z_end) {
+					e->comp_size = rd64(z);
+					z += 8;
+				}
+				if (e->header_offs == 0xFFFFFFFF && z + 8 <= z_end)
+					e->header_offs = rd64(z);
+				break;
+			}
+			extra += 4 + len;
+		}
+
+		sceClibMemcpy(&ar->names[names_size], &p[46], name_len);
+		ar->names[names_size + name_len] = 0;
+		e->name_offs = names_size;
+		e->name_len = name_len;
+		e->hash = hash_name(&ar->names[names_size], name_len);
+		names_size += name_len + 1;
+
+		p += 46 + name_len + extra_len + comment_len;
+	}
+	free(cd);
+
+	ar->names_size = names_size;
+	build_table(ar);
+	return ar->table ? ZIP_ER_OK : ZIP_ER_MEMORY;
+}
+
+// Same rule as for packs, lookups trust the cached index blindly afterwards
+static int check_index(obb_archive *ar) {
+	if (ar->names[ar->names_size - 1])
+		return -1;
+	for (uint32_t i = 0; i < ar->num_entries; i++) {
+		obb_entry *e = &ar->entries[i];
+		if ((uint64_t)e->name_offs + e->name_len >= ar->names_size || ar->names[e->name_offs + e->name_len] ||
+			e->hash != hash_name(&ar->names[e->name_offs], e->name_len) ||
+			e->comp_size > ar->archive_size || e->header_offs >= ar->archive_size ||
+			(e->data_offs && e->data_offs > ar->archive_size - e->comp_size))
+			return -1;
+	}
+	// At least one free slot has to remain, a probe would never end otherwise
+	uint32_t used = 0;
+	for (uint32_t i = 0; i < ar->table_size; i++) {
+		if (ar->table[i] > ar->num_entries)
+			return -1;
+		used += ar->table[i] != 0;
+	}
+	return used <= ar->num_entries ? 0 : -1;
+}
+
+static int load_index(obb_archive *ar, const char *index_path, int64_t mtime) {
+	SceUID fd = sceIoOpen(index_path, SCE_O_RDONLY, 0);
+	if (fd < 0)
+		return -1;
+
+	obb_index_header hdr;
+	if (sceIoRead(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || hdr.magic != OBB_INDEX_MAGIC || hdr.version != OBB_INDEX_VERSION ||
+		hdr.archive_size != ar->archive_size || hdr.archive_mtime != mtime || !hdr.names_size ||
+		!hdr.table_size || (hdr.table_size & (hdr.table_size - 1)) || hdr.table_size <= hdr.num_entries ||
+		(uint64_t)hdr.num_entries * sizeof(obb_entry) + hdr.names_size + (uint64_t)hdr.table_size * sizeof(uint32_t) > OBB_MAX_PACK_INDEX) {
+		sceIoClose(fd);
+		return -1;
+	}
+
+	ar->num_entries = hdr.num_entries;
+	ar->names_size = hdr.names_size;
+	ar->table_size = hdr.table_size;
+	ar->entries = malloc(hdr.num_entries * sizeof(obb_entry));
+	ar->names = malloc(hdr.names_size);
+	ar->table = malloc(hdr.table_size * sizeof(uint32_t));
+	if (!ar->entries || !ar->names || !ar->table ||
+		sceIoRead(fd, ar->entries, hdr.num_entries * sizeof(obb_entry)) != hdr.num_entries * sizeof(obb_entry) ||
+		sceIoRead(fd, ar->names, hdr.names_size) != hdr.names_size ||
+		sceIoRead(fd, ar->table, hdr.table_size * sizeof(uint32_t)) != hdr.table_size * sizeof(uint32_t) ||
+		check_index(ar) < 0) {
+		if (ar->entries && ar->names && ar->table)
+			sceClibPrintf("obb: ignoring %s, broken index\n", index_path);
+		free(ar->entries);
+		free(ar->names);
+		free(ar->table);
+		ar->entries = NULL;
+		ar->names = NULL;
+		ar->table = NULL;
+		sceIoClose(fd);
+		return -1;
+	}
+
+	sceIoClose(fd);
+	return 0;
+}
+
+static void save_index(obb_archive *ar, const char *index_path, int64_t mtime) {
+	SceUID fd = sceIoOpen(index_path, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+	if (fd < 0)
+		return;
+
+	obb_index_header hdr;
+	sceClibMemset(&hdr, 0, sizeof(hdr));
+	hdr.magic = OBB_INDEX_MAGIC;
+	hdr.version = OBB_INDEX_VERSION;
+	hdr.archive_size = ar->archive_size;
+	hdr.archive_mtime = mtime;
+	hdr.num_entries = ar->num_entries;
+	hdr.names_size = ar->names_size;
+	hdr.table_size = ar->table_size;
+	int ok = sceIoWrite(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+		sceIoWrite(fd, ar->entries, ar->num_entries * sizeof(obb_entry)) == ar->num_entries * sizeof(obb_entry) &&
+		sceIoWrite(fd, ar->names, ar->names_size) == ar->names_size &&
+		sceIoWrite(fd, ar->table, ar->table_size * sizeof(uint32_t)) == ar->table_size * sizeof(uint32_t);
+	sceIoClose(fd);
+
+	// Never leave a truncated index around, it would just fail validation on every boot
+	if (!ok)
+		sceIoRemove(index_path);
+}
+
+// main.obb -> main.pak
+static void make_pack_path(const char *path, char *pack_path) {
+	strncpy(pack_path, path, 250);
+	pack_path[250] = 0;
+	char *ext = strrchr(pack_path, '.');
+	if (!ext || strchr(ext, '/'))
+		ext = pack_path + strlen(pack_path);
+	strcpy(ext, ".pak");
+}
+
+// Same crc the repack tool stores, a rewritten obb never keeps its central directory in place
+static int source_crc(const char *path, uint64_t size, uint32_t *crc) {
+	uint32_t tail_size = size < PACK_SOURCE_TAIL ? size : PACK_SOURCE_TAIL;
+	SceUID fd = fd_pool_open(path);
+	if (fd < 0)
+		return -1;
+	uint8_t *tail = malloc(tail_size ? tail_size : 1);
+	int res = tail ? read_at(fd, tail, tail_size, size - tail_size, IO_CLASS_INTERACTIVE) : -1;
+	if (res == 0)
+		*crc = crc32(0, tail, tail_size);
+	free(tail);
+	fd_pool_close(fd);
+	return res;
+}
+
+// The index is trusted by every lookup afterwards, so nothing in it may point outside of the pack
+static int check_pack(pack_header *hdr, uint8_t *index, uint64_t pack_size) {
+	pack_entry *entries = (pack_entry *)index;
+	pack_hash *hashes = (pack_hash *)&index[hdr->num_entries * sizeof(pack_entry)];
+	const char *names = (const char *)&hashes[hdr->num_entries];
+	for (uint32_t i = 0; i < hdr->num_entries; i++) {
+		pack_entry *e = &entries[i];
+		if ((uint64_t)e->name_offs + e->name_len >= hdr->names_size || names[e->name_offs + e->name_len] ||
+			(e->method != PACK_STORED && e->method != PACK_ZSTD) || (e->method == PACK_STORED && e->comp_size != e->size) ||
+			e->offs < hdr->data_offs || e->comp_size > pack_size || e->offs > pack_size - e->comp_size)
+			return -1;
+	}
+	for (uint32_t i = 0; i < hdr->num_entries; i++) {
+		pack_hash *h = &hashes[i];
+		if (h->index >= hdr->num_entries || (i && h->hash < h[-1].hash) ||
+			h->hash != pack_hash_name(&names[entries[h->index].name_offs], entries[h->index].name_len))
+			return -1;
+	}
+	return 0;
+}
+
+static int open_pack(obb_archive *ar, const char *pack_path, const char *obb_path, SceIoStat *obb_st) {
+	SceUID fd = fd_pool_open(pack_path);
+	if (fd < 0)
+		return -1;
+
+	pack_header hdr;
+	SceIoStat st;
+	uint32_t crc;
+	if (read_at(fd, &hdr, sizeof(hdr), 0, IO_CLASS_INTERACTIVE) < 0 || hdr.magic != PACK_MAGIC || hdr.version != PACK_VERSION ||
+		(obb_st && (hdr.source_size != obb_st->st_size || source_crc(obb_path, obb_st->st_size, &crc) < 0 || hdr.source_crc != crc)) ||
+		sceIoGetstatByFd(fd, &st) < 0) {
+		sceClibPrintf("obb: ignoring %s, it doesn't match the obb\n", pack_path);
+		fd_pool_close(fd);
+		return -1;
+	}
+
+	// The whole index sits right after the header, so a single read is enough
+	uint64_t index_size = (uint64_t)hdr.num_entries * (sizeof(pack_entry) + sizeof(pack_hash)) + hdr.names_size;
+	if (hdr.num_listed > hdr.num_entries || !hdr.names_size || index_size > OBB_MAX_PACK_INDEX ||
+		hdr.data_offs < sizeof(hdr) + index_size || hdr.data_offs > st.st_size) {
+		sceClibPrintf("obb: ignoring %s, broken header\n", pack_path);
+		fd_pool_close(fd);
+		return -1;
+	}
+	uint8_t *index = malloc(index_size);
+	ar->entries = calloc(hdr.num_entries ? hdr.num_entries : 1, sizeof(obb_entry));
+	ar->sorted = malloc(hdr.num_entries * sizeof(pack_hash) + 1);
+	ar->names = malloc(hdr.names_size);
+	if (!index || !ar->entries || !ar->sorted || !ar->names || read_at(fd, index, index_size, sizeof(hdr), IO_CLASS_INTERACTIVE) < 0 ||
+		check_pack(&hdr, index, st.st_size) < 0) {
+		if (index && ar->names)
+			sceClibPrintf("obb: ignoring %s, broken index\n", pack_path);
+		free(index);
+		free(ar->entries);
+		free(ar->sorted);
+		free(ar->names);
+		ar->entries = NULL;
+		ar->sorted = NULL;
+		ar->names = NULL;
+		fd_pool_close(fd);
+		return -1;
+	}
+
+	pack_entry *entries = (pack_entry *)index;
+	for (uint32_t i = 0; i < hdr.num_entries; i++) {
+		obb_entry *e = &ar->entries[i];
+		e->name_offs = entries[i].name_offs;
+		e->name_len = entries[i].name_len;
+		e->method = entries[i].method == PACK_ZSTD ? OBB_CM_ZSTD : ZIP_CM_STORE;
+		e->orig_method = entries[i].orig_method;
+		e->crc = entries[i].crc;
+		e->dos_time = entries[i].dos_time;
+		e->comp_size = entries[i].comp_size;
+		e->orig_comp_size = entries[i].orig_comp_size;
+		e->size = entries[i].size;
+		e->data_offs = entries[i].offs;
+	}
+	sceClibMemcpy(ar->sorted, &index[hdr.num_entries * sizeof(pack_entry)], hdr.num_entries * sizeof(pack_hash));
+	sceClibMemcpy(ar->names, &index[hdr.num_entries * (sizeof(pack_entry) + sizeof(pack_hash))], hdr.names_size);
+	for (uint32_t i = 0; i < hdr.num_entries; i++)
+		ar->entries[ar->sorted[i].index].hash = ar->sorted[i].hash;
+	free(index);
+
+	ar->fd = fd;
+	ar->archive_size = st.st_size;
+	ar->num_entries = hdr.num_entries;
+	ar->num_listed = hdr.num_listed;
+	ar->names_size = hdr.names_size;
+	return 0;
+}
+
+static int64_t datetime_to_key(const SceDateTime *dt) {
+	return ((((((int64_t)dt->year * 16 + dt->month) * 32 + dt->day) * 32 + dt->hour) * 64 + dt->minute) * 64 + dt->second);
+}
+
+static int open_zip(obb_archive *ar, const char *path, SceIoStat *st) {
+	ar->archive_size = st->st_size;
+	ar->fd = fd_pool_open(path);
+	if (ar->fd < 0)
+		return ZIP_ER_OPEN;
+
+	char index_path[256];
+	snprintf(index_path, sizeof(index_path), "%s.idx", path);
+	int64_t mtime = datetime_to_key(&st->st_mtime);
+	if (load_index(ar, index_path, mtime) < 0) {
+		uint64_t t = sceKernelGetProcessTimeWide();
+		int res = parse_central_directory(ar);
+		if (res != ZIP_ER_OK) {
+			fd_pool_close(ar->fd);
+			free(ar->entries);
+			free(ar->names);
+			free(ar->table);
+			return res;
+		}
+		sceClibPrintf("obb: indexed %u entries of %s in %llu ms\n", ar->num_entries, path, (sceKernelGetProcessTimeWide() - t) / 1000);
+		save_index(ar, index_path, mtime);
+	}
+	ar->num_listed = ar->num_entries;
+	return ZIP_ER_OK;
+}
+
+obb_archive *obb_open(const char *path, int *error) {
+	pthread_mutex_lock(&archives_lock);
+	for (obb_archive *ar = archives; ar; ar = ar->next) {
+		if (!strcasecmp(ar->path, path)) {
+			ar->refs++;
+			pthread_mutex_unlock(&archives_lock);
+			return ar;
+		}
+	}
+
+	obb_archive *ar = calloc(1, sizeof(obb_archive));
+	if (!ar) {
+		pthread_mutex_unlock(&archives_lock);
+		*error = ZIP_ER_MEMORY;
+		return NULL;
+	}
+	strncpy(ar->path, path, sizeof(ar->path) - 1);
+
+	// A repacked archive takes precedence over the original one, which may even be gone
+	SceIoStat st;
+	char pack_path[256];
+	int have_obb = sceIoGetstat(path, &st) >= 0;
+	make_pack_path(path, pack_path);
+	if (open_pack(ar, pack_path, path, have_obb ? &st : NULL) == 0) {
+		sceClibPrintf("obb: serving %s from %s\n", path, pack_path);
+	} else {
+		int res = have_obb ? open_zip(ar, path, &st) : ZIP_ER_NOENT;
+		if (res != ZIP_ER_OK) {
+			pthread_mutex_unlock(&archives_lock);
+			free(ar);
+			*error = res;
+			return NULL;
+		}
+	}
+
+	pthread_mutex_init(&ar->lock, NULL);
+	ar->refs = 1;
+	ar->next = archives;
+	archives = ar;
+	pthread_mutex_unlock(&archives_lock);
+	return ar;
+}
+
+void obb_close(obb_archive *ar) {
+	pthread_mutex_lock(&archives_lock);
+	if (--ar->refs) {
+		pthread_mutex_unlock(&archives_lock);
+		return;
+	}
+	obb_archive **p = &archives;
+	while (*p != ar)
+		p = &(*p)->next;
+	*p = ar->next;
+	pthread_mutex_unlock(&archives_lock);
+
+	fd_pool_close(ar->fd);
+	pthread_mutex_destroy(&ar->lock);
+	free(ar->entries);
+	free(ar->names);
+	free(ar->table);
+	free(ar->sorted);
+	free(ar);
+}
+
+int64_t obb_num_entries(obb_archive *ar) {
+	return ar->num_entries;
+}
+
+static const char *entry_basename(obb_archive *ar, obb_entry *e) {
+	const char *name = &ar->names[e->name_offs];
+	const char *slash = strrchr(name, '/');
+	return slash ? slash + 1 : name;
+}
+
+int64_t obb_locate(obb_archive *ar, const char *name, uint32_t flags) {
+	if (!(flags & (ZIP_FL_NOCASE | ZIP_FL_NODIR))) {
+		size_t len = strlen(name);
+		uint32_t hash = hash_name(name, len);
+		if (ar->sorted) {
+			// Packs ship their hashes presorted, collisions sit next to each other
+			uint32_t lo = 0, hi = ar->num_entries;
+			while (lo < hi) {
+				uint32_t mid = (lo + hi) / 2;
+				if (ar->sorted[mid].hash < hash)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			for (; lo < ar->num_entries && ar->sorted[lo].hash == hash; lo++) {
+				obb_entry *e = &ar->entries[ar->sorted[lo].index];
+				if (e->name_len == len && !memcmp(&ar->names[e->name_offs], name, len))
+					return ar->sorted[lo].index;
+			}
+			return -1;
+		}
+		uint32_t slot = hash & (ar->table_size - 1);
+		while (ar->table[slot]) {
+			obb_entry *e = &ar->entries[ar->table[slot] - 1];
+			if (e->hash == hash && e->name_len == len && !memcmp(&ar->names[e->name_offs], name, len))
+				return ar->table[slot] - 1;
+			slot = (slot + 1) & (ar->table_size - 1);
+		}
+		return -1;
+	}
+
+	// Uncommon lookups, not worth indexing
+	for (uint32_t i = 0; i < ar->num_entries; i++) {
+		obb_entry *e = &ar->entries[i];
+		const char *entry_name = (flags & ZIP_FL_NODIR) ? entry_basename(ar, e) : &ar->names[e->name_offs];
+		if ((flags & ZIP_FL_NOCASE) ? !strcasecmp(entry_name, name) : !strcmp(entry_name, name))
+			return i;
+	}
+	return -1;
+}
+
+static uint32_t dos_time_to_time(uint32_t dos_time) {
+	int y = ((dos_time >> 25) & 0x7F) + 1980;
+	int m = (dos_time >> 21) & 0x0F;
+	int d = (dos_time >> 16) & 0x1F;
+	if (m < 1 || m > 12 || d < 1)
+		return 0;
+
+	// Days from civil, see http://howardhinnant.github.io/date_algorithms.html
+	y -= m <= 2;
+	int era = y / 400;
+	int yoe = y - era * 400;
+	int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	uint32_t days = era * 146097 + doe - 719468;
+	return days * 86400 + ((dos_time >> 11) & 0x1F) * 3600 + ((dos_time >> 5) & 0x3F) * 60 + (dos_time & 0x1F) * 2;
+}
+
+int obb_stat_index(obb_archive *ar, uint64_t index, obb_stat *st) {
+	if (index >= ar->num_entries)
+		return -1;
+
+	obb_entry *e = &ar->entries[index];
+	st->name = &ar->names[e->name_offs];
+	st->index = index;
+	st->size = e->size;
+	// Packs report the entry as the obb had it, the game never sees their own codec
+	st->comp_size = ar->sorted ? e->orig_comp_size : e->comp_size;
+	st->mtime = dos_time_to_time(e->dos_time);
+	st->crc = e->crc;
+	st->method = ar->sorted ? e->orig_method : e->method;
+	st->flags = e->flags;
+	return 0;
+}
+
+// File cache key of the uncompressed contents of an entry
+static void entry_key(obb_archive *ar, obb_entry *e, char *key) {
+	snprintf(key, 512, "%s:%s", ar->path, &ar->names[e->name_offs]);
+}
+
+static uint64_t resolve_data_offs(obb_archive *ar, obb_entry *e) {
+	pthread_mutex_lock(&ar->lock);
+	uint64_t data_offs = e->data_offs;
+	pthread_mutex_unlock(&ar->lock);
+	if (data_offs)
+		return data_offs;
+
+	uint8_t hdr[30];
+	if (read_at(ar->fd, hdr, sizeof(hdr), e->header_offs, IO_CLASS_INTERACTIVE) < 0 || rd32(hdr) != ZIP_LOCAL_SIG)
+		return 0;
+	data_offs = e->header_offs + sizeof(hdr) + rd16(&hdr[26]) + rd16(&hdr[28]);
+
+	pthread_mutex_lock(&ar->lock);
+	e->data_offs = data_offs;
+	pthread_mutex_unlock(&ar->lock);
+	return data_offs;
+}
+
+static obb_file *fopen_index(obb_archive *ar, uint64_t index, uint32_t flags, int join, int *error) {
+	if (index >= ar->num_entries) {
+		*error = ZIP_ER_INVAL;
+		return NULL;
+	}
+
+	obb_entry *e = &ar->entries[index];
+	if (e->flags & 1) {
+		*error = ZIP_ER_NOPASSWD;
+		return NULL;
+	}
+	int compressed = flags & ZIP_FL_COMPRESSED;
+	if (compressed && ar->sorted) {
+		// The obb compressed bytes are gone, only entries it stored have a raw form left
+		if (e->orig_method != ZIP_CM_STORE) {
+			*error = ZIP_ER_COMPNOTSUPP;
+			return NULL;
+		}
+		compressed = 0;
+	}
+	int raw = compressed || e->method == ZIP_CM_STORE;
+	if (!raw && e->method != ZIP_CM_DEFLATE && e->method != OBB_CM_ZSTD) {
+		*error = ZIP_ER_COMPNOTSUPP;
+		return NULL;
+	}
+
+	obb_file *f = calloc(1, sizeof(obb_file));
+	if (!f) {
+		*error = ZIP_ER_MEMORY;
+		return NULL;
+	}
+	f->ar = ar;
+	f->entry = e;
+	f->io_class = io_class_for_path(&ar->names[e->name_offs]);
+	if (!compressed) {
+		char key[512];
+		entry_key(ar, e, key);
+		f->cached = file_cache_find(key);
+		// The entry may be getting decompressed by the pool already
+		if (!f->cached && join && e->size <= FILE_CACHE_MAX_FILE_SIZE && decomp_join(key))
+			f->cached = file_cache_find(key);
+		if (f->cached) {
+			f->size = e->size;
+			return f;
+		}
+	}
+	f->data_offs = resolve_data_offs(ar, e);
+	if (!f->data_offs) {
+		free(f);
+		*error = ZIP_ER_READ;
+		return NULL;
+	}
+
+	if (raw) {
+		f->size = compressed ? e->comp_size : e->size;
+	} else if (e->method == OBB_CM_ZSTD) {
+		f->size = e->size;
+		f->codec = OBB_CODEC_ZSTD;
+		f->inbuf = malloc(OBB_INFLATE_CHUNK);
+		f->zds = ZSTD_createDStream();
+		if (!f->inbuf || !f->zds || ZSTD_isError(ZSTD_initDStream(f->zds))) {
+			*error = f->inbuf && f->zds ? ZIP_ER_INTERNAL : ZIP_ER_MEMORY;
+			ZSTD_freeDStream(f->zds);
+			free(f->inbuf);
+			free(f);
+			return NULL;
+		}
+	} else {
+		f->size = e->size;
+		f->codec = OBB_CODEC_DEFLATE;
+		f->inbuf = malloc(OBB_INFLATE_CHUNK);
+		if (!f->inbuf || inflateInit2(&f->zs, -MAX_WBITS) != Z_OK) {
+			*error = f->inbuf ? ZIP_ER_ZLIB : ZIP_ER_MEMORY;
+			free(f->inbuf);
+			free(f);
+			return NULL;
+		}
+	}
+
+	return f;
+}
+
+obb_file *obb_fopen_index(obb_archive *ar, uint64_t index, uint32_t flags, int *error) {
+	return fopen_index(ar, index, flags, 1, error);
+}
+
+static int64_t inflate_read(obb_file *f, uint8_t *buf, uint64_t count) {
+	f->zs.next_out = buf;
+	f->zs.avail_out = count;
+	while (f->zs.avail_out && !f->eof) {
+		if (!f->zs.avail_in && f->comp_pos < f->entry->comp_size) {
+			uint32_t chunk = f->entry->comp_size - f->comp_pos > OBB_INFLATE_CHUNK ? OBB_INFLATE_CHUNK : f->entry->comp_size - f->comp_pos;
+			if (read_at(f->ar->fd, f->inbuf, chunk, f->data_offs + f->comp_pos, f->io_class) < 0) {
+				f->error = ZIP_ER_READ;
+				return -1;
+			}
+			f->comp_pos += chunk;
+			f->zs.next_in = f->inbuf;
+			f->zs.avail_in = chunk;
+		}
+
+		int res = inflate(&f->zs, Z_SYNC_FLUSH);
+		if (res == Z_STREAM_END) {
+			f->eof = 1;
+		} else if (res != Z_OK && !(res == Z_BUF_ERROR && f->zs.avail_in)) {
+			f->error = ZIP_ER_ZLIB;
+			return -1;
+		}
+	}
+	return count - f->zs.avail_out;
+}
+
+static int64_t zstd_read(obb_file *f, uint8_t *buf, uint64_t count) {
+	ZSTD_outBuffer out = { buf, count, 0 };
+	while (out.pos < out.size && !f->eof) {
+		if (f->zin.pos == f->zin.size && f->comp_pos < f->entry->comp_size) {
+			uint32_t chunk = f->entry->comp_size - f->comp_pos > OBB_INFLATE_CHUNK ? OBB_INFLATE_CHUNK : f->entry->comp_size - f->comp_pos;
+			if (read_at(f->ar->fd, f->inbuf, chunk, f->data_offs + f->comp_pos, f->io_class) < 0) {
+				f->error = ZIP_ER_READ;
+				return -1;
+			}
+			f->comp_pos += chunk;
+			f->zin.src = f->inbuf;
+			f->zin.size = chunk;
+			f->zin.pos = 0;
+		}
+
+		size_t produced = out.pos;
+		size_t res = ZSTD_decompressStream(f->zds, &out, &f->zin);
+		if (ZSTD_isError(res)) {
+			f->error = ZIP_ER_INCONS;
+			return -1;
+		}
+		if (res == 0) {
+			f->eof = 1;
+		} else if (out.pos == produced && f->zin.pos == f->zin.size && f->comp_pos >= f->entry->comp_size) {
+			// Frame is truncated, it ended before producing the whole entry
+			f->error = ZIP_ER_INCONS;
+			return -1;
+		}
+	}
+	return out.pos;
+}
+
+int64_t obb_fread(obb_file *f, void *buf, uint64_t count) {
+	if (f->error)
+		return -1;
+	if (count > f->size - f->pos)
+		count = f->size - f->pos;
+	if (!count)
+		return 0;
+
+	int64_t res;
+	if (f->cached) {
+		sceClibMemcpy(buf, file_cache_data(f->cached) + f->pos, count);
+		res = count;
+	} else if (f->codec == OBB_CODEC_DEFLATE) {
+		res = inflate_read(f, buf, count);
+	} else if (f->codec == OBB_CODEC_ZSTD) {
+		res = zstd_read(f, buf, count);
+	} else {
+		// Stored data goes straight from the card into the caller buffer
+		res = io_pread(f->ar->fd, buf, count, f->data_offs + f->pos, f->io_class);
+		if (res < 0) {
+			f->error = ZIP_ER_READ;
+			return -1;
+		}
+	}
+	if (res > 0)
+		f->pos += res;
+	return res;
+}
+
+int obb_fseek(obb_file *f, int64_t offset, int whence) {
+	int64_t pos;
+	switch (whence) {
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = f->pos + offset;
+		break;
+	case SEEK_END:
+		pos = f->size + offset;
+		break;
+	default:
+		f->error = ZIP_ER_INVAL;
+		return -1;
+	}
+	if (pos < 0 || pos > f->size) {
+		f->error = ZIP_ER_INVAL;
+		return -1;
+	}
+
+	if (f->codec != OBB_CODEC_NONE && !f->cached && pos != f->pos) {
+		// Compressed streams can't be seeked, restart from scratch if needed and decompress up to the target
+		if (pos < f->pos) {
+			if (f->codec == OBB_CODEC_ZSTD) {
+				ZSTD_DCtx_reset(f->zds, ZSTD_reset_session_only);
+				f->zin.size = f->zin.pos = 0;
+			} else {
+				inflateReset(&f->zs);
+				f->zs.avail_in = 0;
+			}
+			f->comp_pos = 0;
+			f->pos = 0;
+			f->eof = 0;
+		}
+		uint8_t *scratch = malloc(OBB_INFLATE_CHUNK);
+		if (!scratch) {
+			f->error = ZIP_ER_MEMORY;
+			return -1;
+		}
+		while (f->pos < pos) {
+			uint64_t chunk = pos - f->pos > OBB_INFLATE_CHUNK ? OBB_INFLATE_CHUNK : pos - f->pos;
+			if (obb_fread(f, scratch, chunk) <= 0) {
+				free(scratch);
+				return -1;
+			}
+		}
+		free(scratch);
+	}
+	f->pos = pos;
+	return 0;
+}
+
+int64_t obb_ftell(obb_file *f) {
+	return f->pos;
+}
+
+void obb_fclose(obb_file *f) {
+	if (f->cached)
+		file_cache_release(f->cached);
+	if (f->codec == OBB_CODEC_DEFLATE)
+		inflateEnd(&f->zs);
+	else if (f->codec == OBB_CODEC_ZSTD)
+		ZSTD_freeDStream(f->zds);
+	free(f->inbuf);
+	free(f);
+}
+
+const char *obb_path(obb_archive *ar) {
+	return ar->path;
+}
+
+// Entries fitting the cache are small enough to be read in one go and decoded by
+// the whole-buffer inflater, which is a lot faster than the streaming one
+static int inflate_whole(obb_archive *ar, obb_entry *e, uint8_t *data) {
+	if (e->method != ZIP_CM_DEFLATE || (e->flags & 1))
+		return -1;
+	uint64_t data_offs = resolve_data_offs(ar, e);
+	uint8_t *comp = malloc(e->comp_size ? e->comp_size : 1);
+	if (!data_offs || !comp) {
+		free(comp);
+		return -1;
+	}
+
+	size_t in_used, out_used;
+	int res = -1;
+	if (read_at(ar->fd, comp, e->comp_size, data_offs, IO_CLASS_INTERACTIVE) == 0 &&
+		fast_inflate(comp, e->comp_size, data, e->size, &in_used, &out_used) == FAST_INFLATE_OK && out_used == e->size)
+		res = 0;
+	free(comp);
+	return res;
+}
+
+// Decompresses a whole entry into the file cache, so that later opens never touch the card
+int obb_prefetch_index(obb_archive *ar, uint64_t index) {
+	if (index >= ar->num_entries)
+		return -1;
+	obb_entry *e = &ar->entries[index];
+	char key[512];
+	entry_key(ar, e, key);
+	file_cache_entry *cached = file_cache_find(key);
+	if (cached) {
+		file_cache_release(cached);
+		return 0;
+	}
+	if (e->size > FILE_CACHE_MAX_FILE_SIZE)
+		return -1;
+
+	uint8_t *data = malloc(e->size ? e->size : 1);
+	if (!data)
+		return -1;
+	if (inflate_whole(ar, e, data) < 0) {
+		// Joining would deadlock when running as a pool job for this very entry
+		int error;
+		obb_file *f = fopen_index(ar, index, 0, 0, &error);
+		if (!f || obb_fread(f, data, e->size) != e->size) {
+			if (f)
+				obb_fclose(f);
+			free(data);
+			return -1;
+		}
+		obb_fclose(f);
+	}
+
+	cached = file_cache_insert(key, data, e->size);
+	if (!cached)
+		return -1;
+	file_cache_release(cached);
+	return 0;
+}
+
+typedef struct {
+	obb_archive *ar;
+	uint64_t index;
+} prefetch_job;
+
+static void prefetch_job_run(void *arg) {
+	prefetch_job *job = arg;
+	obb_prefetch_index(job->ar, job->index);
+	obb_close(job->ar);
+	free(job);
+}
+
+// Same as obb_prefetch_index, but the entry gets decompressed by the worker pool
+int obb_queue_index(obb_archive *ar, uint64_t index) {
+	if (index >= ar->num_entries || ar->entries[index].size > FILE_CACHE_MAX_FILE_SIZE)
+		return -1;
+	prefetch_job *job = malloc(sizeof(prefetch_job));
+	if (!job)
+		return -1;
+
+	// The job keeps the archive alive until it's done with it
+	pthread_mutex_lock(&archives_lock);
+	ar->refs++;
+	pthread_mutex_unlock(&archives_lock);
+	job->ar = ar;
+	job->index = index;
+
+	char key[512];
+	entry_key(ar, &ar->entries[index], key);
+	if (decomp_queue(key, prefetch_job_run, job) < 0) {
+		obb_close(ar);
+		free(job);
+	}
+	return 0;
+}
+
+/*
+ * libzip ABI shims
+ */
+
+typedef struct {
+	obb_archive *ar;
+	int error;
+	zip_error_bionic zerr; // handed out by zip_get_error
+} zip_hook_t;
+
+// struct zip_stat as seen by libuaf.so, time_t is 32 bits on bionic
+typedef struct {
+	uint64_t valid;
+	const char *name;
+	uint64_t index;
+	uint64_t size;
+	uint64_t comp_size;
+	int32_t mtime;
+	uint32_t crc;
+	uint16_t comp_method;
+	uint16_t encryption_method;
+	uint32_t flags;
+} zip_stat_bionic;
+
+void *zip_open_hook(const char *path, int flags, int *errorp) {
+	char real_path[256];
+	dlog("zip_open(%s)\n", path);
+	path = vfs_path(path, real_path);
+
+	// We only ever serve archives for reading
+	if (flags & ZIP_TRUNCATE) {
+		if (errorp)
+			*errorp = ZIP_ER_RDONLY;
+		return NULL;
+	}
+
+	zip_hook_t *za = calloc(1, sizeof(zip_hook_t));
+	if (!za) {
+		if (errorp)
+			*errorp = ZIP_ER_MEMORY;
+		return NULL;
+	}
+	int error = ZIP_ER_OK;
+	za->ar = obb_open(path, &error);
+	if (!za->ar) {
+		free(za);
+		if (errorp)
+			*errorp = error;
+		return NULL;
+	}
+	return za;
+}
+
+void zip_discard_hook(void *za) {
+	zip_hook_t *z = (zip_hook_t *)za;
+	if (!z)
+		return;
+	obb_close(z->ar);
+	free(z);
+}
+
+int zip_close_hook(void *za) {
+	zip_discard_hook(za);
+	return 0;
+}
+
+// Loose assets packed along with the obb are only served through the vfs, the game
+// must keep seeing the obb contents it shipped with through libzip
+static int zip_listed(zip_hook_t *z, uint64_t index) {
+	if (index < z->ar->num_listed)
+		return 1;
+	z->error = ZIP_ER_INVAL;
+	return 0;
+}
+
+int64_t zip_get_num_entries_hook(void *za, uint32_t flags) {
+	return za ? ((zip_hook_t *)za)->ar->num_listed : -1;
+}
+
+int zip_get_num_files_hook(void *za) {
+	return za ? ((zip_hook_t *)za)->ar->num_listed : -1;
+}
+
+const char *zip_get_name_hook(void *za, uint64_t index, uint32_t flags) {
+	zip_hook_t *z = (zip_hook_t *)za;
+	obb_stat st;
+	if (!zip_listed(z, index))
+		return NULL;
+	if (obb_stat_index(z->ar, index, &st) < 0) {
+		z->error = ZIP_ER_INVAL;
+		return NULL;
+	}
+	return st.name;
+}
+
+int64_t zip_name_locate_hook(void *za, const char *fname, uint32_t flags) {
+	zip_hook_t *z = (zip_hook_t *)za;
+	if (!z || !fname)
+		return -1;
+	int64_t index = obb_locate(z->ar, fname, flags);
+	if (index < 0 || index >= z->ar->num_listed) {
+		z->error = ZIP_ER_NOENT;
+		return -1;
+	}
+	return index;
+}
+
+int zip_stat_index_hook(void *za, uint64_t index, uint32_t flags, void *st) {
+	zip_hook_t *z = (zip_hook_t *)za;
+	zip_stat_bionic *out = (zip_stat_bionic *)st;
+	obb_stat ost;
+	if (!zip_listed(z, index))
+		return -1;
+	if (obb_stat_index(z->ar, index, &ost) < 0) {
+		z->error = ZIP_ER_INVAL;
+		return -1;
+	}
+
+	out->valid = ZIP_STAT_NAME | ZIP_STAT_INDEX | ZIP_STAT_SIZE | ZIP_STAT_COMP_SIZE | ZIP_STAT_MTIME |
+		ZIP_STAT_CRC | ZIP_STAT_COMP_METHOD | ZIP_STAT_ENCRYPTION_METHOD | ZIP_STAT_FLAGS;
+	out->name = ost.name;
+	out->index = ost.index;
+	out->size = ost.size;
+	out->comp_size = ost.comp_size;
+	out->mtime = ost.mtime;
+	out->crc = ost.crc;
+	out->comp_method = ost.method;
+	out->encryption_method = (ost.flags & 1) ? ZIP_EM_UNKNOWN : ZIP_EM_NONE;
+	out->flags = 0;
+	return 0;
+}
+
+int zip_stat_hook(void *za, const char *fname, uint32_t flags, void *st) {
+	int64_t index = zip_name_locate_hook(za, fname, flags);
+	if (index < 0)
+		return -1;
+	return zip_stat_index_hook(za, index, flags, st);
+}
+
+void *zip_fopen_index_hook(void *za, uint64_t index, uint32_t flags) {
+	zip_hook_t *z = (zip_hook_t *)za;
+	int error = ZIP_ER_INVAL;
+	uint64_t start = trace_begin();
+	obb_file *f = NULL;
+	if (index < z->ar->num_listed) {
+		prefetch_notify_obb(z->ar->path, &z->ar->names[z->ar->entries[index].name_offs]);
+		f = obb_fopen_index(z->ar, index, flags, &error);
+	}
+	if (!f)
+		z->error = error;
+	trace_record(TRACE_ZIP_OPEN, index < z->ar->num_listed ? trace_path(&z->ar->names[z->ar->entries[index].name_offs]) : 0,
+		(uintptr_t)f, 0, f ? z->ar->entries[index].size : 0, !f, start);
+	return f;
+}
+
+void *zip_fopen_hook(void *za, const char *fname, uint32_t flags) {
+	dlog("zip_fopen(%s)\n", fname);
+	int64_t index = zip_name_locate_hook(za, fname, flags);
+	if (index < 0)
+		return NULL;
+	return zip_fopen_index_hook(za, index, flags);
+}
+
+int64_t zip_fread_hook(void *zf, void *buf, uint64_t count) {
+	if (!zf)
+		return -1;
+	uint64_t start = trace_begin();
+	uint64_t offset = obb_ftell((obb_file *)zf);
+	int64_t res = obb_fread((obb_file *)zf, buf, count);
+	trace_record(TRACE_ZIP_READ, 0, (uintptr_t)zf, offset, count, res < 0, start);
+	return res;
+}
+
+int zip_fseek_hook(void *zf, int64_t offset, int whence) {
+	if (!zf)
+		return -1;
+	uint64_t start = trace_begin();
+	int res = obb_fseek((obb_file *)zf, offset, whence);
+	trace_record(TRACE_ZIP_SEEK, 0, (uintptr_t)zf, offset, whence, res < 0, start);
+	return res;
+}
+
+int64_t zip_ftell_hook(void *zf) {
+	if (!zf)
+		return -1;
+	return obb_ftell((obb_file *)zf);
+}
+
+int zip_fclose_hook(void *zf) {
+	if (!zf)
+		return ZIP_ER_INVAL;
+	int error = ((obb_file *)zf)->error;
+	uint64_t start = trace_begin();
+	obb_fclose((obb_file *)zf);
+	trace_record(TRACE_ZIP_CLOSE, 0, (uintptr_t)zf, TRACE_NO_OFFSET, 0, 0, start);
+	return error;
+}
+
+static const char *zip_error_str(int error) {
+	switch (error) {
+	case ZIP_ER_OK:
+		return "No error";
+	case ZIP_ER_READ:
+		return "Read error";
+	case ZIP_ER_NOENT:
+		return "No such file";
+	case ZIP_ER_OPEN:
+		return "Can't open file";
+	case ZIP_ER_ZLIB:
+		return "Zlib error";
+	case ZIP_ER_MEMORY:
+		return "Malloc failure";
+	case ZIP_ER_COMPNOTSUPP:
+		return "Compression method not supported";
+	case ZIP_ER_INVAL:
+		return "Invalid argument";
+	case ZIP_ER_NOZIP:
+		return "Not a zip archive";
+	case ZIP_ER_INCONS:
+		return "Zip archive inconsistent";
+	case ZIP_ER_RDONLY:
+		return "Read-only archive";
+	case ZIP_ER_NOPASSWD:
+		return "No password provided";
+	case ZIP_ER_OPNOTSUPP:
+		return "Operation not supported";
+	default:
+		return "Unknown error";
+	}
+}
+
+const char *zip_strerror_hook(void *za) {
+	return zip_error_str(((zip_hook_t *)za)->error);
+}
+
+const char *zip_file_strerror_hook(void *zf) {
+	return zip_error_str(((obb_file *)zf)->error);
+}
+
+void zip_error_get_hook(void *za, int *zep, int *sep) {
+	zip_hook_t *z = (zip_hook_t *)za;
+	if (zep)
+		*zep = z->error;
+	if (sep)
+		*sep = 0;
+}
+
+void zip_error_clear_hook(void *za) {
+	if (za)
+		((zip_hook_t *)za)->error = ZIP_ER_OK;
+}
+
+void zip_file_error_clear_hook(void *zf) {
+	if (zf)
+		((obb_file *)zf)->error = ZIP_ER_OK;
+}
+
+void zip_file_error_get_hook(void *zf, int *zep, int *sep) {
+	if (zep)
+		*zep = ((obb_file *)zf)->error;
+	if (sep)
+		*sep = 0;
+}
+
+void *zip_get_error_hook(void *za) {
+	zip_hook_t *z = (zip_hook_t *)za;
+	z->zerr.zip_err = z->error;
+	z->zerr.sys_err = 0;
+	z->zerr.str = NULL;
+	return &z->zerr;
+}
+
+void *zip_file_get_error_hook(void *zf) {
+	obb_file *f = (obb_file *)zf;
+	f->zerr.zip_err = f->error;
+	f->zerr.sys_err = 0;
+	f->zerr.str = NULL;
+	return &f->zerr;
+}
+
+// Neither the OBB nor the packs carry comments, libzip reports those as empty strings
+const char *zip_get_archive_comment_hook(void *za, int *lenp, uint32_t flags) {
+	if (lenp)
+		*lenp = 0;
+	return "";
+}
+
+const char *zip_file_get_comment_hook(void *za, uint64_t index, uint32_t *lenp, uint32_t flags) {
+	zip_hook_t *z = (zip_hook_t *)za;
+	if (!zip_listed(z, index))
+		return NULL;
+	if (lenp)
+		*lenp = 0;
+	return "";
+}
+
+const char *zip_get_file_comment_hook(void *za, uint64_t index, int *lenp, int flags) {
+	return zip_file_get_comment_hook(za, index, (uint32_t *)lenp, flags);
+}
+
+int zip_set_default_password_hook(void *za, const char *password) {
+	return 0;
+}
+
+// Encrypted entries already fail with ZIP_ER_NOPASSWD, the password is of no use to us
+void *zip_fopen_encrypted_hook(void *za, const char *fname, uint32_t flags, const char *password) {
+	return zip_fopen_hook(za, fname, flags);
+}
+
+void *zip_fopen_index_encrypted_hook(void *za, uint64_t index, uint32_t flags, const char *password) {
+	return zip_fopen_index_hook(za, index, flags);
+}
+
+int zip_get_archive_flag_hook(void *za, uint32_t flag, uint32_t flags) {
+	return flag == ZIP_AFL_RDONLY;
+}
+
+int64_t zip_file_extra_fields_count_hook(void *za, uint64_t index, uint32_t flags) {
+	return 0;
+}
+
+const uint8_t *zip_file_extra_field_get_hook(void *za, uint64_t index, uint16_t idx, uint16_t *idp, uint16_t *lenp, uint32_t flags) {
+	((zip_hook_t *)za)->error = ZIP_ER_NOENT;
+	return NULL;
+}
+
+int zip_file_get_external_attributes_hook(void *za, uint64_t index, uint32_t flags, uint8_t *opsys, uint32_t *attributes) {
+	zip_hook_t *z = (zip_hook_t *)za;
+	if (!zip_listed(z, index))
+		return -1;
+	if (opsys)
+		*opsys = ZIP_OPSYS_DEFAULT;
+	if (attributes)
+		*attributes = 0;
+	return 0;
+}
+
+int zip_unchange_hook(void *za) {
+	return 0;
+}
+
+// Every call that would modify the archive, they all take it as first argument
+int zip_rdonly_hook(void *za) {
+	((zip_hook_t *)za)->error = ZIP_ER_RDONLY;
+	return -1;
+}
+
+// Sources bound to one of our archives, and archives opened on something else than a path
+void *zip_source_hook(void *za) {
+	if (za)
+		((zip_hook_t *)za)->error = ZIP_ER_OPNOTSUPP;
+	return NULL;
+}
+
+void *zip_fdopen_hook(int fd, int flags, int *errorp) {
+	if (errorp)
+		*errorp = ZIP_ER_OPNOTSUPP;
+	return NULL;
+}
+
+void *zip_open_from_source_hook(void *src, int flags, void *error) {
+	zip_error_bionic *ze = (zip_error_bionic *)error;
+	if (ze) {
+		ze->zip_err = ZIP_ER_OPNOTSUPP;
+		ze->sys_err = 0;
+	}
+	return NULL;
+}
+
+// Whatever else the game imports from libzip and we don't know about
+void *zip_unsupported_hook(void) {
+	sceClibPrintf("obb: unsupported libzip call\n");
+	return NULL;
+}
@@ -0,0 +1,77 @@
+#ifndef __OBB_H__
+#define __OBB_H__
+
+#include <stdint.h>
+
+typedef struct obb_archive obb_archive;
+typedef struct obb_file obb_file;
+
+typedef struct {
+	const char *name;
+	uint64_t index;
+	uint64_t size;
+	uint64_t comp_size;
+	uint32_t mtime;
+	uint32_t crc;
+	uint16_t method;
+	uint16_t flags;
+} obb_stat;
+
+obb_archive *obb_open(const char *path, int *error);
+void obb_close(obb_archive *ar);
+int64_t obb_num_entries(obb_archive *ar);
+int64_t obb_locate(obb_archive *ar, const char *name, uint32_t flags);
+int obb_stat_index(obb_archive *ar, uint64_t index, obb_stat *st);
+
+obb_file *obb_fopen_index(obb_archive *ar, uint64_t index, uint32_t flags, int *error);
+int64_t obb_fread(obb_file *f, void *buf, uint64_t count);
+int obb_fseek(obb_file *f, int64_t offset, int whence);
+int64_t obb_ftell(obb_file *f);
+void obb_fclose(obb_file *f);
+
+const char *obb_path(obb_archive *ar);
+int obb_prefetch_index(obb_archive *ar, uint64_t index);
+int obb_queue_index(obb_archive *ar, uint64_t index);
+
+// libzip ABI shims for the copy statically linked in libuaf.so
+void *zip_open_hook(const char *path, int flags, int *errorp);
+int zip_close_hook(void *za);
+void zip_discard_hook(void *za);
+int64_t zip_get_num_entries_hook(void *za, uint32_t flags);
+int zip_get_num_files_hook(void *za);
+const char *zip_get_name_hook(void *za, uint64_t index, uint32_t flags);
+int64_t zip_name_locate_hook(void *za, const char *fname, uint32_t flags);
+int zip_stat_hook(void *za, const char *fname, uint32_t flags, void *st);
+int zip_stat_index_hook(void *za, uint64_t index, uint32_t flags, void *st);
+void *zip_fopen_hook(void *za, const char *fname, uint32_t flags);
+void *zip_fopen_index_hook(void *za, uint64_t index, uint32_t flags);
+int64_t zip_fread_hook(void *zf, void *buf, uint64_t count);
+int zip_fseek_hook(void *zf, int64_t offset, int whence);
+int64_t zip_ftell_hook(void *zf);
+int zip_fclose_hook(void *zf);
+const char *zip_strerror_hook(void *za);
+const char *zip_file_strerror_hook(void *zf);
+void zip_error_get_hook(void *za, int *zep, int *sep);
+void zip_error_clear_hook(void *za);
+void zip_file_error_clear_hook(void *zf);
+void zip_file_error_get_hook(void *zf, int *zep, int *sep);
+void *zip_get_error_hook(void *za);
+void *zip_file_get_error_hook(void *zf);
+const char *zip_get_archive_comment_hook(void *za, int *lenp, uint32_t flags);
+const char *zip_file_get_comment_hook(void *za, uint64_t index, uint32_t *lenp, uint32_t flags);
+const char *zip_get_file_comment_hook(void *za, uint64_t index, int *lenp, int flags);
+int zip_set_default_password_hook(void *za, const char *password);
+void *zip_fopen_encrypted_hook(void *za, const char *fname, uint32_t flags, const char *password);
+void *zip_fopen_index_encrypted_hook(void *za, uint64_t index, uint32_t flags, const char *password);
+int zip_get_archive_flag_hook(void *za, uint32_t flag, uint32_t flags);
+int64_t zip_file_extra_fields_count_hook(void *za, uint64_t index, uint32_t flags);
+const uint8_t *zip_file_extra_field_get_hook(void *za, uint64_t index, uint16_t idx, uint16_t *idp, uint16_t *lenp, uint32_t flags);
+int zip_file_get_external_attributes_hook(void *za, uint64_t index, uint32_t flags, uint8_t *opsys, uint32_t *attributes);
+int zip_unchange_hook(void *za);
+int zip_rdonly_hook(void *za);
+void *zip_source_hook(void *za);
+void *zip_fdopen_hook(int fd, int flags, int *errorp);
+void *zip_open_from_source_hook(void *src, int flags, void *error);
+void *zip_unsupported_hook(void);
+
+#endif
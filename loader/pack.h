@@ -0,0 +1,61 @@
+#ifndef __PACK_H__
+#define __PACK_H__
+
+#include <stdint.h>
+
+// Loader-native replacement for main.obb, built on PC by tools/obb_repack.c.
+// Layout: pack_header, pack_entry[num_entries], pack_hash[num_entries], names,
+// then every entry data starting on a PACK_ALIGN boundary. The first num_listed
+// entries mirror the obb, loose assets packed along come after them.
+
+#define PACK_MAGIC 0x4B415056 // VPAK
+#define PACK_VERSION 2
+#define PACK_ALIGN 4096
+#define PACK_SOURCE_TAIL (64 * 1024) // obb bytes covered by source_crc, central directory included
+
+enum {
+	PACK_STORED = 0,
+	PACK_ZSTD = 1
+};
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_entries;
+	uint32_t names_size;
+	uint32_t num_listed; // entries the game sees through libzip
+	uint32_t source_crc; // crc32 of the last PACK_SOURCE_TAIL bytes of the obb
+	uint64_t source_size; // size of the obb the pack was built from
+	uint64_t data_offs; // first entry data, right after the names
+} pack_header;
+
+typedef struct {
+	uint64_t offs;
+	uint64_t comp_size;
+	uint64_t size;
+	uint64_t orig_comp_size; // as stored in the obb
+	uint32_t crc;
+	uint32_t dos_time;
+	uint32_t name_offs; // names are NUL terminated
+	uint16_t name_len;
+	uint16_t orig_method; // zip method in the obb
+	uint8_t method;
+	uint8_t pad[7];
+} pack_entry;
+
+// Sorted by hash, the FNV-1a of the entry name as used by the obb index
+typedef struct {
+	uint32_t hash;
+	uint32_t index;
+} pack_hash;
+
+static inline uint32_t pack_hash_name(const char *name, uint32_t len) {
+	uint32_t h = 0x811C9DC5;
+	for (uint32_t i = 0; i < len; i++) {
+		h ^= (uint8_t)name[i];
+		h *= 0x01000193;
+	}
+	return h;
+}
+
+#endif
@@ -0,0 +1,300 @@
+/* prefetch.c -- profile driven cache warming during boot
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "prefetch.h"
+#include "file_cache.h"
+#include "obb.h"
+#include "io_sched.h"
+
+#define PREFETCH_MAX_ENTRIES 4096
+#define PREFETCH_TABLE_SIZE 8192 // power of two, at least twice the max entries
+#define PREFETCH_AHEAD 32 // max entries warmed past the last one the game reached
+
+enum {
+	PREFETCH_FILE,
+	PREFETCH_OBB
+};
+
+typedef struct {
+	uint32_t hash;
+	uint8_t type;
+	uint8_t done;
+	char *archive; // PREFETCH_OBB only
+	char *name;
+} prefetch_entry;
+
+typedef struct {
+	prefetch_entry *entries;
+	uint32_t count;
+	uint16_t *table; // entry index + 1, 0 is empty
+} prefetch_list;
+
+static char profile_path[256];
+static prefetch_list profile; // recorded in a previous session
+static prefetch_list record; // being recorded in this session
+static volatile int recording = 0;
+static int running = 0;
+static uint32_t cursor = 0; // next profile entry to warm
+static uint32_t game_pos = 0; // profile entry following the last one the game opened
+static prefetch_stats stats;
+static pthread_t prefetch_thread_id;
+static pthread_mutex_t prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefetch_cond = PTHREAD_COND_INITIALIZER;
+
+static uint32_t hash_key(int type, const char *archive, const char *name) {
+	uint32_t h = 0x811C9DC5 ^ type;
+	if (archive) {
+		while (*archive) {
+			h ^= (uint8_t)tolower((uint8_t)*archive++);
+			h *= 0x01000193;
+		}
+		h ^= ':';
+		h *= 0x01000193;
+	}
+	while (*name) {
+		h ^= (uint8_t)tolower((uint8_t)*name++);
+		h *= 0x01000193;
+	}
+	return h ? h : 1;
+}
+
+static int list_find(prefetch_list *l, uint32_t hash, int type, const char *archive, const char *name) {
+	uint32_t i = hash & (PREFETCH_TABLE_SIZE - 1);
+	while (l->table[i]) {
+		prefetch_entry *e = &l->entries[l->table[i] - 1];
+		if (e->hash == hash && e->type == type && !strcasecmp(e->name, name) &&
+			(!archive || !strcasecmp(e->archive, archive)))
+			return l->table[i] - 1;
+		i = (i + 1) & (PREFETCH_TABLE_SIZE - 1);
+	}
+	return -1;
+}
+
+static int list_add(prefetch_list *l, uint32_t hash, int type, const char *archive, const char *name) {
+	if (l->count >= PREFETCH_MAX_ENTRIES)
+		return -1;
+	prefetch_entry *e = &l->entries[l->count];
+	e->hash = hash;
+	e->type = type;
+	e->done = 0;
+	e->archive = archive ? strdup(archive) : NULL;
+	e->name = strdup(name);
+	if (!e->name || (archive && !e->archive)) {
+		free(e->archive);
+		free(e->name);
+		return -1;
+	}
+	uint32_t i = hash & (PREFETCH_TABLE_SIZE - 1);
+	while (l->table[i])
+		i = (i + 1) & (PREFETCH_TABLE_SIZE - 1);
+	l->table[i] = ++l->count;
+	return l->count - 1;
+}
+
+static int list_init(prefetch_list *l) {
+	l->entries = calloc(PREFETCH_MAX_ENTRIES, sizeof(prefetch_entry));
+	l->table = calloc(PREFETCH_TABLE_SIZE, sizeof(uint16_t));
+	l->count = 0;
+	return l->entries && l->table ? 0 : -1;
+}
+
+static void list_free(prefetch_list *l) {
+	for (uint32_t i = 0; i < l->count; i++) {
+		free(l->entries[i].archive);
+		free(l->entries[i].name);
+	}
+	free(l->entries);
+	free(l->table);
+	memset(l, 0, sizeof(prefetch_list));
+}
+
+// One entry per line, either "F\t<path>" or "Z\t<archive>\t<entry>"
+static void load_profile(const char *path) {
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return;
+	if (list_init(&profile) < 0) {
+		fclose(f);
+		list_free(&profile);
+		return;
+	}
+
+	char line[1024];
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\r\n")] = 0;
+		if (line[0] == 'F' && line[1] == '\t') {
+			list_add(&profile, hash_key(PREFETCH_FILE, NULL, &line[2]), PREFETCH_FILE, NULL, &line[2]);
+		} else if (line[0] == 'Z' && line[1] == '\t') {
+			char *name = strchr(&line[2], '\t');
+			if (!name)
+				continue;
+			*name++ = 0;
+			list_add(&profile, hash_key(PREFETCH_OBB, &line[2], name), PREFETCH_OBB, &line[2], name);
+		}
+	}
+	fclose(f);
+	stats.profile_entries = profile.count;
+}
+
+static void save_profile(const char *path) {
+	FILE *f = fopen(path, "w");
+	if (!f)
+		return;
+	for (uint32_t i = 0; i < record.count; i++) {
+		prefetch_entry *e = &record.entries[i];
+		if (e->type == PREFETCH_FILE)
+			fprintf(f, "F\t%s\n", e->name);
+		else
+			fprintf(f, "Z\t%s\t%s\n", e->archive, e->name);
+	}
+	fclose(f);
+}
+
+static void warm(prefetch_entry *e, obb_archive **ar) {
+	if (e->type == PREFETCH_FILE) {
+		file_cache_entry *cached = file_cache_get(e->name);
+		if (cached)
+			file_cache_release(cached);
+		return;
+	}
+
+	// Archives are shared, so keeping our reference around is cheap
+	if (!*ar || strcasecmp(obb_path(*ar), e->archive)) {
+		if (*ar)
+			obb_close(*ar);
+		int error;
+		*ar = obb_open(e->archive, &error);
+		if (!*ar)
+			return;
+	}
+	int64_t index = obb_locate(*ar, e->name, 0);
+	if (index >= 0)
+		obb_queue_index(*ar, index);
+}
+
+static void *prefetch_thread(void *arg) {
+	obb_archive *ar = NULL;
+	io_set_thread_class(IO_CLASS_BACKGROUND);
+	pthread_mutex_lock(&prefetch_lock);
+	for (;;) {
+		while (running && (cursor >= profile.count || cursor >= game_pos + PREFETCH_AHEAD))
+			pthread_cond_wait(&prefetch_cond, &prefetch_lock);
+		if (!running)
+			break;
+
+		// The game got past us, there's no point in loading what it already opened
+		if (cursor < game_pos)
+			cursor = game_pos;
+		prefetch_entry *e = &profile.entries[cursor++];
+		if (e->done)
+			continue;
+		e->done = 1;
+		stats.warmed++;
+		pthread_mutex_unlock(&prefetch_lock);
+
+		warm(e, &ar);
+
+		pthread_mutex_lock(&prefetch_lock);
+	}
+	pthread_mutex_unlock(&prefetch_lock);
+
+	if (ar)
+		obb_close(ar);
+	return NULL;
+}
+
+void prefetch_init(const char *path) {
+	strncpy(profile_path, path, sizeof(profile_path) - 1);
+	if (list_init(&record) < 0) {
+		list_free(&record);
+		return;
+	}
+	recording = 1;
+
+	load_profile(path);
+	if (!profile.count)
+		return;
+
+	sceClibPrintf("prefetch: warming caches with %u profiled entries\n", profile.count);
+	running = 1;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, 64 * 1024);
+	pthread_create(&prefetch_thread_id, &attr, prefetch_thread, NULL);
+}
+
+// Stops warming and stores the accesses recorded so far for the next boot
+void prefetch_finish(void) {
+	if (!recording)
+		return;
+
+	pthread_mutex_lock(&prefetch_lock);
+	recording = 0;
+	int was_running = running;
+	running = 0;
+	pthread_cond_signal(&prefetch_cond);
+	pthread_mutex_unlock(&prefetch_lock);
+	if (was_running)
+		pthread_join(prefetch_thread_id, NULL);
+
+	sceClibPrintf("prefetch: %u warmed, %u reached by the game first, %u accesses off profile\n",
+		stats.warmed, stats.skipped, stats.diverged);
+	save_profile(profile_path);
+	list_free(&record);
+	list_free(&profile);
+}
+
+static void notify(int type, const char *archive, const char *name) {
+	if (!recording)
+		return;
+
+	uint32_t hash = hash_key(type, archive, name);
+	pthread_mutex_lock(&prefetch_lock);
+	if (recording && list_find(&record, hash, type, archive, name) < 0)
+		list_add(&record, hash, type, archive, name);
+
+	if (running) {
+		int idx = list_find(&profile, hash, type, archive, name);
+		if (idx < 0) {
+			stats.diverged++;
+		} else {
+			if (!profile.entries[idx].done) {
+				profile.entries[idx].done = 1;
+				stats.skipped++;
+			}
+			// Follow the game when it jumps ahead in the profile
+			if (idx + 1 > game_pos) {
+				game_pos = idx + 1;
+				pthread_cond_signal(&prefetch_cond);
+			}
+		}
+	}
+	pthread_mutex_unlock(&prefetch_lock);
+}
+
+void prefetch_notify_file(const char *path) {
+	notify(PREFETCH_FILE, NULL, path);
+}
+
+void prefetch_notify_obb(const char *archive, const char *name) {
+	notify(PREFETCH_OBB, archive, name);
+}
+
+void prefetch_get_stats(prefetch_stats *out) {
+	pthread_mutex_lock(&prefetch_lock);
+	*out = stats;
+	pthread_mutex_unlock(&prefetch_lock);
+}
@@ -0,0 +1,21 @@
+#ifndef __PREFETCH_H__
+#define __PREFETCH_H__
+
+#include <stdint.h>
+
+typedef struct {
+	uint32_t profile_entries;
+	uint32_t warmed; // entries loaded ahead of the game
+	uint32_t skipped; // entries the game reached first
+	uint32_t diverged; // accesses not in the profile
+} prefetch_stats;
+
+void prefetch_init(const char *profile_path);
+void prefetch_finish(void);
+
+void prefetch_notify_file(const char *path);
+void prefetch_notify_obb(const char *archive, const char *name);
+
+void prefetch_get_stats(prefetch_stats *stats);
+
+#endif
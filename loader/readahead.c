@@ -0,0 +1,321 @@
+/* readahead.c -- asynchronous sequential read-ahead for streamed files
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "readahead.h"
+#include "fd_pool.h"
+#include "io_sched.h"
+
+#define RA_SEQUENTIAL_THRESHOLD 2
+
+enum {
+	RA_EMPTY,
+	RA_LOADING,
+	RA_READY
+};
+
+typedef struct {
+	uint8_t *data;
+	uint64_t offs;
+	uint32_t len;
+	int state;
+	int prefetched;
+	struct ra_file *owner;
+} ra_buffer;
+
+struct ra_file {
+	SceUID fd;
+	uint64_t size;
+	uint64_t pos;
+	uint64_t last_end;
+	int sequential; // number of back to back sequential reads
+	int io_class;
+	ra_buffer buf[2];
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	char path[];
+};
+
+static uint32_t ra_window = 0;
+
+static ra_file *fds[READAHEAD_MAX_FDS];
+static pthread_mutex_t fds_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static readahead_stats stats;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Runs on the I/O scheduler thread
+static void prefetch_done(void *arg, int res) {
+	ra_buffer *b = arg;
+	ra_file *f = b->owner;
+	pthread_mutex_lock(&f->lock);
+	b->len = res > 0 ? res : 0;
+	b->state = res > 0 ? RA_READY : RA_EMPTY;
+	b->prefetched = 1;
+	pthread_cond_broadcast(&f->cond);
+	pthread_mutex_unlock(&f->lock);
+}
+
+// Prefetches are issued through the I/O scheduler, which must be running already
+void readahead_init(uint32_t window) {
+	ra_window = window;
+}
+
+ra_file *ra_open(const char *path) {
+	if (!ra_window)
+		return NULL;
+
+	SceIoStat st;
+	if (sceIoGetstat(path, &st) < 0 || SCE_S_ISDIR(st.st_mode))
+		return NULL;
+
+	size_t len = strlen(path);
+	ra_file *f = calloc(1, sizeof(ra_file) + len + 1);
+	if (!f)
+		return NULL;
+	memcpy(f->path, path, len + 1);
+	f->buf[0].data = memalign(64, ra_window);
+	f->buf[1].data = memalign(64, ra_window);
+	f->fd = fd_pool_open(path);
+	if (!f->buf[0].data || !f->buf[1].data || f->fd < 0) {
+		if (f->fd >= 0)
+			fd_pool_close(f->fd);
+		free(f->buf[0].data);
+		free(f->buf[1].data);
+		free(f);
+		return NULL;
+	}
+	f->size = st.st_size;
+	f->io_class = io_class_for_path(path);
+	f->buf[0].owner = f;
+	f->buf[1].owner = f;
+	pthread_mutex_init(&f->lock, NULL);
+	pthread_cond_init(&f->cond, NULL);
+	return f;
+}
+
+static ra_buffer *find_buffer(ra_file *f, uint64_t offs) {
+	for (int i = 0; i < 2; i++) {
+		ra_buffer *b = &f->buf[i];
+		if (b->state == RA_EMPTY || offs < b->offs)
+			continue;
+		if (b->state == RA_LOADING ? offs < b->offs + ra_window : offs < b->offs + b->len)
+			return b;
+	}
+	return NULL;
+}
+
+static int schedule_prefetch(ra_file *f, ra_buffer *cur) {
+	uint64_t next = cur->offs + cur->len;
+	if (next >= f->size || find_buffer(f, next))
+		return 0;
+
+	// Only one buffer can ever be in flight, the other one is being consumed
+	ra_buffer *b = cur == &f->buf[0] ? &f->buf[1] : &f->buf[0];
+	if (b->state == RA_LOADING)
+		return 0;
+
+	uint32_t len = f->size - next > ra_window ? ra_window : f->size - next;
+	if (io_submit(f->fd, b->data, len, next, f->io_class, prefetch_done, b) < 0)
+		return 0;
+	b->state = RA_LOADING;
+	b->offs = next;
+	b->len = 0;
+	return 1;
+}
+
+int64_t ra_read(ra_file *f, void *buf, uint64_t count) {
+	uint8_t *dst = (uint8_t *)buf;
+	uint64_t stall = 0;
+	int missed = 0, from_prefetch = 0, prefetched = 0;
+	ra_buffer *last = NULL;
+
+	pthread_mutex_lock(&f->lock);
+	f->sequential = f->pos == f->last_end ? f->sequential + 1 : 0;
+	if (count > f->size - f->pos)
+		count = f->pos < f->size ? f->size - f->pos : 0;
+
+	uint64_t done = 0;
+	while (done < count) {
+		ra_buffer *b = find_buffer(f, f->pos);
+		if (b && b->state == RA_LOADING) {
+			uint64_t t = sceKernelGetProcessTimeWide();
+			while (b->state == RA_LOADING)
+				pthread_cond_wait(&f->cond, &f->lock);
+			stall += sceKernelGetProcessTimeWide() - t;
+			continue;
+		}
+
+		if (!b) {
+			missed = 1;
+			if (!f->sequential || count - done >= ra_window) {
+				// Random access or big reads, buffering would only add a copy. The lock
+				// can't be held meanwhile, the scheduler may be completing a prefetch of ours.
+				pthread_mutex_unlock(&f->lock);
+				int res = io_pread(f->fd, dst + done, count - done, f->pos, f->io_class);
+				pthread_mutex_lock(&f->lock);
+				if (res <= 0)
+					break;
+				f->pos += res;
+				done += res;
+				continue;
+			}
+
+			// Sequential small read with nothing buffered, fill a window synchronously
+			if (f->buf[0].state == RA_LOADING)
+				b = &f->buf[1];
+			else if (f->buf[1].state == RA_LOADING)
+				b = &f->buf[0];
+			else
+				b = f->buf[0].offs <= f->buf[1].offs ? &f->buf[0] : &f->buf[1];
+			uint32_t len = f->size - f->pos > ra_window ? ra_window : f->size - f->pos;
+			b->state = RA_LOADING;
+			b->offs = f->pos;
+			b->len = 0;
+			pthread_mutex_unlock(&f->lock);
+			int res = io_pread(f->fd, b->data, len, b->offs, f->io_class);
+			pthread_mutex_lock(&f->lock);
+			pthread_cond_broadcast(&f->cond);
+			if (res <= 0) {
+				b->state = RA_EMPTY;
+				break;
+			}
+			b->len = res;
+			b->state = RA_READY;
+			b->prefetched = 0;
+		} else if (b->prefetched) {
+			from_prefetch = 1;
+		}
+
+		uint32_t n = b->offs + b->len - f->pos;
+		if (n > count - done)
+			n = count - done;
+		sceClibMemcpy(dst + done, &b->data[f->pos - b->offs], n);
+		f->pos += n;
+		done += n;
+		last = b;
+	}
+	f->last_end = f->pos;
+
+	if (last && f->sequential >= RA_SEQUENTIAL_THRESHOLD)
+		prefetched = schedule_prefetch(f, last);
+	pthread_mutex_unlock(&f->lock);
+
+	pthread_mutex_lock(&stats_lock);
+	stats.reads++;
+	stats.bytes += done;
+	stats.stall_us += stall;
+	stats.prefetches += prefetched;
+	if (missed)
+		stats.misses++;
+	else if (from_prefetch)
+		stats.prefetch_hits++;
+	pthread_mutex_unlock(&stats_lock);
+	return done;
+}
+
+int64_t ra_seek(ra_file *f, int64_t offset, int whence) {
+	pthread_mutex_lock(&f->lock);
+	int64_t pos;
+	switch (whence) {
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = f->pos + offset;
+		break;
+	case SEEK_END:
+		pos = f->size + offset;
+		break;
+	default:
+		pos = -1;
+		break;
+	}
+	if (pos >= 0)
+		f->pos = pos;
+	pthread_mutex_unlock(&f->lock);
+	return pos;
+}
+
+uint64_t ra_size(ra_file *f) {
+	return f->size;
+}
+
+const char *ra_path(ra_file *f) {
+	return f->path;
+}
+
+void ra_close(ra_file *f) {
+	// In-flight prefetches still reference the handle
+	pthread_mutex_lock(&f->lock);
+	while (f->buf[0].state == RA_LOADING || f->buf[1].state == RA_LOADING)
+		pthread_cond_wait(&f->cond, &f->lock);
+	pthread_mutex_unlock(&f->lock);
+
+	fd_pool_close(f->fd);
+	pthread_cond_destroy(&f->cond);
+	pthread_mutex_destroy(&f->lock);
+	free(f->buf[0].data);
+	free(f->buf[1].data);
+	free(f);
+}
+
+// Positional read for callers doing their own buffering, keeps the sequential
+// detection working as long as offsets keep moving forward
+int64_t ra_pread(ra_file *f, void *buf, uint64_t count, uint64_t offs) {
+	if (ra_seek(f, offs, SEEK_SET) < 0)
+		return -1;
+	return ra_read(f, buf, count);
+}
+
+int ra_open_fd(const char *path) {
+	ra_file *ra = ra_open(path);
+	if (!ra)
+		return -1;
+
+	pthread_mutex_lock(&fds_lock);
+	for (int i = 0; i < READAHEAD_MAX_FDS; i++) {
+		if (!fds[i]) {
+			fds[i] = ra;
+			pthread_mutex_unlock(&fds_lock);
+			return READAHEAD_FD_BASE + i;
+		}
+	}
+	pthread_mutex_unlock(&fds_lock);
+	ra_close(ra);
+	return -1;
+}
+
+ra_file *ra_from_fd(int fd) {
+	if (fd < READAHEAD_FD_BASE || fd >= READAHEAD_FD_BASE + READAHEAD_MAX_FDS)
+		return NULL;
+	return fds[fd - READAHEAD_FD_BASE];
+}
+
+int ra_close_fd(int fd) {
+	ra_file *ra = ra_from_fd(fd);
+	if (!ra)
+		return -1;
+	pthread_mutex_lock(&fds_lock);
+	fds[fd - READAHEAD_FD_BASE] = NULL;
+	pthread_mutex_unlock(&fds_lock);
+	ra_close(ra);
+	return 0;
+}
+
+void readahead_get_stats(readahead_stats *out) {
+	pthread_mutex_lock(&stats_lock);
+	*out = stats;
+	pthread_mutex_unlock(&stats_lock);
+}
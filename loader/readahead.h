@@ -0,0 +1,37 @@
+#ifndef __READAHEAD_H__
+#define __READAHEAD_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define READAHEAD_FD_BASE 0x4000
+#define READAHEAD_MAX_FDS 64
+
+typedef struct ra_file ra_file;
+
+typedef struct {
+	uint32_t reads;
+	uint32_t prefetch_hits; // reads fully served from prefetched data
+	uint32_t misses; // reads which had to wait on a synchronous card access
+	uint32_t prefetches;
+	uint64_t stall_us; // time spent waiting for in-flight prefetches
+	uint64_t bytes;
+} readahead_stats;
+
+void readahead_init(uint32_t window);
+
+ra_file *ra_open(const char *path);
+int64_t ra_read(ra_file *f, void *buf, uint64_t count);
+int64_t ra_pread(ra_file *f, void *buf, uint64_t count, uint64_t offs);
+int64_t ra_seek(ra_file *f, int64_t offset, int whence);
+uint64_t ra_size(ra_file *f);
+const char *ra_path(ra_file *f);
+void ra_close(ra_file *f);
+
+int ra_open_fd(const char *path);
+ra_file *ra_from_fd(int fd);
+int ra_close_fd(int fd);
+
+void readahead_get_stats(readahead_stats *stats);
+
+#endif
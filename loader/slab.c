@@ -0,0 +1,791 @@
+/* slab.c -- size-class allocator with per-thread caches for the game heap
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "slab.h"
+#include "heap_prof.h"
+
+#ifdef __vita__
+#include <vitasdk.h>
+#define current_thread() ((uint32_t)sceKernelGetThreadId())
+#define current_time() sceKernelGetProcessTimeWide()
+#else
+#include <time.h>
+#define current_thread() ((uint32_t)(uintptr_t)pthread_self())
+static uint64_t current_time(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+#endif
+
+#define SLAB_SPAN_SIZE (64 * 1024) // carved into objects of a single class
+#define SLAB_PAGE_SIZE 0x1000
+#define SLAB_MIN_SIZE 16
+#define SLAB_MAX_SMALL 8192 // bigger requests are served as page runs
+#define SLAB_NUM_CLASSES 32
+#define SLAB_CACHE_BYTES (32 * 1024) // per class, a thread cache holds about this much
+#define SLAB_CACHE_MIN 4
+#define SLAB_CACHE_MAX 128
+#define SLAB_HEAP_CACHE_DIV 4 // MemoryId heap caches hold this much less, a thread may feed many heaps
+#define SLAB_BULK_MIN_SPANS 4 // smaller MemoryId heaps keep their spans when they empty out
+#define SLAB_BULK_IDLE_US (2 * 1000 * 1000) // emptied heaps wait this long before handing their spans back
+
+typedef struct slab_object {
+	struct slab_object *next;
+} slab_object;
+
+typedef struct {
+	pthread_mutex_t lock;
+	slab_object *free; // objects given back by thread caches
+	uint32_t free_count;
+	uint8_t *bump; // not yet carved tail of the current span
+	uint8_t *bump_end;
+} slab_class;
+
+typedef struct slab_heap_cache {
+	slab_object *head[SLAB_NUM_CLASSES];
+	uint32_t count[SLAB_NUM_CLASSES];
+	// Written by the owning thread alone, the others only sum them up. They wrap
+	// below zero in a thread freeing more than it allocated.
+	uint32_t allocs;
+	uint32_t live_blocks;
+	size_t live_bytes;
+	struct slab_heap_cache *next;
+} slab_heap_cache;
+
+// Heap 0 serves plain malloc through the thread caches. The others hold the
+// allocations of a single ITF MemoryId and get fed through thread caches of their own.
+typedef struct {
+	pthread_mutex_t lock;
+	slab_class classes[SLAB_NUM_CLASSES];
+	slab_heap_stats stats; // counters of exited threads and of cacheless allocations, under the lock
+	slab_heap_cache *caches; // of every thread using the heap, under the lock
+	size_t handed_bytes; // away from the central lists, thread caches included
+	uint64_t idle_since; // first collect that found nothing live, 0 while in use
+} slab_heap;
+
+// Only ever touched by its own thread, so no locking at all
+typedef struct {
+	slab_object *head[SLAB_NUM_CLASSES];
+	uint32_t count[SLAB_NUM_CLASSES];
+	slab_heap_cache *heaps[SLAB_MAX_HEAPS]; // created on first use of a MemoryId heap
+} slab_cache;
+
+static uint8_t *arena = NULL, *arena_end = NULL;
+static uint8_t *arena_top = NULL; // next span to hand out
+static uint8_t *span_class = NULL; // class + 1 of every span in use
+static uint8_t *span_heap = NULL;
+static uint8_t *free_spans = NULL; // given back by emptied heaps, linked through their first word
+static uint16_t *span_free_objs = NULL; // scratch counts of slab_collect
+static uint32_t heap0_max_spans = 0; // the rest of the arena is kept for MemoryId heaps
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t collect_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static slab_heap heaps[SLAB_MAX_HEAPS];
+static slab_class *classes = heaps[0].classes;
+static uint32_t class_size[SLAB_NUM_CLASSES];
+static uint32_t cache_limit[SLAB_NUM_CLASSES];
+static uint32_t heap_cache_limit[SLAB_NUM_CLASSES];
+static uint8_t size_class[SLAB_MAX_SMALL / SLAB_MIN_SIZE + 1];
+static int num_classes = 0;
+
+static pthread_key_t cache_key;
+static slab_stats stats;
+
+#define count_stat(field) __atomic_fetch_add(&stats.field, 1, __ATOMIC_RELAXED)
+// Plain loads and stores, only the owner of the field ever writes it
+#define own_add(field, n) __atomic_store_n(&(field), (field) + (n), __ATOMIC_RELAXED)
+#define own_sub(field, n) __atomic_store_n(&(field), (field) - (n), __ATOMIC_RELAXED)
+
+#ifdef ENABLE_ALLOC_TRACE
+#define SLAB_TRACE_BATCH 4096
+
+static FILE *trace_file = NULL;
+static slab_trace_record trace_buf[SLAB_TRACE_BATCH];
+static int trace_used = 0;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void slab_trace_init(const char *path) {
+	FILE *f = fopen(path, "wb");
+	if (!f)
+		return;
+	uint32_t magic = SLAB_TRACE_MAGIC;
+	fwrite(&magic, 1, sizeof(magic), f);
+	trace_file = f;
+}
+
+static void trace_alloc(int type, void *ptr, void *old, size_t size, size_t align) {
+	if (!trace_file)
+		return;
+	pthread_mutex_lock(&trace_lock);
+	slab_trace_record *r = &trace_buf[trace_used++];
+	r->type = type;
+	r->thread = current_thread();
+	r->ptr = (uint32_t)(uintptr_t)ptr;
+	r->old = (uint32_t)(uintptr_t)old;
+	r->size = size;
+	r->align = align;
+	if (trace_used == SLAB_TRACE_BATCH) {
+		fwrite(trace_buf, sizeof(slab_trace_record), trace_used, trace_file);
+		fflush(trace_file);
+		trace_used = 0;
+	}
+	pthread_mutex_unlock(&trace_lock);
+}
+#else
+#define trace_alloc(type, ptr, old, size, align)
+#endif
+
+static size_t page_round(size_t size) {
+	return (size + SLAB_PAGE_SIZE - 1) & ~(SLAB_PAGE_SIZE - 1);
+}
+
+static int is_owned(void *p) {
+	return (uint8_t *)p >= arena && (uint8_t *)p < arena_end;
+}
+
+static int class_of(void *p) {
+	return span_class[((uint8_t *)p - arena) / SLAB_SPAN_SIZE] - 1;
+}
+
+static int heap_of(void *p) {
+	return span_heap[((uint8_t *)p - arena) / SLAB_SPAN_SIZE];
+}
+
+// Called with the class lock held
+static int new_span(int h, int c) {
+	pthread_mutex_lock(&arena_lock);
+	uint8_t *span = free_spans;
+	if (!h && heaps[0].stats.spans >= heap0_max_spans) {
+		pthread_mutex_unlock(&arena_lock);
+		return 0;
+	}
+	if (span) {
+		free_spans = *(uint8_t **)span;
+	} else if (arena_top < arena_end) {
+		span = arena_top;
+		arena_top += SLAB_SPAN_SIZE;
+	} else {
+		pthread_mutex_unlock(&arena_lock);
+		return 0;
+	}
+	span_class[(span - arena) / SLAB_SPAN_SIZE] = c + 1;
+	span_heap[(span - arena) / SLAB_SPAN_SIZE] = h;
+	heaps[h].stats.spans++;
+	stats.spans++;
+	stats.arena_used += SLAB_SPAN_SIZE;
+	pthread_mutex_unlock(&arena_lock);
+
+	slab_class *sc = &heaps[h].classes[c];
+	sc->bump = span;
+	sc->bump_end = span + (SLAB_SPAN_SIZE / class_size[c]) * class_size[c];
+	return 1;
+}
+
+// Hands back the spans of a class whose objects all sit on its central list, or were
+// never carved. Objects parked in thread caches keep their span, nothing else can
+// reach the ones on the central list while the class lock is held. Called under
+// slab_collect's lock too, it owns the scratch counts.
+static int release_free_spans(int h, int c) {
+	slab_class *sc = &heaps[h].classes[c];
+	uint32_t per_span = SLAB_SPAN_SIZE / class_size[c];
+	for (slab_object *o = sc->free; o; o = o->next)
+		span_free_objs[((uint8_t *)o - arena) / SLAB_SPAN_SIZE]++;
+	if (sc->bump != sc->bump_end)
+		span_free_objs[(sc->bump - arena) / SLAB_SPAN_SIZE] += (sc->bump_end - sc->bump) / class_size[c];
+
+	pthread_mutex_lock(&arena_lock);
+	int num_spans = (arena_top - arena) / SLAB_SPAN_SIZE, released = 0;
+	for (int i = 0; i < num_spans; i++) {
+		if (span_class[i] == c + 1 && span_heap[i] == h && span_free_objs[i] == per_span)
+			released++;
+		else
+			span_free_objs[i] = 0;
+	}
+	pthread_mutex_unlock(&arena_lock);
+	// Only the lock held here hands out spans of this class, the picked ones stay free
+	if (!released)
+		return 0;
+
+	// Off the list before the spans get linked through their first word
+	slab_object **p = &sc->free;
+	while (*p) {
+		if (span_free_objs[((uint8_t *)*p - arena) / SLAB_SPAN_SIZE]) {
+			*p = (*p)->next;
+			sc->free_count--;
+		} else {
+			p = &(*p)->next;
+		}
+	}
+	if (sc->bump != sc->bump_end && span_free_objs[(sc->bump - arena) / SLAB_SPAN_SIZE])
+		sc->bump = sc->bump_end = NULL;
+
+	pthread_mutex_lock(&arena_lock);
+	for (int i = 0; i < num_spans; i++) {
+		if (!span_free_objs[i])
+			continue;
+		uint8_t *span = arena + i * SLAB_SPAN_SIZE;
+		*(uint8_t **)span = free_spans;
+		free_spans = span;
+		span_class[i] = 0;
+		span_free_objs[i] = 0;
+		heaps[h].stats.spans--;
+		stats.spans--;
+		stats.arena_used -= SLAB_SPAN_SIZE;
+	}
+	pthread_mutex_unlock(&arena_lock);
+	return released;
+}
+
+// Moves half a cache worth of objects from the central list, carving fresh spans if needed
+static int refill(slab_cache *tc, int c) {
+	slab_class *sc = &classes[c];
+	slab_object *head = NULL;
+	uint32_t n = 0, want = cache_limit[c] / 2;
+	pthread_mutex_lock(&sc->lock);
+	while (n < want && sc->free) {
+		slab_object *o = sc->free;
+		sc->free = o->next;
+		o->next = head;
+		head = o;
+		n++;
+	}
+	sc->free_count -= n;
+	while (n < want) {
+		if (sc->bump == sc->bump_end && !new_span(0, c))
+			break;
+		slab_object *o = (slab_object *)sc->bump;
+		sc->bump += class_size[c];
+		o->next = head;
+		head = o;
+		n++;
+	}
+	pthread_mutex_unlock(&sc->lock);
+	count_stat(refills);
+	tc->head[c] = head;
+	tc->count[c] = n;
+	return n;
+}
+
+// Hands the objects past the first count ones back, the list is cut without the lock held
+static void release(slab_cache *tc, int c, uint32_t keep) {
+	slab_object *first = tc->head[c], *last = NULL;
+	for (uint32_t i = 0; i < keep; i++) {
+		last = first;
+		first = first->next;
+	}
+	if (!first)
+		return;
+	slab_object *tail = first;
+	while (tail->next)
+		tail = tail->next;
+	if (last)
+		last->next = NULL;
+	else
+		tc->head[c] = NULL;
+	uint32_t moved = tc->count[c] - keep;
+	tc->count[c] = keep;
+
+	slab_class *sc = &classes[c];
+	pthread_mutex_lock(&sc->lock);
+	tail->next = sc->free;
+	sc->free = first;
+	sc->free_count += moved;
+	pthread_mutex_unlock(&sc->lock);
+	count_stat(releases);
+}
+
+// Batch granularity, so the peak includes whatever sits in thread caches
+static void heap_count_handed(slab_heap *hp, size_t bytes) {
+	size_t handed = __atomic_add_fetch(&hp->handed_bytes, bytes, __ATOMIC_RELAXED);
+	size_t peak = __atomic_load_n(&hp->stats.peak_bytes, __ATOMIC_RELAXED);
+	while (handed > peak && !__atomic_compare_exchange_n(&hp->stats.peak_bytes, &peak, handed, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+// Same as refill and release, for MemoryId heaps
+static int heap_refill(slab_heap *hp, slab_heap_cache *hc, int h, int c) {
+	slab_class *sc = &hp->classes[c];
+	slab_object *head = NULL;
+	uint32_t n = 0, want = heap_cache_limit[c] / 2;
+	pthread_mutex_lock(&sc->lock);
+	while (n < want && sc->free) {
+		slab_object *o = sc->free;
+		sc->free = o->next;
+		o->next = head;
+		head = o;
+		n++;
+	}
+	sc->free_count -= n;
+	while (n < want) {
+		if (sc->bump == sc->bump_end && !new_span(h, c))
+			break;
+		slab_object *o = (slab_object *)sc->bump;
+		sc->bump += class_size[c];
+		o->next = head;
+		head = o;
+		n++;
+	}
+	pthread_mutex_unlock(&sc->lock);
+	heap_count_handed(hp, (size_t)n * class_size[c]);
+	count_stat(refills);
+	hc->head[c] = head;
+	hc->count[c] = n;
+	return n;
+}
+
+static void heap_release_cached(slab_heap *hp, slab_heap_cache *hc, int c, uint32_t keep) {
+	slab_object *first = hc->head[c], *last = NULL;
+	for (uint32_t i = 0; i < keep; i++) {
+		last = first;
+		first = first->next;
+	}
+	if (!first)
+		return;
+	slab_object *tail = first;
+	while (tail->next)
+		tail = tail->next;
+	if (last)
+		last->next = NULL;
+	else
+		hc->head[c] = NULL;
+	uint32_t moved = hc->count[c] - keep;
+	hc->count[c] = keep;
+
+	slab_class *sc = &hp->classes[c];
+	pthread_mutex_lock(&sc->lock);
+	tail->next = sc->free;
+	sc->free = first;
+	sc->free_count += moved;
+	pthread_mutex_unlock(&sc->lock);
+	__atomic_sub_fetch(&hp->handed_bytes, (size_t)moved * class_size[c], __ATOMIC_RELAXED);
+	count_stat(releases);
+}
+
+static void destroy_cache(void *arg) {
+	slab_cache *tc = arg;
+	for (int c = 0; c < num_classes; c++)
+		release(tc, c, 0);
+	for (int h = 1; h < SLAB_MAX_HEAPS; h++) {
+		slab_heap_cache *hc = tc->heaps[h];
+		if (!hc)
+			continue;
+		slab_heap *hp = &heaps[h];
+		for (int c = 0; c < num_classes; c++)
+			heap_release_cached(hp, hc, c, 0);
+		pthread_mutex_lock(&hp->lock);
+		slab_heap_cache **p = &hp->caches;
+		while (*p != hc)
+			p = &(*p)->next;
+		*p = hc->next;
+		hp->stats.allocs += hc->allocs;
+		hp->stats.live_blocks += hc->live_blocks;
+		hp->stats.live_bytes += hc->live_bytes;
+		pthread_mutex_unlock(&hp->lock);
+		free(hc);
+	}
+	free(tc);
+}
+
+static slab_cache *get_cache(void) {
+	slab_cache *tc = pthread_getspecific(cache_key);
+	if (!tc) {
+		tc = calloc(1, sizeof(slab_cache));
+		if (!tc)
+			return NULL;
+		pthread_setspecific(cache_key, tc);
+		count_stat(caches);
+	}
+	return tc;
+}
+
+static void *alloc_class(int c, size_t alignment) {
+	slab_cache *tc = get_cache();
+	if (tc && (tc->head[c] || refill(tc, c))) {
+		slab_object *o = tc->head[c];
+		tc->head[c] = o->next;
+		tc->count[c]--;
+		return o;
+	}
+	count_stat(fallbacks);
+	return memalign(alignment, class_size[c]);
+}
+
+static slab_heap_cache *get_heap_cache(int h) {
+	slab_cache *tc = get_cache();
+	if (!tc)
+		return NULL;
+	if (!tc->heaps[h]) {
+		slab_heap_cache *hc = calloc(1, sizeof(slab_heap_cache));
+		if (!hc)
+			return NULL;
+		pthread_mutex_lock(&heaps[h].lock);
+		hc->next = heaps[h].caches;
+		heaps[h].caches = hc;
+		pthread_mutex_unlock(&heaps[h].lock);
+		tc->heaps[h] = hc;
+	}
+	return tc->heaps[h];
+}
+
+// The counting stays with the thread cache, the hot path takes no lock and no atomic
+static void *heap_alloc_class(int h, int c) {
+	slab_heap *hp = &heaps[h];
+	slab_heap_cache *hc = get_heap_cache(h);
+	slab_object *o = NULL;
+	if (hc) {
+		if (hc->head[c] || heap_refill(hp, hc, h, c)) {
+			o = hc->head[c];
+			hc->head[c] = o->next;
+			hc->count[c]--;
+			own_add(hc->allocs, 1);
+			own_add(hc->live_blocks, 1);
+			own_add(hc->live_bytes, class_size[c]);
+		}
+	} else {
+		slab_class *sc = &hp->classes[c];
+		pthread_mutex_lock(&sc->lock);
+		o = sc->free;
+		if (o) {
+			sc->free = o->next;
+			sc->free_count--;
+		} else if (sc->bump != sc->bump_end || new_span(h, c)) {
+			o = (slab_object *)sc->bump;
+			sc->bump += class_size[c];
+		}
+		pthread_mutex_unlock(&sc->lock);
+		if (o) {
+			heap_count_handed(hp, class_size[c]);
+			pthread_mutex_lock(&hp->lock);
+			hp->stats.allocs++;
+			hp->stats.live_blocks++;
+			hp->stats.live_bytes += class_size[c];
+			pthread_mutex_unlock(&hp->lock);
+		}
+	}
+	if (o)
+		return o;
+	count_stat(fallbacks);
+	return memalign(SLAB_MIN_SIZE, class_size[c]);
+}
+
+static void heap_release(int h, int c, void *p) {
+	slab_heap *hp = &heaps[h];
+	slab_heap_cache *hc = get_heap_cache(h);
+	if (!hc) {
+		slab_class *sc = &hp->classes[c];
+		pthread_mutex_lock(&sc->lock);
+		((slab_object *)p)->next = sc->free;
+		sc->free = p;
+		sc->free_count++;
+		pthread_mutex_unlock(&sc->lock);
+		__atomic_sub_fetch(&hp->handed_bytes, class_size[c], __ATOMIC_RELAXED);
+		pthread_mutex_lock(&hp->lock);
+		hp->stats.live_blocks--;
+		hp->stats.live_bytes -= class_size[c];
+		pthread_mutex_unlock(&hp->lock);
+		return;
+	}
+	((slab_object *)p)->next = hc->head[c];
+	hc->head[c] = p;
+	own_sub(hc->live_blocks, 1);
+	own_sub(hc->live_bytes, class_size[c]);
+	if (++hc->count[c] > heap_cache_limit[c])
+		heap_release_cached(hp, hc, c, heap_cache_limit[c] / 2);
+}
+
+// Whole pages, so that a freed run fits the next large request of similar size
+static void *alloc_large(size_t size) {
+	if (size > SIZE_MAX - SLAB_PAGE_SIZE)
+		return NULL;
+	count_stat(large);
+	return malloc(page_round(size));
+}
+
+static void *alloc_in(int h, size_t size) {
+	if (!arena || size > SLAB_MAX_SMALL) {
+		if (h)
+			__atomic_fetch_add(&heaps[h].stats.large, 1, __ATOMIC_RELAXED);
+		return alloc_large(size);
+	}
+	int c = size_class[(size + SLAB_MIN_SIZE - 1) / SLAB_MIN_SIZE];
+	return h ? heap_alloc_class(h, c) : alloc_class(c, SLAB_MIN_SIZE);
+}
+
+static void *alloc(size_t size) {
+	return alloc_in(0, size);
+}
+
+static void release_object(void *p) {
+	if (!is_owned(p)) {
+		free(p);
+		return;
+	}
+	int c = class_of(p);
+	int h = heap_of(p);
+	if (h) {
+		heap_release(h, c, p);
+		return;
+	}
+	slab_cache *tc = get_cache();
+	if (!tc) {
+		slab_class *sc = &classes[c];
+		pthread_mutex_lock(&sc->lock);
+		((slab_object *)p)->next = sc->free;
+		sc->free = p;
+		sc->free_count++;
+		pthread_mutex_unlock(&sc->lock);
+		return;
+	}
+	((slab_object *)p)->next = tc->head[c];
+	tc->head[c] = p;
+	if (++tc->count[c] > cache_limit[c])
+		release(tc, c, cache_limit[c] / 2);
+}
+
+static void *alloc_aligned(size_t alignment, size_t size) {
+	if (alignment <= SLAB_MIN_SIZE)
+		return alloc(size);
+	if (arena && !(alignment & (alignment - 1)) && alignment <= SLAB_MAX_SMALL && size <= SLAB_MAX_SMALL) {
+		// Objects sit at multiples of their size from a span boundary
+		size_t rounded = (size + alignment - 1) & ~(alignment - 1);
+		int c = size_class[rounded / SLAB_MIN_SIZE];
+		while (class_size[c] % alignment)
+			c++;
+		return alloc_class(c, alignment);
+	}
+	count_stat(large);
+	return memalign(alignment, size);
+}
+
+void slab_init(size_t arena_size, size_t memid_reserve) {
+	// 16 byte steps up to 128, then four classes per power of two
+	uint32_t size = SLAB_MIN_SIZE;
+	while (size <= SLAB_MAX_SMALL && num_classes < SLAB_NUM_CLASSES) {
+		class_size[num_classes] = size;
+		uint32_t limit = SLAB_CACHE_BYTES / size;
+		cache_limit[num_classes] = limit < SLAB_CACHE_MIN ? SLAB_CACHE_MIN : (limit > SLAB_CACHE_MAX ? SLAB_CACHE_MAX : limit);
+		limit = cache_limit[num_classes] / SLAB_HEAP_CACHE_DIV;
+		heap_cache_limit[num_classes] = limit < SLAB_CACHE_MIN ? SLAB_CACHE_MIN : limit;
+		pthread_mutex_init(&classes[num_classes].lock, NULL);
+		num_classes++;
+		if (size < 128) {
+			size += SLAB_MIN_SIZE;
+		} else {
+			uint32_t pow2 = 128;
+			while (pow2 * 2 <= size)
+				pow2 *= 2;
+			size += pow2 / 4;
+		}
+	}
+	for (int i = 0, c = 0; i <= SLAB_MAX_SMALL / SLAB_MIN_SIZE; i++) {
+		while (class_size[c] < i * SLAB_MIN_SIZE)
+			c++;
+		size_class[i] = c;
+	}
+
+	for (int h = 1; h < SLAB_MAX_HEAPS; h++) {
+		pthread_mutex_init(&heaps[h].lock, NULL);
+		for (int c = 0; c < num_classes; c++)
+			pthread_mutex_init(&heaps[h].classes[c].lock, NULL);
+	}
+
+	arena_size &= ~(SLAB_SPAN_SIZE - 1);
+	span_class = calloc(arena_size / SLAB_SPAN_SIZE, 1);
+	span_heap = calloc(arena_size / SLAB_SPAN_SIZE, 1);
+	span_free_objs = calloc(arena_size / SLAB_SPAN_SIZE, sizeof(uint16_t));
+	arena = memalign(SLAB_SPAN_SIZE, arena_size);
+	if (!span_class || !span_heap || !span_free_objs || !arena || pthread_key_create(&cache_key, destroy_cache)) {
+		free(span_class);
+		free(span_heap);
+		free(span_free_objs);
+		free(arena);
+		arena = NULL;
+		return;
+	}
+	arena_top = arena;
+	arena_end = arena + arena_size;
+	stats.arena_size = arena_size;
+	heap0_max_spans = (arena_size - (memid_reserve < arena_size ? memid_reserve : arena_size)) / SLAB_SPAN_SIZE;
+}
+
+void *slab_malloc(size_t size) {
+	void *p = alloc(size);
+	trace_alloc(SLAB_TRACE_MALLOC, p, NULL, size, 0);
+	heap_prof_alloc(p, size, (uintptr_t)__builtin_return_address(0));
+	return p;
+}
+
+void slab_free(void *p) {
+	if (!p)
+		return;
+	trace_alloc(SLAB_TRACE_FREE, NULL, p, 0, 0);
+	heap_prof_free(p);
+	release_object(p);
+}
+
+void *slab_calloc(size_t nmemb, size_t size) {
+	if (size && nmemb > SIZE_MAX / size)
+		return NULL;
+	size *= nmemb;
+	void *p = alloc(size);
+	if (p)
+		memset(p, 0, size);
+	trace_alloc(SLAB_TRACE_MALLOC, p, NULL, size, 0);
+	heap_prof_alloc(p, size, (uintptr_t)__builtin_return_address(0));
+	return p;
+}
+
+size_t slab_usable_size(void *p) {
+	if (!p)
+		return 0;
+	return is_owned(p) ? class_size[class_of(p)] : malloc_usable_size(p);
+}
+
+// Like bionic, a zero size frees the block
+void *slab_realloc(void *p, size_t size) {
+	if (p && !size) {
+		slab_free(p);
+		return NULL;
+	}
+
+	void *n;
+	size_t usable = slab_usable_size(p);
+	if (!p) {
+		n = alloc(size);
+	} else if (size <= usable && (size > SLAB_MAX_SMALL || size > usable / 2)) {
+		n = p;
+	} else if (!is_owned(p) && size > SLAB_MAX_SMALL) {
+		n = realloc(p, page_round(size));
+	} else {
+		// Blocks stay with the MemoryId they were allocated for
+		n = alloc_in(is_owned(p) ? heap_of(p) : 0, size);
+		if (n) {
+			memcpy(n, p, usable < size ? usable : size);
+			release_object(p);
+		}
+	}
+	trace_alloc(SLAB_TRACE_REALLOC, n, p, size, 0);
+	if (n) {
+		heap_prof_free(p);
+		heap_prof_alloc(n, size, (uintptr_t)__builtin_return_address(0));
+	}
+	return n;
+}
+
+void *slab_memalign(size_t alignment, size_t size) {
+	void *p = alloc_aligned(alignment, size);
+	trace_alloc(SLAB_TRACE_MEMALIGN, p, NULL, size, alignment);
+	heap_prof_alloc(p, size, (uintptr_t)__builtin_return_address(0));
+	return p;
+}
+
+int slab_posix_memalign(void **memptr, size_t alignment, size_t size) {
+	if (!alignment || (alignment & (alignment - 1)) || (alignment % sizeof(void *)))
+		return EINVAL;
+	void *p = alloc_aligned(alignment, size);
+	trace_alloc(SLAB_TRACE_MEMALIGN, p, NULL, size, alignment);
+	if (!p)
+		return ENOMEM;
+	heap_prof_alloc(p, size, (uintptr_t)__builtin_return_address(0));
+	*memptr = p;
+	return 0;
+}
+
+// Entry point of operator new(size_t, ITF::MemoryId::ITF_ALLOCATOR_IDS), ids past the
+// last heap share the plain one
+void *slab_memid_alloc(size_t size, int id) {
+	void *p = alloc_in(id >= 0 && id < SLAB_MAX_HEAPS - 1 ? id + 1 : 0, size);
+	trace_alloc(SLAB_TRACE_MALLOC, p, NULL, size, 0);
+	heap_prof_alloc(p, size, (uintptr_t)__builtin_return_address(0));
+	return p;
+}
+
+static uint32_t heap_live_blocks(slab_heap *hp) {
+	uint32_t live = hp->stats.live_blocks;
+	for (slab_heap_cache *hc = hp->caches; hc; hc = hc->next)
+		live += __atomic_load_n(&hc->live_blocks, __ATOMIC_RELAXED);
+	return live;
+}
+
+// Hands the spans of emptied MemoryId heaps back once they stayed idle for a while,
+// a level loaded right after the previous one got unloaded would carve them again.
+// Idleness is sampled on every call, mem_monitor makes them often enough for that.
+// Under memory pressure every emptied heap goes, whatever its size, and plain malloc
+// gives back its own free spans as well.
+void slab_collect(int force) {
+	if (!arena)
+		return;
+	uint64_t now = current_time();
+	pthread_mutex_lock(&collect_lock);
+	for (int h = 1; h < SLAB_MAX_HEAPS; h++) {
+		slab_heap *hp = &heaps[h];
+		if (!__atomic_load_n(&hp->stats.spans, __ATOMIC_RELAXED))
+			continue;
+		pthread_mutex_lock(&hp->lock);
+		int idle = !heap_live_blocks(hp);
+		if (!idle)
+			hp->idle_since = 0;
+		else if (!hp->idle_since)
+			hp->idle_since = now;
+		if (idle && (force || (hp->stats.spans >= SLAB_BULK_MIN_SPANS && now - hp->idle_since >= SLAB_BULK_IDLE_US))) {
+			int released = 0;
+			for (int c = 0; c < num_classes; c++) {
+				pthread_mutex_lock(&hp->classes[c].lock);
+				released += release_free_spans(h, c);
+				pthread_mutex_unlock(&hp->classes[c].lock);
+			}
+			if (released)
+				hp->stats.bulk_releases++;
+		}
+		pthread_mutex_unlock(&hp->lock);
+	}
+	for (int c = 0; force && c < num_classes; c++) {
+		pthread_mutex_lock(&classes[c].lock);
+		release_free_spans(0, c);
+		pthread_mutex_unlock(&classes[c].lock);
+	}
+	pthread_mutex_unlock(&collect_lock);
+}
+
+void slab_get_stats(slab_stats *out) {
+	pthread_mutex_lock(&arena_lock);
+	*out = stats;
+	pthread_mutex_unlock(&arena_lock);
+
+	// Read without the class locks, a figure off by a few objects is fine for headroom tracking
+	out->span_free = 0;
+	for (int h = 0; h < SLAB_MAX_HEAPS; h++) {
+		for (int c = 0; c < num_classes; c++) {
+			slab_class *sc = &heaps[h].classes[c];
+			uint8_t *bump = sc->bump, *bump_end = sc->bump_end;
+			out->span_free += (size_t)sc->free_count * class_size[c] + (bump_end > bump ? bump_end - bump : 0);
+		}
+	}
+}
+
+int slab_get_memid_stats(int id, slab_heap_stats *out) {
+	if (id < 0 || id >= SLAB_MAX_HEAPS - 1)
+		return -1;
+	slab_heap *hp = &heaps[id + 1];
+	pthread_mutex_lock(&hp->lock);
+	*out = hp->stats;
+	for (slab_heap_cache *hc = hp->caches; hc; hc = hc->next) {
+		out->allocs += __atomic_load_n(&hc->allocs, __ATOMIC_RELAXED);
+		out->live_blocks += __atomic_load_n(&hc->live_blocks, __ATOMIC_RELAXED);
+		out->live_bytes += __atomic_load_n(&hc->live_bytes, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&hp->lock);
+	return 0;
+}
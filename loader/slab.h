@@ -0,0 +1,72 @@
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "config.h"
+
+#define SLAB_TRACE_MAGIC 0x43525441 // ATRC
+#define SLAB_MAX_HEAPS 32 // one per ITF MemoryId, plus the one of plain malloc
+
+enum {
+	SLAB_TRACE_MALLOC, // ptr = result
+	SLAB_TRACE_FREE, // old = freed pointer
+	SLAB_TRACE_REALLOC, // old = input, ptr = result
+	SLAB_TRACE_MEMALIGN // align holds the requested alignment
+};
+
+// Fixed size records following a 32 bit magic, pointers only serve as ids
+typedef struct {
+	uint32_t type;
+	uint32_t thread;
+	uint32_t ptr;
+	uint32_t old;
+	uint32_t size;
+	uint32_t align;
+} slab_trace_record;
+
+typedef struct {
+	uint32_t spans; // arena spans handed to size classes
+	size_t arena_used;
+	size_t arena_size;
+	size_t span_free; // bytes of used spans on central lists or not carved yet, thread caches aside
+	uint32_t refills; // thread caches refilled from the central lists
+	uint32_t releases; // thread caches trimmed back to the central lists
+	uint32_t large; // allocations served as page runs
+	uint32_t fallbacks; // small allocations left to the system heap
+	uint32_t caches; // thread caches created
+} slab_stats;
+
+typedef struct {
+	uint32_t allocs;
+	uint32_t live_blocks;
+	size_t live_bytes; // rounded up to the size class
+	size_t peak_bytes; // taken from the central lists, thread caches included
+	uint32_t spans;
+	uint32_t bulk_releases; // times the heap emptied out and handed its spans back
+	uint32_t large; // allocations above the biggest class, left to the system heap
+} slab_heap_stats;
+
+void slab_init(size_t arena_size, size_t memid_reserve);
+
+void *slab_malloc(size_t size);
+void slab_free(void *p);
+void *slab_calloc(size_t nmemb, size_t size);
+void *slab_realloc(void *p, size_t size);
+void *slab_memalign(size_t alignment, size_t size);
+int slab_posix_memalign(void **memptr, size_t alignment, size_t size);
+size_t slab_usable_size(void *p);
+void *slab_memid_alloc(size_t size, int id);
+void slab_collect(int force);
+
+void slab_get_stats(slab_stats *stats);
+int slab_get_memid_stats(int id, slab_heap_stats *stats);
+
+#ifdef ENABLE_ALLOC_TRACE
+void slab_trace_init(const char *path);
+#else
+#define slab_trace_init(path)
+#endif
+
+#endif
@@ -640,6 +640,23 @@ uintptr_t so_symbol(so_module *mod, const char *symbol) {
 	return mod->text_base + mod->dynsym[index].st_value;
 }
 
+// Nearest exported function starting at or before addr, NULL if there is none
+const char *so_symbol_name(so_module *mod, uintptr_t addr, uintptr_t *offset) {
+	uintptr_t rel = (addr & ~1) - mod->text_base;
+	int best = -1;
+	for (int i = 0; i < mod->num_dynsym; i++) {
+		Elf32_Sym *sym = &mod->dynsym[i];
+		if (sym->st_shndx == SHN_UNDEF || ELF32_ST_TYPE(sym->st_info) != STT_FUNC)
+			continue;
+		if ((sym->st_value & ~1) <= rel && (best == -1 || sym->st_value > mod->dynsym[best].st_value))
+			best = i;
+	}
+	if (best == -1)
+		return NULL;
+	*offset = rel - (mod->dynsym[best].st_value & ~1);
+	return mod->dynstr + mod->dynsym[best].st_name;
+}
+
 void so_symbol_fix_ldmia(so_module *mod, const char *symbol) {
 	// This is meant to work around crashes due to unaligned accesses (SIGBUS :/) due to certain
 	// kernels not having the fault trap enabled, e.g. certain RK3326 Odroid Go Advance clone distros.
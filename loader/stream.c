@@ -0,0 +1,841 @@
+/* stream.c -- buffered stdio replacement for the game file I/O
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <malloc.h>
+#include <pthread.h>
+
+#include "stream.h"
+#include "writebehind.h"
+#include "trace.h"
+#include "fd_pool.h"
+#include "io_sched.h"
+#include "obb.h"
+
+//#define ENABLE_DEBUG
+
+#ifdef ENABLE_DEBUG
+#define dlog sceClibPrintf
+#else
+#define dlog
+#endif
+
+#define STREAM_MAGIC 0x4D525453 // STRM
+
+enum {
+	STREAM_FD,
+	STREAM_MEM,
+	STREAM_RA,
+	STREAM_BUF,
+	STREAM_OBB
+};
+
+struct stream {
+	uint32_t magic;
+	int type;
+	SceUID fd;
+	file_cache_entry *entry;
+	ra_file *ra;
+	obb_file *obb;
+	uint8_t *buf;
+	size_t buf_size;
+	uint64_t buf_offs; // file offset of buf[0]
+	size_t buf_len; // valid bytes when reading
+	size_t buf_pos;
+	int64_t size;
+	uint8_t readable;
+	uint8_t writable;
+	uint8_t append;
+	uint8_t writing; // buf[0..buf_pos) holds pending data
+	uint8_t eof;
+	uint8_t error;
+	uint8_t dirty; // buffer contents still have to be committed
+	uint8_t pooled; // fd is shared through fd_pool
+	int io_class;
+	char *commit_path;
+	int fileno;
+};
+
+static stream *fds[STREAM_MAX_FDS];
+static pthread_mutex_t fds_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static stream *stream_alloc(int type, size_t buf_size) {
+	stream *s = calloc(1, sizeof(stream));
+	if (!s)
+		return NULL;
+	if (buf_size) {
+		s->buf = memalign(64, buf_size);
+		if (!s->buf) {
+			free(s);
+			return NULL;
+		}
+	}
+	s->magic = STREAM_MAGIC;
+	s->type = type;
+	s->buf_size = buf_size;
+	s->fileno = -1;
+	return s;
+}
+
+stream *stream_open(const char *path, const char *mode, size_t buf_size) {
+	int flags;
+	switch (mode[0]) {
+	case 'r':
+		flags = strchr(mode, '+') ? SCE_O_RDWR : SCE_O_RDONLY;
+		break;
+	case 'w':
+		flags = (strchr(mode, '+') ? SCE_O_RDWR : SCE_O_WRONLY) | SCE_O_CREAT | SCE_O_TRUNC;
+		break;
+	case 'a':
+		flags = (strchr(mode, '+') ? SCE_O_RDWR : SCE_O_WRONLY) | SCE_O_CREAT;
+		break;
+	default:
+		return NULL;
+	}
+
+	// Read-only streams only use positional reads, so they can share a descriptor
+	int pooled = flags == SCE_O_RDONLY;
+	SceUID fd = pooled ? fd_pool_open(path) : sceIoOpen(path, flags, 0777);
+	if (fd < 0)
+		return NULL;
+	SceIoStat st;
+	stream *s = NULL;
+	if (sceIoGetstatByFd(fd, &st) < 0 || !(s = stream_alloc(STREAM_FD, buf_size))) {
+		if (pooled)
+			fd_pool_close(fd);
+		else
+			sceIoClose(fd);
+		return NULL;
+	}
+	s->fd = fd;
+	s->pooled = pooled;
+	s->io_class = io_class_for_path(path);
+	s->size = st.st_size;
+	s->readable = (flags & SCE_O_RDWR) != SCE_O_WRONLY;
+	s->writable = (flags & SCE_O_RDWR) != SCE_O_RDONLY;
+	s->append = mode[0] == 'a';
+	if (s->append)
+		s->buf_offs = s->size;
+	return s;
+}
+
+// The cached file contents directly act as the stream buffer
+stream *stream_open_mem(file_cache_entry *entry) {
+	stream *s = stream_alloc(STREAM_MEM, 0);
+	if (!s)
+		return NULL;
+	s->entry = entry;
+	s->buf = (uint8_t *)file_cache_data(entry);
+	s->buf_size = s->buf_len = s->size = file_cache_size(entry);
+	s->readable = 1;
+	return s;
+}
+
+stream *stream_open_ra(ra_file *ra, size_t buf_size) {
+	stream *s = stream_alloc(STREAM_RA, buf_size);
+	if (!s)
+		return NULL;
+	s->ra = ra;
+	s->size = ra_size(ra);
+	s->readable = 1;
+	return s;
+}
+
+// Archive entry decompressed as it gets read, for the ones too big to be held whole
+stream *stream_open_obb(obb_file *f, uint64_t size, size_t buf_size) {
+	stream *s = stream_alloc(STREAM_OBB, buf_size);
+	if (!s)
+		return NULL;
+	s->obb = f;
+	s->size = size;
+	s->readable = 1;
+	return s;
+}
+
+// Growable in-memory file, handed over to the write-behind queue on flush and close
+stream *stream_open_buf(uint8_t *data, size_t size, const char *commit_path, int append) {
+	stream *s = stream_alloc(STREAM_BUF, 0);
+	if (!s)
+		return NULL;
+	if (commit_path) {
+		s->commit_path = strdup(commit_path);
+		if (!s->commit_path) {
+			free(s);
+			return NULL;
+		}
+		s->writable = 1;
+		s->dirty = 1; // even an untouched file must be created or truncated
+	}
+	s->buf = data;
+	s->buf_size = s->buf_len = s->size = size;
+	s->readable = 1;
+	s->append = append;
+	return s;
+}
+
+// Closes without committing anything, for streams that never reached the game
+void stream_abort(stream *s) {
+	s->writing = 0;
+	s->dirty = 0;
+	stream_close(s);
+}
+
+static int64_t backend_pread(stream *s, void *buf, size_t size, uint64_t offs) {
+	switch (s->type) {
+	case STREAM_FD:
+		return io_pread(s->fd, buf, size, offs, s->io_class);
+	case STREAM_RA:
+		return ra_pread(s->ra, buf, size, offs);
+	case STREAM_OBB:
+		if (obb_ftell(s->obb) != offs && obb_fseek(s->obb, offs, SEEK_SET) < 0)
+			return -1;
+		return obb_fread(s->obb, buf, size);
+	default:
+		return 0;
+	}
+}
+
+static int flush_writes(stream *s) {
+	if (!s->writing || !s->buf_pos)
+		return 0;
+
+	int res = sceIoPwrite(s->fd, s->buf, s->buf_pos, s->buf_offs);
+	if (res != s->buf_pos) {
+		s->error = 1;
+		return -1;
+	}
+	s->buf_offs += s->buf_pos;
+	if (s->buf_offs > s->size)
+		s->size = s->buf_offs;
+	s->buf_pos = s->buf_len = 0;
+	return 0;
+}
+
+static void stop_writing(stream *s) {
+	flush_writes(s);
+	s->writing = 0;
+}
+
+int stream_close(stream *s) {
+	int res = 0;
+	if (s->writing)
+		res = flush_writes(s);
+
+	if (s->fileno >= 0) {
+		pthread_mutex_lock(&fds_lock);
+		fds[s->fileno - STREAM_FD_BASE] = NULL;
+		pthread_mutex_unlock(&fds_lock);
+	}
+
+	switch (s->type) {
+	case STREAM_FD:
+		if (s->pooled)
+			fd_pool_close(s->fd);
+		else
+			sceIoClose(s->fd);
+		free(s->buf);
+		break;
+	case STREAM_MEM:
+		file_cache_release(s->entry);
+		break;
+	case STREAM_RA:
+		ra_close(s->ra);
+		free(s->buf);
+		break;
+	case STREAM_OBB:
+		obb_fclose(s->obb);
+		free(s->buf);
+		break;
+	case STREAM_BUF:
+		if (s->dirty)
+			wb_commit(s->commit_path, s->buf, s->buf_len);
+		else
+			free(s->buf);
+		free(s->commit_path);
+		break;
+	}
+	s->magic = 0;
+	free(s);
+	return res;
+}
+
+size_t stream_read(stream *s, void *buf, size_t size) {
+	if (!s->readable) {
+		s->error = 1;
+		return 0;
+	}
+	if (s->writing)
+		stop_writing(s);
+
+	uint8_t *dst = (uint8_t *)buf;
+	size_t done = 0;
+	while (done < size) {
+		size_t avail = s->buf_len - s->buf_pos;
+		if (avail) {
+			size_t n = size - done < avail ? size - done : avail;
+			sceClibMemcpy(dst + done, &s->buf[s->buf_pos], n);
+			s->buf_pos += n;
+			done += n;
+			continue;
+		}
+		if (s->type == STREAM_MEM || s->type == STREAM_BUF) {
+			s->eof = 1;
+			break;
+		}
+
+		// Big reads skip the buffer entirely, small ones get coalesced in a single refill
+		uint64_t pos = s->buf_offs + s->buf_pos;
+		int64_t res;
+		if (size - done >= s->buf_size) {
+			res = backend_pread(s, dst + done, size - done, pos);
+			if (res > 0) {
+				done += res;
+				s->buf_offs = pos + res;
+				s->buf_len = s->buf_pos = 0;
+			}
+		} else {
+			res = backend_pread(s, s->buf, s->buf_size, pos);
+			if (res > 0) {
+				s->buf_offs = pos;
+				s->buf_len = res;
+				s->buf_pos = 0;
+			}
+		}
+		if (res <= 0) {
+			if (res < 0)
+				s->error = 1;
+			else
+				s->eof = 1;
+			break;
+		}
+	}
+	return done;
+}
+
+static size_t buf_write(stream *s, const void *buf, size_t size) {
+	size_t pos = s->append ? s->buf_len : s->buf_pos;
+	if (pos + size > s->buf_size) {
+		size_t cap = s->buf_size ? s->buf_size : 4096;
+		while (cap < pos + size)
+			cap *= 2;
+		uint8_t *p = realloc(s->buf, cap);
+		if (!p) {
+			s->error = 1;
+			return 0;
+		}
+		s->buf = p;
+		s->buf_size = cap;
+	}
+	sceClibMemcpy(&s->buf[pos], buf, size);
+	s->buf_pos = pos + size;
+	if (s->buf_pos > s->buf_len)
+		s->buf_len = s->size = s->buf_pos;
+	s->dirty = 1;
+	return size;
+}
+
+size_t stream_write(stream *s, const void *buf, size_t size) {
+	if (!s->writable) {
+		s->error = 1;
+		return 0;
+	}
+	if (s->type == STREAM_BUF)
+		return buf_write(s, buf, size);
+	if (!s->writing) {
+		uint64_t pos = s->append ? s->size : s->buf_offs + s->buf_pos;
+		s->buf_offs = pos;
+		s->buf_len = s->buf_pos = 0;
+		s->writing = 1;
+	}
+
+	const uint8_t *src = (const uint8_t *)buf;
+	size_t done = 0;
+	while (done < size) {
+		if (!s->buf_pos && size - done >= s->buf_size) {
+			int res = sceIoPwrite(s->fd, src + done, size - done, s->buf_offs);
+			if (res <= 0) {
+				s->error = 1;
+				break;
+			}
+			done += res;
+			s->buf_offs += res;
+			if (s->buf_offs > s->size)
+				s->size = s->buf_offs;
+			continue;
+		}
+
+		size_t n = s->buf_size - s->buf_pos;
+		if (n > size - done)
+			n = size - done;
+		sceClibMemcpy(&s->buf[s->buf_pos], src + done, n);
+		s->buf_pos += n;
+		done += n;
+		if (s->buf_pos == s->buf_size && flush_writes(s) < 0)
+			break;
+	}
+	return done;
+}
+
+int stream_seek(stream *s, int64_t offset, int whence) {
+	int64_t pos;
+	switch (whence) {
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = stream_tell(s) + offset;
+		break;
+	case SEEK_END:
+		pos = stream_size(s) + offset;
+		break;
+	default:
+		return -1;
+	}
+	if (pos < 0)
+		return -1;
+
+	s->eof = 0;
+	if (s->type == STREAM_MEM || s->type == STREAM_BUF) {
+		s->buf_pos = pos > s->size ? s->size : pos;
+		return 0;
+	}
+
+	// Seeking inside the buffered window just moves the cursor
+	if (!s->writing && pos >= s->buf_offs && pos <= s->buf_offs + s->buf_len) {
+		s->buf_pos = pos - s->buf_offs;
+		return 0;
+	}
+
+	if (s->writing && flush_writes(s) < 0)
+		return -1;
+	s->buf_offs = pos;
+	s->buf_len = s->buf_pos = 0;
+	return 0;
+}
+
+// ftruncate on a stream fd, the write-behind buffer of a pending save gets resized in place
+int stream_truncate(stream *s, int64_t length) {
+	if (!s->writable || length < 0)
+		return -1;
+	if (s->type == STREAM_BUF) {
+		if (length > s->buf_size) {
+			uint8_t *p = realloc(s->buf, length);
+			if (!p)
+				return -1;
+			s->buf = p;
+			s->buf_size = length;
+		}
+		if (length > s->buf_len)
+			sceClibMemset(&s->buf[s->buf_len], 0, length - s->buf_len);
+		s->buf_len = s->size = length;
+		if (s->buf_pos > length)
+			s->buf_pos = length;
+		s->dirty = 1;
+		return 0;
+	}
+	if (s->type != STREAM_FD || flush_writes(s) < 0)
+		return -1;
+
+	SceIoStat st;
+	sceClibMemset(&st, 0, sizeof(st));
+	st.st_size = length;
+	if (sceIoChstatByFd(s->fd, &st, SCE_CST_SIZE) < 0)
+		return -1;
+	s->size = length;
+	// Whatever got buffered for reading may be past the new end
+	if (!s->writing) {
+		s->buf_offs += s->buf_pos;
+		s->buf_len = s->buf_pos = 0;
+	}
+	return 0;
+}
+
+int64_t stream_tell(stream *s) {
+	return s->buf_offs + s->buf_pos;
+}
+
+// Whole contents of streams living in RAM, NULL for the others
+const uint8_t *stream_data(stream *s) {
+	if (s->type == STREAM_MEM || (s->type == STREAM_BUF && !s->writable))
+		return s->buf;
+	return NULL;
+}
+
+int64_t stream_size(stream *s) {
+	if (s->writing && s->buf_offs + s->buf_pos > s->size)
+		return s->buf_offs + s->buf_pos;
+	return s->size;
+}
+
+int stream_flush(stream *s) {
+	if (s->type == STREAM_BUF && s->dirty) {
+		uint8_t *copy = malloc(s->buf_len ? s->buf_len : 1);
+		if (!copy)
+			return -1;
+		sceClibMemcpy(copy, s->buf, s->buf_len);
+		wb_commit(s->commit_path, copy, s->buf_len);
+		s->dirty = 0;
+		return 0;
+	}
+	return flush_writes(s);
+}
+
+stream *stream_from_file(void *f) {
+	stream *s = (stream *)f;
+	return (s && s->magic == STREAM_MAGIC) ? s : NULL;
+}
+
+stream *stream_from_fd(int fd) {
+	if (fd < STREAM_FD_BASE || fd >= STREAM_FD_BASE + STREAM_MAX_FDS)
+		return NULL;
+	return fds[fd - STREAM_FD_BASE];
+}
+
+/*
+ * bionic stdio ABI, stdin/stdout/stderr are not streams and just swallow everything
+ */
+
+size_t fread_hook(void *ptr, size_t size, size_t nmemb, void *f) {
+	stream *s = stream_from_file(f);
+	if (!s || !size)
+		return 0;
+	uint64_t start = trace_begin();
+	uint64_t offset = stream_tell(s);
+	size_t res = stream_read(s, ptr, size * nmemb);
+	trace_record(TRACE_READ, 0, (uintptr_t)s, offset, size * nmemb, s->error, start);
+	return res / size;
+}
+
+size_t fwrite_hook(const void *ptr, size_t size, size_t nmemb, void *f) {
+	stream *s = stream_from_file(f);
+	if (!size)
+		return 0;
+	if (!s)
+		return nmemb;
+	return stream_write(s, ptr, size * nmemb) / size;
+}
+
+int fseek_hook(void *f, long offset, int whence) {
+	stream *s = stream_from_file(f);
+	if (!s)
+		return -1;
+	uint64_t start = trace_begin();
+	int res = stream_seek(s, offset, whence);
+	trace_record(TRACE_SEEK, 0, (uintptr_t)s, offset, whence, res < 0, start);
+	return res;
+}
+
+long ftell_hook(void *f) {
+	stream *s = stream_from_file(f);
+	if (!s)
+		return -1;
+	return stream_tell(s);
+}
+
+int fsetpos_hook(void *f, const long *pos) {
+	return fseek_hook(f, *pos, SEEK_SET);
+}
+
+char *fgets_hook(char *str, int size, void *f) {
+	stream *s = stream_from_file(f);
+	if (!s || size <= 0 || !s->readable)
+		return NULL;
+	if (s->writing)
+		stop_writing(s);
+
+	int len = 0;
+	while (len < size - 1) {
+		size_t avail = s->buf_len - s->buf_pos;
+		if (!avail) {
+			uint8_t c;
+			if (stream_read(s, &c, 1) != 1)
+				break;
+			str[len++] = c;
+			if (c == '\n')
+				break;
+			continue;
+		}
+		if (avail > size - 1 - len)
+			avail = size - 1 - len;
+		uint8_t *start = &s->buf[s->buf_pos];
+		uint8_t *nl = sceClibMemchr(start, '\n', avail);
+		size_t n = nl ? nl - start + 1 : avail;
+		sceClibMemcpy(&str[len], start, n);
+		s->buf_pos += n;
+		len += n;
+		if (nl)
+			break;
+	}
+	if (!len)
+		return NULL;
+	str[len] = 0;
+	return str;
+}
+
+int getc_hook(void *f) {
+	stream *s = stream_from_file(f);
+	if (!s)
+		return EOF;
+	if (!s->writing && s->buf_pos < s->buf_len)
+		return s->buf[s->buf_pos++];
+	uint8_t c;
+	return stream_read(s, &c, 1) == 1 ? c : EOF;
+}
+
+int ungetc_hook(int c, void *f) {
+	stream *s = stream_from_file(f);
+	if (!s || c == EOF || s->writing || !s->buf_pos)
+		return EOF;
+	// Memory backed files may be shared or committed later, so we can only step back over the same character
+	if (s->buf[s->buf_pos - 1] != (uint8_t)c) {
+		if (s->type == STREAM_MEM || s->type == STREAM_BUF)
+			return EOF;
+		s->buf[s->buf_pos - 1] = c;
+	}
+	s->buf_pos--;
+	s->eof = 0;
+	return (uint8_t)c;
+}
+
+int putc_hook(int c, void *f) {
+	stream *s = stream_from_file(f);
+	uint8_t ch = c;
+	if (s && stream_write(s, &ch, 1) != 1)
+		return EOF;
+	return ch;
+}
+
+// Wide characters go through the stream as UTF-8, the encoding of the bionic default locale
+static int utf8_encode(uint32_t wc, uint8_t *out) {
+	if (wc < 0x80) {
+		out[0] = wc;
+		return 1;
+	}
+	if (wc < 0x800) {
+		out[0] = 0xC0 | (wc >> 6);
+		out[1] = 0x80 | (wc & 0x3F);
+		return 2;
+	}
+	if (wc < 0x10000) {
+		if (wc >= 0xD800 && wc < 0xE000)
+			return -1;
+		out[0] = 0xE0 | (wc >> 12);
+		out[1] = 0x80 | ((wc >> 6) & 0x3F);
+		out[2] = 0x80 | (wc & 0x3F);
+		return 3;
+	}
+	if (wc < 0x110000) {
+		out[0] = 0xF0 | (wc >> 18);
+		out[1] = 0x80 | ((wc >> 12) & 0x3F);
+		out[2] = 0x80 | ((wc >> 6) & 0x3F);
+		out[3] = 0x80 | (wc & 0x3F);
+		return 4;
+	}
+	return -1;
+}
+
+uint32_t getwc_hook(void *f) {
+	stream *s = stream_from_file(f);
+	int c = getc_hook(f);
+	if (c == EOF)
+		return STREAM_WEOF;
+	if (c < 0x80)
+		return c;
+
+	int len = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 0;
+	if (!len || c > 0xF4)
+		goto invalid;
+	uint32_t wc = c & (0x3F >> (len - 1));
+	for (int i = 1; i < len; i++) {
+		c = getc_hook(f);
+		if (c == EOF)
+			goto invalid;
+		if ((c & 0xC0) != 0x80) {
+			ungetc_hook(c, f);
+			goto invalid;
+		}
+		wc = (wc << 6) | (c & 0x3F);
+	}
+	// Overlong forms and surrogates
+	uint8_t check[4];
+	if (utf8_encode(wc, check) != len)
+		goto invalid;
+	return wc;
+
+invalid:
+	s->error = 1;
+	return STREAM_WEOF;
+}
+
+uint32_t ungetwc_hook(uint32_t wc, void *f) {
+	stream *s = stream_from_file(f);
+	uint8_t seq[4];
+	int len = wc == STREAM_WEOF ? -1 : utf8_encode(wc, seq);
+	if (!s || len < 0 || s->writing || s->buf_pos < len)
+		return STREAM_WEOF;
+	uint8_t *prev = &s->buf[s->buf_pos - len];
+	if (sceClibMemcmp(prev, seq, len)) {
+		if (s->type == STREAM_MEM || s->type == STREAM_BUF)
+			return STREAM_WEOF;
+		sceClibMemcpy(prev, seq, len);
+	}
+	s->buf_pos -= len;
+	s->eof = 0;
+	return wc;
+}
+
+uint32_t putwc_hook(uint32_t wc, void *f) {
+	stream *s = stream_from_file(f);
+	uint8_t seq[4];
+	int len = utf8_encode(wc, seq);
+	if (len < 0) {
+		if (s)
+			s->error = 1;
+		return STREAM_WEOF;
+	}
+	if (s && stream_write(s, seq, len) != len)
+		return STREAM_WEOF;
+	return wc;
+}
+
+int fputs_hook(const char *str, void *f) {
+	stream *s = stream_from_file(f);
+	size_t len = strlen(str);
+	if (s && stream_write(s, str, len) != len)
+		return EOF;
+	return 0;
+}
+
+int vfprintf_hook(void *f, const char *fmt, va_list list) {
+	stream *s = stream_from_file(f);
+	char string[1024];
+	va_list copy;
+	va_copy(copy, list);
+	int len = vsnprintf(string, sizeof(string), fmt, copy);
+	va_end(copy);
+	if (len < 0)
+		return len;
+
+	if (!s) {
+		dlog("%s", string);
+		return len;
+	}
+	if (len < sizeof(string))
+		return stream_write(s, string, len) == len ? len : -1;
+
+	char *big = malloc(len + 1);
+	if (!big)
+		return -1;
+	vsnprintf(big, len + 1, fmt, list);
+	int res = stream_write(s, big, len) == len ? len : -1;
+	free(big);
+	return res;
+}
+
+int fprintf_hook(void *f, const char *fmt, ...) {
+	va_list list;
+	va_start(list, fmt);
+	int res = vfprintf_hook(f, fmt, list);
+	va_end(list);
+	return res;
+}
+
+static ssize_t scan_read(void *cookie, char *buf, size_t size) {
+	return stream_read((stream *)cookie, buf, size);
+}
+
+static int scan_seek(void *cookie, _off64_t *offset, int whence) {
+	stream *s = (stream *)cookie;
+	if (stream_seek(s, *offset, whence) < 0)
+		return -1;
+	*offset = stream_tell(s);
+	return 0;
+}
+
+int fscanf_hook(void *f, const char *fmt, ...) {
+	stream *s = stream_from_file(f);
+	if (!s)
+		return EOF;
+
+	// Let newlib do the parsing through an unbuffered proxy, then step back over
+	// whatever lookahead it pushed back
+	cookie_io_functions_t funcs = {
+		.read = scan_read,
+		.write = NULL,
+		.seek = scan_seek,
+		.close = NULL
+	};
+	FILE *proxy = fopencookie(s, "r", funcs);
+	if (!proxy)
+		return EOF;
+	setvbuf(proxy, NULL, _IONBF, 0);
+
+	va_list list;
+	va_start(list, fmt);
+	int res = vfscanf(proxy, fmt, list);
+	va_end(list);
+
+	int64_t pos = ftello(proxy);
+	fclose(proxy);
+	if (pos >= 0)
+		stream_seek(s, pos, SEEK_SET);
+	return res;
+}
+
+int feof_hook(void *f) {
+	stream *s = stream_from_file(f);
+	return s ? s->eof : 0;
+}
+
+int ferror_hook(void *f) {
+	stream *s = stream_from_file(f);
+	return s ? s->error : 0;
+}
+
+void clearerr_hook(void *f) {
+	stream *s = stream_from_file(f);
+	if (s)
+		s->eof = s->error = 0;
+}
+
+int fflush_hook(void *f) {
+	stream *s = stream_from_file(f);
+	if (!s)
+		return 0;
+	return stream_flush(s);
+}
+
+// Descriptors are handed out lazily, they're only good for fstat, read, write and lseek
+int fileno_hook(void *f) {
+	stream *s = stream_from_file(f);
+	if (!s)
+		return -1;
+	if (s->fileno >= 0)
+		return s->fileno;
+
+	pthread_mutex_lock(&fds_lock);
+	for (int i = 0; i < STREAM_MAX_FDS; i++) {
+		if (!fds[i]) {
+			fds[i] = s;
+			s->fileno = STREAM_FD_BASE + i;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&fds_lock);
+	return s->fileno;
+}
+
+// Buffering is chosen by the loader
+int setvbuf_hook(void *f, char *buf, int mode, size_t size) {
+	return 0;
+}
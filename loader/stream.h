@@ -0,0 +1,62 @@
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+
+#include "file_cache.h"
+#include "readahead.h"
+#include "obb.h"
+
+#define STREAM_FD_BASE 0x5000
+#define STREAM_MAX_FDS 64
+#define STREAM_WEOF 0xFFFFFFFF // bionic wint_t is 32 bits
+
+typedef struct stream stream;
+
+stream *stream_open(const char *path, const char *mode, size_t buf_size);
+stream *stream_open_mem(file_cache_entry *entry);
+stream *stream_open_ra(ra_file *ra, size_t buf_size);
+stream *stream_open_obb(obb_file *f, uint64_t size, size_t buf_size);
+stream *stream_open_buf(uint8_t *data, size_t size, const char *commit_path, int append);
+int stream_close(stream *s);
+void stream_abort(stream *s);
+
+size_t stream_read(stream *s, void *buf, size_t size);
+size_t stream_write(stream *s, const void *buf, size_t size);
+int stream_seek(stream *s, int64_t offset, int whence);
+int stream_truncate(stream *s, int64_t length);
+int64_t stream_tell(stream *s);
+int64_t stream_size(stream *s);
+const uint8_t *stream_data(stream *s);
+int stream_flush(stream *s);
+
+stream *stream_from_file(void *f);
+stream *stream_from_fd(int fd);
+
+// bionic stdio ABI
+size_t fread_hook(void *ptr, size_t size, size_t nmemb, void *f);
+size_t fwrite_hook(const void *ptr, size_t size, size_t nmemb, void *f);
+int fseek_hook(void *f, long offset, int whence);
+long ftell_hook(void *f);
+int fsetpos_hook(void *f, const long *pos);
+char *fgets_hook(char *s, int size, void *f);
+int getc_hook(void *f);
+int ungetc_hook(int c, void *f);
+int putc_hook(int c, void *f);
+uint32_t getwc_hook(void *f);
+uint32_t ungetwc_hook(uint32_t wc, void *f);
+uint32_t putwc_hook(uint32_t wc, void *f);
+int fputs_hook(const char *s, void *f);
+int fprintf_hook(void *f, const char *fmt, ...);
+int vfprintf_hook(void *f, const char *fmt, va_list list);
+int fscanf_hook(void *f, const char *fmt, ...);
+int feof_hook(void *f);
+int ferror_hook(void *f);
+void clearerr_hook(void *f);
+int fflush_hook(void *f);
+int fileno_hook(void *f);
+int setvbuf_hook(void *f, char *buf, int mode, size_t size);
+
+#endif
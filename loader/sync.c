@@ -0,0 +1,446 @@
+/* sync.c -- user space locking for the game threads
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "sync.h"
+
+#define SYNC_SPIN_MAX 100 // upper bound of the adaptive spin, in pause iterations
+
+#if defined(__arm__)
+#define cpu_relax() __asm__ volatile("yield" ::: "memory")
+#elif defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() __asm__ volatile("" ::: "memory")
+#endif
+
+static sync_stats stats;
+
+#define count_stat(field) __atomic_fetch_add(&stats.field, 1, __ATOMIC_RELAXED)
+
+/*
+ * Wait backend, futex semantics: sync_wait() sleeps as long as *addr holds expected
+ * and nobody called sync_wake() on addr, or until the monotonic deadline in us passes
+ * (0 for none). Spurious returns are allowed, ETIMEDOUT is only returned on a timeout.
+ */
+#ifdef __vita__
+#include <vitasdk.h>
+
+#define SYNC_BUCKETS 64
+
+// The kernel has no futex, waiters park on their own semaphore in a hashed list instead
+typedef struct sync_waiter {
+	struct sync_waiter *next;
+	uint32_t *addr;
+	SceUID sema;
+	int woken;
+} sync_waiter;
+
+typedef struct {
+	SceKernelLwMutexWork lock;
+	sync_waiter *head;
+	sync_waiter *tail;
+} sync_bucket;
+
+static sync_bucket buckets[SYNC_BUCKETS];
+static pthread_key_t sema_key;
+
+static uintptr_t thread_id(void) {
+	return sceKernelGetThreadId();
+}
+
+uint64_t sync_now_us(void) {
+	return sceKernelGetProcessTimeWide();
+}
+
+static void destroy_sema(void *arg) {
+	sceKernelDeleteSema((SceUID)arg);
+}
+
+static SceUID thread_sema(void) {
+	SceUID sema = (SceUID)pthread_getspecific(sema_key);
+	if (!sema) {
+		sema = sceKernelCreateSema("sync_waiter", 0, 0, 1, NULL);
+		pthread_setspecific(sema_key, (void *)sema);
+	}
+	return sema;
+}
+
+static sync_bucket *bucket_for(uint32_t *addr) {
+	return &buckets[(((uintptr_t)addr >> 2) * 0x9E3779B1u) >> 26];
+}
+
+static void unlink_waiter(sync_bucket *b, sync_waiter *w) {
+	sync_waiter *prev = NULL;
+	for (sync_waiter *it = b->head; it; prev = it, it = it->next) {
+		if (it != w)
+			continue;
+		if (prev)
+			prev->next = w->next;
+		else
+			b->head = w->next;
+		if (b->tail == w)
+			b->tail = prev;
+		return;
+	}
+}
+
+static int sync_wait(uint32_t *addr, uint32_t expected, uint64_t deadline) {
+	sync_bucket *b = bucket_for(addr);
+	sync_waiter w = { NULL, addr, thread_sema(), 0 };
+	if (w.sema < 0)
+		return EAGAIN;
+
+	sceKernelLockLwMutex(&b->lock, 1, NULL);
+	// Checked under the bucket lock, a waker changes the word before taking it
+	if (__atomic_load_n(addr, __ATOMIC_RELAXED) != expected) {
+		sceKernelUnlockLwMutex(&b->lock, 1);
+		return EAGAIN;
+	}
+	if (b->tail)
+		b->tail->next = &w;
+	else
+		b->head = &w;
+	b->tail = &w;
+	sceKernelUnlockLwMutex(&b->lock, 1);
+
+	if (!deadline) {
+		sceKernelWaitSema(w.sema, 1, NULL);
+		return 0;
+	}
+	uint64_t now = sync_now_us();
+	SceUInt timeout = now >= deadline ? 0 : (deadline - now > UINT_MAX ? UINT_MAX : deadline - now);
+	if (sceKernelWaitSema(w.sema, 1, &timeout) >= 0)
+		return 0;
+
+	sceKernelLockLwMutex(&b->lock, 1, NULL);
+	if (!w.woken) {
+		unlink_waiter(b, &w);
+		sceKernelUnlockLwMutex(&b->lock, 1);
+		return ETIMEDOUT;
+	}
+	sceKernelUnlockLwMutex(&b->lock, 1);
+	// Woken right as the timeout hit, the signal is on its way and must not be left for the next wait
+	sceKernelWaitSema(w.sema, 1, NULL);
+	return 0;
+}
+
+static void sync_wake(uint32_t *addr, int count) {
+	sync_bucket *b = bucket_for(addr);
+	sync_waiter *woken = NULL;
+	sceKernelLockLwMutex(&b->lock, 1, NULL);
+	sync_waiter *it = b->head;
+	while (it && count) {
+		sync_waiter *next = it->next;
+		if (it->addr == addr) {
+			unlink_waiter(b, it);
+			it->woken = 1;
+			it->next = woken;
+			woken = it;
+			count--;
+		}
+		it = next;
+	}
+	sceKernelUnlockLwMutex(&b->lock, 1);
+	// A waiter can't return before its semaphore is signaled, so its node is still there
+	while (woken) {
+		sync_waiter *next = woken->next;
+		sceKernelSignalSema(woken->sema, 1);
+		woken = next;
+	}
+}
+
+void sync_init(void) {
+	for (int i = 0; i < SYNC_BUCKETS; i++)
+		sceKernelCreateLwMutex(&buckets[i].lock, "sync_bucket", 0, 0, NULL);
+	pthread_key_create(&sema_key, destroy_sema);
+}
+
+#else
+// Host backend, used by the benchmarks in tools/
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+static __thread char thread_marker;
+
+static uintptr_t thread_id(void) {
+	return (uintptr_t)&thread_marker;
+}
+
+uint64_t sync_now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int sync_wait(uint32_t *addr, uint32_t expected, uint64_t deadline) {
+	struct timespec ts, *timeout = NULL;
+	if (deadline) {
+		uint64_t now = sync_now_us();
+		if (now >= deadline)
+			return ETIMEDOUT;
+		ts.tv_sec = (deadline - now) / 1000000;
+		ts.tv_nsec = (deadline - now) % 1000000 * 1000;
+		timeout = &ts;
+	}
+	if (syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, timeout, NULL, 0) < 0)
+		return errno == ETIMEDOUT ? ETIMEDOUT : 0;
+	return 0;
+}
+
+static void sync_wake(uint32_t *addr, int count) {
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+void sync_init(void) {
+}
+#endif
+
+void sync_mutex_init(sync_mutex *m, int type) {
+	m->state = 0;
+	m->type = type;
+	m->spins = 0;
+	m->owner = 0;
+	m->count = 0;
+}
+
+static void lock_slow(sync_mutex *m) {
+	count_stat(mutex_contended);
+
+	// Critical sections in the engine are short, the owner is likely done before a sleep would even start
+	int max = m->spins * 2 + 10;
+	if (max > SYNC_SPIN_MAX)
+		max = SYNC_SPIN_MAX;
+	int n = 0;
+	while (n++ < max) {
+		cpu_relax();
+		uint32_t c = 0;
+		if (__atomic_load_n(&m->state, __ATOMIC_RELAXED) == 0 &&
+		    __atomic_compare_exchange_n(&m->state, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			m->spins += (n - m->spins) / 8;
+			count_stat(mutex_spun);
+			return;
+		}
+	}
+	m->spins += (n - m->spins) / 8;
+
+	// Whoever gets the lock from here on assumes there may be sleepers left behind
+	while (__atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE) != 0) {
+		count_stat(mutex_sleeps);
+		sync_wait(&m->state, 2, 0);
+	}
+}
+
+int sync_mutex_lock(sync_mutex *m) {
+	uintptr_t self = 0;
+	if (m->type != SYNC_MUTEX_NORMAL) {
+		self = thread_id();
+		// Only this thread can have stored its own id
+		if (__atomic_load_n(&m->owner, __ATOMIC_RELAXED) == self) {
+			if (m->type == SYNC_MUTEX_ERRORCHECK)
+				return EDEADLK;
+			if (m->count == UINT32_MAX)
+				return EAGAIN;
+			m->count++;
+			return 0;
+		}
+	}
+
+	uint32_t c = 0;
+	if (!__atomic_compare_exchange_n(&m->state, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		lock_slow(m);
+
+	if (self) {
+		__atomic_store_n(&m->owner, self, __ATOMIC_RELAXED);
+		m->count = 1;
+	}
+	return 0;
+}
+
+int sync_mutex_trylock(sync_mutex *m) {
+	uintptr_t self = 0;
+	if (m->type != SYNC_MUTEX_NORMAL) {
+		self = thread_id();
+		if (__atomic_load_n(&m->owner, __ATOMIC_RELAXED) == self) {
+			if (m->type == SYNC_MUTEX_ERRORCHECK)
+				return EBUSY;
+			if (m->count == UINT32_MAX)
+				return EAGAIN;
+			m->count++;
+			return 0;
+		}
+	}
+
+	uint32_t c = 0;
+	if (!__atomic_compare_exchange_n(&m->state, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return EBUSY;
+
+	if (self) {
+		__atomic_store_n(&m->owner, self, __ATOMIC_RELAXED);
+		m->count = 1;
+	}
+	return 0;
+}
+
+int sync_mutex_unlock(sync_mutex *m) {
+	if (m->type != SYNC_MUTEX_NORMAL) {
+		if (__atomic_load_n(&m->owner, __ATOMIC_RELAXED) != thread_id())
+			return EPERM;
+		if (--m->count)
+			return 0;
+		__atomic_store_n(&m->owner, 0, __ATOMIC_RELAXED);
+	}
+
+	if (__atomic_exchange_n(&m->state, 0, __ATOMIC_RELEASE) == 2)
+		sync_wake(&m->state, 1);
+	return 0;
+}
+
+int sync_mutex_destroy(sync_mutex *m) {
+	// No kernel object behind it, a held mutex is the only thing to refuse
+	return __atomic_load_n(&m->state, __ATOMIC_RELAXED) ? EBUSY : 0;
+}
+
+// Game deadlines are CLOCK_REALTIME, setting the clock mid wait must neither cut nor stretch it
+uint64_t sync_deadline(const struct timespec *abstime) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	uint64_t now = sync_now_us();
+	int64_t left = ((int64_t)abstime->tv_sec - tv.tv_sec) * 1000000 + (abstime->tv_nsec / 1000 - tv.tv_usec);
+	return left > 0 ? now + left : now;
+}
+
+void sync_cond_init(sync_cond *c) {
+	c->seq = 0;
+	c->waiters = 0;
+}
+
+int sync_cond_timedwait(sync_cond *c, sync_mutex *m, uint64_t deadline) {
+	// Counted while the mutex is still held, a signaler that changed the predicate under it can't miss us
+	__atomic_add_fetch(&c->waiters, 1, __ATOMIC_SEQ_CST);
+	uint32_t seq = __atomic_load_n(&c->seq, __ATOMIC_SEQ_CST);
+	count_stat(cond_waits);
+
+	// A recursive owner gives up every level, and gets them all back
+	uint32_t depth = m->count;
+	if (m->type != SYNC_MUTEX_NORMAL)
+		m->count = 1;
+	sync_mutex_unlock(m);
+
+	// Anything bumping seq since we read it makes the wait return right away
+	int ret = sync_wait(&c->seq, seq, deadline);
+	__atomic_sub_fetch(&c->waiters, 1, __ATOMIC_SEQ_CST);
+
+	sync_mutex_lock(m);
+	if (m->type != SYNC_MUTEX_NORMAL)
+		m->count = depth;
+	if (ret == ETIMEDOUT) {
+		count_stat(cond_timeouts);
+		return ETIMEDOUT;
+	}
+	return 0;
+}
+
+int sync_cond_wait(sync_cond *c, sync_mutex *m) {
+	return sync_cond_timedwait(c, m, 0);
+}
+
+int sync_cond_signal(sync_cond *c) {
+	if (!__atomic_load_n(&c->waiters, __ATOMIC_SEQ_CST)) {
+		count_stat(cond_idle);
+		return 0;
+	}
+	__atomic_add_fetch(&c->seq, 1, __ATOMIC_SEQ_CST);
+	sync_wake(&c->seq, 1);
+	return 0;
+}
+
+int sync_cond_broadcast(sync_cond *c) {
+	if (!__atomic_load_n(&c->waiters, __ATOMIC_SEQ_CST)) {
+		count_stat(cond_idle);
+		return 0;
+	}
+	__atomic_add_fetch(&c->seq, 1, __ATOMIC_SEQ_CST);
+	sync_wake(&c->seq, INT_MAX);
+	return 0;
+}
+
+int sync_cond_destroy(sync_cond *c) {
+	return __atomic_load_n(&c->waiters, __ATOMIC_RELAXED) ? EBUSY : 0;
+}
+
+/*
+ * A negative count means zero with sleepers behind it. A post then can't tell how
+ * many there are, so it wakes them all and those who lose the race go back to sleep.
+ */
+int sync_sem_init(sync_sem *s, unsigned int value) {
+	if (value > INT32_MAX)
+		return EINVAL;
+	s->count = value;
+	return 0;
+}
+
+int sync_sem_post(sync_sem *s) {
+	int32_t old = __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+	int32_t n;
+	do {
+		if (old == INT32_MAX)
+			return EOVERFLOW;
+		n = old < 0 ? 1 : old + 1;
+	} while (!__atomic_compare_exchange_n(&s->count, &old, n, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	if (old < 0)
+		sync_wake((uint32_t *)&s->count, INT_MAX);
+	return 0;
+}
+
+int sync_sem_trywait(sync_sem *s) {
+	int32_t old = __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+	while (old > 0) {
+		if (__atomic_compare_exchange_n(&s->count, &old, old - 1, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return 0;
+	}
+	return EAGAIN;
+}
+
+int sync_sem_timedwait(sync_sem *s, uint64_t deadline) {
+	for (;;) {
+		if (!sync_sem_trywait(s))
+			return 0;
+		// Flag the sleeper before going down, so the next post knows to wake us
+		int32_t old = 0;
+		if (!__atomic_compare_exchange_n(&s->count, &old, -1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED) && old > 0)
+			continue;
+		count_stat(sem_sleeps);
+		if (sync_wait((uint32_t *)&s->count, (uint32_t)-1, deadline) == ETIMEDOUT) {
+			// One last look, a post may have landed right at the deadline
+			if (!sync_sem_trywait(s))
+				return 0;
+			count_stat(sem_timeouts);
+			return ETIMEDOUT;
+		}
+	}
+}
+
+int sync_sem_wait(sync_sem *s) {
+	return sync_sem_timedwait(s, 0);
+}
+
+int sync_sem_getvalue(sync_sem *s) {
+	int32_t v = __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+	return v < 0 ? 0 : v;
+}
+
+void sync_get_stats(sync_stats *out) {
+	*out = stats;
+}
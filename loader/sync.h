@@ -0,0 +1,68 @@
+#ifndef __SYNC_H__
+#define __SYNC_H__
+
+#include <stdint.h>
+#include <time.h>
+
+// Same values as the bionic and newlib mutex types
+enum {
+	SYNC_MUTEX_NORMAL,
+	SYNC_MUTEX_RECURSIVE,
+	SYNC_MUTEX_ERRORCHECK
+};
+
+typedef struct {
+	uint32_t state; // 0 unlocked, 1 locked, 2 locked with sleepers
+	uint16_t type;
+	uint16_t spins; // running estimate of how long the lock is worth spinning for
+	uintptr_t owner; // recursive and errorcheck only
+	uint32_t count;
+} sync_mutex;
+
+typedef struct {
+	uint32_t seq; // bumped by every signal and broadcast, waiters sleep on it
+	uint32_t waiters;
+} sync_cond;
+
+typedef struct {
+	int32_t count; // fits the single word of a bionic sem_t
+} sync_sem;
+
+typedef struct {
+	uint32_t mutex_contended; // locks that missed the fast path
+	uint32_t mutex_spun; // of those, taken while spinning
+	uint32_t mutex_sleeps; // kernel waits
+	uint32_t cond_waits;
+	uint32_t cond_timeouts;
+	uint32_t cond_idle; // signals and broadcasts with nobody to wake
+	uint32_t sem_sleeps;
+	uint32_t sem_timeouts;
+} sync_stats;
+
+void sync_init(void);
+uint64_t sync_now_us(void);
+uint64_t sync_deadline(const struct timespec *abstime);
+
+void sync_mutex_init(sync_mutex *m, int type);
+int sync_mutex_lock(sync_mutex *m);
+int sync_mutex_trylock(sync_mutex *m);
+int sync_mutex_unlock(sync_mutex *m);
+int sync_mutex_destroy(sync_mutex *m);
+
+void sync_cond_init(sync_cond *c);
+int sync_cond_wait(sync_cond *c, sync_mutex *m);
+int sync_cond_timedwait(sync_cond *c, sync_mutex *m, uint64_t deadline);
+int sync_cond_signal(sync_cond *c);
+int sync_cond_broadcast(sync_cond *c);
+int sync_cond_destroy(sync_cond *c);
+
+int sync_sem_init(sync_sem *s, unsigned int value);
+int sync_sem_post(sync_sem *s);
+int sync_sem_wait(sync_sem *s);
+int sync_sem_trywait(sync_sem *s);
+int sync_sem_timedwait(sync_sem *s, uint64_t deadline);
+int sync_sem_getvalue(sync_sem *s);
+
+void sync_get_stats(sync_stats *stats);
+
+#endif
@@ -0,0 +1,210 @@
+/* trace.c -- binary recorder of the game file accesses
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "trace.h"
+
+#ifdef ENABLE_IO_TRACE
+
+#define TRACE_RING_SIZE 16384 // must be a power of two
+#define TRACE_FLUSH_INTERVAL (100 * 1000)
+#define TRACE_PATH_BUCKETS 1024
+
+typedef struct {
+	volatile uint32_t seq; // index + 1 once the record is fully written
+	trace_record_t rec;
+} trace_slot;
+
+typedef struct trace_path_t {
+	struct trace_path_t *next;
+	uint32_t hash;
+	uint32_t id;
+	char name[];
+} trace_path_t;
+
+static trace_slot ring[TRACE_RING_SIZE];
+static volatile uint32_t ring_head = 0; // next slot to be reserved by producers
+static volatile uint32_t ring_tail = 0; // next slot to be written out, owned by the flusher
+static volatile uint32_t dropped = 0;
+
+static trace_path_t *paths[TRACE_PATH_BUCKETS];
+static trace_path_t **pending_paths = NULL; // defined but not written out yet
+static int num_pending_paths = 0, pending_paths_size = 0;
+static uint32_t num_paths = 0;
+static pthread_mutex_t paths_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static SceUID trace_fd = -1;
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_record_t out[1024];
+
+uint64_t trace_begin(void) {
+	return sceKernelGetProcessTimeWide();
+}
+
+static uint32_t hash_path(const char *path) {
+	uint32_t h = 0x811C9DC5;
+	while (*path) {
+		h ^= (uint8_t)tolower((uint8_t)*path++);
+		h *= 0x01000193;
+	}
+	return h;
+}
+
+uint32_t trace_path(const char *path) {
+	uint32_t hash = hash_path(path);
+	pthread_mutex_lock(&paths_lock);
+	trace_path_t *p = paths[hash % TRACE_PATH_BUCKETS];
+	while (p) {
+		if (p->hash == hash && !strcasecmp(p->name, path)) {
+			pthread_mutex_unlock(&paths_lock);
+			return p->id;
+		}
+		p = p->next;
+	}
+
+	size_t len = strlen(path);
+	p = malloc(sizeof(trace_path_t) + len + 1);
+	if (num_pending_paths == pending_paths_size) {
+		pending_paths_size = pending_paths_size ? pending_paths_size * 2 : 64;
+		pending_paths = realloc(pending_paths, pending_paths_size * sizeof(trace_path_t *));
+	}
+	if (!p || !pending_paths) {
+		free(p);
+		pthread_mutex_unlock(&paths_lock);
+		return 0;
+	}
+	p->hash = hash;
+	p->id = ++num_paths;
+	memcpy(p->name, path, len + 1);
+	p->next = paths[hash % TRACE_PATH_BUCKETS];
+	paths[hash % TRACE_PATH_BUCKETS] = p;
+	pending_paths[num_pending_paths++] = p;
+	pthread_mutex_unlock(&paths_lock);
+	return p->id;
+}
+
+// Producers reserve a slot with a CAS on the head and publish it through the
+// slot sequence, so the hooks never block on each other or on the flusher
+void trace_record(int type, uint32_t path_id, uintptr_t handle, uint64_t offset, uint32_t size, int failed, uint64_t start) {
+	uint64_t now = sceKernelGetProcessTimeWide();
+	uint32_t head = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+	do {
+		if (head - __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) >= TRACE_RING_SIZE) {
+			__atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+	} while (!__atomic_compare_exchange_n(&ring_head, &head, head + 1, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+	trace_slot *slot = &ring[head & (TRACE_RING_SIZE - 1)];
+	slot->rec.timestamp = start;
+	slot->rec.offset = offset;
+	slot->rec.latency = now - start;
+	slot->rec.thread = sceKernelGetThreadId();
+	slot->rec.handle = handle;
+	slot->rec.path_id = path_id;
+	slot->rec.size = size;
+	slot->rec.type = type;
+	slot->rec.result = failed ? 1 : 0;
+	__atomic_store_n(&slot->seq, head + 1, __ATOMIC_RELEASE);
+}
+
+void trace_phase(const char *name) {
+	uint64_t start = trace_begin();
+	trace_record(TRACE_PHASE, trace_path(name), 0, TRACE_NO_OFFSET, 0, 0, start);
+}
+
+static void write_paths(void) {
+	pthread_mutex_lock(&paths_lock);
+	for (int i = 0; i < num_pending_paths; i++) {
+		trace_path_t *p = pending_paths[i];
+		trace_record_t rec;
+		memset(&rec, 0, sizeof(rec));
+		rec.type = TRACE_PATH;
+		rec.path_id = p->id;
+		rec.size = strlen(p->name);
+		rec.offset = TRACE_NO_OFFSET;
+		sceIoWrite(trace_fd, &rec, sizeof(rec));
+		sceIoWrite(trace_fd, p->name, rec.size);
+	}
+	num_pending_paths = 0;
+	pthread_mutex_unlock(&paths_lock);
+}
+
+void trace_flush(void) {
+	if (trace_fd < 0)
+		return;
+
+	pthread_mutex_lock(&flush_lock);
+	// Paths are always interned before the records using them get reserved
+	write_paths();
+
+	uint32_t tail = ring_tail;
+	uint32_t head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+	int n = 0;
+	while (tail != head) {
+		trace_slot *slot = &ring[tail & (TRACE_RING_SIZE - 1)];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != tail + 1)
+			break; // still being written, picked up on next flush
+		out[n++] = slot->rec;
+		tail++;
+		if (n == sizeof(out) / sizeof(*out)) {
+			__atomic_store_n(&ring_tail, tail, __ATOMIC_RELEASE);
+			sceIoWrite(trace_fd, out, n * sizeof(*out));
+			n = 0;
+		}
+	}
+	__atomic_store_n(&ring_tail, tail, __ATOMIC_RELEASE);
+	if (n)
+		sceIoWrite(trace_fd, out, n * sizeof(*out));
+
+	uint32_t lost = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+	sceIoPwrite(trace_fd, &lost, sizeof(lost), offsetof(trace_header, dropped));
+	pthread_mutex_unlock(&flush_lock);
+}
+
+static void *trace_thread(void *arg) {
+	for (;;) {
+		sceKernelDelayThread(TRACE_FLUSH_INTERVAL);
+		trace_flush();
+	}
+	return NULL;
+}
+
+void trace_init(const char *path) {
+	trace_fd = sceIoOpen(path, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+	if (trace_fd < 0) {
+		sceClibPrintf("trace: cannot create %s\n", path);
+		return;
+	}
+	trace_header hdr = {
+		.magic = TRACE_MAGIC,
+		.version = TRACE_VERSION,
+		.record_size = sizeof(trace_record_t),
+		.dropped = 0
+	};
+	sceIoWrite(trace_fd, &hdr, sizeof(hdr));
+
+	pthread_t t;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, 32 * 1024);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_create(&t, &attr, trace_thread, NULL);
+	atexit(trace_flush);
+	sceClibPrintf("trace: recording to %s\n", path);
+}
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+
+#include "config.h"
+
+#define TRACE_MAGIC 0x43525456 // VTRC
+#define TRACE_VERSION 1
+#define TRACE_NO_OFFSET 0xFFFFFFFFFFFFFFFFULL
+
+enum {
+	TRACE_PATH, // path_id definition, size bytes of name follow the record
+	TRACE_PHASE, // path_id names the load phase starting here
+	TRACE_OPEN,
+	TRACE_READ,
+	TRACE_SEEK,
+	TRACE_STAT,
+	TRACE_CLOSE,
+	TRACE_ASSET_OPEN,
+	TRACE_ASSET_READ,
+	TRACE_ASSET_SEEK,
+	TRACE_ASSET_CLOSE,
+	TRACE_ZIP_OPEN,
+	TRACE_ZIP_READ,
+	TRACE_ZIP_SEEK,
+	TRACE_ZIP_CLOSE,
+	TRACE_NUM_TYPES
+};
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t dropped; // events lost to a full ring, patched on flush
+} trace_header;
+
+typedef struct {
+	uint64_t timestamp; // usecs of process time when the call started
+	uint64_t offset; // position before the call, TRACE_NO_OFFSET if unknown
+	uint32_t latency; // usecs spent inside the call
+	uint32_t thread;
+	uint32_t handle; // FILE, fd, AAsset or zip_file the event refers to
+	uint32_t path_id;
+	uint32_t size; // bytes requested for reads, file size for opens and stats, whence for seeks
+	uint16_t type;
+	uint16_t result; // 1 if the call failed
+} trace_record_t;
+
+#ifdef ENABLE_IO_TRACE
+void trace_init(const char *path);
+void trace_flush(void);
+uint64_t trace_begin(void);
+uint32_t trace_path(const char *path);
+void trace_record(int type, uint32_t path_id, uintptr_t handle, uint64_t offset, uint32_t size, int failed, uint64_t start);
+void trace_phase(const char *name);
+#else
+#define trace_init(path)
+#define trace_flush()
+#define trace_begin() 0
+#define trace_record(type, path_id, handle, offset, size, failed, start) ((void)(offset), (void)(start))
+#define trace_phase(name)
+#endif
+
+#endif
@@ -0,0 +1,587 @@
+/* vfs.c -- mount table routing file lookups through stackable backends
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <zip.h>
+
+#include "config.h"
+#include "vfs.h"
+#include "file_cache.h"
+#include "fs_index.h"
+#include "writebehind.h"
+#include "dir_cache.h"
+#include "readahead.h"
+#include "obb.h"
+#include "fd_pool.h"
+#include "mmap.h"
+#include "io_sched.h"
+#include "prefetch.h"
+
+typedef struct {
+	char prefix[256];
+	size_t len;
+	int order[VFS_NUM_BACKENDS];
+	int count;
+} vfs_mount_point;
+
+typedef struct {
+	uint32_t hash;
+	file_cache_entry *entry; // NULL until preloaded, or once invalidated
+	char *path;
+} overlay_file;
+
+static char vfs_root[256];
+static size_t vfs_root_len = 0;
+static vfs_mount_point mounts[VFS_MAX_MOUNTS];
+static int num_mounts = 0;
+static pthread_mutex_t mounts_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static obb_archive *archive = NULL;
+static pthread_once_t archive_once = PTHREAD_ONCE_INIT;
+
+static overlay_file *overlay = NULL;
+static int overlay_count = 0;
+static size_t overlay_budget = 0;
+static pthread_mutex_t overlay_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t hash_path(const char *path) {
+	uint32_t h = 0x811C9DC5;
+	while (*path) {
+		h ^= (uint8_t)tolower((uint8_t)*path++);
+		h *= 0x01000193;
+	}
+	return h;
+}
+
+// Relative paths are relative to the data directory, as they'd be to the apk on Android.
+// The absolute path is written to buf, which must hold 256 bytes, and returned.
+const char *vfs_path(const char *path, char *buf) {
+	if (!strncmp(path, "ux0:", 4))
+		snprintf(buf, 256, "%s", path);
+	else
+		snprintf(buf, 256, "%s/%s", vfs_root, path);
+	return buf;
+}
+
+// Host backend, the data directory as it is on the card
+
+static stream *host_open(const char *path, size_t buf_size) {
+	file_cache_entry *entry = file_cache_get(path);
+	if (entry) {
+		stream *s = stream_open_mem(entry);
+		if (s)
+			return s;
+		file_cache_release(entry);
+	}
+	ra_file *ra = ra_open(path);
+	if (ra) {
+		stream *s = stream_open_ra(ra, buf_size);
+		if (s)
+			return s;
+		ra_close(ra);
+	}
+	return stream_open(path, "r", buf_size);
+}
+
+static int host_open_fd(const char *path) {
+	int fd = ra_open_fd(path);
+	return fd >= 0 ? fd : open(path, O_RDONLY);
+}
+
+static int host_stat(const char *path, struct stat *st) {
+	int res = wb_stat(path, st);
+	if (res != WB_UNKNOWN)
+		return res;
+	res = fs_index_stat(path, st);
+	if (res == FS_INDEX_UNKNOWN) {
+		res = stat(path, st);
+		if (res == 0)
+			fs_index_update(path, st);
+	}
+	return res == FS_INDEX_HIT ? 0 : -1;
+}
+
+// Pending saves get merged into the listing of the disk
+static dir_listing *host_list(const char *path, dir_listing *base) {
+	dir_listing *own = wb_handles(path) ? wb_list_dir(path) : dir_cache_get(path);
+	if (!own || !base)
+		return own ? own : base;
+
+	int count = dir_cache_count(own);
+	dir_patch *patch = malloc((count ? count : 1) * sizeof(dir_patch));
+	dir_listing *l = NULL;
+	if (patch) {
+		for (int i = 0; i < count; i++) {
+			patch[i].name = dir_cache_name(own, i);
+			patch[i].state = dir_cache_is_dir(own, i) ? DIR_PATCH_DIR : DIR_PATCH_FILE;
+		}
+		l = dir_cache_patch(base, path, patch, count);
+		free(patch);
+	} else {
+		errno = ENOMEM;
+	}
+	dir_cache_release(own);
+	dir_cache_release(base);
+	return l;
+}
+
+
+static void archive_open(void) {
+	int error;
+	archive = obb_open(VFS_ARCHIVE_PATH, &error);
+}
+
+static int64_t archive_locate(const char *path) {
+	if (strncasecmp(path, vfs_root, vfs_root_len) || path[vfs_root_len] != '/')
+		return -1;
+	pthread_once(&archive_once, archive_open);
+	if (!archive)
+		return -1;
+	return obb_locate(archive, &path[vfs_root_len + 1], 0);
+}
+
+// Small entries get decompressed in one go, they'd be read whole anyway
+static stream *archive_open_entry(const char *path, size_t buf_size) {
+	int64_t index = archive_locate(path);
+	if (index < 0)
+		return NULL;
+
+	int error;
+	obb_stat st;
+	obb_file *f = obb_fopen_index(archive, index, 0, &error);
+	if (!f)
+		return NULL;
+	obb_stat_index(archive, index, &st);
+	if (st.size > VFS_ARCHIVE_MAX_BUFFERED) {
+		stream *s = stream_open_obb(f, st.size, buf_size);
+		if (!s)
+			obb_fclose(f);
+		return s;
+	}
+	uint8_t *buf = malloc(st.size ? st.size : 1);
+	if (!buf || obb_fread(f, buf, st.size) != st.size) {
+		free(buf);
+		obb_fclose(f);
+		return NULL;
+	}
+	obb_fclose(f);
+
+	stream *s = stream_open_buf(buf, st.size, NULL, 0);
+	if (!s)
+		free(buf);
+	return s;
+}
+
+static int archive_stat(const char *path, struct stat *st) {
+	int64_t index = archive_locate(path);
+	if (index < 0)
+		return -1;
+	obb_stat ost;
+	if (obb_stat_index(archive, index, &ost) < 0)
+		return -1;
+	memset(st, 0, sizeof(*st));
+	st->st_mode = S_IFREG | 0444;
+	st->st_size = ost.size;
+	st->st_mtime = ost.mtime;
+	return 0;
+}
+
+static int add_child(dir_patch **patch, int *count, int *cap, const char *name, size_t len, int is_dir) {
+	// Files are unique in the archive, only the directories they imply repeat
+	for (int i = 0; is_dir && i < *count; i++) {
+		if ((*patch)[i].state == DIR_PATCH_DIR && !strncasecmp((*patch)[i].name, name, len) && !(*patch)[i].name[len])
+			return 0;
+	}
+	if (*count == *cap) {
+		int n = *cap ? *cap * 2 : 16;
+		dir_patch *p = realloc(*patch, n * sizeof(dir_patch));
+		if (!p)
+			return -1;
+		*patch = p;
+		*cap = n;
+	}
+	char *copy = malloc(len + 1);
+	if (!copy)
+		return -1;
+	memcpy(copy, name, len);
+	copy[len] = 0;
+	(*patch)[*count].name = copy;
+	(*patch)[*count].state = is_dir ? DIR_PATCH_DIR : DIR_PATCH_FILE;
+	(*count)++;
+	return 0;
+}
+
+// The archive keeps no directories of its own, they are whatever its entry names imply.
+// Every entry gets looked at, listing directories is rare enough for that.
+static dir_listing *archive_list(const char *path, dir_listing *base) {
+	if (strncasecmp(path, vfs_root, vfs_root_len) || (path[vfs_root_len] != '/' && path[vfs_root_len]))
+		return base;
+	pthread_once(&archive_once, archive_open);
+	if (!archive)
+		return base;
+
+	const char *rel = path[vfs_root_len] ? &path[vfs_root_len + 1] : "";
+	size_t rel_len = strlen(rel);
+	dir_patch *patch = NULL;
+	int count = 0, cap = 0, res = 0, found = 0;
+	int64_t num = obb_num_entries(archive);
+	for (int64_t i = 0; i < num && res == 0; i++) {
+		obb_stat st;
+		if (obb_stat_index(archive, i, &st) < 0)
+			continue;
+		const char *name = st.name;
+		if (rel_len) {
+			if (strncasecmp(name, rel, rel_len) || name[rel_len] != '/')
+				continue;
+			name += rel_len + 1;
+		}
+		found = 1;
+		size_t len = strcspn(name, "/");
+		if (len)
+			res = add_child(&patch, &count, &cap, name, len, name[len] == '/');
+	}
+
+	dir_listing *l = base;
+	if (res < 0) {
+		if (base)
+			dir_cache_release(base);
+		errno = ENOMEM;
+		l = NULL;
+	} else if (found) {
+		l = dir_cache_patch(base, path, patch, count);
+		if (base)
+			dir_cache_release(base);
+	}
+	for (int i = 0; i < count; i++)
+		free((char *)patch[i].name);
+	free(patch);
+	return l;
+}
+
+// Overlay backend, hot files pinned in the file cache so that opening them costs no card access
+
+static overlay_file *overlay_find(const char *path) {
+	uint32_t hash = hash_path(path);
+	for (int i = 0; i < overlay_count; i++) {
+		if (overlay[i].hash == hash && overlay[i].entry && !strcasecmp(overlay[i].path, path))
+			return &overlay[i];
+	}
+	return NULL;
+}
+
+static stream *overlay_open(const char *path, size_t buf_size) {
+	pthread_mutex_lock(&overlay_lock);
+	overlay_file *o = overlay_find(path);
+	file_cache_entry *entry = o ? file_cache_find(o->path) : NULL;
+	pthread_mutex_unlock(&overlay_lock);
+	if (!entry)
+		return NULL;
+	stream *s = stream_open_mem(entry);
+	if (!s)
+		file_cache_release(entry);
+	return s;
+}
+
+static int overlay_stat(const char *path, struct stat *st) {
+	pthread_mutex_lock(&overlay_lock);
+	overlay_file *o = overlay_find(path);
+	if (o) {
+		memset(st, 0, sizeof(*st));
+		st->st_mode = S_IFREG | 0666;
+		st->st_size = file_cache_size(o->entry);
+	}
+	pthread_mutex_unlock(&overlay_lock);
+	return o ? 0 : -1;
+}
+
+static void overlay_invalidate(const char *path) {
+	pthread_mutex_lock(&overlay_lock);
+	overlay_file *o = overlay_find(path);
+	if (o) {
+		file_cache_release(o->entry);
+		o->entry = NULL;
+	}
+	pthread_mutex_unlock(&overlay_lock);
+}
+
+static void *overlay_thread(void *arg) {
+	io_set_thread_class(IO_CLASS_BACKGROUND);
+	uint64_t t = sceKernelGetProcessTimeWide();
+	size_t total = 0;
+	int loaded = 0;
+	for (int i = 0; i < overlay_count; i++) {
+		SceIoStat st;
+		if (sceIoGetstat(overlay[i].path, &st) < 0 || SCE_S_ISDIR(st.st_mode) || total + st.st_size > overlay_budget)
+			continue;
+		SceUID fd = fd_pool_open(overlay[i].path);
+		if (fd < 0)
+			continue;
+		uint8_t *data = malloc(st.st_size ? st.st_size : 1);
+		if (data && io_pread(fd, data, st.st_size, 0, IO_CLASS_BACKGROUND) == st.st_size) {
+			file_cache_entry *entry = file_cache_pin(overlay[i].path, data, st.st_size);
+			pthread_mutex_lock(&overlay_lock);
+			overlay[i].entry = entry;
+			pthread_mutex_unlock(&overlay_lock);
+			if (entry) {
+				total += st.st_size;
+				loaded++;
+			}
+		} else {
+			free(data);
+		}
+		fd_pool_close(fd);
+	}
+	sceClibPrintf("vfs: preloaded %d files (%u bytes) in %llu ms\n", loaded, total, (sceKernelGetProcessTimeWide() - t) / 1000);
+	return NULL;
+}
+
+// The manifest lists one path per line, relative to the data directory. Files get
+// loaded in the background, until then they keep being served by the next backends.
+void vfs_overlay_load(const char *manifest, size_t budget) {
+	FILE *f = fopen(manifest, "r");
+	if (!f)
+		return;
+	char line[256], path[256];
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\r\n")] = 0;
+		if (!line[0] || line[0] == '#')
+			continue;
+		overlay_file *o = realloc(overlay, (overlay_count + 1) * sizeof(overlay_file));
+		if (!o)
+			break;
+		overlay = o;
+		o = &overlay[overlay_count];
+		o->path = strdup(vfs_path(line, path));
+		if (!o->path)
+			break;
+		o->hash = hash_path(o->path);
+		o->entry = NULL;
+		overlay_count++;
+	}
+	fclose(f);
+	if (!overlay_count)
+		return;
+
+	overlay_budget = budget;
+	pthread_t t;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, 32 * 1024);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_create(&t, &attr, overlay_thread, NULL);
+}
+
+static const vfs_backend backends[VFS_NUM_BACKENDS] = {
+	[VFS_HOST] = { "host", host_open, host_open_fd, host_stat, NULL, host_list },
+	[VFS_ARCHIVE] = { "archive", archive_open_entry, NULL, archive_stat, NULL, archive_list },
+	[VFS_OVERLAY] = { "overlay", overlay_open, NULL, overlay_stat, overlay_invalidate, NULL }, // its files are on the card too
+};
+
+// The longest matching prefix decides the lookup order, remounting a prefix replaces it
+int vfs_mount(const char *prefix, const int *order, int count) {
+	if (count > VFS_NUM_BACKENDS || strlen(prefix) >= sizeof(mounts[0].prefix))
+		return -1;
+	pthread_mutex_lock(&mounts_lock);
+	int i;
+	for (i = 0; i < num_mounts; i++) {
+		if (!strcasecmp(mounts[i].prefix, prefix))
+			break;
+	}
+	if (i == VFS_MAX_MOUNTS) {
+		pthread_mutex_unlock(&mounts_lock);
+		return -1;
+	}
+	if (i == num_mounts)
+		num_mounts++;
+	strcpy(mounts[i].prefix, prefix);
+	mounts[i].len = strlen(prefix);
+	memcpy(mounts[i].order, order, count * sizeof(int));
+	mounts[i].count = count;
+	pthread_mutex_unlock(&mounts_lock);
+	return 0;
+}
+
+// The archive only backs the top level entries it actually has, so that lookups of
+// saves, configs and other files of the data root never end up searching it
+void vfs_mount_archive(void) {
+	static const int order[] = { VFS_OVERLAY, VFS_HOST, VFS_ARCHIVE };
+	pthread_once(&archive_once, archive_open);
+	if (!archive)
+		return;
+
+	char tops[VFS_MAX_MOUNTS - VFS_RESERVED_MOUNTS - 1][256]; // the root takes one
+	int num_tops = 0;
+	int64_t count = obb_num_entries(archive);
+	for (int64_t i = 0; i < count && num_tops >= 0; i++) {
+		obb_stat st;
+		if (obb_stat_index(archive, i, &st) < 0)
+			continue;
+		size_t len = strcspn(st.name, "/");
+		if (!len || vfs_root_len + len + 1 >= sizeof(tops[0]))
+			continue;
+		int j;
+		for (j = 0; j < num_tops; j++) {
+			if (!strncasecmp(&tops[j][vfs_root_len + 1], st.name, len) && !tops[j][vfs_root_len + 1 + len])
+				break;
+		}
+		if (j < num_tops)
+			continue;
+		if (num_tops == sizeof(tops) / sizeof(*tops)) {
+			num_tops = -1;
+			break;
+		}
+		snprintf(tops[num_tops++], sizeof(tops[0]), "%s/%.*s", vfs_root, (int)len, st.name);
+	}
+
+	if (num_tops < 0) {
+		sceClibPrintf("vfs: too many top level archive entries, mounting it under the whole root\n");
+		vfs_mount(vfs_root, order, sizeof(order) / sizeof(*order));
+		return;
+	}
+	for (int i = 0; i < num_tops; i++)
+		vfs_mount(tops[i], order, sizeof(order) / sizeof(*order));
+}
+
+void vfs_init(const char *root) {
+	strncpy(vfs_root, root, sizeof(vfs_root) - 1);
+	vfs_root_len = strlen(vfs_root);
+	static const int order[] = { VFS_OVERLAY, VFS_HOST };
+	vfs_mount(root, order, sizeof(order) / sizeof(*order));
+}
+
+// Paths outside of every mount only exist on the card
+static int lookup_order(const char *path, int *order) {
+	static const int host_only[] = { VFS_HOST };
+	const vfs_mount_point *best = NULL;
+	pthread_mutex_lock(&mounts_lock);
+	for (int i = 0; i < num_mounts; i++) {
+		const vfs_mount_point *m = &mounts[i];
+		if ((!best || m->len > best->len) && !strncasecmp(path, m->prefix, m->len) &&
+			(path[m->len] == '/' || !path[m->len]))
+			best = m;
+	}
+	int count = best ? best->count : 1;
+	memcpy(order, best ? best->order : host_only, count * sizeof(int));
+	pthread_mutex_unlock(&mounts_lock);
+	return count;
+}
+
+stream *vfs_open(const char *path, size_t buf_size) {
+	prefetch_notify_file(path);
+	int order[VFS_NUM_BACKENDS];
+	int count = lookup_order(path, order);
+	for (int i = 0; i < count; i++) {
+		stream *s = backends[order[i]].open(path, buf_size);
+		if (s)
+			return s;
+	}
+	return NULL;
+}
+
+int vfs_open_fd(const char *path) {
+	prefetch_notify_file(path);
+	int order[VFS_NUM_BACKENDS];
+	int count = lookup_order(path, order);
+	for (int i = 0; i < count; i++) {
+		const vfs_backend *b = &backends[order[i]];
+		if (b->open_fd) {
+			int fd = b->open_fd(path);
+			if (fd >= 0)
+				return fd;
+			continue;
+		}
+		stream *s = b->open(path, STREAM_BUFFER_SIZE);
+		if (s) {
+			int fd = fileno_hook(s);
+			if (fd >= 0)
+				return fd;
+			stream_close(s);
+		}
+	}
+	return -1;
+}
+
+int vfs_stat(const char *path, struct stat *st) {
+	int order[VFS_NUM_BACKENDS];
+	int count = lookup_order(path, order);
+	for (int i = 0; i < count; i++) {
+		if (backends[order[i]].stat(path, st) == 0)
+			return 0;
+	}
+	return -1;
+}
+
+// A directory also lists what the mounts below it serve, the data root would miss
+// the top level archive entries otherwise
+static int list_order(const char *path, size_t len, int *order) {
+	int count = lookup_order(path, order);
+	pthread_mutex_lock(&mounts_lock);
+	for (int i = 0; i < num_mounts; i++) {
+		const vfs_mount_point *m = &mounts[i];
+		if (m->len <= len || m->prefix[len] != '/' || strncasecmp(path, m->prefix, len))
+			continue;
+		for (int j = 0; j < m->count; j++) {
+			int k;
+			for (k = 0; k < count; k++) {
+				if (order[k] == m->order[j])
+					break;
+			}
+			if (k == count)
+				order[count++] = m->order[j];
+		}
+	}
+	pthread_mutex_unlock(&mounts_lock);
+	return count;
+}
+
+// Backends are merged from the last to the first, so that the entries of the
+// preferred ones win when both have the same name
+dir_listing *vfs_list_dir(const char *path) {
+	char dir[256];
+	strncpy(dir, path, sizeof(dir) - 1);
+	dir[sizeof(dir) - 1] = 0;
+	size_t len = strlen(dir);
+	while (len > 1 && dir[len - 1] == '/')
+		dir[--len] = 0;
+
+	int order[VFS_NUM_BACKENDS];
+	int count = list_order(dir, len, order);
+	dir_listing *l = NULL;
+	int error = ENOENT;
+	for (int i = count - 1; i >= 0; i--) {
+		if (!backends[order[i]].list)
+			continue;
+		errno = 0;
+		l = backends[order[i]].list(dir, l);
+		if (!l && errno)
+			error = errno;
+	}
+	if (!l)
+		errno = error;
+	return l;
+}
+
+// Drops whatever keeps the file open or loaded, it's about to be written, removed or renamed
+void vfs_invalidate(const char *path) {
+	fd_pool_invalidate(path);
+	mmap_invalidate(path);
+	for (int i = 0; i < VFS_NUM_BACKENDS; i++) {
+		if (backends[i].invalidate)
+			backends[i].invalidate(path);
+	}
+}
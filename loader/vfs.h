@@ -0,0 +1,46 @@
+#ifndef __VFS_H__
+#define __VFS_H__
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "stream.h"
+#include "dir_cache.h"
+
+#define VFS_MAX_MOUNTS 16
+#define VFS_RESERVED_MOUNTS 4 // left for the loader's own mounts by vfs_mount_archive
+#define VFS_ARCHIVE_PATH "ux0:data/valiant/main.obb"
+
+enum {
+	VFS_HOST, // the data directory on the memory card
+	VFS_ARCHIVE, // entries of the obb, or of its repacked version
+	VFS_OVERLAY, // files preloaded in RAM from a manifest
+	VFS_NUM_BACKENDS
+};
+
+// Paths given to backends are always absolute
+typedef struct {
+	const char *name;
+	stream *(*open)(const char *path, size_t buf_size);
+	int (*open_fd)(const char *path); // optional, opens served as streams otherwise
+	int (*stat)(const char *path, struct stat *st);
+	void (*invalidate)(const char *path); // optional
+	// Optional, merges the entries of a directory into base, which it takes over.
+	// NULL when neither of them has the directory.
+	dir_listing *(*list)(const char *path, dir_listing *base);
+} vfs_backend;
+
+void vfs_init(const char *root);
+int vfs_mount(const char *prefix, const int *order, int count);
+void vfs_mount_archive(void);
+void vfs_overlay_load(const char *manifest, size_t budget);
+
+const char *vfs_path(const char *path, char *buf);
+
+stream *vfs_open(const char *path, size_t buf_size);
+int vfs_open_fd(const char *path);
+int vfs_stat(const char *path, struct stat *st);
+dir_listing *vfs_list_dir(const char *path);
+void vfs_invalidate(const char *path);
+
+#endif
@@ -0,0 +1,696 @@
+/* writebehind.c -- asynchronous atomic persistence of save data
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "writebehind.h"
+#include "file_cache.h"
+#include "fs_index.h"
+#include "dir_cache.h"
+#include "vfs.h"
+
+#define WB_TMP_SUFFIX ".wbtmp"
+
+enum {
+	WB_OP_WRITE,
+	WB_OP_RENAME,
+	WB_OP_REMOVE,
+	WB_OP_MKDIR,
+	WB_OP_RMDIR
+};
+
+// Immutable snapshot of a file, shared between the overlay and the queue
+typedef struct {
+	int refs;
+	size_t size;
+	uint8_t *data;
+} wb_buf;
+
+typedef struct wb_op {
+	struct wb_op *next;
+	int type;
+	uint32_t seq;
+	wb_buf *buf;
+	char path[256];
+	char new_path[256];
+} wb_op;
+
+// Latest state of a path which still has queued operations
+typedef struct wb_entry {
+	struct wb_entry *next;
+	uint32_t seq; // last queued operation touching the path
+	wb_buf *buf; // NULL if pending removal or a directory
+	uint8_t is_dir; // pending directory creation
+	uint8_t foreign; // outside of the root, e.g. the source of a rename into it
+	time_t mtime;
+	char key[256];
+	char path[256]; // as the game spelled it, for listings
+} wb_entry;
+
+static char root_path[256];
+static size_t root_len = 0;
+
+static wb_entry *entries = NULL;
+static int num_foreign = 0;
+static wb_op *queue_head = NULL, *queue_tail = NULL;
+static uint32_t queue_seq = 0;
+static uint32_t done_seq = 0; // last operation that reached the disk
+static int busy = 0;
+static pthread_mutex_t wb_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+
+static int under_root(const char *path) {
+	return root_len && !strncasecmp(path, root_path, root_len) && (path[root_len] == '/' || path[root_len] == 0);
+}
+
+static void make_key(const char *path, char *key) {
+	int i;
+	for (i = 0; path[i] && i < 255; i++)
+		key[i] = tolower((uint8_t)path[i]);
+	key[i] = 0;
+}
+
+static void buf_release(wb_buf *b) {
+	if (b && --b->refs == 0) {
+		free(b->data);
+		free(b);
+	}
+}
+
+static wb_entry *find_entry(const char *key) {
+	wb_entry *e = entries;
+	while (e) {
+		if (!strcmp(e->key, key))
+			return e;
+		e = e->next;
+	}
+	return NULL;
+}
+
+// Called with the lock held. Without memory for the entry, the operation is waited for instead,
+// so that the disk answers for the path in the meantime. Returns NULL once it landed.
+static wb_entry *set_entry(const char *path, wb_buf *b, uint32_t seq) {
+	char key[256];
+	make_key(path, key);
+	// An entry for an operation already done would never be dropped
+	if ((int32_t)(done_seq - seq) >= 0)
+		return NULL;
+	wb_entry *e = find_entry(key);
+	if (!e) {
+		e = calloc(1, sizeof(wb_entry));
+		if (!e) {
+			sceClibPrintf("writebehind: out of memory, waiting for %s to be persisted\n", path);
+			while ((int32_t)(done_seq - seq) < 0)
+				pthread_cond_wait(&idle_cond, &wb_lock);
+			return NULL;
+		}
+		strcpy(e->key, key);
+		e->foreign = !under_root(path);
+		e->next = entries;
+		entries = e;
+		if (e->foreign)
+			__atomic_add_fetch(&num_foreign, 1, __ATOMIC_RELEASE);
+	}
+	if (b)
+		b->refs++;
+	buf_release(e->buf);
+	e->buf = b;
+	e->is_dir = 0;
+	e->seq = seq;
+	e->mtime = time(NULL);
+	strncpy(e->path, path, sizeof(e->path) - 1);
+	return e;
+}
+
+// Whether key names a direct child of the directory dir_key
+static int is_child(const char *key, const char *dir_key, size_t dir_len) {
+	return !strncmp(key, dir_key, dir_len) && key[dir_len] == '/' && key[dir_len + 1] && !strchr(&key[dir_len + 1], '/');
+}
+
+static void drop_entry(const char *path, uint32_t seq) {
+	char key[256];
+	make_key(path, key);
+	wb_entry **p = &entries;
+	while (*p) {
+		wb_entry *e = *p;
+		if (!strcmp(e->key, key)) {
+			// Newer operations on the same path keep the entry alive
+			if (e->seq == seq) {
+				*p = e->next;
+				if (e->foreign)
+					__atomic_sub_fetch(&num_foreign, 1, __ATOMIC_RELEASE);
+				buf_release(e->buf);
+				free(e);
+			}
+			return;
+		}
+		p = &e->next;
+	}
+}
+
+static void enqueue(wb_op *op) {
+	op->seq = ++queue_seq;
+	op->next = NULL;
+	if (queue_tail)
+		queue_tail->next = op;
+	else
+		queue_head = op;
+	queue_tail = op;
+	pthread_cond_signal(&queue_cond);
+}
+
+// Data lands in a temporary file first, so that a crash or power loss mid-write
+// never leaves a truncated save behind. See recover_dir for the other half.
+static int write_file(const char *path, const uint8_t *data, size_t size) {
+	char tmp[256 + sizeof(WB_TMP_SUFFIX)];
+	sprintf(tmp, "%s%s", path, WB_TMP_SUFFIX);
+
+	SceUID fd = sceIoOpen(tmp, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+	if (fd < 0)
+		return fd;
+	size_t done = 0;
+	while (done < size) {
+		int res = sceIoWrite(fd, data + done, size - done);
+		if (res <= 0) {
+			sceIoClose(fd);
+			sceIoRemove(tmp);
+			return -1;
+		}
+		done += res;
+	}
+	sceIoSyncByFd(fd, 0);
+	sceIoClose(fd);
+
+	sceIoRemove(path);
+	return sceIoRename(tmp, path);
+}
+
+static void run_op(wb_op *op) {
+	int res;
+	switch (op->type) {
+	case WB_OP_WRITE:
+		vfs_invalidate(op->path);
+		res = write_file(op->path, op->buf->data, op->buf->size);
+		file_cache_invalidate(op->path);
+		dir_cache_invalidate(op->path);
+		fs_index_write_end((uintptr_t)op);
+		break;
+	case WB_OP_RENAME:
+		vfs_invalidate(op->path);
+		vfs_invalidate(op->new_path);
+		sceIoRemove(op->new_path);
+		res = sceIoRename(op->path, op->new_path);
+		file_cache_invalidate(op->path);
+		file_cache_invalidate(op->new_path);
+		dir_cache_invalidate(op->path);
+		dir_cache_invalidate(op->new_path);
+		fs_index_rename(op->path, op->new_path);
+		break;
+	case WB_OP_REMOVE:
+		vfs_invalidate(op->path);
+		res = sceIoRemove(op->path);
+		file_cache_invalidate(op->path);
+		dir_cache_invalidate(op->path);
+		fs_index_remove(op->path);
+		break;
+	case WB_OP_MKDIR:
+		res = sceIoMkdir(op->path, 0777);
+		dir_cache_invalidate(op->path);
+		fs_index_add_dir(op->path);
+		break;
+	case WB_OP_RMDIR:
+		res = sceIoRmdir(op->path);
+		dir_cache_invalidate(op->path);
+		fs_index_remove(op->path);
+		break;
+	}
+	if (res < 0)
+		sceClibPrintf("writebehind: failed to persist %s (0x%08X)\n", op->path, res);
+}
+
+static void *wb_thread(void *arg) {
+	for (;;) {
+		pthread_mutex_lock(&wb_lock);
+		while (!queue_head)
+			pthread_cond_wait(&queue_cond, &wb_lock);
+		wb_op *op = queue_head;
+		queue_head = op->next;
+		if (!queue_head)
+			queue_tail = NULL;
+		busy = 1;
+		pthread_mutex_unlock(&wb_lock);
+
+		run_op(op);
+
+		pthread_mutex_lock(&wb_lock);
+		drop_entry(op->path, op->seq);
+		if (op->type == WB_OP_RENAME)
+			drop_entry(op->new_path, op->seq);
+		done_seq = op->seq;
+		busy = 0;
+		pthread_cond_broadcast(&idle_cond);
+		pthread_mutex_unlock(&wb_lock);
+
+		buf_release(op->buf);
+		free(op);
+	}
+	return NULL;
+}
+
+static void recover_dir(char *path, size_t len) {
+	SceUID d = sceIoDopen(path);
+	if (d < 0)
+		return;
+
+	SceIoDirent ent;
+	while (sceIoDread(d, &ent) > 0) {
+		size_t name_len = strlen(ent.d_name);
+		if (len + name_len + 2 > 256)
+			continue;
+		sprintf(&path[len], "/%s", ent.d_name);
+		if (SCE_S_ISDIR(ent.d_stat.st_mode)) {
+			recover_dir(path, len + name_len + 1);
+		} else if (name_len > strlen(WB_TMP_SUFFIX) && !strcmp(&ent.d_name[name_len - strlen(WB_TMP_SUFFIX)], WB_TMP_SUFFIX)) {
+			// If the target is gone we died between removal and rename and the
+			// temporary copy is complete, otherwise it may be partial
+			char target[256];
+			strcpy(target, path);
+			target[len + name_len + 1 - strlen(WB_TMP_SUFFIX)] = 0;
+			SceIoStat st;
+			if (sceIoGetstat(target, &st) < 0) {
+				sceClibPrintf("writebehind: restoring %s\n", target);
+				sceIoRename(path, target);
+			} else {
+				sceIoRemove(path);
+			}
+		}
+		path[len] = 0;
+	}
+
+	sceIoDclose(d);
+}
+
+static int power_cb(int notifyId, int notifyCount, int powerInfo, void *common) {
+	if (powerInfo & (SCE_POWER_CB_APP_SUSPEND | SCE_POWER_CB_SYSTEM_SUSPEND))
+		wb_flush();
+	return 0;
+}
+
+static int power_thread(SceSize args, void *argp) {
+	SceUID cb = sceKernelCreateCallback("wb_power", 0, power_cb, NULL);
+	scePowerRegisterCallback(cb);
+	for (;;) {
+		sceKernelDelayThreadCB(1000 * 1000);
+	}
+	return 0;
+}
+
+void wb_init(const char *root) {
+	strncpy(root_path, root, sizeof(root_path) - 1);
+	root_len = strlen(root_path);
+
+	char path[256];
+	strcpy(path, root_path);
+	recover_dir(path, root_len);
+
+	pthread_t t;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, 64 * 1024);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_create(&t, &attr, wb_thread, NULL);
+
+	SceUID power = sceKernelCreateThread("wb_power", power_thread, 0x10000100, 0x1000, 0, 0, NULL);
+	sceKernelStartThread(power, 0, NULL);
+	atexit(wb_flush);
+}
+
+// Paths under the root, and any other one that still has operations queued
+int wb_handles(const char *path) {
+	if (under_root(path))
+		return 1;
+	if (!__atomic_load_n(&num_foreign, __ATOMIC_ACQUIRE))
+		return 0;
+	char key[256];
+	make_key(path, key);
+	pthread_mutex_lock(&wb_lock);
+	int res = find_entry(key) != NULL;
+	pthread_mutex_unlock(&wb_lock);
+	return res;
+}
+
+// Waits for the queued operations on a path and anything below it, called with the lock held
+static void wait_tree(const char *path) {
+	char key[256];
+	make_key(path, key);
+	size_t len = strlen(key);
+	for (;;) {
+		wb_entry *e = entries;
+		while (e && (strncmp(e->key, key, len) || (e->key[len] != 0 && e->key[len] != '/')))
+			e = e->next;
+		if (!e)
+			return;
+		pthread_cond_wait(&idle_cond, &wb_lock);
+	}
+}
+
+int wb_lookup(const char *path) {
+	char key[256];
+	if (!wb_handles(path))
+		return WB_UNKNOWN;
+	make_key(path, key);
+	pthread_mutex_lock(&wb_lock);
+	wb_entry *e = find_entry(key);
+	int res = e ? (e->buf || e->is_dir ? WB_HIT : WB_MISS) : WB_UNKNOWN;
+	pthread_mutex_unlock(&wb_lock);
+	return res;
+}
+
+int wb_stat(const char *path, struct stat *st) {
+	char key[256];
+	if (!wb_handles(path))
+		return WB_UNKNOWN;
+	make_key(path, key);
+	pthread_mutex_lock(&wb_lock);
+	wb_entry *e = find_entry(key);
+	int res = WB_UNKNOWN;
+	if (e && (e->buf || e->is_dir)) {
+		memset(st, 0, sizeof(struct stat));
+		st->st_mode = e->is_dir ? S_IFDIR | 0777 : S_IFREG | 0777;
+		st->st_nlink = 1;
+		st->st_size = e->buf ? e->buf->size : 0;
+		st->st_atime = st->st_mtime = st->st_ctime = e->mtime;
+		res = WB_HIT;
+	} else if (e) {
+		res = WB_MISS;
+	}
+	pthread_mutex_unlock(&wb_lock);
+	if (res == WB_MISS)
+		errno = ENOENT;
+	return res;
+}
+
+// Returns a private copy of the current contents of a file, pending or on disk
+static int load_file(const char *path, uint8_t **data, size_t *size) {
+	char key[256];
+	make_key(path, key);
+	pthread_mutex_lock(&wb_lock);
+	wb_entry *e = find_entry(key);
+	if (e) {
+		int res = -1;
+		if (e->buf) {
+			*size = e->buf->size;
+			*data = malloc(*size ? *size : 1);
+			if (*data) {
+				sceClibMemcpy(*data, e->buf->data, *size);
+				res = 0;
+			}
+		}
+		int is_dir = e->is_dir;
+		pthread_mutex_unlock(&wb_lock);
+		if (res < 0)
+			errno = is_dir ? EISDIR : ENOENT;
+		return res;
+	}
+	pthread_mutex_unlock(&wb_lock);
+
+	SceUID fd = sceIoOpen(path, SCE_O_RDONLY, 0);
+	if (fd < 0) {
+		errno = ENOENT;
+		return -1;
+	}
+	SceIoStat st;
+	sceIoGetstatByFd(fd, &st);
+	*size = st.st_size;
+	*data = malloc(*size ? *size : 1);
+	if (!*data || sceIoRead(fd, *data, *size) != *size) {
+		free(*data);
+		sceIoClose(fd);
+		errno = EIO;
+		return -1;
+	}
+	sceIoClose(fd);
+	return 0;
+}
+
+stream *wb_fopen(const char *path, const char *mode) {
+	uint8_t *data = NULL;
+	size_t size = 0;
+	if (mode[0] != 'w' && load_file(path, &data, &size) < 0 && mode[0] == 'r')
+		return NULL;
+
+	int writable = strpbrk(mode, "wa+") != NULL;
+	stream *s = stream_open_buf(data, size, writable ? path : NULL, mode[0] == 'a');
+	if (!s)
+		free(data);
+	return s;
+}
+
+void wb_commit(const char *path, uint8_t *data, size_t size) {
+	wb_op *op = calloc(1, sizeof(wb_op));
+	wb_buf *b = calloc(1, sizeof(wb_buf));
+	if (!op || !b) {
+		free(op);
+		free(b);
+		free(data);
+		sceClibPrintf("writebehind: out of memory, dropping %s\n", path);
+		return;
+	}
+	b->data = data;
+	b->size = size;
+	b->refs = 1;
+	op->type = WB_OP_WRITE;
+	op->buf = b;
+	strcpy(op->path, path);
+	fs_index_write_begin((uintptr_t)op, path);
+
+	pthread_mutex_lock(&wb_lock);
+	enqueue(op);
+	set_entry(path, b, op->seq);
+	pthread_mutex_unlock(&wb_lock);
+}
+
+int wb_rename(const char *old_path, const char *new_path) {
+	// The new path must keep on serving the old contents until the rename reaches the disk
+	uint8_t *data;
+	size_t size;
+	if (load_file(old_path, &data, &size) < 0) {
+		SceIoStat st;
+		struct stat pending;
+		int state = wb_stat(old_path, &pending);
+		if ((state == WB_HIT && S_ISDIR(pending.st_mode)) ||
+			(state == WB_UNKNOWN && sceIoGetstat(old_path, &st) >= 0 && SCE_S_ISDIR(st.st_mode))) {
+			// Directories are rare enough to just be moved synchronously, only the
+			// operations queued below either path have to land first
+			pthread_mutex_lock(&wb_lock);
+			wait_tree(old_path);
+			wait_tree(new_path);
+			pthread_mutex_unlock(&wb_lock);
+			int res = sceIoRename(old_path, new_path);
+			if (res >= 0) {
+				fs_index_rename(old_path, new_path);
+				dir_cache_invalidate(old_path);
+				dir_cache_invalidate(new_path);
+			}
+			return res;
+		}
+		return -1;
+	}
+
+	wb_op *op = calloc(1, sizeof(wb_op));
+	wb_buf *b = calloc(1, sizeof(wb_buf));
+	if (!op || !b) {
+		free(op);
+		free(b);
+		free(data);
+		return -1;
+	}
+	b->data = data;
+	b->size = size;
+	b->refs = 1;
+	op->type = WB_OP_RENAME;
+	op->buf = b;
+	strcpy(op->path, old_path);
+	strcpy(op->new_path, new_path);
+
+	pthread_mutex_lock(&wb_lock);
+	enqueue(op);
+	set_entry(old_path, NULL, op->seq);
+	set_entry(new_path, b, op->seq);
+	pthread_mutex_unlock(&wb_lock);
+	return 0;
+}
+
+int wb_remove(const char *path) {
+	SceIoStat st;
+	struct stat pending;
+	int res = wb_stat(path, &pending);
+	if (res == WB_MISS || (res == WB_UNKNOWN && (sceIoGetstat(path, &st) < 0 || SCE_S_ISDIR(st.st_mode)))) {
+		errno = ENOENT;
+		return -1;
+	}
+	if (res == WB_HIT && S_ISDIR(pending.st_mode)) {
+		errno = EISDIR;
+		return -1;
+	}
+
+	wb_op *op = calloc(1, sizeof(wb_op));
+	if (!op)
+		return -1;
+	op->type = WB_OP_REMOVE;
+	strcpy(op->path, path);
+
+	pthread_mutex_lock(&wb_lock);
+	enqueue(op);
+	set_entry(path, NULL, op->seq);
+	pthread_mutex_unlock(&wb_lock);
+	return 0;
+}
+
+// Listing of a directory as it will be once the queue drains, disk contents patched with
+// the pending state of its children
+dir_listing *wb_list_dir(const char *path) {
+	char key[256];
+	make_key(path, key);
+	size_t len = strlen(key);
+	while (len && key[len - 1] == '/')
+		key[--len] = 0;
+
+	// Pending state is sampled before the disk, so that an operation landing in
+	// between shows up in both rather than in neither
+	pthread_mutex_lock(&wb_lock);
+	wb_entry *self = find_entry(key);
+	if (self && !self->is_dir) {
+		pthread_mutex_unlock(&wb_lock);
+		errno = self->buf ? ENOTDIR : ENOENT;
+		return NULL;
+	}
+	int pending_dir = self != NULL;
+	int count = 0;
+	for (wb_entry *e = entries; e; e = e->next) {
+		if (is_child(e->key, key, len))
+			count++;
+	}
+	dir_patch *patch = count ? malloc(count * (sizeof(dir_patch) + 256)) : NULL;
+	if (count && !patch) {
+		pthread_mutex_unlock(&wb_lock);
+		errno = ENOMEM;
+		return NULL;
+	}
+	char *names = (char *)&patch[count];
+	count = 0;
+	for (wb_entry *e = entries; e; e = e->next) {
+		if (!is_child(e->key, key, len))
+			continue;
+		strcpy(&names[count * 256], &e->path[len + 1]);
+		patch[count].name = &names[count * 256];
+		patch[count].state = e->is_dir ? DIR_PATCH_DIR : (e->buf ? DIR_PATCH_FILE : DIR_PATCH_REMOVE);
+		count++;
+	}
+	pthread_mutex_unlock(&wb_lock);
+
+	dir_listing *base = dir_cache_get(path);
+	if (!base && !pending_dir) {
+		free(patch);
+		return NULL;
+	}
+	if (!count && base)
+		return base;
+	dir_listing *l = dir_cache_patch(base, path, patch, count);
+	if (base)
+		dir_cache_release(base);
+	free(patch);
+	return l;
+}
+
+// Whether the path or one of its parents has operations still queued
+int wb_pending(const char *path) {
+	char key[256];
+	make_key(path, key);
+	size_t len = strlen(key);
+	pthread_mutex_lock(&wb_lock);
+	int res = 0;
+	for (;;) {
+		key[len] = 0;
+		res = find_entry(key) != NULL;
+		char *slash = strrchr(key, '/');
+		if (res || !slash)
+			break;
+		len = slash - key;
+	}
+	pthread_mutex_unlock(&wb_lock);
+	return res;
+}
+
+int wb_mkdir(const char *path) {
+	struct stat st;
+	SceIoStat sst;
+	int res = wb_stat(path, &st);
+	if (res == WB_HIT || (res == WB_UNKNOWN && sceIoGetstat(path, &sst) >= 0)) {
+		errno = EEXIST;
+		return -1;
+	}
+
+	wb_op *op = calloc(1, sizeof(wb_op));
+	if (!op) {
+		errno = ENOMEM;
+		return -1;
+	}
+	op->type = WB_OP_MKDIR;
+	strcpy(op->path, path);
+
+	pthread_mutex_lock(&wb_lock);
+	enqueue(op);
+	wb_entry *e = set_entry(path, NULL, op->seq);
+	if (e)
+		e->is_dir = 1;
+	pthread_mutex_unlock(&wb_lock);
+	return 0;
+}
+
+int wb_rmdir(const char *path) {
+	dir_listing *l = wb_list_dir(path);
+	if (!l)
+		return -1;
+	int count = dir_cache_count(l);
+	dir_cache_release(l);
+	if (count) {
+		errno = ENOTEMPTY;
+		return -1;
+	}
+
+	wb_op *op = calloc(1, sizeof(wb_op));
+	if (!op) {
+		errno = ENOMEM;
+		return -1;
+	}
+	op->type = WB_OP_RMDIR;
+	strcpy(op->path, path);
+
+	pthread_mutex_lock(&wb_lock);
+	enqueue(op);
+	set_entry(path, NULL, op->seq);
+	pthread_mutex_unlock(&wb_lock);
+	return 0;
+}
+
+void wb_flush(void) {
+	pthread_mutex_lock(&wb_lock);
+	while (queue_head || busy)
+		pthread_cond_wait(&idle_cond, &wb_lock);
+	pthread_mutex_unlock(&wb_lock);
+}
@@ -0,0 +1,32 @@
+#ifndef __WRITEBEHIND_H__
+#define __WRITEBEHIND_H__
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "stream.h"
+#include "dir_cache.h"
+
+enum {
+	WB_MISS = -1, // pending removal, path must be reported as missing
+	WB_HIT = 0, // pending contents in memory
+	WB_UNKNOWN = 1, // nothing queued, caller must query the filesystem
+};
+
+void wb_init(const char *root);
+int wb_handles(const char *path);
+
+int wb_lookup(const char *path);
+int wb_stat(const char *path, struct stat *st);
+stream *wb_fopen(const char *path, const char *mode);
+
+void wb_commit(const char *path, uint8_t *data, size_t size);
+int wb_rename(const char *old_path, const char *new_path);
+int wb_remove(const char *path);
+int wb_mkdir(const char *path);
+int wb_rmdir(const char *path);
+int wb_pending(const char *path);
+dir_listing *wb_list_dir(const char *path);
+void wb_flush(void);
+
+#endif
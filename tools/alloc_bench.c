@@ -0,0 +1,315 @@
+/* alloc_bench.c -- host replay of a recorded allocation trace against the slab allocator
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build with: cc -O2 -Iloader -o alloc_bench tools/alloc_bench.c loader/slab.c -lpthread
+ * Usage: alloc_bench [-t threads] [-r rounds] [-n synthetic_ops] [alloc_trace.bin]
+ *
+ * Traces are recorded by the loader built with ENABLE_ALLOC_TRACE. Without one, a
+ * synthetic trace shaped like per-frame engine allocations is used. Every thread
+ * replays the whole trace on its own, so that lock contention shows up. Each row runs
+ * in a child process of its own, so that it starts from a fresh arena.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <malloc.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "slab.h"
+
+#define BENCH_MAX_THREADS 16
+#define BENCH_LIVE_TARGET 16384 // blocks alive at once in the synthetic trace
+
+typedef struct {
+	const char *name;
+	void *(*alloc)(size_t size);
+	void (*release)(void *p);
+	void *(*resize)(void *p, size_t size);
+	void *(*aligned)(size_t alignment, size_t size);
+} allocator;
+
+typedef struct {
+	uint32_t id;
+	void *p;
+} live_slot;
+
+typedef struct {
+	const allocator *a;
+	int rounds;
+	int failures;
+} bench_thread;
+
+static slab_trace_record *records = NULL;
+static int num_records = 0;
+static uint32_t table_size = 0;
+
+static uint64_t now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void load_trace(const char *path) {
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "cannot open %s\n", path);
+		exit(1);
+	}
+	uint32_t magic = 0;
+	if (fread(&magic, 1, sizeof(magic), f) != sizeof(magic) || magic != SLAB_TRACE_MAGIC) {
+		fprintf(stderr, "%s is not an allocation trace\n", path);
+		exit(1);
+	}
+	fseeko(f, 0, SEEK_END);
+	num_records = (ftello(f) - sizeof(magic)) / sizeof(slab_trace_record);
+	fseeko(f, sizeof(magic), SEEK_SET);
+	records = malloc(num_records * sizeof(slab_trace_record));
+	if (fread(records, sizeof(slab_trace_record), num_records, f) != num_records) {
+		fprintf(stderr, "cannot read %s\n", path);
+		exit(1);
+	}
+	fclose(f);
+}
+
+static uint32_t synthetic_size(void) {
+	int r = rand() % 100;
+	if (r < 70)
+		return 8 + rand() % 120;
+	if (r < 95)
+		return 128 + rand() % 1920;
+	return 2048 + rand() % (62 * 1024);
+}
+
+// Mostly small short lived blocks, with a slowly churning live set
+static void synthesize(int ops) {
+	uint32_t *live = malloc(ops * sizeof(uint32_t));
+	int num_live = 0;
+	uint32_t next_id = 1;
+	records = calloc(ops, sizeof(slab_trace_record));
+	srand(1234);
+	for (num_records = 0; num_records < ops; num_records++) {
+		slab_trace_record *r = &records[num_records];
+		int op = rand() % 100;
+		int frees = num_live < BENCH_LIVE_TARGET ? 45 : 55;
+		if (num_live && op < frees) {
+			int i = rand() % num_live;
+			r->type = SLAB_TRACE_FREE;
+			r->old = live[i];
+			live[i] = live[--num_live];
+		} else if (num_live && op < frees + 5) {
+			int i = rand() % num_live;
+			r->type = SLAB_TRACE_REALLOC;
+			r->old = live[i];
+			r->ptr = live[i] = next_id++;
+			r->size = synthetic_size();
+		} else {
+			r->type = op < frees + 8 ? SLAB_TRACE_MEMALIGN : SLAB_TRACE_MALLOC;
+			r->align = r->type == SLAB_TRACE_MEMALIGN ? 64 : 0;
+			r->ptr = live[num_live++] = next_id++;
+			r->size = synthetic_size();
+		}
+	}
+	free(live);
+}
+
+static uint32_t slot_of(uint32_t id) {
+	return (id * 0x9E3779B1u) & (table_size - 1);
+}
+
+static void put(live_slot *table, uint32_t id, void *p) {
+	uint32_t i = slot_of(id);
+	while (table[i].id)
+		i = (i + 1) & (table_size - 1);
+	table[i].id = id;
+	table[i].p = p;
+}
+
+// Backward shift deletion keeps the probe sequences intact
+static void *take(live_slot *table, uint32_t id) {
+	uint32_t i = slot_of(id);
+	while (table[i].id && table[i].id != id)
+		i = (i + 1) & (table_size - 1);
+	if (!table[i].id)
+		return NULL;
+	void *p = table[i].p;
+	uint32_t hole = i;
+	for (;;) {
+		i = (i + 1) & (table_size - 1);
+		if (!table[i].id)
+			break;
+		uint32_t home = slot_of(table[i].id);
+		if (((i - home) & (table_size - 1)) >= ((i - hole) & (table_size - 1))) {
+			table[hole] = table[i];
+			hole = i;
+		}
+	}
+	table[hole].id = 0;
+	return p;
+}
+
+static void *replay(void *arg) {
+	bench_thread *t = arg;
+	const allocator *a = t->a;
+	live_slot *table = calloc(table_size, sizeof(live_slot));
+	for (int round = 0; round < t->rounds; round++) {
+		for (int i = 0; i < num_records; i++) {
+			slab_trace_record *r = &records[i];
+			void *p;
+			switch (r->type) {
+			case SLAB_TRACE_MALLOC:
+			case SLAB_TRACE_MEMALIGN:
+				p = r->type == SLAB_TRACE_MALLOC ? a->alloc(r->size) : a->aligned(r->align, r->size);
+				if (!p || (r->align && ((uintptr_t)p & (r->align - 1)))) {
+					t->failures++;
+					break;
+				}
+				memset(p, 0xA5, r->size < 64 ? r->size : 64);
+				if (r->ptr)
+					put(table, r->ptr, p);
+				break;
+			case SLAB_TRACE_FREE:
+				a->release(take(table, r->old));
+				break;
+			case SLAB_TRACE_REALLOC:
+				p = a->resize(r->old ? take(table, r->old) : NULL, r->size);
+				if (p && r->ptr)
+					put(table, r->ptr, p);
+				else if (r->size)
+					t->failures++;
+				break;
+			}
+		}
+		// Whatever the trace never freed goes away before the next round
+		for (uint32_t i = 0; i < table_size; i++) {
+			if (table[i].id) {
+				a->release(table[i].p);
+				table[i].id = 0;
+			}
+		}
+	}
+	free(table);
+	return NULL;
+}
+
+static uint64_t run(const allocator *a, int threads, int rounds) {
+	pthread_t tid[BENCH_MAX_THREADS];
+	bench_thread t[BENCH_MAX_THREADS];
+	uint64_t start = now_us();
+	for (int i = 0; i < threads; i++) {
+		t[i].a = a;
+		t[i].rounds = rounds;
+		t[i].failures = 0;
+		pthread_create(&tid[i], NULL, replay, &t[i]);
+	}
+	int failures = 0;
+	for (int i = 0; i < threads; i++) {
+		pthread_join(tid[i], NULL);
+		failures += t[i].failures;
+	}
+	uint64_t elapsed = now_us() - start;
+	uint64_t ops = (uint64_t)num_records * rounds * threads;
+	printf("%-8s %8.1f ms, %6.1f Mops/s\n", a->name, elapsed / 1000.0, ops / (double)elapsed);
+	if (failures) {
+		fprintf(stderr, "%s: %d allocations failed\n", a->name, failures);
+		exit(1);
+	}
+	return elapsed;
+}
+
+// The child reports the time through a pipe, the arena stats it prints itself
+static uint64_t run_fresh(const allocator *a, int threads, int rounds) {
+	int fds[2];
+	if (pipe(fds) < 0) {
+		perror("pipe");
+		exit(1);
+	}
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid == 0) {
+		close(fds[0]);
+		slab_init(SLAB_ARENA_SIZE, SLAB_MEMID_RESERVE);
+		uint64_t elapsed = run(a, threads, rounds);
+		slab_stats st;
+		slab_get_stats(&st);
+		uint32_t spans = st.spans;
+		// The replay threads are gone, so their caches went back to the central lists
+		slab_collect(1);
+		slab_get_stats(&st);
+		if (st.refills || st.large || st.fallbacks)
+			printf("         %u spans, %u left after collect, %u refills, %u releases, %u large, %u fallbacks\n",
+				spans, st.spans, st.refills, st.releases, st.large, st.fallbacks);
+		fflush(stdout);
+		_exit(write(fds[1], &elapsed, sizeof(elapsed)) == sizeof(elapsed) ? 0 : 1);
+	}
+	close(fds[1]);
+	uint64_t elapsed = 0;
+	int status = 0;
+	int ok = pid > 0 && read(fds[0], &elapsed, sizeof(elapsed)) == sizeof(elapsed);
+	close(fds[0]);
+	if (pid < 0 || waitpid(pid, &status, 0) < 0 || !ok || !WIFEXITED(status) || WEXITSTATUS(status)) {
+		fprintf(stderr, "%s: run failed\n", a->name);
+		exit(1);
+	}
+	return elapsed;
+}
+
+// Same trace through a MemoryId heap, as operator new of ITF objects would
+static void *memid_malloc(size_t size) {
+	return slab_memid_alloc(size, 0);
+}
+
+static const allocator system_allocator = { "system", malloc, free, realloc, memalign };
+static const allocator slab_allocator = { "slab", slab_malloc, slab_free, slab_realloc, slab_memalign };
+static const allocator memid_allocator = { "memid", memid_malloc, slab_free, slab_realloc, slab_memalign };
+
+int main(int argc, char *argv[]) {
+	int threads = 4, rounds = 3, ops = 2000000;
+	const char *path = NULL;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-t") && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+			rounds = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+			ops = atoi(argv[++i]);
+		else if (argv[i][0] != '-')
+			path = argv[i];
+		else {
+			fprintf(stderr, "usage: alloc_bench [-t threads] [-r rounds] [-n synthetic_ops] [alloc_trace.bin]\n");
+			return 1;
+		}
+	}
+	if (threads < 1 || threads > BENCH_MAX_THREADS) {
+		fprintf(stderr, "threads must be between 1 and %d\n", BENCH_MAX_THREADS);
+		return 1;
+	}
+
+	if (path)
+		load_trace(path);
+	else
+		synthesize(ops);
+	if (!num_records) {
+		fprintf(stderr, "no allocations to replay\n");
+		return 1;
+	}
+	table_size = 1024;
+	while (table_size < num_records * 2)
+		table_size *= 2;
+	printf("%d records, %d threads, %d rounds\n", num_records, threads, rounds);
+
+	uint64_t system_t = run_fresh(&system_allocator, threads, rounds);
+	uint64_t slab_t = run_fresh(&slab_allocator, threads, rounds);
+	printf("speedup  %.2fx\n", (double)system_t / slab_t);
+	uint64_t memid_t = run_fresh(&memid_allocator, threads, rounds);
+	printf("speedup  %.2fx\n", (double)system_t / memid_t);
+	return 0;
+}
@@ -0,0 +1,215 @@
+/* decomp_bench.c -- host throughput benchmark of the decompression pool
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build with: cc -O2 -Iloader -o decomp_bench tools/decomp_bench.c loader/decomp.c -lz -lpthread
+ * Usage: decomp_bench [-n entries] [-s entry_size] [-w max_workers] [main.obb]
+ *
+ * Without an obb, synthetic entries are used. Otherwise its deflated entries are
+ * loaded in memory, so that the card speed doesn't get measured.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include "decomp.h"
+
+#define BENCH_MAX_PENDING 32
+
+typedef struct {
+	uint8_t *comp;
+	uint32_t comp_size;
+	uint32_t size;
+	uint32_t crc;
+} bench_entry;
+
+static bench_entry *entries = NULL;
+static int num_entries = 0;
+
+static int remaining = 0;
+static int failures = 0;
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+static uint64_t now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline uint16_t rd16(const uint8_t *p) {
+	return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t rd32(const uint8_t *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void add_entry(uint8_t *comp, uint32_t comp_size, uint32_t size, uint32_t crc) {
+	entries = realloc(entries, (num_entries + 1) * sizeof(bench_entry));
+	entries[num_entries].comp = comp;
+	entries[num_entries].comp_size = comp_size;
+	entries[num_entries].size = size;
+	entries[num_entries].crc = crc;
+	num_entries++;
+}
+
+// Text-like data, compressing roughly as well as the game scripts and meshes do
+static void make_synthetic(int count, uint32_t size) {
+	static const char *words[] = { "actor", "scene", "mesh", "0.125", "texture", "anim", "{", "}", "\n", "frise", "1024", "sound" };
+	srand(1);
+	for (int i = 0; i < count; i++) {
+		uint8_t *data = malloc(size);
+		for (uint32_t p = 0; p < size;) {
+			const char *w = words[rand() % (sizeof(words) / sizeof(*words))];
+			for (; *w && p < size; w++)
+				data[p++] = *w;
+			if (p < size)
+				data[p++] = rand() % 4 ? ' ' : 'a' + rand() % 26;
+		}
+
+		uLongf comp_size = compressBound(size);
+		uint8_t *comp = malloc(comp_size);
+		z_stream zs;
+		memset(&zs, 0, sizeof(zs));
+		deflateInit2(&zs, 9, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+		zs.next_in = data;
+		zs.avail_in = size;
+		zs.next_out = comp;
+		zs.avail_out = comp_size;
+		deflate(&zs, Z_FINISH);
+		add_entry(comp, zs.total_out, size, crc32(0, data, size));
+		deflateEnd(&zs);
+		free(data);
+	}
+}
+
+// Only the deflated entries of the archive, walking local headers is good enough here
+static void load_obb(const char *path, int max) {
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "cannot open %s\n", path);
+		exit(1);
+	}
+	uint8_t hdr[30];
+	while (num_entries < max && fread(hdr, 1, sizeof(hdr), f) == sizeof(hdr) && rd32(hdr) == 0x04034B50) {
+		uint32_t comp_size = rd32(&hdr[18]);
+		fseeko(f, rd16(&hdr[26]) + rd16(&hdr[28]), SEEK_CUR);
+		if (rd16(&hdr[6]) & 8) {
+			fprintf(stderr, "streamed zip entries are not supported\n");
+			break;
+		}
+		if (rd16(&hdr[8]) == 8 && comp_size) {
+			uint8_t *comp = malloc(comp_size);
+			if (fread(comp, 1, comp_size, f) != comp_size)
+				break;
+			add_entry(comp, comp_size, rd32(&hdr[22]), rd32(&hdr[14]));
+		} else {
+			fseeko(f, comp_size, SEEK_CUR);
+		}
+	}
+	fclose(f);
+}
+
+static void inflate_job(void *arg) {
+	bench_entry *e = arg;
+	uint8_t *data = malloc(e->size ? e->size : 1);
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	inflateInit2(&zs, -MAX_WBITS);
+	zs.next_in = e->comp;
+	zs.avail_in = e->comp_size;
+	zs.next_out = data;
+	zs.avail_out = e->size;
+	int res = inflate(&zs, Z_FINISH);
+	inflateEnd(&zs);
+	int ok = res == Z_STREAM_END && crc32(0, data, e->size) == e->crc;
+	free(data);
+
+	pthread_mutex_lock(&done_lock);
+	if (!ok)
+		failures++;
+	remaining--;
+	pthread_cond_signal(&done_cond);
+	pthread_mutex_unlock(&done_lock);
+}
+
+static uint64_t run(int round) {
+	remaining = num_entries;
+	uint64_t t = now_us();
+	for (int i = 0; i < num_entries; i++) {
+		// Stay below the pool queue limit, past it the submitter would run jobs itself
+		pthread_mutex_lock(&done_lock);
+		while (i - (num_entries - remaining) >= BENCH_MAX_PENDING)
+			pthread_cond_wait(&done_cond, &done_lock);
+		pthread_mutex_unlock(&done_lock);
+
+		char key[64];
+		snprintf(key, sizeof(key), "%d:%d", round, i);
+		decomp_queue(key, inflate_job, &entries[i]);
+	}
+
+	// Waiting without joining, a joining requester would run jobs itself
+	pthread_mutex_lock(&done_lock);
+	while (remaining)
+		pthread_cond_wait(&done_cond, &done_lock);
+	pthread_mutex_unlock(&done_lock);
+	return now_us() - t;
+}
+
+int main(int argc, char *argv[]) {
+	int count = 512, max_workers = 3;
+	uint32_t size = 256 * 1024;
+	const char *obb = NULL;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-n") && i + 1 < argc)
+			count = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+			size = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-w") && i + 1 < argc)
+			max_workers = atoi(argv[++i]);
+		else if (argv[i][0] != '-')
+			obb = argv[i];
+		else {
+			fprintf(stderr, "usage: decomp_bench [-n entries] [-s entry_size] [-w max_workers] [main.obb]\n");
+			return 1;
+		}
+	}
+
+	if (obb)
+		load_obb(obb, count);
+	else
+		make_synthetic(count, size);
+	if (!num_entries) {
+		fprintf(stderr, "no deflated entries to benchmark\n");
+		return 1;
+	}
+	uint64_t total = 0;
+	for (int i = 0; i < num_entries; i++)
+		total += entries[i].size;
+	printf("%d entries, %llu bytes uncompressed\n", num_entries, (unsigned long long)total);
+
+	uint64_t base = 0;
+	for (int w = 1; w <= max_workers; w++) {
+		decomp_init(w);
+		run(0); // warm up
+		uint64_t t = run(w);
+		if (w == 1)
+			base = t;
+		printf("%d worker%s: %7.1f ms, %7.1f MB/s, %.2fx\n", w, w > 1 ? "s" : "", t / 1000.0,
+			total / (double)t, (double)base / t);
+	}
+
+	if (failures) {
+		fprintf(stderr, "%d entries failed to decompress\n", failures);
+		return 1;
+	}
+	return 0;
+}
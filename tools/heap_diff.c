@@ -0,0 +1,152 @@
+/* heap_diff.c -- compares two heap snapshots written by the allocation profiler
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build with: cc -O2 -o heap_diff tools/heap_diff.c
+ * Usage: heap_diff [-t] [-n top] [before.txt] after.txt
+ *
+ * With two snapshots, call sites are listed by how much their live memory grew,
+ * so that whatever a level leaves behind stands out. With a single one, they are
+ * listed by peak usage instead. Sites are merged across threads unless -t is given.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+typedef struct {
+	uint32_t site;
+	uint32_t caller;
+	char thread[64];
+	char symbol[512];
+	int64_t live_blocks[2];
+	int64_t live_bytes[2];
+	int64_t peak_bytes[2];
+	int64_t allocs[2];
+	int64_t frees[2];
+} diff_site;
+
+static diff_site *sites = NULL;
+static int num_sites = 0, sites_size = 0;
+static int per_thread = 0;
+
+static diff_site *get_site(uint32_t site, uint32_t caller, const char *thread) {
+	for (int i = 0; i < num_sites; i++) {
+		diff_site *s = &sites[i];
+		if (s->site == site && s->caller == caller && (!per_thread || !strcmp(s->thread, thread)))
+			return s;
+	}
+	if (num_sites == sites_size) {
+		sites_size = sites_size ? sites_size * 2 : 1024;
+		sites = realloc(sites, sites_size * sizeof(diff_site));
+	}
+	diff_site *s = &sites[num_sites++];
+	memset(s, 0, sizeof(diff_site));
+	s->site = site;
+	s->caller = caller;
+	return s;
+}
+
+static void load_snapshot(const char *path, int slot) {
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "cannot open %s\n", path);
+		exit(1);
+	}
+	char line[1024];
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#') {
+			if (!strncmp(line, "# snapshot", 10))
+				printf("%s: %s", slot ? "after " : "before", line + 2);
+			continue;
+		}
+		char *field[9];
+		int n = 0;
+		char *p = line;
+		while (n < 9) {
+			field[n++] = p;
+			p = strchr(p, n < 9 ? '\t' : '\n');
+			if (!p)
+				break;
+			*p++ = 0;
+		}
+		if (n < 9)
+			continue;
+		diff_site *s = get_site(strtoul(field[0], NULL, 16), strtoul(field[1], NULL, 16), field[2]);
+		snprintf(s->thread, sizeof(s->thread), "%s", per_thread ? field[2] : "*");
+		snprintf(s->symbol, sizeof(s->symbol), "%s", field[8]);
+		s->live_blocks[slot] += strtoll(field[3], NULL, 10);
+		s->live_bytes[slot] += strtoll(field[4], NULL, 10);
+		s->peak_bytes[slot] += strtoll(field[5], NULL, 10);
+		s->allocs[slot] += strtoll(field[6], NULL, 10);
+		s->frees[slot] += strtoll(field[7], NULL, 10);
+	}
+	fclose(f);
+}
+
+static int by_growth(const void *a, const void *b) {
+	const diff_site *x = a, *y = b;
+	int64_t dx = x->live_bytes[1] - x->live_bytes[0], dy = y->live_bytes[1] - y->live_bytes[0];
+	return dx < dy ? 1 : (dx > dy ? -1 : 0);
+}
+
+static int by_peak(const void *a, const void *b) {
+	const diff_site *x = a, *y = b;
+	return x->peak_bytes[1] < y->peak_bytes[1] ? 1 : (x->peak_bytes[1] > y->peak_bytes[1] ? -1 : 0);
+}
+
+int main(int argc, char *argv[]) {
+	const char *paths[2];
+	int num_paths = 0, top = 50;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-t"))
+			per_thread = 1;
+		else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+			top = atoi(argv[++i]);
+		else if (argv[i][0] != '-' && num_paths < 2)
+			paths[num_paths++] = argv[i];
+		else {
+			num_paths = 0;
+			break;
+		}
+	}
+	if (!num_paths) {
+		fprintf(stderr, "usage: heap_diff [-t] [-n top] [before.txt] after.txt\n");
+		return 1;
+	}
+
+	if (num_paths == 2)
+		load_snapshot(paths[0], 0);
+	load_snapshot(paths[num_paths - 1], 1);
+
+	int64_t grown = 0, shrunk = 0;
+	for (int i = 0; i < num_sites; i++) {
+		int64_t d = sites[i].live_bytes[1] - sites[i].live_bytes[0];
+		if (d > 0)
+			grown += d;
+		else
+			shrunk -= d;
+	}
+	if (num_paths == 2) {
+		qsort(sites, num_sites, sizeof(diff_site), by_growth);
+		printf("%lld bytes grown, %lld bytes released over %d sites\n\n", (long long)grown, (long long)shrunk, num_sites);
+	} else {
+		qsort(sites, num_sites, sizeof(diff_site), by_peak);
+	}
+	// A single snapshot is diffed against nothing
+	printf("%12s %10s %12s %12s %10s  %-16s %s\n", "delta_bytes", "delta_blk", "live_bytes", "peak_bytes", "allocs", "thread", "site <- caller");
+	for (int i = 0; i < num_sites && i < top; i++) {
+		diff_site *s = &sites[i];
+		if (num_paths == 2 && s->live_bytes[1] == s->live_bytes[0])
+			continue;
+		printf("%12lld %10lld %12lld %12lld %10lld  %-16s %s (0x%08X <- 0x%08X)\n",
+			(long long)(s->live_bytes[1] - s->live_bytes[0]), (long long)(s->live_blocks[1] - s->live_blocks[0]),
+			(long long)s->live_bytes[1], (long long)s->peak_bytes[1], (long long)(s->allocs[1] - s->allocs[0]),
+			s->thread, s->symbol, s->site, s->caller);
+	}
+	return 0;
+}
@@ -0,0 +1,166 @@
+/* inflate_bench.c -- host benchmark of the whole-buffer inflater against zlib
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build with: cc -O2 -Iloader -o inflate_bench tools/inflate_bench.c loader/fast_inflate.c -lz -lpthread
+ * Usage: inflate_bench [-n max_entries] [-r rounds] main.obb
+ *
+ * Deflated entries are loaded in memory first, so that only decoding gets measured.
+ * Every decoded entry is checked against the crc stored in the archive.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <zlib.h>
+
+#include "fast_inflate.h"
+
+typedef struct {
+	uint8_t *comp;
+	uint32_t comp_size;
+	uint32_t size;
+	uint32_t crc;
+} bench_entry;
+
+static bench_entry *entries = NULL;
+static int num_entries = 0;
+
+static uint64_t now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline uint16_t rd16(const uint8_t *p) {
+	return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t rd32(const uint8_t *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Walks the central directory, local headers may lack sizes for streamed entries
+static void load_obb(const char *path, int max) {
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "cannot open %s\n", path);
+		exit(1);
+	}
+	fseeko(f, 0, SEEK_END);
+	long size = ftello(f);
+	uint8_t *zip = malloc(size);
+	fseeko(f, 0, SEEK_SET);
+	if (fread(zip, 1, size, f) != size) {
+		fprintf(stderr, "cannot read %s\n", path);
+		exit(1);
+	}
+	fclose(f);
+
+	long eocd = size - 22;
+	while (eocd >= 0 && rd32(&zip[eocd]) != 0x06054B50)
+		eocd--;
+	if (eocd < 0) {
+		fprintf(stderr, "not a zip archive\n");
+		exit(1);
+	}
+
+	uint8_t *p = &zip[rd32(&zip[eocd + 16])];
+	for (int i = rd16(&zip[eocd + 10]); i > 0 && num_entries < max; i--) {
+		if (rd32(p) != 0x02014B50)
+			break;
+		uint8_t *local = &zip[rd32(&p[42])];
+		if (rd16(&p[10]) == 8 && rd32(&p[20])) {
+			entries = realloc(entries, (num_entries + 1) * sizeof(bench_entry));
+			bench_entry *e = &entries[num_entries++];
+			e->comp = local + 30 + rd16(&local[26]) + rd16(&local[28]);
+			e->comp_size = rd32(&p[20]);
+			e->size = rd32(&p[24]);
+			e->crc = rd32(&p[16]);
+		}
+		p += 46 + rd16(&p[28]) + rd16(&p[30]) + rd16(&p[32]);
+	}
+}
+
+static int zlib_inflate(bench_entry *e, uint8_t *out) {
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	inflateInit2(&zs, -MAX_WBITS);
+	zs.next_in = e->comp;
+	zs.avail_in = e->comp_size;
+	zs.next_out = out;
+	zs.avail_out = e->size;
+	int res = inflate(&zs, Z_FINISH);
+	inflateEnd(&zs);
+	return res == Z_STREAM_END && zs.total_out == e->size ? 0 : -1;
+}
+
+static int fast_inflate_entry(bench_entry *e, uint8_t *out) {
+	size_t in_used, out_used;
+	return fast_inflate(e->comp, e->comp_size, out, e->size, &in_used, &out_used) == FAST_INFLATE_OK && out_used == e->size ? 0 : -1;
+}
+
+static uint64_t run(const char *name, int (*decode)(bench_entry *, uint8_t *), uint8_t *out, int rounds, uint64_t total) {
+	int failures = 0;
+	uint64_t t = now_us();
+	for (int r = 0; r < rounds; r++) {
+		for (int i = 0; i < num_entries; i++) {
+			if (decode(&entries[i], out) < 0 || (r == 0 && crc32(0, out, entries[i].size) != entries[i].crc))
+				failures++;
+		}
+	}
+	t = now_us() - t;
+	printf("%-8s %8.1f ms, %7.1f MB/s\n", name, t / 1000.0, total * rounds / (double)t);
+	if (failures) {
+		fprintf(stderr, "%s: %d entries failed to decode\n", name, failures);
+		exit(1);
+	}
+	return t;
+}
+
+int main(int argc, char *argv[]) {
+	int max = 1 << 30, rounds = 3;
+	const char *obb = NULL;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-n") && i + 1 < argc)
+			max = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+			rounds = atoi(argv[++i]);
+		else if (argv[i][0] != '-')
+			obb = argv[i];
+		else {
+			obb = NULL;
+			break;
+		}
+	}
+	if (!obb) {
+		fprintf(stderr, "usage: inflate_bench [-n max_entries] [-r rounds] main.obb\n");
+		return 1;
+	}
+
+	load_obb(obb, max);
+	if (!num_entries) {
+		fprintf(stderr, "no deflated entries to benchmark\n");
+		return 1;
+	}
+	uint64_t total = 0, comp_total = 0;
+	uint32_t largest = 0;
+	for (int i = 0; i < num_entries; i++) {
+		total += entries[i].size;
+		comp_total += entries[i].comp_size;
+		if (entries[i].size > largest)
+			largest = entries[i].size;
+	}
+	printf("%d entries, %llu -> %llu bytes\n", num_entries, (unsigned long long)comp_total, (unsigned long long)total);
+
+	uint8_t *out = malloc(largest ? largest : 1);
+	uint64_t zlib_t = run("zlib", zlib_inflate, out, rounds, total);
+	uint64_t fast_t = run("fast", fast_inflate_entry, out, rounds, total);
+	printf("speedup  %.2fx\n", (double)zlib_t / fast_t);
+	return 0;
+}
@@ -0,0 +1,472 @@
+/* obb_repack.c -- converts main.obb into the loader-native pack format
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build with: cc -O2 -Iloader -o obb_repack tools/obb_repack.c -lz -lzstd
+ * Usage: obb_repack [-p boot.profile] [-l level] [-a assets_dir] main.obb main.pak
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <zstd.h>
+
+#include "pack.h"
+
+#define DATA_PREFIX "ux0:data/valiant/"
+#define MIN_SAVING 10 // percent, entries shrinking less than this are stored
+
+#define ZIP_EOCD_SIG 0x06054B50
+#define ZIP_EOCD64_SIG 0x06064B50
+#define ZIP_EOCD64_LOC_SIG 0x07064B50
+#define ZIP_CDIR_SIG 0x02014B50
+#define ZIP_LOCAL_SIG 0x04034B50
+
+typedef struct {
+	char *name;
+	char *host_path; // set for loose assets, NULL for obb entries
+	uint16_t method;
+	uint32_t crc;
+	uint32_t dos_time;
+	uint64_t comp_size;
+	uint64_t size;
+	uint64_t header_offs;
+	int order; // position in the boot profile, -1 if not recorded
+	pack_entry out;
+} src_entry;
+
+static src_entry *entries = NULL;
+static uint32_t num_entries = 0;
+static uint32_t max_entries = 0;
+
+static inline uint16_t rd16(const uint8_t *p) {
+	return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t rd32(const uint8_t *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t rd64(const uint8_t *p) {
+	return rd32(p) | ((uint64_t)rd32(p + 4) << 32);
+}
+
+static void *xmalloc(size_t size) {
+	void *p = malloc(size ? size : 1);
+	if (!p) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+static void read_at(FILE *f, void *buf, size_t size, uint64_t offs) {
+	if (fseeko(f, offs, SEEK_SET) < 0 || fread(buf, 1, size, f) != size) {
+		fprintf(stderr, "read error at offset %llu\n", (unsigned long long)offs);
+		exit(1);
+	}
+}
+
+static src_entry *add_entry(void) {
+	if (num_entries == max_entries) {
+		max_entries = max_entries ? max_entries * 2 : 1024;
+		entries = realloc(entries, max_entries * sizeof(src_entry));
+		if (!entries) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+	}
+	src_entry *e = &entries[num_entries++];
+	memset(e, 0, sizeof(*e));
+	e->order = -1;
+	return e;
+}
+
+static void parse_zip(FILE *f, uint64_t size) {
+	uint32_t tail_size = size < 0x10000 + 22 ? size : 0x10000 + 22;
+	if (tail_size < 22) {
+		fprintf(stderr, "not a zip archive\n");
+		exit(1);
+	}
+	uint8_t *tail = xmalloc(tail_size);
+	read_at(f, tail, tail_size, size - tail_size);
+
+	int eocd = -1;
+	for (int i = tail_size - 22; i >= 0; i--) {
+		if (rd32(&tail[i]) == ZIP_EOCD_SIG) {
+			eocd = i;
+			break;
+		}
+	}
+	if (eocd < 0) {
+		fprintf(stderr, "not a zip archive\n");
+		exit(1);
+	}
+
+	uint64_t count = rd16(&tail[eocd + 10]);
+	uint64_t cd_size = rd32(&tail[eocd + 12]);
+	uint64_t cd_offs = rd32(&tail[eocd + 16]);
+	if (eocd >= 20 && rd32(&tail[eocd - 20]) == ZIP_EOCD64_LOC_SIG) {
+		uint8_t eocd64[56];
+		read_at(f, eocd64, sizeof(eocd64), rd64(&tail[eocd - 12]));
+		if (rd32(eocd64) != ZIP_EOCD64_SIG) {
+			fprintf(stderr, "broken zip64 end of central directory\n");
+			exit(1);
+		}
+		count = rd64(&eocd64[32]);
+		cd_size = rd64(&eocd64[40]);
+		cd_offs = rd64(&eocd64[48]);
+	}
+	free(tail);
+
+	uint8_t *cd = xmalloc(cd_size);
+	read_at(f, cd, cd_size, cd_offs);
+	uint8_t *p = cd, *end = cd + cd_size;
+	for (uint64_t i = 0; i < count; i++) {
+		if (p + 46 > end || rd32(p) != ZIP_CDIR_SIG) {
+			fprintf(stderr, "broken central directory\n");
+			exit(1);
+		}
+		uint16_t name_len = rd16(&p[28]);
+		uint16_t extra_len = rd16(&p[30]);
+		uint16_t comment_len = rd16(&p[32]);
+		if (p + 46 + name_len + extra_len + comment_len > end) {
+			fprintf(stderr, "broken central directory\n");
+			exit(1);
+		}
+		if (rd16(&p[8]) & 1) {
+			fprintf(stderr, "encrypted entries are not supported\n");
+			exit(1);
+		}
+
+		src_entry *e = add_entry();
+		e->method = rd16(&p[10]);
+		e->dos_time = rd32(&p[12]);
+		e->crc = rd32(&p[16]);
+		e->comp_size = rd32(&p[20]);
+		e->size = rd32(&p[24]);
+		e->header_offs = rd32(&p[42]);
+		e->name = xmalloc(name_len + 1);
+		memcpy(e->name, &p[46], name_len);
+		e->name[name_len] = 0;
+
+		// Zip64 extended information, fields are only present when saturated
+		uint8_t *x = &p[46 + name_len], *x_end = x + extra_len;
+		while (x + 4 <= x_end) {
+			uint16_t id = rd16(x), len = rd16(x + 2);
+			if (id == 0x0001) {
+				uint8_t *v = x + 4;
+				if (e->size == 0xFFFFFFFF && v + 8 <= x + 4 + len) {
+					e->size = rd64(v);
+					v += 8;
+				}
+				if (e->comp_size == 0xFFFFFFFF && v + 8 <= x + 4 + len) {
+					e->comp_size = rd64(v);
+					v += 8;
+				}
+				if (e->header_offs == 0xFFFFFFFF && v + 8 <= x + 4 + len)
+					e->header_offs = rd64(v);
+			}
+			x += 4 + len;
+		}
+		p += 46 + name_len + extra_len + comment_len;
+	}
+	free(cd);
+}
+
+static uint8_t *load_zip_entry(FILE *f, src_entry *e) {
+	uint8_t hdr[30];
+	read_at(f, hdr, sizeof(hdr), e->header_offs);
+	if (rd32(hdr) != ZIP_LOCAL_SIG) {
+		fprintf(stderr, "%s: broken local header\n", e->name);
+		exit(1);
+	}
+	uint8_t *comp = xmalloc(e->comp_size);
+	read_at(f, comp, e->comp_size, e->header_offs + sizeof(hdr) + rd16(&hdr[26]) + rd16(&hdr[28]));
+
+	uint8_t *data;
+	if (e->method == 0) {
+		data = comp;
+	} else if (e->method == 8) {
+		data = xmalloc(e->size);
+		z_stream zs;
+		memset(&zs, 0, sizeof(zs));
+		inflateInit2(&zs, -MAX_WBITS);
+		zs.next_in = comp;
+		zs.avail_in = e->comp_size;
+		zs.next_out = data;
+		zs.avail_out = e->size;
+		int res = inflate(&zs, Z_FINISH);
+		inflateEnd(&zs);
+		if (res != Z_STREAM_END || zs.total_out != e->size) {
+			fprintf(stderr, "%s: inflate failed\n", e->name);
+			exit(1);
+		}
+		free(comp);
+	} else {
+		fprintf(stderr, "%s: unsupported compression method %u\n", e->name, e->method);
+		exit(1);
+	}
+
+	if (crc32(0, data, e->size) != e->crc) {
+		fprintf(stderr, "%s: crc mismatch\n", e->name);
+		exit(1);
+	}
+	return data;
+}
+
+static uint8_t *load_host_file(src_entry *e) {
+	FILE *f = fopen(e->host_path, "rb");
+	if (!f) {
+		fprintf(stderr, "cannot open %s\n", e->host_path);
+		exit(1);
+	}
+	uint8_t *data = xmalloc(e->size);
+	if (fread(data, 1, e->size, f) != e->size) {
+		fprintf(stderr, "cannot read %s\n", e->host_path);
+		exit(1);
+	}
+	fclose(f);
+	e->crc = crc32(0, data, e->size);
+	return data;
+}
+
+static src_entry *find_entry(const char *name);
+
+// Loose assets are served by the vfs under their path relative to the data directory,
+// they never show up in the libzip view of the obb
+static void scan_assets(const char *root, const char *rel) {
+	char path[4096];
+	snprintf(path, sizeof(path), "%s%s%s", root, *rel ? "/" : "", rel);
+	DIR *d = opendir(path);
+	if (!d) {
+		fprintf(stderr, "cannot open %s\n", path);
+		exit(1);
+	}
+
+	struct dirent *ent;
+	while ((ent = readdir(d))) {
+		if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, ".."))
+			continue;
+		char child_rel[4096], child_path[8192];
+		snprintf(child_rel, sizeof(child_rel), "%s%s%s", rel, *rel ? "/" : "", ent->d_name);
+		snprintf(child_path, sizeof(child_path), "%s/%s", root, child_rel);
+		struct stat st;
+		if (stat(child_path, &st) < 0)
+			continue;
+		if (S_ISDIR(st.st_mode)) {
+			scan_assets(root, child_rel);
+		} else if (S_ISREG(st.st_mode)) {
+			if (find_entry(child_rel)) {
+				fprintf(stderr, "%s: already in the obb, skipped\n", child_rel);
+				continue;
+			}
+			src_entry *e = add_entry();
+			e->name = strdup(child_rel);
+			e->host_path = strdup(child_path);
+			e->size = st.st_size;
+			e->dos_time = (1 << 21) | (1 << 16); // 1980-01-01
+		}
+	}
+	closedir(d);
+}
+
+static src_entry *find_entry(const char *name) {
+	for (uint32_t i = 0; i < num_entries; i++) {
+		if (!strcmp(entries[i].name, name))
+			return &entries[i];
+	}
+	return NULL;
+}
+
+// Entries touched during a recorded boot are laid out first, in access order
+static void apply_profile(const char *path) {
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "cannot open %s\n", path);
+		exit(1);
+	}
+
+	char line[1024];
+	int order = 0;
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\r\n")] = 0;
+		const char *name = NULL;
+		if (line[0] == 'Z' && line[1] == '\t') {
+			char *sep = strchr(&line[2], '\t');
+			if (sep)
+				name = sep + 1;
+		} else if (line[0] == 'F' && line[1] == '\t' && !strncmp(&line[2], DATA_PREFIX, strlen(DATA_PREFIX))) {
+			name = &line[2 + strlen(DATA_PREFIX)];
+		}
+		if (!name)
+			continue;
+		src_entry *e = find_entry(name);
+		if (e && e->order < 0)
+			e->order = order++;
+	}
+	fclose(f);
+	printf("%d entries ordered by boot profile\n", order);
+}
+
+static int cmp_layout(const void *a, const void *b) {
+	const src_entry *x = *(const src_entry **)a, *y = *(const src_entry **)b;
+	if ((x->order < 0) != (y->order < 0))
+		return x->order < 0 ? 1 : -1;
+	if (x->order != y->order)
+		return x->order < y->order ? -1 : 1;
+	return x < y ? -1 : x > y;
+}
+
+static int cmp_hash(const void *a, const void *b) {
+	const pack_hash *x = a, *y = b;
+	if (x->hash != y->hash)
+		return x->hash < y->hash ? -1 : 1;
+	return x->index < y->index ? -1 : x->index > y->index;
+}
+
+static void write_at(FILE *f, const void *buf, size_t size, uint64_t offs) {
+	if (fseeko(f, offs, SEEK_SET) < 0 || fwrite(buf, 1, size, f) != size) {
+		fprintf(stderr, "write error at offset %llu\n", (unsigned long long)offs);
+		exit(1);
+	}
+}
+
+static void usage(void) {
+	fprintf(stderr, "usage: obb_repack [-p boot.profile] [-l level] [-a assets_dir] main.obb main.pak\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	const char *profile = NULL, *assets = NULL;
+	int level = 19;
+	int i = 1;
+	for (; i < argc && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "-p") && i + 1 < argc)
+			profile = argv[++i];
+		else if (!strcmp(argv[i], "-l") && i + 1 < argc)
+			level = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-a") && i + 1 < argc)
+			assets = argv[++i];
+		else
+			usage();
+	}
+	if (argc - i != 2)
+		usage();
+	const char *obb_path = argv[i], *pak_path = argv[i + 1];
+
+	FILE *in = fopen(obb_path, "rb");
+	if (!in) {
+		fprintf(stderr, "cannot open %s\n", obb_path);
+		return 1;
+	}
+	fseeko(in, 0, SEEK_END);
+	uint64_t source_size = ftello(in);
+	uint32_t source_tail = source_size < PACK_SOURCE_TAIL ? source_size : PACK_SOURCE_TAIL;
+	uint8_t *tail = xmalloc(source_tail);
+	read_at(in, tail, source_tail, source_size - source_tail);
+	uint32_t source_crc = crc32(0, tail, source_tail);
+	free(tail);
+	parse_zip(in, source_size);
+	uint32_t num_listed = num_entries;
+	if (assets)
+		scan_assets(assets, "");
+	if (profile)
+		apply_profile(profile);
+
+	// Index layout, entries keep their original order so zip indices stay valid
+	uint32_t names_size = 0;
+	for (uint32_t j = 0; j < num_entries; j++)
+		names_size += strlen(entries[j].name) + 1;
+	pack_header hdr = { PACK_MAGIC, PACK_VERSION, num_entries, names_size, num_listed, source_crc, source_size, 0 };
+	uint64_t index_end = sizeof(hdr) + (uint64_t)num_entries * (sizeof(pack_entry) + sizeof(pack_hash)) + names_size;
+	hdr.data_offs = (index_end + PACK_ALIGN - 1) & ~(uint64_t)(PACK_ALIGN - 1);
+
+	FILE *out = fopen(pak_path, "wb");
+	if (!out) {
+		fprintf(stderr, "cannot create %s\n", pak_path);
+		return 1;
+	}
+
+	src_entry **layout = xmalloc(num_entries * sizeof(src_entry *));
+	for (uint32_t j = 0; j < num_entries; j++)
+		layout[j] = &entries[j];
+	qsort(layout, num_entries, sizeof(src_entry *), cmp_layout);
+
+	ZSTD_CCtx *cctx = ZSTD_createCCtx();
+	uint64_t offs = hdr.data_offs, total_in = 0, total_out = 0;
+	uint32_t num_zstd = 0;
+	for (uint32_t j = 0; j < num_entries; j++) {
+		src_entry *e = layout[j];
+		uint8_t *data = e->host_path ? load_host_file(e) : load_zip_entry(in, e);
+
+		size_t bound = ZSTD_compressBound(e->size);
+		uint8_t *comp = xmalloc(bound);
+		size_t comp_size = ZSTD_compressCCtx(cctx, comp, bound, data, e->size, level);
+		e->out.offs = offs;
+		e->out.size = e->size;
+		e->out.crc = e->crc;
+		e->out.dos_time = e->dos_time;
+		e->out.orig_method = e->host_path ? 0 : e->method;
+		e->out.orig_comp_size = e->host_path ? e->size : e->comp_size;
+		if (!ZSTD_isError(comp_size) && comp_size * 100 <= e->size * (100 - MIN_SAVING)) {
+			e->out.method = PACK_ZSTD;
+			e->out.comp_size = comp_size;
+			write_at(out, comp, comp_size, offs);
+			num_zstd++;
+		} else {
+			e->out.method = PACK_STORED;
+			e->out.comp_size = e->size;
+			write_at(out, data, e->size, offs);
+		}
+		offs = (offs + e->out.comp_size + PACK_ALIGN - 1) & ~(uint64_t)(PACK_ALIGN - 1);
+		total_in += e->size;
+		total_out += e->out.comp_size;
+		free(comp);
+		free(data);
+	}
+	ZSTD_freeCCtx(cctx);
+	free(layout);
+
+	pack_entry *index = xmalloc(num_entries * sizeof(pack_entry));
+	pack_hash *hashes = xmalloc(num_entries * sizeof(pack_hash));
+	char *names = xmalloc(names_size);
+	uint32_t name_offs = 0;
+	for (uint32_t j = 0; j < num_entries; j++) {
+		src_entry *e = &entries[j];
+		uint32_t len = strlen(e->name);
+		e->out.name_offs = name_offs;
+		e->out.name_len = len;
+		memcpy(&names[name_offs], e->name, len + 1);
+		name_offs += len + 1;
+		index[j] = e->out;
+		hashes[j].hash = pack_hash_name(e->name, len);
+		hashes[j].index = j;
+	}
+	qsort(hashes, num_entries, sizeof(pack_hash), cmp_hash);
+
+	// The header goes last, a pack interrupted midway is never picked up by the loader
+	write_at(out, index, num_entries * sizeof(pack_entry), sizeof(hdr));
+	write_at(out, hashes, num_entries * sizeof(pack_hash), sizeof(hdr) + num_entries * sizeof(pack_entry));
+	write_at(out, names, names_size, sizeof(hdr) + num_entries * (sizeof(pack_entry) + sizeof(pack_hash)));
+	if (offs > hdr.data_offs) {
+		// Pad the last entry, so that the file size is aligned too
+		uint8_t zero = 0;
+		write_at(out, &zero, 1, offs - 1);
+	}
+	write_at(out, &hdr, sizeof(hdr), 0);
+	if (fclose(out) != 0) {
+		fprintf(stderr, "cannot write %s\n", pak_path);
+		return 1;
+	}
+	fclose(in);
+
+	printf("%u entries, %u zstd, %llu -> %llu bytes\n", num_entries, num_zstd, (unsigned long long)total_in, (unsigned long long)total_out);
+	return 0;
+}
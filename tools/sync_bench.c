@@ -0,0 +1,241 @@
+/* sync_bench.c -- host benchmark of the loader mutex against the system one
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build with: cc -O2 -Iloader -o sync_bench tools/sync_bench.c loader/sync.c -lpthread
+ * Usage: sync_bench [-t threads] [-n iterations] [-w work]
+ *
+ * Runs on the futex backend of sync.c. The uncontended pass locks and unlocks from a
+ * single thread, the contended one has every thread bump a shared counter under the
+ * lock with a few iterations of busy work inside and outside, like the engine job queues.
+ * Semaphores are timed handing items from half the threads to the other half through
+ * a bounded queue, one semaphore counting items and one counting free slots.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "sync.h"
+
+#define BENCH_MAX_THREADS 64
+#define BENCH_QUEUE_SLOTS 64
+
+typedef struct {
+	const char *name;
+	void (*lock)(void *m);
+	void (*unlock)(void *m);
+	void *mutex;
+} bench_lock;
+
+static int iterations = 1000000, work = 20;
+static volatile uint32_t counter;
+static volatile uint32_t sink;
+
+static void sync_lock(void *m) { sync_mutex_lock(m); }
+static void sync_unlock(void *m) { sync_mutex_unlock(m); }
+static void system_lock(void *m) { pthread_mutex_lock(m); }
+static void system_unlock(void *m) { pthread_mutex_unlock(m); }
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void busy(int n) {
+	for (int i = 0; i < n; i++)
+		sink += i;
+}
+
+static void *idle(void *arg) {
+	return arg;
+}
+
+static void *contend(void *arg) {
+	bench_lock *l = arg;
+	for (int i = 0; i < iterations; i++) {
+		l->lock(l->mutex);
+		counter++;
+		busy(work);
+		l->unlock(l->mutex);
+		busy(work);
+	}
+	return NULL;
+}
+
+static void run(bench_lock *l, int threads) {
+	uint64_t start = now_ns();
+	for (int i = 0; i < iterations; i++) {
+		l->lock(l->mutex);
+		l->unlock(l->mutex);
+	}
+	double single = (double)(now_ns() - start) / iterations;
+
+	pthread_t t[BENCH_MAX_THREADS];
+	counter = 0;
+	start = now_ns();
+	for (int i = 0; i < threads; i++)
+		pthread_create(&t[i], NULL, contend, l);
+	for (int i = 0; i < threads; i++)
+		pthread_join(t[i], NULL);
+	double contended = (double)(now_ns() - start) / ((double)iterations * threads);
+
+	printf("%-8s %8.1f ns uncontended %8.1f ns contended (%d threads)%s\n", l->name, single, contended, threads,
+		counter == (uint32_t)iterations * threads ? "" : ", LOST UPDATES");
+}
+
+typedef struct {
+	const char *name;
+	void (*post)(void *s);
+	void (*wait)(void *s);
+	void *items;
+	void *slots;
+} bench_sem;
+
+static void sync_post(void *s) { sync_sem_post(s); }
+static void sync_wait(void *s) { sync_sem_wait(s); }
+static void system_post(void *s) { sem_post(s); }
+static void system_wait(void *s) { sem_wait(s); }
+
+static uint32_t handed_over;
+
+static void *produce(void *arg) {
+	bench_sem *s = arg;
+	for (int i = 0; i < iterations; i++) {
+		s->wait(s->slots);
+		busy(work);
+		s->post(s->items);
+	}
+	return NULL;
+}
+
+static void *consume(void *arg) {
+	bench_sem *s = arg;
+	for (int i = 0; i < iterations; i++) {
+		s->wait(s->items);
+		__atomic_add_fetch(&handed_over, 1, __ATOMIC_RELAXED);
+		busy(work);
+		s->post(s->slots);
+	}
+	return NULL;
+}
+
+static void run_sem(bench_sem *s, int threads) {
+	int pairs = threads / 2 ? threads / 2 : 1;
+	pthread_t t[BENCH_MAX_THREADS];
+	handed_over = 0;
+	uint64_t start = now_ns();
+	for (int i = 0; i < pairs; i++) {
+		pthread_create(&t[i * 2], NULL, produce, s);
+		pthread_create(&t[i * 2 + 1], NULL, consume, s);
+	}
+	for (int i = 0; i < pairs * 2; i++)
+		pthread_join(t[i], NULL);
+	double secs = (now_ns() - start) / 1e9;
+
+	printf("%-8s %8.0f items/s (%d producers, %d consumers)%s\n", s->name, handed_over / secs, pairs, pairs,
+		handed_over == (uint32_t)iterations * pairs ? "" : ", LOST ITEMS");
+}
+
+// trywait must come back at once, timedwait must honour a deadline already behind it
+static int check_sem(void) {
+	sync_sem s;
+	sync_sem_init(&s, 1);
+	int ok = !sync_sem_trywait(&s) && sync_sem_trywait(&s) == EAGAIN;
+	uint64_t start = now_ns();
+	for (int i = 0; i < 1000; i++)
+		ok &= sync_sem_trywait(&s) == EAGAIN;
+	ok &= now_ns() - start < 1000000;
+	start = now_ns();
+	ok &= sync_sem_timedwait(&s, sync_now_us() - 1) == ETIMEDOUT && now_ns() - start < 1000000;
+	ok &= !sync_sem_post(&s) && !sync_sem_timedwait(&s, sync_now_us() - 1);
+	ok &= sync_sem_timedwait(&s, sync_now_us() + 5000) == ETIMEDOUT && now_ns() - start >= 5000000;
+	return ok;
+}
+
+// The types init_static_mutex handled must keep their semantics
+static int check_types(void) {
+	sync_mutex m;
+	int ok = 1;
+	sync_mutex_init(&m, SYNC_MUTEX_RECURSIVE);
+	ok &= !sync_mutex_lock(&m) && !sync_mutex_lock(&m) && !sync_mutex_trylock(&m);
+	ok &= !sync_mutex_unlock(&m) && !sync_mutex_unlock(&m) && !sync_mutex_unlock(&m);
+	ok &= sync_mutex_unlock(&m) == EPERM && !sync_mutex_destroy(&m);
+	sync_mutex_init(&m, SYNC_MUTEX_ERRORCHECK);
+	ok &= !sync_mutex_lock(&m) && sync_mutex_lock(&m) == EDEADLK && sync_mutex_trylock(&m) == EBUSY;
+	ok &= sync_mutex_destroy(&m) == EBUSY && !sync_mutex_unlock(&m) && sync_mutex_unlock(&m) == EPERM;
+	sync_mutex_init(&m, SYNC_MUTEX_NORMAL);
+	ok &= !sync_mutex_trylock(&m) && sync_mutex_trylock(&m) == EBUSY && !sync_mutex_unlock(&m);
+	return ok;
+}
+
+int main(int argc, char *argv[]) {
+	int threads = 4;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-t") && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+			iterations = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-w") && i + 1 < argc)
+			work = atoi(argv[++i]);
+		else {
+			fprintf(stderr, "usage: sync_bench [-t threads] [-n iterations] [-w work]\n");
+			return 1;
+		}
+	}
+	if (threads < 1 || threads > BENCH_MAX_THREADS)
+		threads = 4;
+
+	if (!check_types()) {
+		printf("recursive/errorcheck semantics broken\n");
+		return 1;
+	}
+	if (!check_sem()) {
+		printf("semaphore trywait/timedwait semantics broken\n");
+		return 1;
+	}
+
+	// glibc drops the bus lock while the process has a single thread, the game never does
+	pthread_t t;
+	pthread_create(&t, NULL, idle, NULL);
+	pthread_join(t, NULL);
+
+	sync_init();
+	sync_mutex sm;
+	sync_mutex_init(&sm, SYNC_MUTEX_NORMAL);
+	pthread_mutex_t pm = PTHREAD_MUTEX_INITIALIZER;
+	bench_lock locks[] = {
+		{ "system", system_lock, system_unlock, &pm },
+		{ "sync", sync_lock, sync_unlock, &sm },
+	};
+	for (int i = 0; i < 2; i++)
+		run(&locks[i], threads);
+
+	sync_sem sitems, sslots;
+	sync_sem_init(&sitems, 0);
+	sync_sem_init(&sslots, BENCH_QUEUE_SLOTS);
+	sem_t pitems, pslots;
+	sem_init(&pitems, 0, 0);
+	sem_init(&pslots, 0, BENCH_QUEUE_SLOTS);
+	bench_sem sems[] = {
+		{ "system", system_post, system_wait, &pitems, &pslots },
+		{ "sync", sync_post, sync_wait, &sitems, &sslots },
+	};
+	for (int i = 0; i < 2; i++)
+		run_sem(&sems[i], threads);
+
+	sync_stats st;
+	sync_get_stats(&st);
+	printf("sync: %u contended locks, %u taken spinning, %u sleeps, %u sem sleeps\n",
+		st.mutex_contended, st.mutex_spun, st.mutex_sleeps, st.sem_sleeps);
+	return 0;
+}
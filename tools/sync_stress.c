@@ -0,0 +1,255 @@
+/* sync_stress.c -- host stress test of the loader condition variables
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build with: cc -O2 -Iloader -o sync_stress tools/sync_stress.c loader/sync.c -lpthread
+ * Usage: sync_stress [-t threads] [-n rounds]
+ *
+ * Runs on the futex backend of sync.c. A lost wakeup leaves some waiter asleep with
+ * nobody left to signal it, so a watchdog fails the run as soon as the active test
+ * stops making progress. Signals are sent both with and without the mutex held.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "sync.h"
+
+#define STRESS_MAX_THREADS 64
+#define STRESS_QUEUE_SIZE 8
+#define STRESS_STALL_US (3 * 1000000)
+#define STRESS_TIMEOUT_US 10000
+
+static int threads = 4, rounds = 200000;
+static const char *current_test;
+static uint32_t progress;
+static int failures;
+
+static sync_mutex lock;
+static sync_cond cond_a, cond_b;
+
+static void step(void) {
+	__atomic_add_fetch(&progress, 1, __ATOMIC_RELAXED);
+}
+
+static void signal_maybe_unlocked(sync_cond *c, int i) {
+	// Half the signals go out after the unlock, the waiter may not be asleep yet either way
+	if (i & 1) {
+		sync_cond_signal(c);
+		sync_mutex_unlock(&lock);
+	} else {
+		sync_mutex_unlock(&lock);
+		sync_cond_signal(c);
+	}
+}
+
+static void *watchdog(void *arg) {
+	uint32_t last = 0;
+	uint64_t since = sync_now_us();
+	for (;;) {
+		usleep(100000);
+		uint32_t now = __atomic_load_n(&progress, __ATOMIC_RELAXED);
+		if (now != last) {
+			last = now;
+			since = sync_now_us();
+		} else if (sync_now_us() - since > STRESS_STALL_US) {
+			printf("FAIL %s: no progress for %d s, a wakeup was lost\n", current_test, STRESS_STALL_US / 1000000);
+			exit(1);
+		}
+	}
+	return arg;
+}
+
+// Two threads hand a token back and forth, each hand-off is a single signal
+static int turn;
+
+static void *pingpong(void *arg) {
+	int me = (intptr_t)arg;
+	sync_cond *mine = me ? &cond_b : &cond_a, *other = me ? &cond_a : &cond_b;
+	for (int i = 0; i < rounds; i++) {
+		sync_mutex_lock(&lock);
+		while (turn != me)
+			sync_cond_wait(mine, &lock);
+		turn = !me;
+		step();
+		signal_maybe_unlocked(other, i);
+	}
+	return NULL;
+}
+
+// Bounded queue, producers and consumers only ever signal one waiter
+static uint32_t queue[STRESS_QUEUE_SIZE];
+static int head, tail, count, produced_per_thread;
+static uint64_t consumed_sum;
+static int consumed;
+
+static void *producer(void *arg) {
+	uint32_t base = (intptr_t)arg * produced_per_thread;
+	for (int i = 0; i < produced_per_thread; i++) {
+		sync_mutex_lock(&lock);
+		while (count == STRESS_QUEUE_SIZE)
+			sync_cond_wait(&cond_b, &lock);
+		queue[tail] = base + i;
+		tail = (tail + 1) % STRESS_QUEUE_SIZE;
+		count++;
+		step();
+		signal_maybe_unlocked(&cond_a, i);
+	}
+	return NULL;
+}
+
+static void *consumer(void *arg) {
+	int total = (intptr_t)arg;
+	for (;;) {
+		sync_mutex_lock(&lock);
+		while (!count && consumed < total)
+			sync_cond_wait(&cond_a, &lock);
+		if (consumed == total) {
+			sync_mutex_unlock(&lock);
+			// Wake the other consumers so they notice the end too
+			sync_cond_broadcast(&cond_a);
+			return NULL;
+		}
+		consumed_sum += queue[head];
+		head = (head + 1) % STRESS_QUEUE_SIZE;
+		count--;
+		consumed++;
+		step();
+		signal_maybe_unlocked(&cond_b, consumed);
+	}
+}
+
+// Every thread waits for all the others on each round, the last one broadcasts
+static int arrived, generation;
+
+static void *barrier(void *arg) {
+	for (int i = 0; i < rounds / 16; i++) {
+		sync_mutex_lock(&lock);
+		int gen = generation;
+		if (++arrived == threads) {
+			arrived = 0;
+			generation++;
+			step();
+			sync_cond_broadcast(&cond_a);
+		} else {
+			while (gen == generation)
+				sync_cond_wait(&cond_a, &lock);
+		}
+		sync_mutex_unlock(&lock);
+	}
+	return arg;
+}
+
+static void start_threads(pthread_t *t, int n, void *(*fn)(void *), int index_arg, intptr_t arg) {
+	for (int i = 0; i < n; i++)
+		pthread_create(&t[i], NULL, fn, (void *)(index_arg ? i : arg));
+}
+
+static void join_threads(pthread_t *t, int n) {
+	for (int i = 0; i < n; i++)
+		pthread_join(t[i], NULL);
+}
+
+static void report(uint64_t start) {
+	printf("ok   %-10s %6llu ms\n", current_test, (unsigned long long)(sync_now_us() - start) / 1000);
+}
+
+static void check_timeouts(void) {
+	current_test = "timedwait";
+	uint64_t worst = 0;
+	int bad = 0;
+	sync_mutex_lock(&lock);
+	for (int i = 0; i < 20; i++) {
+		uint64_t start = sync_now_us();
+		int ret;
+		// Spurious returns are allowed, the caller loops until its deadline like the game does
+		do {
+			ret = sync_cond_timedwait(&cond_a, &lock, start + STRESS_TIMEOUT_US);
+		} while (!ret);
+		uint64_t elapsed = sync_now_us() - start;
+		if (ret != ETIMEDOUT || elapsed < STRESS_TIMEOUT_US)
+			bad++;
+		if (elapsed - STRESS_TIMEOUT_US > worst)
+			worst = elapsed - STRESS_TIMEOUT_US;
+		step();
+	}
+	// A deadline already behind us must not sleep at all
+	uint64_t start = sync_now_us();
+	if (sync_cond_timedwait(&cond_a, &lock, start - 1) != ETIMEDOUT || sync_now_us() - start > STRESS_TIMEOUT_US)
+		bad++;
+	sync_mutex_unlock(&lock);
+	if (bad) {
+		printf("FAIL timedwait: %d waits returned early or without ETIMEDOUT\n", bad);
+		failures++;
+	} else {
+		printf("ok   timedwait  %6llu us worst overshoot\n", (unsigned long long)worst);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-t") && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+			rounds = atoi(argv[++i]);
+		else {
+			fprintf(stderr, "usage: sync_stress [-t threads] [-n rounds]\n");
+			return 1;
+		}
+	}
+	if (threads < 2 || threads > STRESS_MAX_THREADS)
+		threads = 4;
+
+	sync_init();
+	sync_mutex_init(&lock, SYNC_MUTEX_NORMAL);
+	sync_cond_init(&cond_a);
+	sync_cond_init(&cond_b);
+	pthread_t w;
+	pthread_create(&w, NULL, watchdog, NULL);
+
+	pthread_t t[STRESS_MAX_THREADS];
+	current_test = "pingpong";
+	uint64_t start = sync_now_us();
+	start_threads(t, 2, pingpong, 1, 0);
+	join_threads(t, 2);
+	report(start);
+
+	current_test = "queue";
+	int producers = threads / 2, consumers = threads - producers;
+	produced_per_thread = rounds / producers;
+	int total = produced_per_thread * producers;
+	start = sync_now_us();
+	start_threads(t, producers, producer, 1, 0);
+	start_threads(t + producers, consumers, consumer, 0, total);
+	join_threads(t, threads);
+	uint64_t expected = (uint64_t)total * (total - 1) / 2;
+	if (consumed != total || consumed_sum != expected) {
+		printf("FAIL queue: %d/%d items, checksum %llu instead of %llu\n", consumed, total,
+			(unsigned long long)consumed_sum, (unsigned long long)expected);
+		failures++;
+	} else {
+		report(start);
+	}
+
+	current_test = "barrier";
+	start = sync_now_us();
+	start_threads(t, threads, barrier, 0, 0);
+	join_threads(t, threads);
+	report(start);
+
+	check_timeouts();
+
+	sync_stats st;
+	sync_get_stats(&st);
+	printf("sync: %u cond waits, %u timeouts, %u idle signals, %u contended locks, %u sleeps\n",
+		st.cond_waits, st.cond_timeouts, st.cond_idle, st.mutex_contended, st.mutex_sleeps);
+	return failures ? 1 : 0;
+}
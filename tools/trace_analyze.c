@@ -0,0 +1,345 @@
+/* trace_analyze.c -- host side summary of loader file access traces
+ *
+ * Copyright (C) 2025 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build with: cc -O2 -Iloader -o trace_analyze tools/trace_analyze.c
+ * Usage: trace_analyze [-n top] trace.bin
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "trace.h"
+
+#define DATA_PREFIX "ux0:data/valiant/"
+#define MAX_HANDLES 4096
+
+typedef struct {
+	char *name;
+	uint32_t opens;
+	uint32_t max_open; // highest number of simultaneously open handles
+	uint32_t open_now;
+	uint32_t stats;
+	uint32_t reads;
+	uint32_t seeks;
+	uint32_t seq_reads; // reads starting where the previous one ended
+	uint32_t fwd_jumps;
+	uint32_t back_jumps;
+	uint64_t bytes;
+	uint64_t size;
+	uint64_t blocked_us;
+} file_info;
+
+typedef struct {
+	uint32_t handle;
+	int file; // -1 if the slot is free
+	uint64_t next_offs;
+} handle_info;
+
+typedef struct {
+	char *name;
+	uint64_t start;
+	uint64_t end;
+	uint32_t events;
+	uint64_t blocked_us;
+	uint64_t bytes;
+} phase_info;
+
+static char **paths = NULL; // indexed by path_id
+static uint32_t num_paths = 0;
+
+static file_info *files = NULL;
+static int num_files = 0;
+
+static handle_info handles[MAX_HANDLES];
+
+static phase_info *phases = NULL;
+static int num_phases = 0;
+
+static const char *type_names[TRACE_NUM_TYPES] = {
+	"path", "phase", "open", "read", "seek", "stat", "close",
+	"asset_open", "asset_read", "asset_seek", "asset_close",
+	"zip_open", "zip_read", "zip_seek", "zip_close"
+};
+static uint32_t type_count[TRACE_NUM_TYPES];
+static uint64_t type_blocked[TRACE_NUM_TYPES];
+
+static void *xrealloc(void *p, size_t size) {
+	p = realloc(p, size);
+	if (!p) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+// Paths come in relative, absolute or as archive entries, fold them on a single spelling
+static char *normalize(const char *name, int is_zip) {
+	if (!strncasecmp(name, DATA_PREFIX, strlen(DATA_PREFIX)))
+		name += strlen(DATA_PREFIX);
+	char *res = xrealloc(NULL, strlen(name) + 5);
+	sprintf(res, "%s%s", is_zip ? "obb:" : "", name);
+	for (char *p = res; *p; p++)
+		*p = tolower((unsigned char)*p);
+	return res;
+}
+
+static int get_file(uint32_t path_id, int is_zip) {
+	if (!path_id || path_id >= num_paths || !paths[path_id])
+		return -1;
+	char *name = normalize(paths[path_id], is_zip);
+	for (int i = 0; i < num_files; i++) {
+		if (!strcmp(files[i].name, name)) {
+			free(name);
+			return i;
+		}
+	}
+	files = xrealloc(files, (num_files + 1) * sizeof(file_info));
+	memset(&files[num_files], 0, sizeof(file_info));
+	files[num_files].name = name;
+	return num_files++;
+}
+
+static handle_info *find_handle(uint32_t handle, int create) {
+	uint32_t h = (handle * 0x9E3779B1) % MAX_HANDLES;
+	for (int i = 0; i < MAX_HANDLES; i++) {
+		handle_info *e = &handles[(h + i) % MAX_HANDLES];
+		if (e->file >= 0 && e->handle == handle)
+			return e;
+		if (e->file < 0 && e->handle == 0) // never used, end of the probe chain
+			break;
+	}
+	if (!create)
+		return NULL;
+	for (int i = 0; i < MAX_HANDLES; i++) {
+		handle_info *e = &handles[(h + i) % MAX_HANDLES];
+		if (e->file < 0) {
+			e->handle = handle;
+			return e;
+		}
+	}
+	return NULL;
+}
+
+static void process(const trace_record_t *r, phase_info *phase) {
+	type_count[r->type]++;
+	type_blocked[r->type] += r->latency;
+	if (phase) {
+		phase->events++;
+		phase->blocked_us += r->latency;
+		phase->end = r->timestamp + r->latency;
+	}
+
+	int is_zip = r->type >= TRACE_ZIP_OPEN;
+	switch (r->type) {
+	case TRACE_OPEN:
+	case TRACE_ASSET_OPEN:
+	case TRACE_ZIP_OPEN: {
+		int f = get_file(r->path_id, is_zip);
+		if (f < 0)
+			return;
+		files[f].opens++;
+		files[f].blocked_us += r->latency;
+		if (r->result)
+			return;
+		if (r->size > files[f].size)
+			files[f].size = r->size;
+		if (++files[f].open_now > files[f].max_open)
+			files[f].max_open = files[f].open_now;
+		handle_info *h = find_handle(r->handle, 1);
+		if (h) {
+			h->file = f;
+			h->next_offs = 0;
+		}
+		break;
+	}
+	case TRACE_STAT: {
+		int f = get_file(r->path_id, 0);
+		if (f >= 0) {
+			files[f].stats++;
+			files[f].blocked_us += r->latency;
+		}
+		break;
+	}
+	case TRACE_READ:
+	case TRACE_ASSET_READ:
+	case TRACE_ZIP_READ: {
+		if (phase)
+			phase->bytes += r->size;
+		handle_info *h = find_handle(r->handle, 0);
+		if (!h)
+			return;
+		file_info *f = &files[h->file];
+		f->reads++;
+		f->bytes += r->size;
+		f->blocked_us += r->latency;
+		if (r->offset != TRACE_NO_OFFSET) {
+			if (r->offset == h->next_offs)
+				f->seq_reads++;
+			else if (r->offset > h->next_offs)
+				f->fwd_jumps++;
+			else
+				f->back_jumps++;
+			h->next_offs = r->offset + r->size;
+		}
+		break;
+	}
+	case TRACE_SEEK:
+	case TRACE_ASSET_SEEK:
+	case TRACE_ZIP_SEEK: {
+		handle_info *h = find_handle(r->handle, 0);
+		if (h) {
+			files[h->file].seeks++;
+			files[h->file].blocked_us += r->latency;
+		}
+		break;
+	}
+	case TRACE_CLOSE:
+	case TRACE_ASSET_CLOSE:
+	case TRACE_ZIP_CLOSE: {
+		handle_info *h = find_handle(r->handle, 0);
+		if (h) {
+			files[h->file].open_now--;
+			files[h->file].blocked_us += r->latency;
+			h->file = -1; // the slot stays tombstoned with its handle set
+		}
+		break;
+	}
+	}
+}
+
+static int cmp_bytes(const void *a, const void *b) {
+	const file_info *fa = a, *fb = b;
+	if (fa->bytes != fb->bytes)
+		return fa->bytes < fb->bytes ? 1 : -1;
+	return fb->opens - fa->opens;
+}
+
+static int cmp_opens(const void *a, const void *b) {
+	const file_info *fa = a, *fb = b;
+	if (fa->opens != fb->opens)
+		return fb->opens - fa->opens;
+	return fa->blocked_us < fb->blocked_us ? 1 : -1;
+}
+
+int main(int argc, char *argv[]) {
+	int top = 30;
+	const char *fname = NULL;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-n") && i + 1 < argc)
+			top = atoi(argv[++i]);
+		else
+			fname = argv[i];
+	}
+	if (!fname) {
+		fprintf(stderr, "usage: %s [-n top] trace.bin\n", argv[0]);
+		return 1;
+	}
+
+	FILE *f = fopen(fname, "rb");
+	if (!f) {
+		fprintf(stderr, "cannot open %s\n", fname);
+		return 1;
+	}
+	trace_header hdr;
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != TRACE_MAGIC || hdr.version != TRACE_VERSION || hdr.record_size != sizeof(trace_record_t)) {
+		fprintf(stderr, "%s is not a supported trace file\n", fname);
+		return 1;
+	}
+
+	for (int i = 0; i < MAX_HANDLES; i++)
+		handles[i].file = -1;
+
+	trace_record_t r;
+	uint64_t first = 0, last = 0;
+	uint32_t num_events = 0;
+	phase_info *phase = NULL;
+	while (fread(&r, sizeof(r), 1, f) == 1) {
+		if (r.type >= TRACE_NUM_TYPES) {
+			fprintf(stderr, "corrupted record at offset %ld\n", ftell(f) - (long)sizeof(r));
+			break;
+		}
+		if (r.type == TRACE_PATH) {
+			if (r.path_id >= num_paths) {
+				paths = xrealloc(paths, (r.path_id + 1) * sizeof(char *));
+				memset(&paths[num_paths], 0, (r.path_id + 1 - num_paths) * sizeof(char *));
+				num_paths = r.path_id + 1;
+			}
+			paths[r.path_id] = xrealloc(NULL, r.size + 1);
+			if (fread(paths[r.path_id], 1, r.size, f) != r.size)
+				break;
+			paths[r.path_id][r.size] = 0;
+			continue;
+		}
+
+		if (!num_events++)
+			first = r.timestamp;
+		if (r.timestamp + r.latency > last)
+			last = r.timestamp + r.latency;
+
+		if (r.type == TRACE_PHASE) {
+			phases = xrealloc(phases, (num_phases + 1) * sizeof(phase_info));
+			phase = &phases[num_phases++];
+			memset(phase, 0, sizeof(phase_info));
+			phase->name = r.path_id < num_paths && paths[r.path_id] ? paths[r.path_id] : "?";
+			phase->start = phase->end = r.timestamp;
+			continue;
+		}
+		process(&r, phase);
+	}
+	fclose(f);
+
+	uint64_t blocked = 0;
+	for (int i = 0; i < TRACE_NUM_TYPES; i++)
+		blocked += type_blocked[i];
+	printf("%u events over %.2f s, %.2f s spent inside file calls, %u events dropped\n\n",
+		num_events, (last - first) / 1000000.0, blocked / 1000000.0, hdr.dropped);
+
+	printf("%-12s %10s %12s\n", "call", "count", "blocked ms");
+	for (int i = TRACE_OPEN; i < TRACE_NUM_TYPES; i++) {
+		if (type_count[i])
+			printf("%-12s %10u %12.1f\n", type_names[i], type_count[i], type_blocked[i] / 1000.0);
+	}
+
+	if (num_phases) {
+		printf("\n%-24s %10s %10s %12s %12s\n", "phase", "wall ms", "events", "blocked ms", "read KB");
+		for (int i = 0; i < num_phases; i++) {
+			phase_info *p = &phases[i];
+			uint64_t end = i + 1 < num_phases ? phases[i + 1].start : p->end;
+			printf("%-24s %10.1f %10u %12.1f %12llu\n", p->name, (end - p->start) / 1000.0, p->events,
+				p->blocked_us / 1000.0, (unsigned long long)(p->bytes / 1024));
+		}
+	}
+
+	qsort(files, num_files, sizeof(file_info), cmp_bytes);
+	printf("\nTop %d files by bytes read\n", top);
+	printf("%-48s %6s %8s %10s %8s %6s %6s %6s %10s\n", "file", "opens", "reads", "KB", "size KB", "seq%", "fwd", "back", "blocked ms");
+	for (int i = 0; i < num_files && i < top; i++) {
+		file_info *fi = &files[i];
+		printf("%-48s %6u %8u %10llu %8llu %6u %6u %6u %10.1f\n", fi->name, fi->opens, fi->reads,
+			(unsigned long long)(fi->bytes / 1024), (unsigned long long)(fi->size / 1024),
+			fi->reads ? fi->seq_reads * 100 / fi->reads : 0, fi->fwd_jumps, fi->back_jumps, fi->blocked_us / 1000.0);
+	}
+
+	qsort(files, num_files, sizeof(file_info), cmp_opens);
+	printf("\nRedundant opens\n");
+	printf("%-48s %6s %6s %10s %10s\n", "file", "opens", "stats", "reread KB", "concurrent");
+	int redundant = 0;
+	for (int i = 0; i < num_files && redundant < top; i++) {
+		file_info *fi = &files[i];
+		if (fi->opens < 2)
+			break;
+		uint64_t reread = fi->bytes > fi->size ? fi->bytes - fi->size : 0;
+		printf("%-48s %6u %6u %10llu %10u\n", fi->name, fi->opens, fi->stats, (unsigned long long)(reread / 1024), fi->max_open);
+		redundant++;
+	}
+	if (!redundant)
+		printf("none\n");
+
+	return 0;
+}